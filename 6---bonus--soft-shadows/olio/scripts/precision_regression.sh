@@ -0,0 +1,52 @@
+#!/bin/bash
+# ======================================================================
+# Olio: Simple renderer
+# Copyright (C) 2022 by Hadi Fadaifard
+#
+# Author: Hadi Fadaifard, 2022
+# ======================================================================
+#
+# Single vs double precision regression: builds olio in both
+# configurations, renders the bundled scenes with each build, and
+# compares the single precision images against the double precision
+# ones with olio_imgdiff.
+#
+# usage: precision_regression.sh [build_dir] [shadow_samples]
+
+set -e
+
+OLIO_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR=${1:-${OLIO_DIR}/build/precision}
+SHADOW_SAMPLES=${2:-4}
+OUT_DIR=${BUILD_DIR}/images
+
+# build both configurations
+for precision in double single; do
+  flag=OFF
+  [ "${precision}" == "single" ] && flag=ON
+  cmake -S "${OLIO_DIR}" -B "${BUILD_DIR}/${precision}" \
+        -DCMAKE_BUILD_TYPE=Release -DOLIO_USE_SINGLE_PRECISION=${flag}
+  cmake --build "${BUILD_DIR}/${precision}" -j"$(nproc)" \
+        --target olio_rtbasic olio_imgdiff
+done
+
+# render and compare
+mkdir -p "${OUT_DIR}"
+failed=0
+for scene_path in "${OLIO_DIR}"/data/scenes/*.scn; do
+  scene=$(basename "${scene_path}" .scn)
+  for precision in double single; do
+    "${BUILD_DIR}/${precision}/src/rtbasic/olio_rtbasic" \
+      -s "${scene_path}" \
+      -o "${OUT_DIR}/${scene}_${precision}.png" -d "${SHADOW_SAMPLES}"
+  done
+  "${BUILD_DIR}/double/src/imgdiff/olio_imgdiff" \
+    -r "${OUT_DIR}/${scene}_double.png" \
+    -i "${OUT_DIR}/${scene}_single.png" || failed=1
+done
+
+if [ ${failed} -ne 0 ]; then
+  echo "precision regression FAILED"
+  exit 1
+fi
+echo "precision regression passed"
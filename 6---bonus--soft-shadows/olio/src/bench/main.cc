@@ -0,0 +1,598 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       main.cc
+//! \brief      bench cli main.cc file: renders the bundled scenes and
+//!             reports performance as JSON
+//! \author     Hadi Fadaifard, 2022
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <spdlog/spdlog.h>
+#include <tbb/task_arena.h>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "core/types.h"
+#include "core/camera/camera.h"
+#include "core/geometry/surface.h"
+#include "core/geometry/surface_list.h"
+#include "core/geometry/bvh_node.h"
+#include "core/light/light.h"
+#include "core/parser/raytra_parser.h"
+#include "core/renderer/raytracer.h"
+
+#ifndef OLIO_DATA_DIR
+#define OLIO_DATA_DIR "data"
+#endif
+
+using namespace olio::core;
+using namespace std;
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+//! \struct BenchOptions
+//! \brief Benchmark settings
+struct BenchOptions {
+  string scenes;             //!< scene file or directory of scene files
+  string output;             //!< output json path (empty: stdout)
+  string baseline;           //!< baseline json path (empty: no compare)
+  uint image_height{0};      //!< image height (0: scene's own)
+  uint samples_per_pixel{1}; //!< (max) samples per pixel
+  double adaptive_tolerance{0};  //!< adaptive sampling error (0: off)
+  uint shadow_samples{4};    //!< area light samples
+  uint num_threads{0};       //!< render threads (0: all cores)
+  string integrator;         //!< sample integrator (recursive, wavefront)
+  double min_throughput{0};  //!< secondary ray pruning threshold (0: off)
+  bool russian_roulette{false};  //!< roulette instead of pruning
+  string glass_sampling;     //!< glass rays (split, schlick)
+  string sampler;            //!< sample sequence (independent, stratified,
+                             //!< halton, sobol)
+  bool adaptive_shadows{false};  //!< probe area lights before sampling
+  string light_sampling;     //!< area light samples (area, solid_angle, mis)
+  uint light_budget{0};      //!< lights picked per hit point (0: all)
+  bool light_resampling{false};  //!< resample primary hit light samples
+  uint resampling_candidates{8};  //!< candidates per hit point
+  double tolerance{0.05};    //!< allowed relative rays/s drop vs baseline
+};
+
+//! \struct SceneResult
+//! \brief Benchmark results of one scene
+struct SceneResult {
+  string name;               //!< scene name
+  int width{0};              //!< image width
+  int height{0};             //!< image height
+  double parse_time{0};      //!< scene parse time, including mesh loads
+                             //!< and mesh BVH builds (s)
+  double bvh_build_time{0};  //!< scene BVH build time (s)
+  double render_time{0};     //!< render wall time (s)
+  RayCounts ray_counts{};    //!< traced rays
+  double peak_rss_mb{0};     //!< peak resident set size so far (MB)
+
+  //! \brief Get render throughput
+  //! \return Rays per second
+  double GetRaysPerSecond() const {
+    return render_time > 0 ? static_cast<double>(ray_counts.GetTotal()) /
+      render_time : 0;
+  }
+};
+
+
+bool ParseArguments(int argc, char **argv, BenchOptions &options) {
+  po::options_description desc("options");
+  try {
+    desc.add_options()
+      ("help,h", "print usage")
+      ("scenes,s",
+       po::value             (&options.scenes)->default_value(
+         string{OLIO_DATA_DIR} + "/scenes"),
+       "Scene file, or directory whose .scn files are all rendered")
+      ("output,o",
+       po::value             (&options.output),
+       "Output json file (default: stdout)")
+      ("baseline,b",
+       po::value             (&options.baseline),
+       "Baseline json file to compare against")
+      ("tolerance",
+       po::value             (&options.tolerance)->default_value(0.05),
+       "Allowed relative rays/s drop with respect to the baseline")
+      ("height",
+       po::value             (&options.image_height)->default_value(0),
+       "Image height (0: use each scene's resolution)")
+      ("samples_per_pixel,a",
+       po::value             (&options.samples_per_pixel)->default_value(1),
+       "Number of samples per pixel (max in adaptive mode)")
+      ("adaptive_tolerance",
+       po::value             (&options.adaptive_tolerance)->default_value(0),
+       "Adaptive sampling: max relative error per pixel (0: off)")
+      ("shadow_samples,d",
+       po::value             (&options.shadow_samples)->default_value(4),
+       "Number of area light shadow samples")
+      ("threads,t",
+       po::value             (&options.num_threads)->default_value(0),
+       "Number of render threads (0: use all cores)")
+      ("integrator",
+       po::value             (&options.integrator)->default_value("recursive"),
+       "Sample integrator (recursive, wavefront)")
+      ("min_throughput",
+       po::value             (&options.min_throughput)->default_value(0),
+       "Drop mirror/glass rays whose throughput is below this (0: off)")
+      ("russian_roulette",
+       po::bool_switch       (&options.russian_roulette),
+       "Play Russian roulette with low throughput rays instead of "
+       "dropping them")
+      ("glass_sampling",
+       po::value             (&options.glass_sampling)->default_value("split"),
+       "Glass rays (split, schlick)")
+      ("sampler",
+       po::value             (&options.sampler)->default_value("independent"),
+       "Pixel/light sample sequence (independent, stratified, halton, "
+       "sobol)")
+      ("adaptive_shadows",
+       po::bool_switch       (&options.adaptive_shadows),
+       "Trace area light shadow rays only in the penumbra")
+      ("light_sampling",
+       po::value             (&options.light_sampling)->default_value("area"),
+       "Area light samples (area, solid_angle, mis)")
+      ("light_budget",
+       po::value             (&options.light_budget)->default_value(0),
+       "Lights picked per hit point from a light tree (0: all lights)")
+      ("light_resampling",
+       po::bool_switch       (&options.light_resampling),
+       "Resample primary hit light samples (ReSTIR)")
+      ("resampling_candidates",
+       po::value             (&options.resampling_candidates)->default_value(8),
+       "Light resampling: candidate light samples per hit point");
+
+    // parse arguments
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+      cout << desc << endl;
+      return false;
+    }
+    po::notify(vm);
+  } catch(std::exception &e) {
+    cout << desc << endl;
+    spdlog::error("{}", e.what());
+    return false;
+  } catch(...) {
+    cout << desc << endl;
+    spdlog::error("Invalid arguments");
+    return false;
+  }
+  return true;
+}
+
+
+//! \brief Get sampler type from its name
+//! \param[in] name Sampler name (independent, stratified, halton, sobol)
+//! \param[out] type Sampler type
+//! \return True if the name is valid
+bool ParseSamplerType(const string &name, SamplerType *type)
+{
+  *type = SamplerType::kIndependent;
+  if (name == "stratified")
+    *type = SamplerType::kStratified;
+  else if (name == "halton")
+    *type = SamplerType::kHalton;
+  else if (name == "sobol")
+    *type = SamplerType::kSobol;
+  else if (name != "independent")
+    return false;
+  return true;
+}
+
+
+//! \brief Get area light sampling strategy from its name
+//! \param[in] name Strategy name (area, solid_angle, mis)
+//! \param[out] sampling Sampling strategy
+//! \return True if the name is valid
+bool ParseLightSampling(const string &name, AreaLightSampling *sampling)
+{
+  *sampling = AreaLightSampling::kArea;
+  if (name == "solid_angle")
+    *sampling = AreaLightSampling::kSolidAngle;
+  else if (name == "mis")
+    *sampling = AreaLightSampling::kMIS;
+  else if (name != "area")
+    return false;
+  return true;
+}
+
+
+//! \brief Get peak resident set size of the process
+//! \return Peak RSS in MB (0 if unsupported)
+double GetPeakRSS()
+{
+#if defined(_WIN32)
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage))
+    return 0;
+#if defined(__APPLE__)
+  return static_cast<double>(usage.ru_maxrss) / 1048576.0;  // bytes
+#else
+  return static_cast<double>(usage.ru_maxrss) / 1024.0;     // kilobytes
+#endif
+#endif
+}
+
+
+//! \brief Get wall time since start_time
+//! \param[in] start_time Start time
+//! \return Elapsed seconds
+double GetElapsedTime(const chrono::system_clock::time_point &start_time)
+{
+  return chrono::duration_cast<chrono::duration<double>>
+    (chrono::system_clock::now() - start_time).count();
+}
+
+
+//! \brief Parse, build and render one scene
+//! \param[in] scene_path Scene file
+//! \param[in] options Benchmark settings
+//! \param[out] result Benchmark results
+//! \return True on success
+bool BenchScene(const fs::path &scene_path, const BenchOptions &options,
+                SceneResult &result)
+{
+  result.name = scene_path.stem().string();
+  spdlog::info("Benchmarking {}...", result.name);
+
+  // parse
+  Vec2i image_size;
+  Surface::Ptr scene;
+  vector<Light::Ptr> lights;
+  Camera::Ptr camera;
+  auto start_time = chrono::system_clock::now();
+  if (!RaytraParser::ParseFile(scene_path.string(), scene, lights, camera,
+                               image_size) || !scene || !camera ||
+      image_size[0] <= 0 || image_size[1] <= 0) {
+    spdlog::error("Failed to parse scene file: {}", scene_path.string());
+    return false;
+  }
+  result.parse_time = GetElapsedTime(start_time);
+
+  // build scene bvh (mesh bvhs were built while parsing, and are
+  // counted in parse_time)
+  auto scene_list = dynamic_pointer_cast<SurfaceList>(scene);
+  if (!scene_list) {
+    spdlog::error("Unexpected scene type: {}", scene_path.string());
+    return false;
+  }
+  auto bvh = BVHNode::BuildBVH(scene_list->GetListSurfaces(), "scene");
+  if (!bvh) {
+    spdlog::error("Empty scene: {}", scene_path.string());
+    return false;
+  }
+  result.bvh_build_time += bvh->GetBuildStats().build_time;
+
+  // render
+  auto grid_size = static_cast<uint>(round(sqrt(options.shadow_samples)));
+  AreaLightSampling light_sampling;
+  ParseLightSampling(options.light_sampling, &light_sampling);
+  for (const auto &light : lights) {
+    auto area_light = dynamic_pointer_cast<AreaLight>(light);
+    if (!area_light)
+      continue;
+    area_light->SetGridSize(grid_size);
+    area_light->SetAdaptive(options.adaptive_shadows);
+    area_light->SetSampling(light_sampling);
+  }
+  RayTracer rt;
+  rt.SetImageHeight(options.image_height ? options.image_height :
+                    static_cast<uint>(image_size[1]));
+  rt.SetNumSamplesPerPixel(options.samples_per_pixel);
+  rt.SetAdaptiveSampling(static_cast<Real>(options.adaptive_tolerance));
+  rt.SetNumThreads(options.num_threads);
+  rt.SetLightBudget(options.light_budget);
+  LightResamplingOptions resampling_options;
+  resampling_options.enabled = options.light_resampling;
+  resampling_options.candidates = options.resampling_candidates;
+  rt.SetLightResampling(resampling_options);
+  rt.SetIntegrator(options.integrator == "wavefront" ? Integrator::kWavefront :
+                   Integrator::kRecursive);
+  PathOptions path_options;
+  path_options.min_throughput = static_cast<Real>(options.min_throughput);
+  path_options.russian_roulette = options.russian_roulette;
+  if (options.glass_sampling == "schlick")
+    path_options.glass_sampling = GlassSampling::kSchlick;
+  rt.SetPathOptions(path_options);
+  SamplerType sampler_type;
+  ParseSamplerType(options.sampler, &sampler_type);
+  rt.SetSamplerType(sampler_type);
+  rt.SetSeed(123543);
+  if (!rt.Render(bvh, lights, camera)) {
+    spdlog::error("Failed to render scene: {}", scene_path.string());
+    return false;
+  }
+  result.height = static_cast<int>(rt.GetImageHeight());
+  result.width = static_cast<int>(camera->GetAspectRatio() *
+                                  static_cast<Real>(result.height) + 0.5f);
+  result.render_time = rt.GetRenderTime();
+  result.ray_counts = rt.GetRayCounts();
+  result.peak_rss_mb = GetPeakRSS();
+  return true;
+}
+
+
+//! \brief Escape a string for a json string literal
+//! \param[in] str Input string
+//! \return Escaped string (without the quotes)
+string EscapeJson(const string &str)
+{
+  string escaped;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += fmt::format("\\u{:04x}", static_cast<int>(c));
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+
+//! \struct ConfigEntry
+//! \brief One benchmark setting that affects the results
+struct ConfigEntry {
+  string key;       //!< json key
+  string value;     //!< value as written to (and read back from) json
+  bool is_string;   //!< whether the value is a json string
+};
+
+
+//! \brief Get the benchmark settings that affect the results
+//! \details The thread count is the resolved one, so runs with
+//!    threads=0 on different machines are not compared.
+//! \param[in] options Benchmark settings
+//! \return Settings, in the order they are written to json
+vector<ConfigEntry> GetConfig(const BenchOptions &options)
+{
+  auto threads = options.num_threads ? options.num_threads :
+    static_cast<uint>(tbb::this_task_arena::max_concurrency());
+  return vector<ConfigEntry>{
+    {"height", fmt::format("{}", options.image_height), false},
+    {"samples_per_pixel", fmt::format("{}", options.samples_per_pixel), false},
+    {"adaptive_tolerance", fmt::format("{}", options.adaptive_tolerance),
+     false},
+    {"shadow_samples", fmt::format("{}", options.shadow_samples), false},
+    {"threads", fmt::format("{}", threads), false},
+    {"integrator", options.integrator, true},
+    {"min_throughput", fmt::format("{}", options.min_throughput), false},
+    {"russian_roulette", fmt::format("{}", options.russian_roulette), false},
+    {"glass_sampling", options.glass_sampling, true},
+    {"sampler", options.sampler, true},
+    {"adaptive_shadows", fmt::format("{}", options.adaptive_shadows), false},
+    {"light_sampling", options.light_sampling, true},
+    {"light_budget", fmt::format("{}", options.light_budget), false},
+    {"light_resampling", fmt::format("{}", options.light_resampling), false},
+    {"resampling_candidates",
+     fmt::format("{}", options.resampling_candidates), false},
+    {"precision", sizeof(Real) == sizeof(float) ? "single" : "double", true}};
+}
+
+
+//! \brief Write benchmark results as json
+//! \param[in] options Benchmark settings
+//! \param[in] results Per-scene results
+//! \param[out] out Output stream
+void WriteJson(const BenchOptions &options,
+               const vector<SceneResult> &results, std::ostream &out)
+{
+  out << "{\n";
+  out << "  \"config\": {";
+  auto config = GetConfig(options);
+  for (size_t i = 0; i < config.size(); ++i) {
+    const auto &entry = config[i];
+    auto value = entry.is_string ? "\"" + EscapeJson(entry.value) + "\"" :
+      entry.value;
+    out << fmt::format("\"{}\": {}{}", entry.key, value,
+                       i + 1 < config.size() ? ", " : "");
+  }
+  out << "},\n";
+  out << "  \"scenes\": [\n";
+  SceneResult total;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto &result = results[i];
+    const auto &rays = result.ray_counts;
+    out << fmt::format("    {{\"name\": \"{}\", \"width\": {}, \"height\": {}, "
+                       "\"parse_time\": {:.6f}, \"bvh_build_time\": {:.6f}, "
+                       "\"render_time\": {:.6f}, \"rays\": {{\"primary\": {}, "
+                       "\"secondary\": {}, \"shadow\": {}, \"total\": {}}}, "
+                       "\"rays_per_sec\": {:.1f}, \"peak_rss_mb\": {:.2f}}}"
+                       "{}\n", EscapeJson(result.name), result.width,
+                       result.height, result.parse_time, result.bvh_build_time,
+                       result.render_time, rays.Get(RayType::kPrimary),
+                       rays.Get(RayType::kSecondary),
+                       rays.Get(RayType::kShadow), rays.GetTotal(),
+                       result.GetRaysPerSecond(), result.peak_rss_mb,
+                       i + 1 < results.size() ? "," : "");
+    total.parse_time += result.parse_time;
+    total.bvh_build_time += result.bvh_build_time;
+    total.render_time += result.render_time;
+    total.ray_counts += rays;
+    total.peak_rss_mb = std::max(total.peak_rss_mb, result.peak_rss_mb);
+  }
+  out << "  ],\n";
+  out << fmt::format("  \"total\": {{\"parse_time\": {:.6f}, "
+                     "\"bvh_build_time\": {:.6f}, \"render_time\": {:.6f}, "
+                     "\"rays\": {}, \"rays_per_sec\": {:.1f}, "
+                     "\"peak_rss_mb\": {:.2f}}}\n", total.parse_time,
+                     total.bvh_build_time, total.render_time,
+                     total.ray_counts.GetTotal(), total.GetRaysPerSecond(),
+                     total.peak_rss_mb);
+  out << "}\n";
+}
+
+
+//! \brief Compare rays/s of each scene against a baseline
+//! \details Fails without comparing if the baseline was run with other
+//!    settings, or rendered a scene at another resolution.
+//! \param[in] baseline_path Baseline json written by a previous run
+//! \param[in] options Benchmark settings
+//! \param[in] results Per-scene results
+//! \return True if no scene is slower than the baseline by more
+//!         than options.tolerance
+bool CompareToBaseline(const string &baseline_path,
+                       const BenchOptions &options,
+                       const vector<SceneResult> &results)
+{
+  namespace pt = boost::property_tree;
+  pt::ptree baseline;
+  try {
+    pt::read_json(baseline_path, baseline);
+  } catch (const std::exception &e) {
+    spdlog::error("Failed to read baseline {}: {}", baseline_path, e.what());
+    return false;
+  }
+
+  // settings
+  bool same_config = true;
+  for (const auto &entry : GetConfig(options)) {
+    auto value = baseline.get_optional<string>(
+      pt::ptree::path_type{"config." + entry.key, '.'});
+    if (!value || *value != entry.value) {
+      spdlog::error("Baseline {} was run with {} = {} (now {})",
+                    baseline_path, entry.key, value ? *value : "(none)",
+                    entry.value);
+      same_config = false;
+    }
+  }
+  if (!same_config) {
+    spdlog::error("Not comparing against a baseline with other settings");
+    return false;
+  }
+
+  struct BaselineScene {
+    int width;
+    int height;
+    double rays_per_sec;
+  };
+  map<string, BaselineScene> baseline_scenes;
+  for (const auto &scene : baseline.get_child("scenes", pt::ptree{})) {
+    baseline_scenes[scene.second.get<string>("name", "")] = BaselineScene{
+      scene.second.get<int>("width", 0), scene.second.get<int>("height", 0),
+      scene.second.get<double>("rays_per_sec", 0)};
+  }
+
+  bool passed = true;
+  for (const auto &result : results) {
+    auto it = baseline_scenes.find(result.name);
+    if (it == baseline_scenes.end() || it->second.rays_per_sec <= 0) {
+      spdlog::warn("{}: not in baseline", result.name);
+      continue;
+    }
+    const auto &base = it->second;
+    if (base.width != result.width || base.height != result.height) {
+      spdlog::error("{}: baseline is {}x{}, not {}x{}; not comparing",
+                    result.name, base.width, base.height, result.width,
+                    result.height);
+      passed = false;
+      continue;
+    }
+    double ratio = result.GetRaysPerSecond() / base.rays_per_sec;
+    bool regressed = ratio < 1 - options.tolerance;
+    if (regressed)
+      passed = false;
+    spdlog::info("{}: {:.3f} Mrays/s vs {:.3f} Mrays/s baseline ({:+.1f}%)"
+                 "{}", result.name, result.GetRaysPerSecond() * 1e-6,
+                 base.rays_per_sec * 1e-6, (ratio - 1) * 100,
+                 regressed ? " -- REGRESSION" : "");
+  }
+  return passed;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  BenchOptions options;
+  if (!ParseArguments(argc, argv, options))
+    return -1;
+  if (options.integrator != "recursive" && options.integrator != "wavefront") {
+    spdlog::error("Invalid integrator: {}", options.integrator);
+    return -1;
+  }
+  if (options.glass_sampling != "split" &&
+      options.glass_sampling != "schlick") {
+    spdlog::error("Invalid glass sampling: {}", options.glass_sampling);
+    return -1;
+  }
+  SamplerType sampler_type;
+  if (!ParseSamplerType(options.sampler, &sampler_type)) {
+    spdlog::error("Invalid sampler: {}", options.sampler);
+    return -1;
+  }
+  AreaLightSampling light_sampling;
+  if (!ParseLightSampling(options.light_sampling, &light_sampling)) {
+    spdlog::error("Invalid light sampling: {}", options.light_sampling);
+    return -1;
+  }
+
+  // collect scenes
+  vector<fs::path> scene_paths;
+  fs::path scenes{options.scenes};
+  if (fs::is_directory(scenes)) {
+    for (const auto &entry : fs::directory_iterator(scenes)) {
+      if (entry.path().extension() == ".scn")
+        scene_paths.push_back(entry.path());
+    }
+    sort(scene_paths.begin(), scene_paths.end());
+  } else {
+    scene_paths.push_back(scenes);
+  }
+  if (scene_paths.empty()) {
+    spdlog::error("No scenes found in {}", options.scenes);
+    return -1;
+  }
+
+  // render scenes
+  vector<SceneResult> results;
+  for (const auto &scene_path : scene_paths) {
+    SceneResult result;
+    if (BenchScene(scene_path, options, result))
+      results.push_back(result);
+  }
+
+  // report
+  if (options.output.empty()) {
+    WriteJson(options, results, cout);
+  } else {
+    std::ofstream out{options.output};
+    if (!out) {
+      spdlog::error("Failed to open {}", options.output);
+      return -1;
+    }
+    WriteJson(options, results, out);
+  }
+  if (results.size() != scene_paths.size())
+    return -1;
+
+  // compare
+  if (!options.baseline.empty() &&
+      !CompareToBaseline(options.baseline, options, results))
+    return 1;
+  return 0;
+}
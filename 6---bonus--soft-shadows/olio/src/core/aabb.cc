@@ -11,6 +11,7 @@
 
 #include "core/aabb.h"
 #include "core/ray.h"
+#include "core/renderer/pixel_diagnostics.h"
 
 namespace olio {
 namespace core {
@@ -97,6 +98,7 @@ AABB::IsPointInside(const Vec3r &point) const
 bool
 AABB::Hit(const Ray &ray, Real tmin, Real tmax) const
 {
+  OLIO_DIAGNOSTICS_ADD(bvh_nodes, 1);
   if (!IsValid())
     return false;
 
@@ -104,10 +106,10 @@ AABB::Hit(const Ray &ray, Real tmin, Real tmax) const
   const Vec3r &origin = ray.GetOrigin();
   const Vec3r &dir = ray.GetDirection();
   for (int i = 0; i < 3; ++i) {
-    Real dir_inv = 1.0f / dir[i];
+    Real dir_inv = 1 / dir[i];
     Real t0 = (min_[i] - origin[i]) * dir_inv;
     Real t1 = (max_[i] - origin[i]) * dir_inv;
-    if (dir_inv < 0.0f)
+    if (dir_inv < 0)
       std::swap(t0, t1);
     tmin = t0 > tmin ? t0 : tmin;
     tmax = t1 < tmax ? t1 : tmax;
@@ -21,9 +21,9 @@ public:
 
   inline int get_face_id() const {return face_id_;}
 
-  inline Vec2r get_uv() const {return uv_;}
+  inline const Vec2r &get_uv() const {return uv_;}
 
-  inline Vec2r get_global_uv() const {return global_uv_;}
+  inline const Vec2r &get_global_uv() const {return global_uv_;}
 
 protected:
   int face_id_{-1};  //!< triangle id in mesh (-1 if not a triangle or TriMesh)
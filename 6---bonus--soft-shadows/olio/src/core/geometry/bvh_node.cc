@@ -8,9 +8,12 @@
 //! \file       bvh_node.cc
 //! \brief      BVHNode class
 //! \author     Hadi Fadaifard, 2022
-#include <iostream>
+#include <algorithm>
+#include <chrono>
 #include "core/geometry/bvh_node.h"
 #include <spdlog/spdlog.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
 #include "core/ray.h"
 #include "core/material/material.h"
 
@@ -18,7 +21,9 @@ namespace olio {
 namespace core {
 
 using namespace std;
-int global_axis = 0; 
+
+BVHBuildOptions BVHNode::default_build_options_;
+
 
 BVHNode::BVHNode(const std::string &name) :
   Surface{}
@@ -35,10 +40,8 @@ BVHNode::GetBoundingBox(bool force_recompute)
     return bbox_;
 
   bbox_.Reset();
-  if (left_)
-    bbox_.ExpandBy(left_->GetBoundingBox(force_recompute));
-  if (right_)
-    bbox_.ExpandBy(right_->GetBoundingBox(force_recompute));
+  for (const auto &primitive : primitives_)
+    bbox_.ExpandBy(primitive->GetBoundingBox(force_recompute));
   // spdlog::info("{}: {}", GetName(), bbox_);
   bound_dirty_ = false;
   return bbox_;
@@ -48,141 +51,90 @@ BVHNode::GetBoundingBox(bool force_recompute)
 bool
 BVHNode::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
 {
-  // ======================================================================
-  // *** Homework: Implement function
-  // ======================================================================
-  // ***** START OF YOUR CODE (DO NOT DELETE/MODIFY THIS LINE) *****
-  if (bbox_.Hit (ray, tmin, tmax)) {
-    // if we are a leaf: try to intersect the surface - record hit and
-    // adjust tmax if necessary, and return true or false
-    // OTHERWISE:
-    /*HitRecord lrec, rrec;
-    bool left_hit = ((left_ != nullptr) && (left_->Hit (ray, tmin, tmax, lrec)));
-    bool right_hit = ((right_ != nullptr) && (right_->Hit (ray, lrec.GetRayT(), tmax, rrec)));
-
-    if (left_hit && right_hit) {
-      if (lrec.GetRayT() < rrec.GetRayT())
-        hit_record = lrec;
-      else
-        hit_record = rrec;
-      return true;
-    }
-    else if (left_hit) {
-      hit_record = lrec;
+  return linear_bvh_.Intersect(ray, tmin, tmax,
+    [&](uint32_t prim_index, Real prim_tmin, Real &prim_tmax) {
+      if (!primitives_[prim_index]->Hit(ray, prim_tmin, prim_tmax,
+                                        hit_record))
+        return false;
+      prim_tmax = hit_record.GetRayT();
       return true;
-    }
-    else if (right_hit) {
-      hit_record = rrec;
-      return true;
-    }*/
-
-    bool hit = false;
-    //HitRecord lrec, rrec;
-    if ((left_ != nullptr) && (left_->Hit (ray, tmin, tmax, hit_record))) {
-      tmax = hit_record.GetRayT();
-      hit = true;
-    }
-    if ((right_ != nullptr) && (right_->Hit (ray, tmin, tmax, hit_record))) {
-      hit = true;
-    }
-    return hit;
-
-  }
-  return false;
-
- //!< remove this line and add your own code
-  // ***** END OF YOUR CODE (DO NOT DELETE/MODIFY THIS LINE) *****
+    });
+}
+
+
+bool
+BVHNode::Occluded(const Ray &ray, Real tmin, Real tmax)
+{
+  return linear_bvh_.Occluded(ray, tmin, tmax,
+    [&](uint32_t prim_index, Real prim_tmin, Real prim_tmax) {
+      return primitives_[prim_index]->Occluded(ray, prim_tmin, prim_tmax);
+    });
 }
 
 
 BVHNode::Ptr
 BVHNode::BuildBVH(std::vector<Surface::Ptr> surfaces, const string &name)
 {
-  //spdlog::info("Building BVH ({})", name);
+  return BuildBVH(std::move(surfaces), default_build_options_, name);
+}
+
 
+BVHNode::Ptr
+BVHNode::BuildBVH(std::vector<Surface::Ptr> surfaces,
+                  const BVHBuildOptions &options, const string &name)
+{
   // error checking
-  auto surface_count = surfaces.size();
-  if (!surface_count)
+  surfaces.erase(remove(surfaces.begin(), surfaces.end(), nullptr),
+                 surfaces.end());
+  if (surfaces.empty())
     return nullptr;
 
-  // make sure we have valid bboxes for surfaces
-  for (auto surface : surfaces) {
-    if (surface)
-      surface->GetBoundingBox();
-  }
-
-  // build bvh
-  uint split_axis = 0;
-  auto bvh_node = BuildBVH(surfaces, 0, surface_count, split_axis, name);
-
-  // compute bboxes
-  if (bvh_node)
-    bvh_node->GetBoundingBox();
+  // start timer
+  auto start_time = chrono::system_clock::now();
 
-  //spdlog::info("Done building BVH ({})", name);
+  // make sure we have valid bboxes for surfaces
+  vector<AABB> prim_bounds(surfaces.size());
+  auto grain_size = std::max<size_t>(options.parallel_size, 1);
+  tbb::parallel_for(tbb::blocked_range<size_t>{0, surfaces.size(),
+                                               grain_size},
+                    [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t i = range.begin(); i != range.end(); ++i)
+      prim_bounds[i] = surfaces[i]->GetBoundingBox();
+  });
+
+  // build bvh and store primitives in leaf order
+  auto bvh_node = BVHNode::Create(name);
+  vector<uint32_t> prim_order;
+  bvh_node->linear_bvh_.Build(prim_bounds, options, prim_order);
+  bvh_node->primitives_.reserve(prim_order.size());
+  for (auto prim_index : prim_order)
+    bvh_node->primitives_.push_back(surfaces[prim_index]);
+  bvh_node->GetBoundingBox();
+
+  // stop timer
+  auto end_time = chrono::system_clock::now();
+  auto build_time = chrono::duration_cast<chrono::duration<double>>
+    (end_time - start_time).count();
+
+  bvh_node->build_stats_ = bvh_node->linear_bvh_.ComputeStats();
+  bvh_node->build_stats_.build_time = build_time;
+  spdlog::info("Built BVH ({}) in {:.3f} s: {}", bvh_node->GetName(),
+               build_time, bvh_node->build_stats_);
   return bvh_node;
 }
 
-// Compares two intervals according to starting times.
-bool compareInterval(Surface::Ptr i1, Surface::Ptr i2)
+
+void
+BVHNode::SetDefaultBuildOptions(const BVHBuildOptions &options)
 {
-    Vec3r min_temp_i1 = i1->GetBoundingBox(false).GetMin();
-    Vec3r min_temp_i2 = i2->GetBoundingBox(false).GetMin();
-    return (min_temp_i1[global_axis] < min_temp_i2[global_axis]);
+  default_build_options_ = options;
 }
 
-BVHNode::Ptr
-BVHNode::BuildBVH(std::vector<Surface::Ptr> &surfaces, size_t start,
-                  size_t end, uint split_axis, const std::string &name)
-{
-  // ======================================================================
-  // *** Homework: Implement function
-  // ======================================================================
-  // ***** START OF YOUR CODE (DO NOT DELETE/MODIFY THIS LINE) *****
-  BVHNode::Ptr bvh_node = BVHNode::Create();
-  size_t N = end - start;
-
-  if (N == 1) {
-    bvh_node->left_ = surfaces[start];
-    bvh_node->right_ = nullptr;
-    bvh_node->bbox_ = surfaces[start]->GetBoundingBox();
-  }
-  else if (N == 2) {
-    bvh_node->left_ = surfaces[start];
-    bvh_node->right_ = surfaces[start+1];
-
-    AABB bbox_combine = bvh_node->left_->GetBoundingBox(false);
-    bbox_combine.ExpandBy(bvh_node->right_->GetBoundingBox(false));
-    bvh_node->bbox_ = bbox_combine;
-
-    //bvh_node->bbox_ = BBoxCombine(surfaces[start]->BoundingBox(), surfaces[start+1]->BoundingBox());
-  }
-  else {
-    //sort A by the surface or bbox centers along AXIS
-    global_axis = split_axis;
-    sort(surfaces.begin(), surfaces.end(), compareInterval);
-    size_t mid = start + N/2;
-    std::vector<Surface::Ptr> surfaces_l(mid), surfaces_r(N-mid);
-    surfaces_l.assign(surfaces.begin(), surfaces.begin() + mid);
-    surfaces_r.assign(surfaces.begin() + mid, surfaces.end());
-    //std::cout << "surfaces size: " << surfaces.size() << "\n" << std::endl;
-    //std::cout << "N: " << N << "\n" << std::endl;
-    //std::cout << "surfaces_l size: " << surfaces_l.size() << "\n" << std::endl;
-    //std::cout << "surfaces_r size: " << surfaces_r.size() << "\n" << std::endl;
-
-    bvh_node->left_ = BVHNode::BuildBVH(surfaces_l, 0, mid, (split_axis+1)%3);
-    bvh_node->right_ = BVHNode::BuildBVH(surfaces_r, 0, surfaces_r.size(), (split_axis+1)%3);
-
-    AABB bbox_combine = bvh_node->left_->GetBoundingBox(false);
-    bbox_combine.ExpandBy(bvh_node->right_->GetBoundingBox(false));
-    bvh_node->bbox_ = bbox_combine;
-
-    //bvh_node->bbox_ = BBoxCombine (left_->bbox_, right_->bbox_)
-  }
 
-  return bvh_node;
-  //return nullptr;  //!< remove this line and add your own code
-  // ***** END OF YOUR CODE (DO NOT DELETE/MODIFY THIS LINE) *****
+const BVHBuildOptions &
+BVHNode::GetDefaultBuildOptions()
+{
+  return default_build_options_;
 }
 
 }  // namespace core
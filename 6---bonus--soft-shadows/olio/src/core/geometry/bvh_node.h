@@ -15,6 +15,7 @@
 #include <string>
 #include <set>
 #include "core/geometry/surface.h"
+#include "core/geometry/linear_bvh.h"
 
 namespace olio {
 namespace core {
@@ -25,6 +26,9 @@ class Material;
 
 //! \class BVHNode
 //! \brief BVHNode class
+//! \details The hierarchy is stored as a contiguous array of compact
+//!    nodes (\ref LinearBVH) that is traversed with an explicit stack.
+//!    Leaves reference ranges of 'primitives_'.
 class BVHNode : public Surface {
 public:
   OLIO_NODE(BVHNode)
@@ -38,28 +42,53 @@ public:
   //! \param[in] hit_record Resulting hit record if ray intersected with surface
   //! \return True if ray intersected with surface
   bool Hit(const Ray &ray, Real tmin, Real tmax,HitRecord &hit_record) override;
+
+  //! \brief Check if ray hits the surface in [tmin, tmax]
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \return True if ray intersected with surface
+  bool Occluded(const Ray &ray, Real tmin, Real tmax) override;
   AABB GetBoundingBox(bool force_recompute=false) override;
+
+  //! \brief Build a BVH over the input surfaces using the default
+  //!        build options (see SetDefaultBuildOptions())
+  //! \param[in] surfaces Surfaces that form the leaves of the tree
+  //! \param[in] name Tree name
+  //! \return Root of the built tree
   static BVHNode::Ptr BuildBVH(std::vector<Surface::Ptr> surfaces,
                                const std::string &name=std::string());
-protected:
-  //! \brief Build a BVH (sub)tree from the input list of surface in
-  //!        the specified range.
-  //! \details Only surfaces with indices in the range [start, end)
-  //!        are used to build the tree. The surfaces will form the
-  //!        leaves of the tree
+
+  //! \brief Build a BVH over the input surfaces
+  //! \param[in] surfaces Surfaces that form the leaves of the tree
+  //! \param[in] options Build options
   //! \param[in] name Tree name
-  //! \param[in] surfaces List of all surfaces
-  //! \param[in] start Index of the first surface in the list
-  //! \param[in] end Index of the last surface in the list
-  //! \param[in] split_axis Axis (dimension) to use to sort and split
-  //! the surfaces by (0: x-axis, 1: y-axis, 2: z-axis).
-  //! \return Built (sub)tree
-  static BVHNode::Ptr BuildBVH(std::vector<Surface::Ptr> &surfaces,
-                               size_t start, size_t end, uint split_axis,
+  //! \return Root of the built tree
+  static BVHNode::Ptr BuildBVH(std::vector<Surface::Ptr> surfaces,
+                               const BVHBuildOptions &options,
                                const std::string &name=std::string());
-  Surface::Ptr left_;
-  Surface::Ptr right_;
+
+  //! \brief Set build options used by BuildBVH() when none are given
+  //! \param[in] options Build options
+  static void SetDefaultBuildOptions(const BVHBuildOptions &options);
+
+  //! \brief Get build options used by BuildBVH() when none are given
+  //! \return Build options
+  static const BVHBuildOptions &GetDefaultBuildOptions();
+
+  //! \brief Get the flattened tree
+  //! \return Flattened tree
+  const LinearBVH &GetLinearBVH() const {return linear_bvh_;}
+
+  //! \brief Get build-quality statistics computed after the build
+  //! \return Build statistics
+  const BVHBuildStats &GetBuildStats() const {return build_stats_;}
+protected:
+  LinearBVH linear_bvh_;                 //!< flattened tree
+  std::vector<Surface::Ptr> primitives_; //!< leaf primitives of linear_bvh_
+  BVHBuildStats build_stats_;            //!< build-quality statistics
 private:
+  static BVHBuildOptions default_build_options_;  //!< default options
 };
 
 }  // namespace core
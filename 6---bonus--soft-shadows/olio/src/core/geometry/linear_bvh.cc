@@ -0,0 +1,371 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       linear_bvh.cc
+//! \brief      LinearBVH class
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/geometry/linear_bvh.h"
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+constexpr uint LinearBVH::kMaxDepth;
+constexpr Real LinearBVH::kTraversalCost;
+constexpr Real LinearBVH::kIntersectionCost;
+
+
+struct LinearBVH::BuildContext {
+  const vector<AABB> &prim_bounds;  //!< bounds of primitives
+  vector<Vec3r> centroids;          //!< centroids of primitive bounds
+  vector<uint32_t> &prim_order;     //!< primitive indices in leaf order
+  BVHBuildOptions options;          //!< build options
+};
+
+
+void
+LinearBVH::Build(const std::vector<AABB> &prim_bounds,
+                 const BVHBuildOptions &options,
+                 std::vector<uint32_t> &prim_order)
+{
+  Clear();
+  auto prim_count = static_cast<uint32_t>(prim_bounds.size());
+  prim_order.resize(prim_count);
+  iota(prim_order.begin(), prim_order.end(), 0);
+  if (!prim_count)
+    return;
+
+  BuildContext context{prim_bounds, {}, prim_order, options};
+  context.options.leaf_size = max(1u, min(options.leaf_size, 0xffffu));
+  context.options.bin_count = max(2u, options.bin_count);
+  context.options.parallel_size = max(2u, options.parallel_size);
+  context.centroids.resize(prim_count, Vec3r{0, 0, 0});
+  tbb::parallel_for(tbb::blocked_range<uint32_t>{0, prim_count,
+                                                 context.options.parallel_size},
+                    [&](const tbb::blocked_range<uint32_t> &range) {
+    for (uint32_t i = range.begin(); i != range.end(); ++i) {
+      if (prim_bounds[i].IsValid())
+        context.centroids[i] = Real(0.5) * (prim_bounds[i].GetMin() +
+                                           prim_bounds[i].GetMax());
+    }
+  });
+
+  // a binary tree with n leaves has at most 2n - 1 nodes
+  Reserve(2 * prim_count - 1);
+  BuildRecursive(context, 0, prim_count, 0);
+}
+
+
+uint32_t
+LinearBVH::BuildRecursive(BuildContext &context, uint32_t start,
+                          uint32_t end, uint depth)
+{
+  auto &prim_order = context.prim_order;
+  const auto &options = context.options;
+  const uint32_t count = end - start;
+
+  // node bounds
+  AABB bbox, centroid_bbox;
+  ComputeBounds(context, start, end, bbox, centroid_bbox);
+
+  uint32_t mid = start;
+  uint axis = 0;
+  if (count > 1 && options.split_method == BVHSplitMethod::kMedian) {
+    // object median along round-robin axes
+    if (count > options.leaf_size) {
+      axis = depth % 3;
+      mid = start + count / 2;
+      const auto &prim_bounds = context.prim_bounds;
+      nth_element(prim_order.begin() + start, prim_order.begin() + mid,
+                  prim_order.begin() + end, [&](uint32_t a, uint32_t b) {
+                    return prim_bounds[a].GetMin()[axis] <
+                      prim_bounds[b].GetMin()[axis];
+                  });
+    }
+  } else if (count > 1) {
+    mid = PartitionSAH(context, start, end, bbox, centroid_bbox, axis);
+
+    // leaves are limited to leaf_size primitives
+    if (mid == start && count > options.leaf_size)
+      mid = start + count / 2;
+
+    // past half the max depth, split at the median so that the
+    // remaining levels are bounded by log2(count)
+    if (mid != start && depth >= kMaxDepth / 2) {
+      mid = start + count / 2;
+      const auto &centroids = context.centroids;
+      nth_element(prim_order.begin() + start, prim_order.begin() + mid,
+                  prim_order.begin() + end, [&](uint32_t a, uint32_t b) {
+                    return centroids[a][axis] < centroids[b][axis];
+                  });
+    }
+  }
+
+  if (mid == start)
+    return AddLeafNode(bbox, start, count);
+
+  // interior node: first child follows the node in the array
+  auto node_index = AddInteriorNode(bbox, axis);
+  if (count < options.parallel_size) {
+    BuildRecursive(context, start, mid, depth + 1);
+    SetSecondChild(node_index, BuildRecursive(context, mid, end, depth + 1));
+    return node_index;
+  }
+
+  // large nodes: build children into separate arrays in parallel (they
+  // partition disjoint ranges of prim_order), then append them
+  LinearBVH left, right;
+  tbb::parallel_invoke(
+    [&] {left.BuildRecursive(context, start, mid, depth + 1);},
+    [&] {right.BuildRecursive(context, mid, end, depth + 1);});
+  AppendSubtree(left);
+  SetSecondChild(node_index, AppendSubtree(right));
+  return node_index;
+}
+
+
+void
+LinearBVH::ComputeBounds(const BuildContext &context, uint32_t start,
+                         uint32_t end, AABB &bbox, AABB &centroid_bbox)
+{
+  using Bounds = pair<AABB, AABB>;
+  auto expand = [&](const tbb::blocked_range<uint32_t> &range,
+                    Bounds bounds) {
+    for (uint32_t i = range.begin(); i != range.end(); ++i) {
+      auto prim = context.prim_order[i];
+      bounds.first.ExpandBy(context.prim_bounds[prim]);
+      bounds.second.ExpandBy(context.centroids[prim]);
+    }
+    return bounds;
+  };
+  tbb::blocked_range<uint32_t> range{start, end,
+                                     context.options.parallel_size};
+  Bounds bounds;
+  if (end - start < context.options.parallel_size) {
+    bounds = expand(range, bounds);
+  } else {
+    bounds = tbb::parallel_reduce(range, bounds, expand,
+      [](Bounds a, const Bounds &b) {
+        a.first.ExpandBy(b.first);
+        a.second.ExpandBy(b.second);
+        return a;
+      });
+  }
+  bbox = bounds.first;
+  centroid_bbox = bounds.second;
+}
+
+
+uint32_t
+LinearBVH::PartitionSAH(BuildContext &context, uint32_t start,
+                        uint32_t end, const AABB &bbox,
+                        const AABB &centroid_bbox, uint &axis)
+{
+  auto &prim_order = context.prim_order;
+  const auto &centroids = context.centroids;
+  const uint32_t count = end - start;
+
+  // split along the axis with the largest centroid extent
+  const Vec3r &extent = centroid_bbox.GetMax() - centroid_bbox.GetMin();
+  axis = 0;
+  if (extent[1] > extent[axis])
+    axis = 1;
+  if (extent[2] > extent[axis])
+    axis = 2;
+  if (!(extent[axis] > 0))
+    return start;
+
+  // assign centroids to bins
+  const uint bin_count = context.options.bin_count;
+  const Real cmin = centroid_bbox.GetMin()[axis];
+  const Real bin_scale = bin_count / extent[axis];
+  auto get_bin = [&](uint32_t prim) {
+    auto bin = static_cast<uint>((centroids[prim][axis] - cmin) * bin_scale);
+    return min(bin, bin_count - 1);
+  };
+  vector<AABB> bin_bounds(bin_count);
+  vector<uint32_t> bin_counts(bin_count, 0);
+  for (uint32_t i = start; i < end; ++i) {
+    auto bin = get_bin(prim_order[i]);
+    ++bin_counts[bin];
+    bin_bounds[bin].ExpandBy(context.prim_bounds[prim_order[i]]);
+  }
+
+  // sweep from the right to collect areas of the second child
+  vector<Real> right_areas(bin_count, 0);
+  AABB right_bbox;
+  for (uint i = bin_count - 1; i > 0; --i) {
+    right_bbox.ExpandBy(bin_bounds[i]);
+    right_areas[i] = SurfaceArea(right_bbox);
+  }
+
+  // sweep from the left to find the cheapest split (after bin 'i')
+  const Real area = SurfaceArea(bbox);
+  const Real inv_area = area > 0 ? 1 / area : 0;
+  Real best_cost = kInfinity;
+  uint best_bin = 0;
+  AABB left_bbox;
+  uint32_t left_count = 0;
+  for (uint i = 0; i + 1 < bin_count; ++i) {
+    left_bbox.ExpandBy(bin_bounds[i]);
+    left_count += bin_counts[i];
+    uint32_t right_count = count - left_count;
+    if (!left_count || !right_count)
+      continue;
+    Real cost = kTraversalCost + kIntersectionCost * inv_area *
+      (left_count * SurfaceArea(left_bbox) +
+       right_count * right_areas[i + 1]);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_bin = i;
+    }
+  }
+
+  // keep small ranges as leaves if splitting does not pay off
+  if (count <= context.options.leaf_size &&
+      count * kIntersectionCost <= best_cost)
+    return start;
+
+  auto it = partition(prim_order.begin() + start, prim_order.begin() + end,
+                      [&](uint32_t prim) {return get_bin(prim) <= best_bin;});
+  return static_cast<uint32_t>(it - prim_order.begin());
+}
+
+
+uint32_t
+LinearBVH::AppendSubtree(const LinearBVH &subtree)
+{
+  auto base = static_cast<uint32_t>(nodes_.size());
+  nodes_.insert(nodes_.end(), subtree.nodes_.begin(), subtree.nodes_.end());
+
+  // second-child offsets of interior nodes are relative to the subtree
+  for (auto i = base; i < nodes_.size(); ++i) {
+    if (!nodes_[i].prim_count)
+      nodes_[i].offset += base;
+  }
+  return base;
+}
+
+
+BVHBuildStats
+LinearBVH::ComputeStats() const
+{
+  BVHBuildStats stats;
+  stats.node_count = nodes_.size();
+  if (nodes_.empty())
+    return stats;
+
+  const Real root_area = SurfaceArea(GetNodeBounds(nodes_[0]));
+  const Real inv_root_area = root_area > 0 ? 1 / root_area : 0;
+  vector<pair<uint32_t, uint>> stack{{0, 0}};
+  while (!stack.empty()) {
+    auto current = stack.back();
+    stack.pop_back();
+    const auto &node = nodes_[current.first];
+    Real area_ratio = SurfaceArea(GetNodeBounds(node)) * inv_root_area;
+    if (node.prim_count > 0) {
+      ++stats.leaf_count;
+      stats.prim_count += node.prim_count;
+      stats.max_depth = max(stats.max_depth, current.second);
+      if (stats.leaf_histogram.size() <= node.prim_count)
+        stats.leaf_histogram.resize(node.prim_count + 1, 0);
+      ++stats.leaf_histogram[node.prim_count];
+      stats.sah_cost += area_ratio * node.prim_count * kIntersectionCost;
+    } else {
+      stats.sah_cost += area_ratio * kTraversalCost;
+      stack.emplace_back(current.first + 1, current.second + 1);
+      stack.emplace_back(node.offset, current.second + 1);
+    }
+  }
+  return stats;
+}
+
+
+Real
+LinearBVH::SurfaceArea(const AABB &bbox)
+{
+  if (!bbox.IsValid())
+    return 0;
+  const Vec3r &d = bbox.GetMax() - bbox.GetMin();
+  return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+
+AABB
+LinearBVH::GetNodeBounds(const LinearBVHNode &node)
+{
+  return AABB{Vec3r{node.bounds[0][0], node.bounds[0][1], node.bounds[0][2]},
+              Vec3r{node.bounds[1][0], node.bounds[1][1], node.bounds[1][2]}};
+}
+
+void
+LinearBVH::SetNodeBounds(const AABB &bbox, LinearBVHNode &node)
+{
+  const Vec3r &bmin = bbox.GetMin();
+  const Vec3r &bmax = bbox.GetMax();
+  for (int i = 0; i < 3; ++i) {
+    // round outwards so that single precision bounds are conservative
+    auto lo = static_cast<float>(bmin[i]);
+    if (static_cast<Real>(lo) > bmin[i])
+      lo = nextafter(lo, -numeric_limits<float>::infinity());
+    auto hi = static_cast<float>(bmax[i]);
+    if (static_cast<Real>(hi) < bmax[i])
+      hi = nextafter(hi, numeric_limits<float>::infinity());
+    node.bounds[0][i] = lo;
+    node.bounds[1][i] = hi;
+  }
+}
+
+
+uint32_t
+LinearBVH::AddInteriorNode(const AABB &bbox, uint axis)
+{
+  LinearBVHNode node;
+  SetNodeBounds(bbox, node);
+  node.offset = 0;
+  node.prim_count = 0;
+  node.axis = static_cast<uint8_t>(axis);
+  node.pad = 0;
+  nodes_.push_back(node);
+  return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+
+uint32_t
+LinearBVH::AddLeafNode(const AABB &bbox, uint32_t first_prim,
+                       uint32_t prim_count)
+{
+  LinearBVHNode node;
+  SetNodeBounds(bbox, node);
+  node.offset = first_prim;
+  node.prim_count = static_cast<uint16_t>(prim_count);
+  node.axis = 0;
+  node.pad = 0;
+  nodes_.push_back(node);
+  return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+
+AABB
+LinearBVH::GetBoundingBox() const
+{
+  if (nodes_.empty())
+    return AABB{};
+  return GetNodeBounds(nodes_[0]);
+}
+
+}  // namespace core
+}  // namespace olio
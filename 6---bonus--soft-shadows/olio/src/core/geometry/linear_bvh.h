@@ -0,0 +1,385 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       linear_bvh.h
+//! \brief      LinearBVH class
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/ostream.h>
+#include "core/types.h"
+#include "core/aabb.h"
+#include "core/ray.h"
+#include "core/renderer/pixel_diagnostics.h"
+
+namespace olio {
+namespace core {
+
+//! \struct LinearBVHNode
+//! \brief Compact (32 bytes) BVH node stored in a contiguous array
+//! \details Nodes are stored in depth-first order: the first child of
+//!    an interior node immediately follows its parent, and 'offset'
+//!    holds the index of the second child. For leaves, 'offset' is
+//!    the index of the first primitive and 'prim_count' the number of
+//!    primitives. Bounds are stored in single precision and rounded
+//!    outwards, so they always enclose the original bounds.
+struct LinearBVHNode {
+  float bounds[2][3];   //!< min (bounds[0]) and max (bounds[1]) coordinates
+  uint32_t offset;      //!< first primitive (leaf) or second child (interior)
+  uint16_t prim_count;  //!< number of primitives (0 for interior nodes)
+  uint8_t axis;         //!< split axis (interior nodes)
+  uint8_t pad;          //!< padding to 32 bytes
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must be 32 bytes");
+
+//! \enum BVHSplitMethod
+//! \brief Method used to split primitives at interior nodes
+enum class BVHSplitMethod {
+  kMedian,  //!< object median along round-robin axes (sorted by bbox min)
+  kSAH      //!< binned surface area heuristic along the largest axis
+};
+
+//! \struct BVHBuildOptions
+//! \brief Parameters for building a LinearBVH
+struct BVHBuildOptions {
+  BVHSplitMethod split_method{BVHSplitMethod::kSAH};  //!< split method
+  uint leaf_size{4};   //!< max primitives per leaf (target for kSAH)
+  uint bin_count{16};  //!< number of SAH bins per node
+  uint parallel_size{4096};  //!< min primitives to build a node in parallel
+};
+
+//! \struct BVHBuildStats
+//! \brief Build-quality report of a LinearBVH
+struct BVHBuildStats {
+  size_t prim_count{0};  //!< number of primitives
+  size_t node_count{0};  //!< number of nodes
+  size_t leaf_count{0};  //!< number of leaves
+  uint max_depth{0};     //!< depth of the deepest leaf (root: 0)
+  Real sah_cost{0};      //!< expected SAH cost of a ray through the root
+  std::vector<size_t> leaf_histogram;  //!< leaf count per primitive count
+  double build_time{0};  //!< build wall time in seconds (set by owners)
+};
+
+//! \class LinearBVH
+//! \brief Flattened bounding volume hierarchy over primitives that
+//!        are referenced by index
+//! \details The class only stores the hierarchy. The owner keeps the
+//!        primitives and intersects them in the callback passed to
+//!        Intersect(), using the primitive indices stored in leaves.
+class LinearBVH {
+public:
+  //! \brief Maximum tree depth supported by the traversal stack
+  static constexpr uint kMaxDepth = 64;
+
+  LinearBVH() = default;
+
+  //! \brief Relative cost of visiting a node, used in SAH costs
+  static constexpr Real kTraversalCost = 0.125;
+
+  //! \brief Relative cost of intersecting a primitive, used in SAH costs
+  static constexpr Real kIntersectionCost = 1;
+
+  //! \brief Remove all nodes
+  void Clear() {nodes_.clear();}
+
+  //! \brief Build the hierarchy over primitives with the input bounds
+  //! \details Subtrees and bound reductions over at least
+  //!    options.parallel_size primitives are computed in parallel with
+  //!    TBB; the result does not depend on the number of threads.
+  //!    Primitives are partitioned in place in 'prim_order'. On
+  //!    return, leaves reference ranges of 'prim_order', i.e., the
+  //!    owner should store its primitives in the order of 'prim_order'.
+  //! \param[in] prim_bounds Bounds of the primitives
+  //! \param[in] options Build options
+  //! \param[out] prim_order Primitive indices in leaf order
+  void Build(const std::vector<AABB> &prim_bounds,
+             const BVHBuildOptions &options,
+             std::vector<uint32_t> &prim_order);
+
+  //! \brief Compute build-quality statistics of the hierarchy
+  //! \return Statistics
+  BVHBuildStats ComputeStats() const;
+
+  //! \brief Check if the hierarchy has no nodes
+  //! \return True if empty
+  bool IsEmpty() const {return nodes_.empty();}
+
+  //! \brief Get number of nodes
+  //! \return Number of nodes
+  size_t GetNodeCount() const {return nodes_.size();}
+
+  //! \brief Get nodes
+  //! \return Nodes in depth-first order
+  const std::vector<LinearBVHNode> &GetNodes() const {return nodes_;}
+
+  //! \brief Reserve memory for nodes
+  //! \param[in] node_count Expected number of nodes
+  void Reserve(size_t node_count) {nodes_.reserve(node_count);}
+
+  //! \brief Append an interior node. Its first child must be the next
+  //!        appended node; the second child is set with SetSecondChild().
+  //! \param[in] bbox Node bounds
+  //! \param[in] axis Split axis
+  //! \return Index of the new node
+  uint32_t AddInteriorNode(const AABB &bbox, uint axis);
+
+  //! \brief Set second child of an interior node
+  //! \param[in] node_index Index of the interior node
+  //! \param[in] child_index Index of the second child
+  void SetSecondChild(uint32_t node_index, uint32_t child_index) {
+    nodes_[node_index].offset = child_index;
+  }
+
+  //! \brief Append a leaf node
+  //! \param[in] bbox Node bounds
+  //! \param[in] first_prim Index of first primitive in leaf
+  //! \param[in] prim_count Number of primitives in leaf
+  //! \return Index of the new node
+  uint32_t AddLeafNode(const AABB &bbox, uint32_t first_prim,
+                       uint32_t prim_count);
+
+  //! \brief Get bounds of the whole hierarchy
+  //! \return Root bounds
+  AABB GetBoundingBox() const;
+
+  //! \brief Find the closest primitive hit by the ray
+  //! \details Nodes are visited with an explicit stack, nearer child
+  //!    first. For each primitive in a visited leaf, hit_primitive
+  //!    is called as: bool hit_primitive(uint32_t prim_index, Real tmin,
+  //!    Real &tmax). On a hit, the callback must update tmax to the hit
+  //!    distance and return true.
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \param[in] hit_primitive Primitive intersection callback
+  //! \return True if any primitive was hit
+  template<typename HitPrimitive>
+  bool Intersect(const Ray &ray, Real tmin, Real tmax,
+                 HitPrimitive &&hit_primitive) const;
+
+  //! \brief Check if the ray hits any primitive
+  //! \details Traversal stops at the first primitive for which
+  //!    occludes is called as: bool occludes(uint32_t prim_index, Real
+  //!    tmin, Real tmax) and returns true.
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \param[in] occludes Primitive occlusion callback
+  //! \return True if any primitive was hit
+  template<typename Occludes>
+  bool Occluded(const Ray &ray, Real tmin, Real tmax,
+                Occludes &&occludes) const;
+protected:
+  //! \brief Ray-box slab test against a node's bounds
+  //! \param[in] node Node to test
+  //! \param[in] origin Ray origin
+  //! \param[in] inv_dir Inverse of ray direction
+  //! \param[in] dir_is_neg Whether each ray direction component is negative
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \return True if the ray overlaps the node in [tmin, tmax]
+  static inline bool HitNode(const LinearBVHNode &node, const Vec3r &origin,
+                             const Vec3r &inv_dir, const int dir_is_neg[3],
+                             Real tmin, Real tmax) {
+    OLIO_DIAGNOSTICS_ADD(bvh_nodes, 1);
+    for (int i = 0; i < 3; ++i) {
+      Real t0 = (static_cast<Real>(node.bounds[dir_is_neg[i]][i]) - origin[i]) *
+        inv_dir[i];
+      Real t1 = (static_cast<Real>(node.bounds[1 - dir_is_neg[i]][i]) -
+                 origin[i]) * inv_dir[i];
+      tmin = t0 > tmin ? t0 : tmin;
+      tmax = t1 < tmax ? t1 : tmax;
+      if (tmax < tmin)
+        return false;
+    }
+    return true;
+  }
+
+  //! \struct BuildContext
+  //! \brief Per-primitive data shared by the recursive build
+  struct BuildContext;
+
+  //! \brief Recursively build the (sub)tree over prim_order[start, end)
+  //! \param[in,out] context Build data
+  //! \param[in] start Index of the first primitive in prim_order
+  //! \param[in] end Index past the last primitive in prim_order
+  //! \param[in] depth Depth of the (sub)tree root
+  //! \return Index of the (sub)tree root
+  uint32_t BuildRecursive(BuildContext &context, uint32_t start,
+                          uint32_t end, uint depth);
+
+  //! \brief Compute bounds and centroid bounds of prim_order[start, end)
+  //! \param[in] context Build data
+  //! \param[in] start Index of the first primitive in prim_order
+  //! \param[in] end Index past the last primitive in prim_order
+  //! \param[out] bbox Bounds of the primitives
+  //! \param[out] centroid_bbox Bounds of the primitive centroids
+  static void ComputeBounds(const BuildContext &context, uint32_t start,
+                            uint32_t end, AABB &bbox, AABB &centroid_bbox);
+
+  //! \brief Find SAH split of prim_order[start, end) and partition it
+  //! \param[in,out] context Build data
+  //! \param[in] start Index of the first primitive in prim_order
+  //! \param[in] end Index past the last primitive in prim_order
+  //! \param[in] bbox Bounds of the primitives
+  //! \param[in] centroid_bbox Bounds of the primitive centroids
+  //! \param[out] axis Split axis
+  //! \return Index of the first primitive of the second child; 'start'
+  //!    if a leaf is cheaper than any split
+  static uint32_t PartitionSAH(BuildContext &context, uint32_t start,
+                               uint32_t end, const AABB &bbox,
+                               const AABB &centroid_bbox, uint &axis);
+
+  //! \brief Append the nodes of another hierarchy, built over the same
+  //!        primitive order
+  //! \param[in] subtree Hierarchy to append
+  //! \return Index of the subtree root
+  uint32_t AppendSubtree(const LinearBVH &subtree);
+
+  //! \brief Compute surface area of a box
+  //! \param[in] bbox Input box
+  //! \return Surface area (0 for invalid boxes)
+  static Real SurfaceArea(const AABB &bbox);
+
+  //! \brief Get bounds of a node
+  //! \param[in] node Input node
+  //! \return Node bounds
+  static AABB GetNodeBounds(const LinearBVHNode &node);
+
+  //! \brief Store bbox in node, rounding the bounds outwards
+  //! \param[in] bbox Input bounds
+  //! \param[out] node Node to store the bounds in
+  static void SetNodeBounds(const AABB &bbox, LinearBVHNode &node);
+
+  std::vector<LinearBVHNode> nodes_;  //!< nodes in depth-first order
+};
+
+
+template<typename HitPrimitive>
+bool
+LinearBVH::Intersect(const Ray &ray, Real tmin, Real tmax,
+                     HitPrimitive &&hit_primitive) const
+{
+  if (nodes_.empty())
+    return false;
+
+  const Vec3r &origin = ray.GetOrigin();
+  const Vec3r &dir = ray.GetDirection();
+  const Vec3r inv_dir{1 / dir[0], 1 / dir[1], 1 / dir[2]};
+  const int dir_is_neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+
+  bool hit = false;
+  uint32_t stack[kMaxDepth];
+  uint stack_size = 0;
+  uint32_t current = 0;
+  while (true) {
+    const auto &node = nodes_[current];
+    if (HitNode(node, origin, inv_dir, dir_is_neg, tmin, tmax)) {
+      if (node.prim_count > 0) {
+        // leaf: intersect primitives (hit_primitive shrinks tmax)
+        for (uint32_t i = 0; i < node.prim_count; ++i) {
+          if (hit_primitive(node.offset + i, tmin, tmax))
+            hit = true;
+        }
+        if (stack_size == 0)
+          break;
+        current = stack[--stack_size];
+      } else if (dir_is_neg[node.axis]) {
+        // visit second (nearer) child first
+        stack[stack_size++] = current + 1;
+        current = node.offset;
+      } else {
+        stack[stack_size++] = node.offset;
+        current = current + 1;
+      }
+    } else {
+      if (stack_size == 0)
+        break;
+      current = stack[--stack_size];
+    }
+  }
+  return hit;
+}
+
+
+template<typename Occludes>
+bool
+LinearBVH::Occluded(const Ray &ray, Real tmin, Real tmax,
+                    Occludes &&occludes) const
+{
+  if (nodes_.empty())
+    return false;
+
+  const Vec3r &origin = ray.GetOrigin();
+  const Vec3r &dir = ray.GetDirection();
+  const Vec3r inv_dir{1 / dir[0], 1 / dir[1], 1 / dir[2]};
+  const int dir_is_neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+
+  uint32_t stack[kMaxDepth + 1];
+  uint stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size) {
+    const auto &node = nodes_[stack[--stack_size]];
+    if (!HitNode(node, origin, inv_dir, dir_is_neg, tmin, tmax))
+      continue;
+    if (node.prim_count > 0) {
+      for (uint32_t i = 0; i < node.prim_count; ++i) {
+        if (occludes(node.offset + i, tmin, tmax))
+          return true;
+      }
+      continue;
+    }
+    // any hit will do, but the nearer child is still more likely to
+    // contain one
+    uint32_t first = static_cast<uint32_t>(&node - nodes_.data()) + 1;
+    if (dir_is_neg[node.axis]) {
+      stack[stack_size++] = first;
+      stack[stack_size++] = node.offset;
+    } else {
+      stack[stack_size++] = node.offset;
+      stack[stack_size++] = first;
+    }
+  }
+  return false;
+}
+
+}  // namespace core
+}  // namespace olio
+
+
+namespace fmt {
+template<>
+struct formatter<olio::core::BVHBuildStats>
+{
+  template<typename ParseContext>
+  inline auto parse(ParseContext &ctx) -> decltype(ctx.begin()) {
+    return ctx.begin();
+  }
+
+  template<typename FormatContext>
+  auto format(olio::core::BVHBuildStats const &stats, FormatContext &ctx) ->
+    decltype(ctx.out()) {
+    format_to(ctx.out(), "{} prims, {} nodes, {} leaves, depth {}, "
+              "SAH cost {:.3f}, leaf sizes [", stats.prim_count,
+              stats.node_count, stats.leaf_count, stats.max_depth,
+              stats.sah_cost);
+    bool first = true;
+    for (size_t i = 0; i < stats.leaf_histogram.size(); ++i) {
+      if (!stats.leaf_histogram[i])
+        continue;
+      format_to(ctx.out(), "{}{}: {}", first ? "" : ", ", i,
+                stats.leaf_histogram[i]);
+      first = false;
+    }
+    return format_to(ctx.out(), "]");
+  }
+};
+}  // namespace fmt
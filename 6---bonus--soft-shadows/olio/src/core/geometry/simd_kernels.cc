@@ -0,0 +1,504 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       simd_kernels.cc
+//! \brief      Wide ray-box and ray-triangle kernels
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/geometry/simd_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#ifdef OLIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+// the float triangle filter only rejects lanes that miss by more than
+// this fraction of the magnitudes of the terms it sums: far more than
+// the rounding of the float inputs and arithmetic (2^-24 relative per
+// operation), so a hit of the exact test is never filtered out
+constexpr float kTriangleErrorScale = 1.0f / 65536;
+
+
+uint
+HitBoxesScalar(const WideBVHNode &node, const WideRay &ray, float tmin,
+               float tmax, float tnear[kWideBVHWidth])
+{
+  uint mask = 0;
+  for (uint i = 0; i < kWideBVHWidth; ++i) {
+    float t0 = tmin, t1 = tmax;
+    for (int a = 0; a < 3; ++a) {
+      float near = (node.bounds[ray.dir_is_neg[a]][a][i] - ray.origin[a]) *
+        ray.inv_dir[a];
+      float far = (node.bounds[1 - ray.dir_is_neg[a]][a][i] - ray.origin[a]) *
+        ray.inv_dir[a];
+      t0 = near > t0 ? near : t0;
+      t1 = far < t1 ? far : t1;
+    }
+    tnear[i] = t0 - ray.t_slack;
+    if (tnear[i] <= t1 * kSimdFarScale + ray.t_slack)
+      mask |= 1u << i;
+  }
+  return mask;
+}
+
+
+uint
+HitTrianglesScalar(const TrianglePacket *packets, uint packet_count,
+                   const WideRay &ray, float tmin, float tmax)
+{
+  const float *d = ray.dir;
+  uint mask = 0;
+  for (uint k = 0; k < packet_count * kTrianglePacketSize; ++k) {
+    const auto &packet = packets[k / kTrianglePacketSize];
+    const uint i = k % kTrianglePacketSize;
+    float e1[3], e2[3], s[3];
+    float e1_max = 0, e2_max = 0, v0_max = 0;
+    for (int a = 0; a < 3; ++a) {
+      e1[a] = packet.e1[a][i];
+      e2[a] = packet.e2[a][i];
+      s[a] = ray.origin[a] - packet.v0[a][i];
+      e1_max = std::max(e1_max, std::fabs(e1[a]));
+      e2_max = std::max(e2_max, std::fabs(e2[a]));
+      v0_max = std::max(v0_max, std::fabs(packet.v0[a][i]));
+    }
+
+    // Moller-Trumbore, without dividing by det
+    float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+                  d[0] * e2[1] - d[1] * e2[0]};
+    float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+                  s[0] * e1[1] - s[1] * e1[0]};
+    float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    float u = s[0] * p[0] + s[1] * p[1] + s[2] * p[2];
+    float v = d[0] * q[0] + d[1] * q[1] + d[2] * q[2];
+    float t = e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2];
+
+    // error bounds from the magnitudes of the factors; |o| + |v0|
+    // bounds both |s| and the cancellation error of o - v0
+    float s_max = ray.origin_max + v0_max;
+    float det_error = kTriangleErrorScale * ray.dir_max * e1_max * e2_max;
+    float u_error = kTriangleErrorScale * ray.dir_max * e2_max * s_max;
+    float v_error = kTriangleErrorScale * ray.dir_max * e1_max * s_max;
+    float t_error = kTriangleErrorScale * e1_max * e2_max * s_max;
+
+    // a det within its error may have the wrong sign (grazing rays,
+    // tiny triangles): leave it to the exact test. Unused lanes have
+    // zero edges and no error, and are never hit.
+    if (std::fabs(det) <= det_error) {
+      if (det_error > 0)
+        mask |= 1u << k;
+      continue;
+    }
+
+    // make det positive, then test the barycentrics and t scaled by det
+    if (det < 0) {
+      det = -det;
+      u = -u;
+      v = -v;
+      t = -t;
+    }
+    float t_det_error = det_error + kTriangleErrorScale * det;
+    if (u >= -u_error && v >= -v_error &&
+        u + v <= det + det_error + u_error + v_error &&
+        t + t_error >= tmin * det - std::fabs(tmin) * t_det_error &&
+        t - t_error <= tmax * det + std::fabs(tmax) * t_det_error)
+      mask |= 1u << k;
+  }
+  return mask;
+}
+
+
+#ifdef OLIO_SIMD_X86
+uint
+HitBoxesSSE(const WideBVHNode &node, const WideRay &ray, float tmin,
+            float tmax, float tnear[kWideBVHWidth])
+{
+  uint mask = 0;
+  for (uint half = 0; half < kWideBVHWidth; half += 4) {
+    __m128 t0 = _mm_set1_ps(tmin);
+    __m128 t1 = _mm_set1_ps(tmax);
+    for (int a = 0; a < 3; ++a) {
+      __m128 origin = _mm_set1_ps(ray.origin[a]);
+      __m128 inv_dir = _mm_set1_ps(ray.inv_dir[a]);
+      __m128 near = _mm_loadu_ps(&node.bounds[ray.dir_is_neg[a]][a][half]);
+      __m128 far = _mm_loadu_ps(&node.bounds[1 - ray.dir_is_neg[a]][a][half]);
+      near = _mm_mul_ps(_mm_sub_ps(near, origin), inv_dir);
+      far = _mm_mul_ps(_mm_sub_ps(far, origin), inv_dir);
+      // NaNs (0 * inf) keep the current interval
+      t0 = _mm_max_ps(near, t0);
+      t1 = _mm_min_ps(far, t1);
+    }
+    __m128 slack = _mm_set1_ps(ray.t_slack);
+    t0 = _mm_sub_ps(t0, slack);
+    t1 = _mm_add_ps(_mm_mul_ps(t1, _mm_set1_ps(kSimdFarScale)), slack);
+    _mm_storeu_ps(&tnear[half], t0);
+    __m128 hit = _mm_cmple_ps(t0, t1);
+    mask |= static_cast<uint>(_mm_movemask_ps(hit)) << half;
+  }
+  return mask;
+}
+
+
+__attribute__((target("avx2")))
+uint
+HitBoxesAVX2(const WideBVHNode &node, const WideRay &ray, float tmin,
+             float tmax, float tnear[kWideBVHWidth])
+{
+  __m256 t0 = _mm256_set1_ps(tmin);
+  __m256 t1 = _mm256_set1_ps(tmax);
+  for (int a = 0; a < 3; ++a) {
+    __m256 origin = _mm256_set1_ps(ray.origin[a]);
+    __m256 inv_dir = _mm256_set1_ps(ray.inv_dir[a]);
+    __m256 near = _mm256_loadu_ps(node.bounds[ray.dir_is_neg[a]][a]);
+    __m256 far = _mm256_loadu_ps(node.bounds[1 - ray.dir_is_neg[a]][a]);
+    near = _mm256_mul_ps(_mm256_sub_ps(near, origin), inv_dir);
+    far = _mm256_mul_ps(_mm256_sub_ps(far, origin), inv_dir);
+    // NaNs (0 * inf) keep the current interval
+    t0 = _mm256_max_ps(near, t0);
+    t1 = _mm256_min_ps(far, t1);
+  }
+  __m256 slack = _mm256_set1_ps(ray.t_slack);
+  t0 = _mm256_sub_ps(t0, slack);
+  t1 = _mm256_add_ps(_mm256_mul_ps(t1, _mm256_set1_ps(kSimdFarScale)), slack);
+  _mm256_storeu_ps(tnear, t0);
+  __m256 hit = _mm256_cmp_ps(t0, t1, _CMP_LE_OQ);
+  return static_cast<uint>(_mm256_movemask_ps(hit));
+}
+
+
+uint
+HitTrianglePacketSSE(const TrianglePacket &packet, const WideRay &ray,
+                     float tmin, float tmax)
+{
+  // same filter as HitTrianglesScalar(), on 4 triangles
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 dx = _mm_set1_ps(ray.dir[0]);
+  __m128 dy = _mm_set1_ps(ray.dir[1]);
+  __m128 dz = _mm_set1_ps(ray.dir[2]);
+  __m128 e1x = _mm_loadu_ps(packet.e1[0]);
+  __m128 e1y = _mm_loadu_ps(packet.e1[1]);
+  __m128 e1z = _mm_loadu_ps(packet.e1[2]);
+  __m128 e2x = _mm_loadu_ps(packet.e2[0]);
+  __m128 e2y = _mm_loadu_ps(packet.e2[1]);
+  __m128 e2z = _mm_loadu_ps(packet.e2[2]);
+  __m128 v0x = _mm_loadu_ps(packet.v0[0]);
+  __m128 v0y = _mm_loadu_ps(packet.v0[1]);
+  __m128 v0z = _mm_loadu_ps(packet.v0[2]);
+
+  // p = d x e2, det = e1 . p
+  __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+  __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+  __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+  __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+                          _mm_mul_ps(e1z, pz));
+
+  // s = o - v0, u = s . p
+  __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), v0x);
+  __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), v0y);
+  __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), v0z);
+  __m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)),
+                        _mm_mul_ps(sz, pz));
+
+  // q = s x e1, v = d . q, t = e2 . q
+  __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+  __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+  __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+  __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+                        _mm_mul_ps(dz, qz));
+  __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                        _mm_mul_ps(e2z, qz));
+
+  // error bounds from the magnitudes of the factors
+  __m128 e1_max = _mm_max_ps(_mm_max_ps(_mm_andnot_ps(sign, e1x),
+                                        _mm_andnot_ps(sign, e1y)),
+                             _mm_andnot_ps(sign, e1z));
+  __m128 e2_max = _mm_max_ps(_mm_max_ps(_mm_andnot_ps(sign, e2x),
+                                        _mm_andnot_ps(sign, e2y)),
+                             _mm_andnot_ps(sign, e2z));
+  __m128 v0_max = _mm_max_ps(_mm_max_ps(_mm_andnot_ps(sign, v0x),
+                                        _mm_andnot_ps(sign, v0y)),
+                             _mm_andnot_ps(sign, v0z));
+  __m128 scale = _mm_set1_ps(kTriangleErrorScale);
+  __m128 d_scale = _mm_set1_ps(kTriangleErrorScale * ray.dir_max);
+  __m128 s_max = _mm_add_ps(_mm_set1_ps(ray.origin_max), v0_max);
+  __m128 det_error = _mm_mul_ps(_mm_mul_ps(d_scale, e1_max), e2_max);
+  __m128 u_error = _mm_mul_ps(_mm_mul_ps(d_scale, e2_max), s_max);
+  __m128 v_error = _mm_mul_ps(_mm_mul_ps(d_scale, e1_max), s_max);
+  __m128 t_error = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(scale, e1_max), e2_max),
+                              s_max);
+
+  // lanes whose det may have the wrong sign go to the exact test
+  __m128 det_sign = _mm_and_ps(det, sign);
+  det = _mm_xor_ps(det, det_sign);
+  __m128 grazing = _mm_and_ps(_mm_cmple_ps(det, det_error),
+                              _mm_cmpgt_ps(det_error, _mm_setzero_ps()));
+
+  // make det positive, then test the barycentrics and t scaled by det
+  u = _mm_xor_ps(u, det_sign);
+  v = _mm_xor_ps(v, det_sign);
+  t = _mm_xor_ps(t, det_sign);
+  __m128 t_det_error = _mm_add_ps(det_error, _mm_mul_ps(scale, det));
+  __m128 t_low = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(tmin), det),
+                            _mm_mul_ps(_mm_set1_ps(std::fabs(tmin)),
+                                       t_det_error));
+  __m128 t_high = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tmax), det),
+                             _mm_mul_ps(_mm_set1_ps(std::fabs(tmax)),
+                                        t_det_error));
+  __m128 hit = _mm_cmpgt_ps(det, det_error);
+  hit = _mm_and_ps(hit, _mm_cmpge_ps(u, _mm_xor_ps(u_error, sign)));
+  hit = _mm_and_ps(hit, _mm_cmpge_ps(v, _mm_xor_ps(v_error, sign)));
+  hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v),
+                                     _mm_add_ps(_mm_add_ps(det, det_error),
+                                                _mm_add_ps(u_error, v_error))));
+  hit = _mm_and_ps(hit, _mm_cmpge_ps(_mm_add_ps(t, t_error), t_low));
+  hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_sub_ps(t, t_error), t_high));
+  hit = _mm_or_ps(hit, grazing);
+  return static_cast<uint>(_mm_movemask_ps(hit));
+}
+
+
+uint
+HitTrianglesSSE(const TrianglePacket *packets, uint packet_count,
+                const WideRay &ray, float tmin, float tmax)
+{
+  uint mask = 0;
+  for (uint p = 0; p < packet_count; ++p) {
+    mask |= HitTrianglePacketSSE(packets[p], ray, tmin, tmax) <<
+      (p * kTrianglePacketSize);
+  }
+  return mask;
+}
+
+
+//! \brief Load the lanes of two packets into one register
+//! \param[in] low Array of the first packet
+//! \param[in] high Array of the second packet (nullptr: zeros)
+//! \return Lanes of both packets
+__attribute__((target("avx2")))
+inline __m256
+LoadPacketPair(const float *low, const float *high)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)),
+                              high ? _mm_loadu_ps(high) : _mm_setzero_ps(),
+                              1);
+}
+
+
+__attribute__((target("avx2")))
+uint
+HitTrianglesAVX2(const TrianglePacket *packets, uint packet_count,
+                 const WideRay &ray, float tmin, float tmax)
+{
+  // same filter as HitTrianglesScalar(), on the 8 triangles of two
+  // packets; the lanes of a missing second packet are zero
+  const TrianglePacket &low = packets[0];
+  const TrianglePacket *high = packet_count > 1 ? &packets[1] : nullptr;
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 dx = _mm256_set1_ps(ray.dir[0]);
+  __m256 dy = _mm256_set1_ps(ray.dir[1]);
+  __m256 dz = _mm256_set1_ps(ray.dir[2]);
+  __m256 e1x = LoadPacketPair(low.e1[0], high ? high->e1[0] : nullptr);
+  __m256 e1y = LoadPacketPair(low.e1[1], high ? high->e1[1] : nullptr);
+  __m256 e1z = LoadPacketPair(low.e1[2], high ? high->e1[2] : nullptr);
+  __m256 e2x = LoadPacketPair(low.e2[0], high ? high->e2[0] : nullptr);
+  __m256 e2y = LoadPacketPair(low.e2[1], high ? high->e2[1] : nullptr);
+  __m256 e2z = LoadPacketPair(low.e2[2], high ? high->e2[2] : nullptr);
+  __m256 v0x = LoadPacketPair(low.v0[0], high ? high->v0[0] : nullptr);
+  __m256 v0y = LoadPacketPair(low.v0[1], high ? high->v0[1] : nullptr);
+  __m256 v0z = LoadPacketPair(low.v0[2], high ? high->v0[2] : nullptr);
+
+  // p = d x e2, det = e1 . p
+  __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+  __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+  __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+  __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px),
+                                           _mm256_mul_ps(e1y, py)),
+                             _mm256_mul_ps(e1z, pz));
+
+  // s = o - v0, u = s . p
+  __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), v0x);
+  __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), v0y);
+  __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), v0z);
+  __m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px),
+                                         _mm256_mul_ps(sy, py)),
+                           _mm256_mul_ps(sz, pz));
+
+  // q = s x e1, v = d . q, t = e2 . q
+  __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+  __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+  __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+  __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx),
+                                         _mm256_mul_ps(dy, qy)),
+                           _mm256_mul_ps(dz, qz));
+  __m256 t = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx),
+                                         _mm256_mul_ps(e2y, qy)),
+                           _mm256_mul_ps(e2z, qz));
+
+  // error bounds from the magnitudes of the factors
+  __m256 e1_max = _mm256_max_ps(_mm256_max_ps(_mm256_andnot_ps(sign, e1x),
+                                              _mm256_andnot_ps(sign, e1y)),
+                                _mm256_andnot_ps(sign, e1z));
+  __m256 e2_max = _mm256_max_ps(_mm256_max_ps(_mm256_andnot_ps(sign, e2x),
+                                              _mm256_andnot_ps(sign, e2y)),
+                                _mm256_andnot_ps(sign, e2z));
+  __m256 v0_max = _mm256_max_ps(_mm256_max_ps(_mm256_andnot_ps(sign, v0x),
+                                              _mm256_andnot_ps(sign, v0y)),
+                                _mm256_andnot_ps(sign, v0z));
+  __m256 scale = _mm256_set1_ps(kTriangleErrorScale);
+  __m256 d_scale = _mm256_set1_ps(kTriangleErrorScale * ray.dir_max);
+  __m256 s_max = _mm256_add_ps(_mm256_set1_ps(ray.origin_max), v0_max);
+  __m256 det_error = _mm256_mul_ps(_mm256_mul_ps(d_scale, e1_max), e2_max);
+  __m256 u_error = _mm256_mul_ps(_mm256_mul_ps(d_scale, e2_max), s_max);
+  __m256 v_error = _mm256_mul_ps(_mm256_mul_ps(d_scale, e1_max), s_max);
+  __m256 t_error = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(scale, e1_max),
+                                               e2_max), s_max);
+
+  // lanes whose det may have the wrong sign go to the exact test
+  __m256 det_sign = _mm256_and_ps(det, sign);
+  det = _mm256_xor_ps(det, det_sign);
+  __m256 grazing = _mm256_and_ps(
+    _mm256_cmp_ps(det, det_error, _CMP_LE_OQ),
+    _mm256_cmp_ps(det_error, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+  // make det positive, then test the barycentrics and t scaled by det
+  u = _mm256_xor_ps(u, det_sign);
+  v = _mm256_xor_ps(v, det_sign);
+  t = _mm256_xor_ps(t, det_sign);
+  __m256 t_det_error = _mm256_add_ps(det_error, _mm256_mul_ps(scale, det));
+  __m256 t_low = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(tmin), det),
+                               _mm256_mul_ps(_mm256_set1_ps(std::fabs(tmin)),
+                                             t_det_error));
+  __m256 t_high = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tmax), det),
+                                _mm256_mul_ps(_mm256_set1_ps(std::fabs(tmax)),
+                                              t_det_error));
+  __m256 hit = _mm256_cmp_ps(det, det_error, _CMP_GT_OQ);
+  hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, _mm256_xor_ps(u_error, sign),
+                                         _CMP_GE_OQ));
+  hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, _mm256_xor_ps(v_error, sign),
+                                         _CMP_GE_OQ));
+  hit = _mm256_and_ps(hit, _mm256_cmp_ps(
+                        _mm256_add_ps(u, v),
+                        _mm256_add_ps(_mm256_add_ps(det, det_error),
+                                      _mm256_add_ps(u_error, v_error)),
+                        _CMP_LE_OQ));
+  hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(t, t_error), t_low,
+                                         _CMP_GE_OQ));
+  hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_sub_ps(t, t_error), t_high,
+                                         _CMP_LE_OQ));
+  hit = _mm256_or_ps(hit, grazing);
+  return static_cast<uint>(_mm256_movemask_ps(hit));
+}
+#endif  // OLIO_SIMD_X86
+
+
+const SimdKernels kScalarKernels{SimdLevel::kScalar, HitBoxesScalar,
+                                 HitTrianglesScalar};
+#ifdef OLIO_SIMD_X86
+const SimdKernels kSSEKernels{SimdLevel::kSSE, HitBoxesSSE, HitTrianglesSSE};
+const SimdKernels kAVX2Kernels{SimdLevel::kAVX2, HitBoxesAVX2,
+                               HitTrianglesAVX2};
+#endif
+
+
+const SimdKernels &
+GetKernels(SimdLevel level)
+{
+#ifdef OLIO_SIMD_X86
+  if (level == SimdLevel::kAVX2)
+    return kAVX2Kernels;
+  if (level == SimdLevel::kSSE)
+    return kSSEKernels;
+#endif
+  return kScalarKernels;
+}
+
+
+// kernels selected with SetSimdLevel()
+atomic<const SimdKernels*> selected_kernels{nullptr};
+
+}  // namespace
+
+
+WideRay::WideRay(const Ray &ray)
+{
+  const Vec3r &ray_origin = ray.GetOrigin();
+  const Vec3r &ray_dir = ray.GetDirection();
+  origin_max = 0;
+  dir_max = 0;
+  Real slack = 0;
+  for (int a = 0; a < 3; ++a) {
+    origin[a] = static_cast<float>(ray_origin[a]);
+    dir[a] = static_cast<float>(ray_dir[a]);
+    inv_dir[a] = static_cast<float>(1 / ray_dir[a]);
+    dir_is_neg[a] = inv_dir[a] < 0;
+    origin_max = std::max(origin_max, std::fabs(origin[a]));
+    dir_max = std::max(dir_max, std::fabs(dir[a]));
+    // rounding the origin moves the slabs along the ray by up to this
+    if (ray_dir[a] != 0) {
+      slack = std::max(slack, std::fabs((ray_origin[a] - origin[a]) /
+                                        ray_dir[a]));
+    }
+  }
+  t_slack = static_cast<float>(slack);
+}
+
+
+SimdLevel
+GetSupportedSimdLevel()
+{
+#ifdef OLIO_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SimdLevel::kAVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return SimdLevel::kSSE;
+#endif
+  return SimdLevel::kScalar;
+}
+
+
+void
+SetSimdLevel(SimdLevel level)
+{
+  auto supported = GetSupportedSimdLevel();
+  if (static_cast<int>(level) > static_cast<int>(supported))
+    level = supported;
+  selected_kernels.store(&GetKernels(level), memory_order_relaxed);
+}
+
+
+const SimdKernels &
+GetSimdKernels()
+{
+  auto kernels = selected_kernels.load(memory_order_relaxed);
+  if (kernels)
+    return *kernels;
+  static const SimdKernels &default_kernels =
+    GetKernels(GetSupportedSimdLevel());
+  return default_kernels;
+}
+
+
+std::string
+GetSimdLevelName(SimdLevel level)
+{
+  switch (level) {
+  case SimdLevel::kAVX2: return "avx2";
+  case SimdLevel::kSSE: return "sse";
+  default: return "scalar";
+  }
+}
+
+}  // namespace core
+}  // namespace olio
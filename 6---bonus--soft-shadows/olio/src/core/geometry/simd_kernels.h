@@ -0,0 +1,143 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       simd_kernels.h
+//! \brief      Wide ray-box and ray-triangle kernels
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "core/types.h"
+#include "core/ray.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define OLIO_SIMD_X86 1
+#endif
+
+namespace olio {
+namespace core {
+
+//! \enum SimdLevel
+//! \brief Instruction set used by the wide kernels
+enum class SimdLevel {
+  kScalar,  //!< portable scalar loops
+  kSSE,     //!< 4-wide SSE
+  kAVX2     //!< 8-wide AVX2
+};
+
+//! \brief Number of children in a WideBVHNode
+constexpr uint kWideBVHWidth = 8;
+
+//! \brief Number of triangles in a TrianglePacket
+constexpr uint kTrianglePacketSize = 4;
+
+//! \brief Max number of TrianglePackets tested by one triangle kernel
+//!        call (8 triangles, one AVX2 register)
+constexpr uint kTriangleKernelPackets = 2;
+
+//! \brief Scale applied to single precision box exit distances to make
+//!        slab tests conservative
+constexpr float kSimdFarScale = 1.00001f;
+
+//! \struct WideBVHNode
+//! \brief BVH node with up to kWideBVHWidth children, with child
+//!        bounds stored as a struct of arrays
+//! \details Unused child slots have empty (inverted) bounds, so rays
+//!    never hit them.
+struct WideBVHNode {
+  float bounds[2][3][kWideBVHWidth];  //!< [min/max][axis][child] bounds
+  uint32_t child[kWideBVHWidth];      //!< child node or first packet
+  uint32_t packet_count[kWideBVHWidth];  //!< packets in leaf (0: node)
+};
+
+//! \struct TrianglePacket
+//! \brief kTrianglePacketSize triangles stored as a struct of arrays
+//!        for the wide ray-triangle kernels
+//! \details Unused lanes have zero edges, so rays never hit them.
+struct TrianglePacket {
+  float v0[3][kTrianglePacketSize];  //!< first vertex
+  float e1[3][kTrianglePacketSize];  //!< second vertex - first vertex
+  float e2[3][kTrianglePacketSize];  //!< third vertex - first vertex
+  uint32_t triangle[kTrianglePacketSize];  //!< triangle index per lane
+};
+
+//! \struct WideRay
+//! \brief Single-precision ray data shared by the wide kernels
+struct WideRay {
+  //! \brief Precompute ray data
+  //! \param[in] ray Input ray
+  explicit WideRay(const Ray &ray);
+
+  float origin[3];   //!< ray origin
+  float dir[3];      //!< ray direction
+  float inv_dir[3];  //!< inverse of ray direction
+  int dir_is_neg[3]; //!< whether each direction component is negative
+  float origin_max;  //!< largest magnitude of the origin's components
+  float dir_max;     //!< largest magnitude of the direction's components
+  float t_slack;     //!< box distance error from rounding the origin
+};
+
+//! \struct SimdKernels
+//! \brief Kernel functions of one SimdLevel
+struct SimdKernels {
+  SimdLevel level;  //!< instruction set of the kernels
+
+  //! \brief Test ray against all children of a node
+  //! \details Writes the entry distance of each child to tnear and
+  //!    returns a bit mask of the children hit in [tmin, tmax]
+  uint (*hit_boxes)(const WideBVHNode &node, const WideRay &ray, float tmin,
+                    float tmax, float tnear[kWideBVHWidth]);
+
+  //! \brief Test ray against all triangles of up to
+  //!        kTriangleKernelPackets consecutive packets
+  //! \details Returns a conservative bit mask of the lanes that may be
+  //!    hit in [tmin, tmax], with bit packet * kTrianglePacketSize +
+  //!    lane for each lane; hits must be confirmed with an exact test
+  uint (*hit_triangles)(const TrianglePacket *packets, uint packet_count,
+                        const WideRay &ray, float tmin, float tmax);
+};
+
+//! \brief Get the best instruction set supported by the CPU
+//! \return Supported SimdLevel
+SimdLevel GetSupportedSimdLevel();
+
+//! \brief Select the kernels used by wide traversals. Levels that
+//!        the CPU does not support fall back to the best supported one.
+//! \param[in] level Requested SimdLevel
+void SetSimdLevel(SimdLevel level);
+
+//! \brief Get the kernels selected with SetSimdLevel() (the best
+//!        supported level by default)
+//! \return Kernels
+const SimdKernels &GetSimdKernels();
+
+//! \brief Get name of an instruction set
+//! \param[in] level Input level
+//! \return Name of level
+std::string GetSimdLevelName(SimdLevel level);
+
+//! \brief Index of the lowest set bit of a non-zero mask
+//! \param[in] mask Input mask
+//! \return Bit index
+inline uint LowestBit(uint mask)
+{
+#if defined(__GNUC__)
+  return static_cast<uint>(__builtin_ctz(mask));
+#else
+  uint bit = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    ++bit;
+  }
+  return bit;
+#endif
+}
+
+}  // namespace core
+}  // namespace olio
@@ -10,8 +10,11 @@
 //! \author     Hadi Fadaifard, 2022
 
 #include "core/geometry/sphere.h"
+#include <cmath>
+#include <utility>
 #include <spdlog/spdlog.h>
 #include "core/ray.h"
+#include "core/renderer/pixel_diagnostics.h"
 
 namespace olio {
 namespace core {
@@ -61,34 +64,60 @@ Sphere::GetBoundingBox(bool force_recompute)
 }
 
 bool
-Sphere::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
+Sphere::RaySphereHit(const Ray &ray, Real tmin, Real tmax, Real &ray_t) const
 {
-  auto p0 = ray.GetOrigin() - center_;
-  auto v = ray.GetDirection();
+  OLIO_DIAGNOSTICS_ADD(primitive_tests, 1);
+  Vec3r p0 = ray.GetOrigin() - center_;
+  const Vec3r &v = ray.GetDirection();
   auto a = v.squaredNorm();
-  auto b = 2 * p0.dot(v);
+  auto half_b = p0.dot(v);
   auto c = p0.squaredNorm() - radius_ * radius_;
 
-  // solve quadratic equation to find t
-  auto a2 = 2 * a;
-  auto discriminant = b * b - 2 * a2 * c;
+  // discriminant / a, computed from the distance between the sphere
+  // center and the ray's line instead of half_b^2 - a * c, which
+  // cancels badly for distant rays
+  Vec3r l = p0 - (half_b / a) * v;
+  auto discriminant = a * (radius_ * radius_ - l.squaredNorm());
   if (discriminant < 0)
     return false;
+
+  // roots as q / a and c / q, where q doesn't suffer from cancellation
   auto s = static_cast<Real>(sqrt(discriminant));
-  auto t = (-b - s) / a2;
-  if (t < tmin)
-    t = (-b + s) / a2;
-  if (t < tmin || t > tmax)
+  auto q = -(half_b + std::copysign(s, half_b));
+  Real t0 = q / a;
+  Real t1 = q != 0 ? c / q : t0;
+  if (t0 > t1)
+    std::swap(t0, t1);
+  ray_t = t0 < tmin ? t1 : t0;
+  return ray_t >= tmin && ray_t <= tmax;
+}
+
+
+bool
+Sphere::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
+{
+  Real t;
+  if (!RaySphereHit(ray, tmin, tmax, t))
     return false;
 
-  // fill hit record
-  const Vec3r &hit_point = ray.At(t);
-  hit_record.SetRayT(t);
+  hit_record.SetHit(t, this);
+  return true;
+}
+
+
+void
+Sphere::ComputeShading(const Ray &ray, HitRecord &hit_record)
+{
+  const Vec3r &hit_point = ray.At(hit_record.GetRayT());
   hit_record.SetPoint(hit_point);
   hit_record.SetNormal(ray, (hit_point - center_).normalized());
-  hit_record.SetSurface(GetPtr());
+}
 
-  const Vec3r hitt = hit_point - center_;
+
+FaceGeoUV
+Sphere::ComputeFaceGeoUV(const HitRecord &hit_record)
+{
+  const Vec3r hitt = hit_record.GetPoint() - center_;
   double ratio = hitt[1]/hitt[0];
   double phi;
 
@@ -124,8 +153,15 @@ Sphere::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
   face_geouv.set_uv(Vec2r{-1, -1});
   face_geouv.set_global_uv(Vec2r{phi/k2Pi, theta/kPi});
 
-  hit_record.SetFaceGeouv(face_geouv);
-  return true;
+  return face_geouv;
+}
+
+
+bool
+Sphere::Occluded(const Ray &ray, Real tmin, Real tmax)
+{
+  Real t;
+  return RaySphereHit(ray, tmin, tmax, t);
 }
 
 }  // namespace core
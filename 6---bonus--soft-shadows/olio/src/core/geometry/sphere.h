@@ -48,6 +48,23 @@ public:
   bool Hit(const Ray &ray, Real tmin, Real tmax,
            HitRecord &hit_record) override;
 
+  //! \brief Check if ray hits the surface in [tmin, tmax]
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \return True if ray intersected with surface
+  bool Occluded(const Ray &ray, Real tmin, Real tmax) override;
+
+  //! \brief Compute shading attributes of a hit on this surface
+  //! \param[in] ray Ray that hit the surface
+  //! \param[in,out] hit_record Hit record filled in by Hit()
+  void ComputeShading(const Ray &ray, HitRecord &hit_record) override;
+
+  //! \brief Compute face/texture coordinates of a hit on this surface
+  //! \param[in] hit_record Hit record of a hit on this surface
+  //! \return Face/texture coordinates of the hit
+  FaceGeoUV ComputeFaceGeoUV(const HitRecord &hit_record) override;
+
   //! \brief Set sphere position
   //! \param[in] center Sphere center/position
   void SetCenter(const Vec3r &center);
@@ -68,6 +85,17 @@ public:
   //! \return Surface's AABB
   AABB GetBoundingBox(bool force_recompute=false) override;
 protected:
+  //! \brief Find the nearest ray-sphere intersection in [tmin, tmax]
+  //! \details The quadratic is solved in a form that avoids
+  //!    cancellation, so distant and grazing rays stay accurate in
+  //!    single precision builds.
+  //! \param[in] ray Input ray
+  //! \param[in] tmin Minimum acceptable value for ray_t
+  //! \param[in] tmax Maximum acceptable value for ray_t
+  //! \param[out] ray_t Value of t for the hit point
+  //! \return True on intersection
+  bool RaySphereHit(const Ray &ray, Real tmin, Real tmax, Real &ray_t) const;
+
   Vec3r center_{0, 0, 0};  //!< sphere position
   Real radius_{0};         //!< sphere radius
 private:
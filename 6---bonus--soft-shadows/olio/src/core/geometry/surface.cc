@@ -30,7 +30,7 @@ Surface::SetMaterial(std::shared_ptr<Material> material)
 }
 
 
-Material::Ptr
+const Material::Ptr &
 Surface::GetMaterial()
 {
   return material_;
@@ -44,6 +44,28 @@ Surface::Hit(const Ray &, Real, Real, HitRecord &)
 }
 
 
+bool
+Surface::Occluded(const Ray &ray, Real tmin, Real tmax)
+{
+  HitRecord hit_record;
+  return Hit(ray, tmin, tmax, hit_record);
+}
+
+
+void
+Surface::ComputeShading(const Ray &ray, HitRecord &hit_record)
+{
+  hit_record.SetPoint(ray.At(hit_record.GetRayT()));
+}
+
+
+FaceGeoUV
+Surface::ComputeFaceGeoUV(const HitRecord &)
+{
+  return FaceGeoUV{};
+}
+
+
 AABB
 Surface::GetBoundingBox(bool /*force_recompute*/)
 {
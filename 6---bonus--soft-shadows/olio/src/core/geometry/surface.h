@@ -35,8 +35,11 @@ public:
 
   //! \brief Check if ray intersects with surface
   //! \details If the ray intersections the surface, the function
-  //!          should fill in the 'hit_record' (i.e., information
-  //!          about the hit point, normal, etc.)
+  //!          should record the hit in 'hit_record' with
+  //!          HitRecord::SetHit() (t, hit surface, primitive id and
+  //!          barycentric coordinates). Shading attributes are
+  //!          computed later by ComputeShading(), for the closest hit
+  //!          only.
   //! \param[in] ray Ray to check intersection against
   //! \param[in] tmin Minimum value for acceptable t (ray fractional distance)
   //! \param[in] tmax Maximum value for acceptable t (ray fractional distance)
@@ -45,13 +48,40 @@ public:
   virtual bool Hit(const Ray &ray, Real tmin, Real tmax,
                    HitRecord &hit_record);
 
+  //! \brief Check if ray hits anything in [tmin, tmax]
+  //! \details Unlike Hit(), the function returns on the first hit it
+  //!          finds and computes no hit information, which is all
+  //!          shadow rays need. The default implementation calls Hit().
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t (ray fractional distance)
+  //! \param[in] tmax Maximum value for acceptable t (ray fractional distance)
+  //! \return True if ray intersected with surface
+  virtual bool Occluded(const Ray &ray, Real tmin, Real tmax);
+
+  //! \brief Compute shading attributes of a hit on this surface
+  //! \details Fills in the hit point, the surface normal and whether
+  //!          the hit was front facing, from the intersection data
+  //!          recorded by Hit(). The default implementation only sets
+  //!          the hit point.
+  //! \param[in] ray Ray that hit the surface
+  //! \param[in,out] hit_record Hit record filled in by Hit()
+  virtual void ComputeShading(const Ray &ray, HitRecord &hit_record);
+
+  //! \brief Compute face/texture coordinates of a hit on this surface
+  //! \details Called by HitRecord::GetFaceGeouv() on first access, after
+  //!          ComputeShading(). The default implementation returns
+  //!          invalid (-1) coordinates.
+  //! \param[in] hit_record Hit record of a hit on this surface
+  //! \return Face/texture coordinates of the hit
+  virtual FaceGeoUV ComputeFaceGeoUV(const HitRecord &hit_record);
+
   //! \brief Set surface's material
   //! \param[in] material Material to set
   virtual void SetMaterial(std::shared_ptr<Material> material);
 
   //! \brief Get surface's material
   //! \return Node's material
-  virtual std::shared_ptr<Material> GetMaterial();
+  virtual const std::shared_ptr<Material> &GetMaterial();
 
 
   //! \brief Set surfaces's bounding box
@@ -48,29 +48,33 @@ SurfaceList::GetBoundingBox(bool force_recompute)
 bool
 SurfaceList::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
 {
-  bool first_hit = true;
+  bool had_hit = false;
   for (size_t i = 0; i < surfaces_.size(); ++i) {
-    auto surface = surfaces_[i];
+    const auto &surface = surfaces_[i];
     if (!surface)
       continue;
 
-    // check for hit
-    HitRecord current_hit;
-    if (!surface->Hit(ray, tmin, tmax, current_hit))
+    // check for a hit closer than the current closest one; surfaces
+    // only record the (small) intersection data, so there is no need
+    // for a temporary hit record
+    if (!surface->Hit(ray, tmin, tmax, hit_record))
       continue;
-
-    // update closest hit record
-    if (first_hit) {
-      hit_record = current_hit;
-      first_hit = false;
-      tmax = current_hit.GetRayT();
-      continue;
-    }
-    hit_record = current_hit;
-    tmax = current_hit.GetRayT();
+    had_hit = true;
+    tmax = hit_record.GetRayT();
   }
 
-  return !first_hit;
+  return had_hit;
+}
+
+
+bool
+SurfaceList::Occluded(const Ray &ray, Real tmin, Real tmax)
+{
+  for (const auto &surface : surfaces_) {
+    if (surface && surface->Occluded(ray, tmin, tmax))
+      return true;
+  }
+  return false;
 }
 
 }  // namespace core
@@ -43,6 +43,13 @@ public:
   bool Hit(const Ray &ray, Real tmin, Real tmax,
            HitRecord &hit_record) override;
 
+  //! \brief Check if ray hits the surface in [tmin, tmax]
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \return True if ray intersected with surface
+  bool Occluded(const Ray &ray, Real tmin, Real tmax) override;
+
 
   inline std::vector<Surface::Ptr> GetListSurfaces() const {return surfaces_;} 
   //! \brief Get/compute surface's AABB
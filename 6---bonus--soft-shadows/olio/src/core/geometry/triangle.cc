@@ -12,6 +12,7 @@
 #include "core/geometry/triangle.h"
 #include <spdlog/spdlog.h>
 #include "core/ray.h"
+#include "core/renderer/pixel_diagnostics.h"
 
 namespace olio {
 namespace core {
@@ -49,6 +50,7 @@ Triangle::RayTriangleHit(const Vec3r &p0, const Vec3r &p1, const Vec3r &p2,
                          const Ray &ray, Real tmin, Real tmax,
                          Real &ray_t, Vec2r &uv)
 {
+  OLIO_DIAGNOSTICS_ADD(primitive_tests, 1);
   const Vec3r &ray_dir = ray.GetDirection();
   const Vec3r &ray_origin = ray.GetOrigin();
   Real a = p0[0] - p1[0];
@@ -70,7 +72,12 @@ Triangle::RayTriangleHit(const Vec3r &p0, const Vec3r &p1, const Vec3r &p2,
   Real jc_minus_al = j * c - a * l;
   Real bl_minus_kc = b * l - k * c;
   Real M = a * ei_minus_hf + b * gf_minus_di + c * dh_minus_eg;
-  if (fabs(M) < kEpsilon)
+
+  // reject rays (nearly) parallel to the triangle; M scales with both
+  // edge lengths and the ray length, so compare relative to them
+  Real scale2 = (a * a + b * b + c * c) * (d * d + e * e + f * f) *
+    (g * g + h * h + i * i);
+  if (M * M <= kRelativeEpsilon * kRelativeEpsilon * scale2)
     return false;
 
   // compute t
@@ -107,21 +114,41 @@ Triangle::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
                       tmin, tmax, ray_t, uv))
     return false;
 
-  // fill hit_record
-  const Vec3r &hit_point = ray.At(ray_t);
-  hit_record.SetRayT(ray_t);
-  hit_record.SetPoint(hit_point);
+  hit_record.SetHit(ray_t, this, 0, uv);
+  return true;
+}
+
+
+void
+Triangle::ComputeShading(const Ray &ray, HitRecord &hit_record)
+{
+  hit_record.SetPoint(ray.At(hit_record.GetRayT()));
   hit_record.SetNormal(ray, normal_);
-  hit_record.SetSurface(GetPtr());
+}
+
 
+FaceGeoUV
+Triangle::ComputeFaceGeoUV(const HitRecord &hit_record)
+{
   FaceGeoUV face_geouv;
 
   face_geouv.set_face_id(0);
-  face_geouv.set_uv(uv);
+  face_geouv.set_uv(hit_record.GetBarycentric());
   face_geouv.set_global_uv(Vec2r{-1, -1});
+  return face_geouv;
+}
 
-  hit_record.SetFaceGeouv(face_geouv);
-  return true;
+
+bool
+Triangle::Occluded(const Ray &ray, Real tmin, Real tmax)
+{
+  if (points_.size() < 3)
+    return false;
+
+  Real ray_t{0};
+  Vec2r uv;
+  return RayTriangleHit(points_[0], points_[1], points_[2], ray, tmin, tmax,
+                        ray_t, uv);
 }
 
 
@@ -68,6 +68,23 @@ public:
   bool Hit(const Ray &ray, Real tmin, Real tmax,
            HitRecord &hit_record) override;
 
+  //! \brief Check if ray hits the surface in [tmin, tmax]
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \return True if ray intersected with surface
+  bool Occluded(const Ray &ray, Real tmin, Real tmax) override;
+
+  //! \brief Compute shading attributes of a hit on this surface
+  //! \param[in] ray Ray that hit the surface
+  //! \param[in,out] hit_record Hit record filled in by Hit()
+  void ComputeShading(const Ray &ray, HitRecord &hit_record) override;
+
+  //! \brief Compute face/texture coordinates of a hit on this surface
+  //! \param[in] hit_record Hit record of a hit on this surface
+  //! \return Face/texture coordinates of the hit
+  FaceGeoUV ComputeFaceGeoUV(const HitRecord &hit_record) override;
+
   //! \brief Set triangle points
   //! \details The function returns false if the number of input
   //! points is fewer than 3. The function should also compute/update
@@ -0,0 +1,154 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       triangle_store.cc
+//! \brief      TriangleStore class
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/geometry/triangle_store.h"
+#include "core/ray.h"
+#include "core/geometry/triangle.h"
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+void
+TriangleStore::Clear()
+{
+  indices_.clear();
+  face_ids_.clear();
+  px_.clear();
+  py_.clear();
+  pz_.clear();
+  nx_.clear();
+  ny_.clear();
+  nz_.clear();
+  u_.clear();
+  v_.clear();
+}
+
+
+void
+TriangleStore::Reserve(size_t vertex_count, size_t triangle_count)
+{
+  indices_.reserve(3 * triangle_count);
+  face_ids_.reserve(triangle_count);
+  for (auto array : {&px_, &py_, &pz_, &nx_, &ny_, &nz_, &u_, &v_})
+    array->reserve(vertex_count);
+}
+
+
+void
+TriangleStore::ShrinkToFit()
+{
+  indices_.shrink_to_fit();
+  face_ids_.shrink_to_fit();
+  for (auto array : {&px_, &py_, &pz_, &nx_, &ny_, &nz_, &u_, &v_})
+    array->shrink_to_fit();
+}
+
+
+uint32_t
+TriangleStore::AddVertex(const Vec3r &position, const Vec3r &normal,
+                         const Vec2r &uv)
+{
+  px_.push_back(position[0]);
+  py_.push_back(position[1]);
+  pz_.push_back(position[2]);
+  nx_.push_back(normal[0]);
+  ny_.push_back(normal[1]);
+  nz_.push_back(normal[2]);
+  u_.push_back(uv[0]);
+  v_.push_back(uv[1]);
+  return static_cast<uint32_t>(px_.size() - 1);
+}
+
+
+uint32_t
+TriangleStore::AddTriangle(uint32_t v0, uint32_t v1, uint32_t v2, int face_id)
+{
+  indices_.push_back(v0);
+  indices_.push_back(v1);
+  indices_.push_back(v2);
+  face_ids_.push_back(face_id);
+  return static_cast<uint32_t>(face_ids_.size() - 1);
+}
+
+
+void
+TriangleStore::ReorderTriangles(const std::vector<uint32_t> &order)
+{
+  vector<uint32_t> indices(3 * order.size());
+  vector<int> face_ids(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const auto *tri = GetTriangle(order[i]);
+    indices[3 * i] = tri[0];
+    indices[3 * i + 1] = tri[1];
+    indices[3 * i + 2] = tri[2];
+    face_ids[i] = face_ids_[order[i]];
+  }
+  indices_.swap(indices);
+  face_ids_.swap(face_ids);
+}
+
+
+AABB
+TriangleStore::GetTriangleBounds(uint32_t tri) const
+{
+  const auto *v = GetTriangle(tri);
+  AABB bbox;
+  bbox.ExpandBy(GetPosition(v[0]));
+  bbox.ExpandBy(GetPosition(v[1]));
+  bbox.ExpandBy(GetPosition(v[2]));
+  return bbox;
+}
+
+
+bool
+TriangleStore::RayTriangleHit(uint32_t tri, const Ray &ray, Real tmin,
+                              Real tmax, Real &ray_t, Vec2r &uv) const
+{
+  const auto *v = GetTriangle(tri);
+  return Triangle::RayTriangleHit(GetPosition(v[0]), GetPosition(v[1]),
+                                  GetPosition(v[2]), ray, tmin, tmax,
+                                  ray_t, uv);
+}
+
+
+Vec3r
+TriangleStore::InterpolateNormal(uint32_t tri, const Vec2r &uv) const
+{
+  const auto *v = GetTriangle(tri);
+  Vec3r normal = (1 - uv[0] - uv[1]) * GetNormal(v[0]) +
+    uv[0] * GetNormal(v[1]) + uv[1] * GetNormal(v[2]);
+  return normal.normalized();
+}
+
+
+Vec2r
+TriangleStore::InterpolateUV(uint32_t tri, const Vec2r &uv) const
+{
+  const auto *v = GetTriangle(tri);
+  return (1 - uv[0] - uv[1]) * GetUV(v[0]) + uv[0] * GetUV(v[1]) +
+    uv[1] * GetUV(v[2]);
+}
+
+
+size_t
+TriangleStore::GetMemoryUsage() const
+{
+  size_t bytes = indices_.capacity() * sizeof(uint32_t) +
+    face_ids_.capacity() * sizeof(int);
+  for (auto array : {&px_, &py_, &pz_, &nx_, &ny_, &nz_, &u_, &v_})
+    bytes += array->capacity() * sizeof(Real);
+  return bytes;
+}
+
+}  // namespace core
+}  // namespace olio
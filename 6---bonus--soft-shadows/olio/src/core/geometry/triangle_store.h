@@ -0,0 +1,137 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       triangle_store.h
+//! \brief      TriangleStore class
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "core/types.h"
+#include "core/aabb.h"
+
+namespace olio {
+namespace core {
+
+class Ray;
+
+//! \class TriangleStore
+//! \brief Packed storage of mesh triangles
+//! \details Triangles are stored as three vertex indices plus the id
+//!    of the face they came from. Vertex positions, normals and uvs
+//!    are stored as a struct of arrays (one array per coordinate).
+class TriangleStore {
+public:
+  TriangleStore() = default;
+
+  //! \brief Remove all vertices and triangles
+  void Clear();
+
+  //! \brief Reserve memory
+  //! \param[in] vertex_count Expected number of vertices
+  //! \param[in] triangle_count Expected number of triangles
+  void Reserve(size_t vertex_count, size_t triangle_count);
+
+  //! \brief Release unused memory
+  void ShrinkToFit();
+
+  //! \brief Append a vertex
+  //! \param[in] position Vertex position
+  //! \param[in] normal Vertex normal
+  //! \param[in] uv Vertex uv coordinates
+  //! \return Index of the new vertex
+  uint32_t AddVertex(const Vec3r &position, const Vec3r &normal,
+                     const Vec2r &uv);
+
+  //! \brief Append a triangle
+  //! \param[in] v0 Index of first vertex
+  //! \param[in] v1 Index of second vertex
+  //! \param[in] v2 Index of third vertex
+  //! \param[in] face_id Id of the face the triangle belongs to
+  //! \return Index of the new triangle
+  uint32_t AddTriangle(uint32_t v0, uint32_t v1, uint32_t v2, int face_id);
+
+  //! \brief Reorder triangles
+  //! \param[in] order Triangle indices in their new order
+  void ReorderTriangles(const std::vector<uint32_t> &order);
+
+  //! \brief Get number of vertices
+  //! \return Number of vertices
+  size_t GetVertexCount() const {return px_.size();}
+
+  //! \brief Get number of triangles
+  //! \return Number of triangles
+  size_t GetTriangleCount() const {return face_ids_.size();}
+
+  //! \brief Get vertex position
+  //! \param[in] v Vertex index
+  //! \return Vertex position
+  Vec3r GetPosition(uint32_t v) const {return Vec3r{px_[v], py_[v], pz_[v]};}
+
+  //! \brief Get vertex normal
+  //! \param[in] v Vertex index
+  //! \return Vertex normal
+  Vec3r GetNormal(uint32_t v) const {return Vec3r{nx_[v], ny_[v], nz_[v]};}
+
+  //! \brief Get vertex uv coordinates
+  //! \param[in] v Vertex index
+  //! \return Vertex uv coordinates
+  Vec2r GetUV(uint32_t v) const {return Vec2r{u_[v], v_[v]};}
+
+  //! \brief Get vertex indices of a triangle
+  //! \param[in] tri Triangle index
+  //! \return Pointer to the triangle's three vertex indices
+  const uint32_t *GetTriangle(uint32_t tri) const {return &indices_[3 * tri];}
+
+  //! \brief Get id of the face a triangle belongs to
+  //! \param[in] tri Triangle index
+  //! \return Face id
+  int GetFaceId(uint32_t tri) const {return face_ids_[tri];}
+
+  //! \brief Compute bounds of a triangle
+  //! \param[in] tri Triangle index
+  //! \return Triangle bounds
+  AABB GetTriangleBounds(uint32_t tri) const;
+
+  //! \brief Compute intersection of ray with a triangle
+  //! \param[in] tri Triangle index
+  //! \param[in] ray Input ray
+  //! \param[in] tmin Minimum acceptable value for ray_t
+  //! \param[in] tmax Maximum acceptable value for ray_t
+  //! \param[out] ray_t In case of intersection, value of t for hit point
+  //! \param[out] uv UV coordinates of the hit point inside the triangle
+  //! \return True on intersection
+  bool RayTriangleHit(uint32_t tri, const Ray &ray, Real tmin, Real tmax,
+                      Real &ray_t, Vec2r &uv) const;
+
+  //! \brief Interpolate vertex normals inside a triangle
+  //! \param[in] tri Triangle index
+  //! \param[in] uv UV coordinates of the point inside the triangle
+  //! \return Normalized interpolated normal
+  Vec3r InterpolateNormal(uint32_t tri, const Vec2r &uv) const;
+
+  //! \brief Interpolate vertex uv coordinates inside a triangle
+  //! \param[in] tri Triangle index
+  //! \param[in] uv UV coordinates of the point inside the triangle
+  //! \return Interpolated uv coordinates
+  Vec2r InterpolateUV(uint32_t tri, const Vec2r &uv) const;
+
+  //! \brief Get number of bytes allocated by the store
+  //! \return Allocated bytes
+  size_t GetMemoryUsage() const;
+protected:
+  std::vector<uint32_t> indices_;  //!< three vertex indices per triangle
+  std::vector<int> face_ids_;      //!< face id of each triangle
+  std::vector<Real> px_, py_, pz_; //!< vertex positions
+  std::vector<Real> nx_, ny_, nz_; //!< vertex normals
+  std::vector<Real> u_, v_;        //!< vertex uv coordinates
+};
+
+}  // namespace core
+}  // namespace olio
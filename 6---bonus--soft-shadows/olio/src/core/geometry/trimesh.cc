@@ -10,6 +10,8 @@
 //! \author     Hadi Fadaifard, 2022
 
 #include "core/geometry/trimesh.h"
+#include <mutex>
+#include <chrono>
 #include <spdlog/spdlog.h>
 #include "core/ray.h"
 #include "core/material/material.h"
@@ -18,8 +20,6 @@
 namespace olio {
 namespace core {
 
-bool shadow_hit = false;
-
 using namespace std;
 namespace fs=boost::filesystem;
 
@@ -30,13 +30,6 @@ TriMesh::TriMesh(const std::string &name) :
   name_ = name.size() ? name : "TriMesh";
 }
 
-void update_shadow_hit() {
-  if (shadow_hit)
-    shadow_hit = false;
-  else 
-    shadow_hit = true;
-}
-
 // ======================================================================
 // *** Homework: Implement unimplemented TriMesh functions here
 // ======================================================================
@@ -48,8 +41,7 @@ bool TriMesh::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
     bool had_hit = false;
     //std::vector<TriMesh::Face>::iterator face;
     //TriMesh::VertexIter  v_it
-    if (!bvh_) {
-      std::cout << "Print here n! \n" << std::endl;
+    if (bvh_.IsEmpty()) {
       for (auto f_it = faces_begin(); f_it != faces_end(); ++f_it) {
         TriMesh::FaceHandle fh = *f_it;
         if (RayFaceHit(fh, ray, tmin, tmax, hit_record)) {
@@ -57,26 +49,44 @@ bool TriMesh::Hit(const Ray &ray, Real tmin, Real tmax, HitRecord &hit_record)
           had_hit = true;
         }
       }
+      return had_hit;
     }
-    else {
-      
-      if (bvh_->Hit(ray, tmin, tmax, hit_record))
-        had_hit = true;
-      
-      //std::cout << "bvh2_size: " << bvh2_.size() << "\n" << std::endl;
-      
-      /*for (int i = 0; i < bvh2_.size(); i++) {
-        if (bvh2_[i]) {
-            if ((bvh2_[i])->Hit(ray, tmin, tmax, hit_record)) {
-              had_hit = true;
-              tmax = hit_record.GetRayT();
-            }
-        }
 
-      }*/
-    }
+    // find closest triangle
+    uint32_t hit_tri = 0;
+    Real hit_t = 0;
+    Vec2r hit_uv{0, 0};
+    had_hit = bvh_.Intersect(ray, tmin, tmax,
+      [&](uint32_t tri, Real tri_tmin, Real &tri_tmax) {
+        Real t;
+        Vec2r uv;
+        if (!triangles_.RayTriangleHit(tri, ray, tri_tmin, tri_tmax, t, uv))
+          return false;
+        tri_tmax = hit_t = t;
+        hit_tri = tri;
+        hit_uv = uv;
+        return true;
+      });
+    if (!had_hit)
+      return false;
 
-  return had_hit;
+    hit_record.SetHit(hit_t, this, hit_tri, hit_uv);
+    return true;
+}
+
+
+bool TriMesh::Occluded(const Ray &ray, Real tmin, Real tmax)
+{
+    if (bvh_.IsEmpty())
+      return Surface::Occluded(ray, tmin, tmax);
+
+    // any triangle in range will do
+    return bvh_.Occluded(ray, tmin, tmax,
+      [&](uint32_t tri, Real tri_tmin, Real tri_tmax) {
+        Real t;
+        Vec2r uv;
+        return triangles_.RayTriangleHit(tri, ray, tri_tmin, tri_tmax, t, uv);
+      });
 }
 
 bool TriMesh::RayFaceHit(TriMesh::FaceHandle fh, const Ray &ray, Real tmin,
@@ -85,15 +95,11 @@ bool TriMesh::RayFaceHit(TriMesh::FaceHandle fh, const Ray &ray, Real tmin,
     int i = 0;
     int f_id = fh.idx();
     Vec3r p[3];
-    Vec3r n[3];
-    Vec2r Tcoord[3];
 
     for (auto fv_it=fv_iter(fh); fv_it; ++fv_it)
     {
 
         p[i] = point( fv_it );
-        n[i] = normal( fv_it );
-        Tcoord[i] = texcoord2D( fv_it );
 
         i++;
     }
@@ -107,7 +113,31 @@ bool TriMesh::RayFaceHit(TriMesh::FaceHandle fh, const Ray &ray, Real tmin,
       return false;
     }
     
-    //std::cout << "RayTriangleHit: Hit \n" << std::endl;
+    // prim id is the face index when the mesh has no BVH
+    hit_record.SetHit(t, this, static_cast<uint32_t>(f_id), uv);
+    return true;
+
+}  
+
+void TriMesh::ComputeShading(const Ray &ray, HitRecord &hit_record)
+{
+    const Vec2r &uv = hit_record.GetBarycentric();
+    hit_record.SetPoint(ray.At(hit_record.GetRayT()));
+    if (!bvh_.IsEmpty()) {
+      hit_record.SetNormal(ray, triangles_.InterpolateNormal(
+                             hit_record.GetPrimId(), uv));
+      return;
+    }
+
+    int i = 0;
+    Vec3r n[3];
+    TriMesh::FaceHandle fh = face_handle(hit_record.GetPrimId());
+    for (auto fv_it=fv_iter(fh); fv_it; ++fv_it)
+    {
+        n[i] = normal( fv_it );
+        i++;
+    }
+
     Real alpha, beta, gamma;
 
     alpha = 1-uv[0]-uv[1];
@@ -116,31 +146,40 @@ bool TriMesh::RayFaceHit(TriMesh::FaceHandle fh, const Ray &ray, Real tmin,
 
     Vec3r normal_tt = alpha * n[0] + beta * n[1] + gamma * n[2];
     Vec3r norm_normal = normal_tt/normal_tt.norm();
-
-    const Vec3r &hit_point = ray.At(t);
-    hit_record.SetRayT(t);
-    hit_record.SetPoint(hit_point);
     hit_record.SetNormal(ray, norm_normal);
-    hit_record.SetSurface(GetPtr());
+}
 
+FaceGeoUV TriMesh::ComputeFaceGeoUV(const HitRecord &hit_record)
+{
+    const Vec2r &uv = hit_record.GetBarycentric();
+    auto prim_id = hit_record.GetPrimId();
     FaceGeoUV face_geouv;
+    face_geouv.set_uv(uv);
+    face_geouv.set_global_uv(Vec2r{-1, -1});
+    if (!bvh_.IsEmpty()) {
+      if (has_vertex_texcoords2D())
+        face_geouv.set_global_uv(triangles_.InterpolateUV(prim_id, uv));
+      face_geouv.set_face_id(triangles_.GetFaceId(prim_id));
+      return face_geouv;
+    }
+
+    face_geouv.set_face_id(static_cast<int>(prim_id));
     if (has_vertex_texcoords2D())
     {
-      Vec2r avg_Tcoord = alpha * Tcoord[0] + beta * Tcoord[1] + gamma * Tcoord[2];
+      int i = 0;
+      Vec2r Tcoord[3];
+      TriMesh::FaceHandle fh = face_handle(prim_id);
+      for (auto fv_it=fv_iter(fh); fv_it; ++fv_it)
+      {
+          Tcoord[i] = texcoord2D( fv_it );
+          i++;
+      }
+      Real alpha = 1-uv[0]-uv[1];
+      Vec2r avg_Tcoord = alpha * Tcoord[0] + uv[0] * Tcoord[1] + uv[1] * Tcoord[2];
       face_geouv.set_global_uv(avg_Tcoord);
     }
-    else
-    {
-      face_geouv.set_global_uv(Vec2r{-1, -1});
-    }
-
-    face_geouv.set_face_id(fh.idx());
-    face_geouv.set_uv(uv);
-    hit_record.SetFaceGeouv(face_geouv);
-
-    return true;
-
-}  
+    return face_geouv;
+}
 
 bool TriMesh::Load(const boost::filesystem::path &filepath)
 {
@@ -154,7 +193,15 @@ bool TriMesh::Load(const boost::filesystem::path &filepath)
                              OpenMesh::IO::Options::VertexNormal |
                              OpenMesh::IO::Options::VertexTexCoord};
 
-  ret = OpenMesh::IO::read_mesh(*this, filepath.string(), opts);
+  {
+    // OpenMesh's readers are shared singletons that keep per-read
+    // state, so only one mesh file can be read at a time
+    static mutex read_mutex;
+    lock_guard<mutex> lock{read_mutex};
+    ret = OpenMesh::IO::read_mesh(*this, filepath.string(), opts);
+  }
+  if (ret)
+    SetFilePath(filepath);
   //ComputeVertexNormals();
   //ComputeFaceNormals();
     if (!opts.check(OpenMesh::IO::Options::FaceNormal)) {
@@ -166,7 +213,8 @@ bool TriMesh::Load(const boost::filesystem::path &filepath)
       //update_vertex_normals();
       ComputeVertexNormals();
     }
-  bvh_ = nullptr;
+  triangles_.Clear();
+  bvh_.Clear();
   //ComputeVertexNormals();
   //ComputeFaceNormals();
   
@@ -179,8 +227,7 @@ bool TriMesh::Load(const boost::filesystem::path &filepath)
       Vec3r p = point(v_it);
       bbox_.ExpandBy(p);
     }
-    //Fill_bbox_vec();
-    UpdateBVHTriMeshFaces();
+    UpdateTriangles();
   }
 
   return ret;
@@ -262,137 +309,59 @@ bool TriMesh::ComputeVertexNormals()
 }
 
 
-void TriMesh::UpdateBVHTriMeshFaces() {
-
-  std::vector<Vec3r> points;  //!< triangle points
-  std::vector<Vec3r> normals;      //!< triangle normal
-  std::vector<Vec2r> textures;
-
-  for (auto f_it = faces_begin(); f_it != faces_end(); ++f_it) {
-
-    TriMesh::FaceHandle fh = *f_it;
-    points.clear();
-    normals.clear();
-    textures.clear();
-
-    for (auto fv_it=fv_iter(fh); fv_it; ++fv_it)
-    {
-
-        points.push_back(point( fv_it ));
-        normals.push_back(normal( fv_it ));
-        textures.push_back(texcoord2D( fv_it ));
-    }    
-    BVHTriMeshFace::Ptr bvh_face = BVHTriMeshFace::Create(points, fh.idx(), normals, textures);
-    bvh_face->SetMaterial(GetMaterial());
-    bvh_faces_.push_back(bvh_face);
-    auto bbox1 = bvh_face->GetBoundingBox(false);
-
-    /*for (auto i = 0; i < bbox_vec_.size(); i++) {
-        
-        auto bbox2 = bbox_vec_[i];
-        if ((bbox1.IntersectWith(bbox2)).IsValid()) {
-          bvh_faces_arr_[i].push_back(bvh_face);
-        }
-
-    }*/
-  }
-
-  /*std::cout << "bbox_vec_size(): " << bbox_vec_.size() << "\n" << std::endl;
-  for (auto i = 0; i < bbox_vec_.size(); i++) {
-    std::cout << "bvh_faces_arr_ size(): " << bvh_faces_arr_[i].size() << "\n" << std::endl;
-  }*/
-
-  UpdateBVHNode();
-  //UpdateBVHNodeArr();
-}
-
-
-void TriMesh::UpdateBVHNode()
-{
-  BVHNode bvhnode;
-  bvh_ = bvhnode.BuildBVH(bvh_faces_);
-}
-
-void TriMesh::UpdateBVHNodeArr()
+void TriMesh::UpdateTriangles()
 {
-  BVHNode bvhnode;
-  for (int i = 0; i < bbox_vec_.size(); i++) {
-    BVHNode::Ptr bvh_Temp = bvhnode.BuildBVH(bvh_faces_arr_[i]);
-    if (bvh_Temp)
-      bvh2_.push_back(bvh_Temp);
+  // pack vertices and triangles
+  triangles_.Clear();
+  triangles_.Reserve(n_vertices(), n_faces());
+  for (auto v_it = vertices_begin(); v_it != vertices_end(); ++v_it) {
+    triangles_.AddVertex(point(*v_it), normal(*v_it),
+                         has_vertex_texcoords2D() ? texcoord2D(*v_it) :
+                         Vec2r{-1, -1});
   }
-}
-
-
-void TriMesh::Fill_bbox_vec()
-{
-  Vec3r min = bbox_.GetMin();
-  Vec3r max = bbox_.GetMax();
-
-  Real x_min = min[0];
-  Real x_max = max[0];
-  Real y_min = min[1];
-  Real y_max = max[1];
-  Real z_min = min[2];
-  Real z_max = max[2];
-
-  Real N_Grids_x = 3;
-  Real N_Grids_y = 3;
-  Real N_Grids_z = 3;
-
-    Real N_Grids_x_tt = 2;
-  Real N_Grids_y_tt = 2;
-  Real N_Grids_z_tt = 2;
-
-
-  Real x_w = (x_max - x_min)/9;
-  Real y_w = (y_max - y_min)/9;
-  Real z_w = (z_max - z_min)/9;
-
- for (int k = 0; k < N_Grids_z; k++) {
-  for (int j = 0; j < N_Grids_y; j++) {
-    for (int i = 0; i < N_Grids_x; i++) {
-
-       for (int k_tt = 0; k_tt < N_Grids_z_tt; k_tt++) {
-        for (int j_tt = 0; j_tt < N_Grids_y_tt; j_tt++) {
-          for (int i_tt = 0; i_tt < N_Grids_x_tt; i_tt++) {
-
-      Real M1 = z_min + (z_w)*(k+k_tt+1);
-      Real M2 = z_min + (z_w)*(k+k_tt);
-
-      Vec3r p1 = Vec3r{x_min + (x_w)*(i+i_tt+1), y_min + (y_w)*(j+j_tt+1), M1};
-      Vec3r p2 = Vec3r{x_min + (x_w)*(i+i_tt), y_min + (y_w)*(j+j_tt), M1};
-      Vec3r p3 = Vec3r{x_min + (x_w)*(i+i_tt+1), y_min + (y_w)*(j+j_tt+1), M2};
-      Vec3r p4 = Vec3r{x_min + (x_w)*(i+i_tt), y_min + (y_w)*(j+j_tt), M2};
-      
-      Vec3r p5 = Vec3r{x_min + (x_w)*(i+i_tt+1), y_min + (y_w)*(j+j_tt), M1};
-      Vec3r p6 = Vec3r{x_min + (x_w)*(i+i_tt), y_min + (y_w)*(j+j_tt+1), M1};
-      Vec3r p7 = Vec3r{x_min + (x_w)*(i+i_tt), y_min + (y_w)*(j+j_tt+1), M2};
-      Vec3r p8 = Vec3r{x_min + (x_w)*(i+i_tt+1), y_min + (y_w)*(j+j_tt), M2};
-
-      AABB bbox_temp;
-
-      bbox_temp.Reset();
-
-      bbox_temp.ExpandBy(p1);
-      bbox_temp.ExpandBy(p2);
-      bbox_temp.ExpandBy(p3);
-      bbox_temp.ExpandBy(p4);
-      bbox_temp.ExpandBy(p5);
-      bbox_temp.ExpandBy(p6);
-      bbox_temp.ExpandBy(p7);
-      bbox_temp.ExpandBy(p8);
-
-      bbox_vec_.push_back(bbox_temp);
-      bvh_faces_arr_.push_back(std::vector<Surface::Ptr>());
-
-          }
-        }
-       }
+  for (auto f_it = faces_begin(); f_it != faces_end(); ++f_it) {
+    TriMesh::FaceHandle fh = *f_it;
+    uint32_t v[3];
+    int i = 0;
+    for (auto fv_it = fv_iter(fh); fv_it && i < 3; ++fv_it) {
+      TriMesh::VertexHandle vh = *fv_it;
+      v[i++] = static_cast<uint32_t>(vh.idx());
     }
-
+    if (i == 3)
+      triangles_.AddTriangle(v[0], v[1], v[2], fh.idx());
   }
-}
+
+  // build bvh and store triangles in leaf order
+  auto start_time = chrono::system_clock::now();
+  auto triangle_count = static_cast<uint32_t>(triangles_.GetTriangleCount());
+  vector<AABB> triangle_bounds(triangle_count);
+  for (uint32_t tri = 0; tri < triangle_count; ++tri)
+    triangle_bounds[tri] = triangles_.GetTriangleBounds(tri);
+  vector<uint32_t> order;
+  LinearBVH binary_bvh;
+  binary_bvh.Build(triangle_bounds, BVHNode::GetDefaultBuildOptions(), order);
+  triangles_.ReorderTriangles(order);
+  triangles_.ShrinkToFit();
+  bvh_.Build(binary_bvh, triangles_);
+  auto end_time = chrono::system_clock::now();
+  auto build_time = chrono::duration_cast<chrono::duration<double>>
+    (end_time - start_time).count();
+
+  build_stats_ = binary_bvh.ComputeStats();
+  build_stats_.build_time = build_time;
+  const auto &name = filepath_.filename().string();
+  spdlog::info("Built BVH ({}) in {:.3f} s: {}; {} wide nodes, {} packets",
+               name, build_time, build_stats_, bvh_.GetNodeCount(),
+               bvh_.GetPacketCount());
+  auto triangle_bytes = static_cast<double>(triangles_.GetMemoryUsage());
+  auto bvh_bytes = static_cast<double>(bvh_.GetMemoryUsage());
+  spdlog::info("{}: {} vertices, {} triangles, {:.2f} MB ({:.1f} bytes per "
+               "triangle: {:.2f} MB triangles, {:.2f} MB BVH)", name,
+               triangles_.GetVertexCount(), triangle_count,
+               (triangle_bytes + bvh_bytes) / 1048576.0,
+               triangle_count ? (triangle_bytes + bvh_bytes) /
+               static_cast<double>(triangle_count) : 0.0,
+               triangle_bytes / 1048576.0, bvh_bytes / 1048576.0);
 }
 
 }  // namespace core
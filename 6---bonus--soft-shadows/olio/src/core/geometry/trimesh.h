@@ -20,7 +20,8 @@
 #include <OpenMesh/Core/Geometry/EigenVectorT.hh>
 #include "core/geometry/surface.h"
 #include "core/geometry/bvh_node.h"
-#include "core/geometry/bvh_trimesh_face.h"
+#include "core/geometry/triangle_store.h"
+#include "core/geometry/wide_bvh.h"
 
 namespace olio {
 namespace core {
@@ -55,6 +56,23 @@ public:
   bool Hit(const Ray &ray, Real tmin, Real tmax,
            HitRecord &hit_record) override;
 
+  //! \brief Check if ray hits the surface in [tmin, tmax]
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \return True if ray intersected with surface
+  bool Occluded(const Ray &ray, Real tmin, Real tmax) override;
+
+  //! \brief Compute shading attributes of a hit on this surface
+  //! \param[in] ray Ray that hit the surface
+  //! \param[in,out] hit_record Hit record filled in by Hit()
+  void ComputeShading(const Ray &ray, HitRecord &hit_record) override;
+
+  //! \brief Compute face/texture coordinates of a hit on this surface
+  //! \param[in] hit_record Hit record of a hit on this surface
+  //! \return Face/texture coordinates of the hit
+  FaceGeoUV ComputeFaceGeoUV(const HitRecord &hit_record) override;
+
   //! \brief Check if input ray intersects with input face in the mesh
   //! \param[in] fh Handle of face to check for intersection
   //! \param[in] ray Input ray to check for intersection
@@ -80,8 +98,6 @@ public:
   //! \return Mesh AABB
   AABB GetBoundingBox(bool force_recompute=false) override;
 
-  void Fill_bbox_vec();
-
   //! \brief Compute face normals
   //! \return true on success
   bool ComputeFaceNormals();
@@ -99,27 +115,26 @@ public:
   //! \return mesh filename
   boost::filesystem::path GetFilePath() const {return filepath_;}
 
-  void UpdateBVHTriMeshFaces();
+  //! \brief Rebuild the packed triangles and their BVH from the mesh.
+  //!        Must be called after the mesh is modified.
+  void UpdateTriangles();
+
+  //! \brief Get packed triangles (in BVH leaf order)
+  //! \return Packed triangles
+  const TriangleStore &GetTriangles() const {return triangles_;}
 
-  void UpdateBVHNodeArr();
+  //! \brief Get BVH over the packed triangles
+  //! \return BVH
+  const WideBVH &GetBVH() const {return bvh_;}
 
-  void UpdateBVHNode();
+  //! \brief Get statistics of the last BVH build
+  //! \return BVH build statistics
+  const BVHBuildStats &GetBuildStats() const {return build_stats_;}
 protected:
   boost::filesystem::path filepath_;
-  std::vector<Surface::Ptr> bvh_faces_;
-  BVHNode::Ptr bvh_{nullptr};
-  std::vector<BVHNode::Ptr> bvh2_;
-  std::vector<AABB> bbox_vec_;
-  std::vector<std::vector<Surface::Ptr>> bvh_faces_arr_;
-};
-
-
-void update_shadow_hit();
-
-class bvh_class_face {
-public:
-  BVHNode::Ptr bvh;
-  Real ray_t;
+  TriangleStore triangles_;  //!< packed triangles referenced by bvh_
+  WideBVH bvh_;              //!< BVH over triangles_
+  BVHBuildStats build_stats_;  //!< statistics of the last BVH build
 };
 
 }  // namespace core
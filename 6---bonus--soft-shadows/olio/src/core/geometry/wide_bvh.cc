@@ -0,0 +1,188 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       wide_bvh.cc
+//! \brief      WideBVH class
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/geometry/wide_bvh.h"
+#include <limits>
+#include "core/geometry/triangle_store.h"
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+constexpr uint WideBVH::kStackSize;
+
+
+void
+WideBVH::Clear()
+{
+  nodes_.clear();
+  packets_.clear();
+}
+
+
+size_t
+WideBVH::GetMemoryUsage() const
+{
+  return nodes_.capacity() * sizeof(WideBVHNode) +
+    packets_.capacity() * sizeof(TrianglePacket);
+}
+
+
+void
+WideBVH::Build(const LinearBVH &bvh, const TriangleStore &triangles)
+{
+  Clear();
+  if (bvh.IsEmpty())
+    return;
+  nodes_.reserve(bvh.GetNodeCount() / (kWideBVHWidth - 1) + 1);
+  packets_.reserve(triangles.GetTriangleCount() / kTrianglePacketSize + 1);
+  BuildNode(bvh, triangles, 0);
+  nodes_.shrink_to_fit();
+  packets_.shrink_to_fit();
+}
+
+
+uint32_t
+WideBVH::BuildNode(const LinearBVH &bvh, const TriangleStore &triangles,
+                   uint32_t binary_index)
+{
+  const auto &binary_nodes = bvh.GetNodes();
+  auto area = [&](uint32_t index) {
+    const auto &b = binary_nodes[index].bounds;
+    float dx = b[1][0] - b[0][0], dy = b[1][1] - b[0][1];
+    float dz = b[1][2] - b[0][2];
+    return dx * dy + dy * dz + dz * dx;
+  };
+
+  // gather children: repeatedly open the largest interior child
+  uint32_t children[kWideBVHWidth];
+  uint child_count = 0;
+  const auto &root = binary_nodes[binary_index];
+  if (root.prim_count) {
+    children[child_count++] = binary_index;
+  } else {
+    children[child_count++] = binary_index + 1;
+    children[child_count++] = root.offset;
+  }
+  while (child_count < kWideBVHWidth) {
+    int largest = -1;
+    float largest_area = -1;
+    for (uint i = 0; i < child_count; ++i) {
+      if (!binary_nodes[children[i]].prim_count &&
+          area(children[i]) > largest_area) {
+        largest = static_cast<int>(i);
+        largest_area = area(children[i]);
+      }
+    }
+    if (largest < 0)
+      break;
+    auto opened = children[largest];
+    children[largest] = opened + 1;
+    children[child_count++] = binary_nodes[opened].offset;
+  }
+
+  // add node with empty child slots
+  WideBVHNode node;
+  for (int a = 0; a < 3; ++a) {
+    for (uint i = 0; i < kWideBVHWidth; ++i) {
+      node.bounds[0][a][i] = numeric_limits<float>::infinity();
+      node.bounds[1][a][i] = -numeric_limits<float>::infinity();
+    }
+  }
+  for (uint i = 0; i < kWideBVHWidth; ++i) {
+    node.child[i] = 0;
+    node.packet_count[i] = 0;
+  }
+  auto node_index = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back(node);
+
+  // fill child slots (recursion may reallocate nodes_)
+  for (uint i = 0; i < child_count; ++i) {
+    const auto &child = binary_nodes[children[i]];
+    uint32_t child_index, packet_count = 0;
+    if (child.prim_count) {
+      child_index = AddPackets(triangles, child.offset, child.prim_count);
+      packet_count = (child.prim_count + kTrianglePacketSize - 1) /
+        kTrianglePacketSize;
+    } else {
+      child_index = BuildNode(bvh, triangles, children[i]);
+    }
+    auto &wide_node = nodes_[node_index];
+    for (int a = 0; a < 3; ++a) {
+      wide_node.bounds[0][a][i] = child.bounds[0][a];
+      wide_node.bounds[1][a][i] = child.bounds[1][a];
+    }
+    wide_node.child[i] = child_index;
+    wide_node.packet_count[i] = packet_count;
+  }
+  return node_index;
+}
+
+
+uint32_t
+WideBVH::AddPackets(const TriangleStore &triangles, uint32_t first,
+                    uint32_t count)
+{
+  auto first_packet = static_cast<uint32_t>(packets_.size());
+  for (uint32_t start = 0; start < count; start += kTrianglePacketSize) {
+    // unused lanes have zero edges and are never hit
+    TrianglePacket packet;
+    for (uint lane = 0; lane < kTrianglePacketSize; ++lane) {
+      Vec3r p0{0, 0, 0}, e1{0, 0, 0}, e2{0, 0, 0};
+      uint32_t tri = numeric_limits<uint32_t>::max();
+      if (start + lane < count) {
+        tri = first + start + lane;
+        const auto *v = triangles.GetTriangle(tri);
+        p0 = triangles.GetPosition(v[0]);
+        e1 = triangles.GetPosition(v[1]) - p0;
+        e2 = triangles.GetPosition(v[2]) - p0;
+      }
+      for (int a = 0; a < 3; ++a) {
+        packet.v0[a][lane] = static_cast<float>(p0[a]);
+        packet.e1[a][lane] = static_cast<float>(e1[a]);
+        packet.e2[a][lane] = static_cast<float>(e2[a]);
+      }
+      packet.triangle[lane] = tri;
+    }
+    packets_.push_back(packet);
+  }
+  return first_packet;
+}
+
+
+uint
+WideBVH::CountChildren(const WideBVHNode &node)
+{
+  // used slots come first; unused ones have inverted bounds
+  uint count = 0;
+  while (count < kWideBVHWidth &&
+         node.bounds[0][0][count] <= node.bounds[1][0][count])
+    ++count;
+  return count;
+}
+
+
+uint
+WideBVH::CountTriangles(const TrianglePacket *packets, uint count)
+{
+  uint triangles = 0;
+  for (uint p = 0; p < count; ++p) {
+    for (uint lane = 0; lane < kTrianglePacketSize; ++lane) {
+      if (packets[p].triangle[lane] != numeric_limits<uint32_t>::max())
+        ++triangles;
+    }
+  }
+  return triangles;
+}
+
+}  // namespace core
+}  // namespace olio
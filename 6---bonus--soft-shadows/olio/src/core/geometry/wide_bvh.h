@@ -0,0 +1,252 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       wide_bvh.h
+//! \brief      WideBVH class
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "core/types.h"
+#include "core/aabb.h"
+#include "core/ray.h"
+#include "core/geometry/linear_bvh.h"
+#include "core/geometry/simd_kernels.h"
+#include "core/renderer/pixel_diagnostics.h"
+
+namespace olio {
+namespace core {
+
+class TriangleStore;
+
+//! \class WideBVH
+//! \brief BVH over triangles with kWideBVHWidth children per node and
+//!        triangles packed for the wide kernels
+//! \details The tree is built by collapsing a binary LinearBVH: each
+//!    wide node adopts up to kWideBVHWidth descendants of a binary
+//!    node, opening the largest interior descendant first. Leaves are
+//!    stored as runs of TrianglePackets. Traversal uses the kernels
+//!    selected with SetSimdLevel().
+class WideBVH {
+public:
+  WideBVH() = default;
+
+  //! \brief Remove all nodes and packets
+  void Clear();
+
+  //! \brief Check if the hierarchy has no nodes
+  //! \return True if empty
+  bool IsEmpty() const {return nodes_.empty();}
+
+  //! \brief Get number of nodes
+  //! \return Number of nodes
+  size_t GetNodeCount() const {return nodes_.size();}
+
+  //! \brief Get number of triangle packets
+  //! \return Number of packets
+  size_t GetPacketCount() const {return packets_.size();}
+
+  //! \brief Get number of bytes allocated by nodes and packets
+  //! \return Allocated bytes
+  size_t GetMemoryUsage() const;
+
+  //! \brief Build from a binary BVH over triangles
+  //! \param[in] bvh Binary BVH whose leaves reference triangle ranges
+  //! \param[in] triangles Triangles referenced by bvh
+  void Build(const LinearBVH &bvh, const TriangleStore &triangles);
+
+  //! \brief Find the closest triangle hit by the ray
+  //! \details Triangles that pass the wide (single precision) test
+  //!    are passed to the callback for an exact test, as:
+  //!    bool hit_primitive(uint32_t triangle, Real tmin, Real &tmax).
+  //!    On a hit, the callback must update tmax to the hit distance
+  //!    and return true.
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \param[in] hit_primitive Exact triangle intersection callback
+  //! \return True if any triangle was hit
+  template<typename HitPrimitive>
+  bool Intersect(const Ray &ray, Real tmin, Real tmax,
+                 HitPrimitive &&hit_primitive) const;
+
+  //! \brief Check if the ray hits any triangle
+  //! \details Triangles that pass the wide test are passed to the
+  //!    callback for an exact test, as: bool occludes(uint32_t triangle,
+  //!    Real tmin, Real tmax). Traversal stops at the first triangle
+  //!    for which the callback returns true.
+  //! \param[in] ray Ray to check intersection against
+  //! \param[in] tmin Minimum value for acceptable t
+  //! \param[in] tmax Maximum value for acceptable t
+  //! \param[in] occludes Exact triangle occlusion callback
+  //! \return True if any triangle was hit
+  template<typename Occludes>
+  bool Occluded(const Ray &ray, Real tmin, Real tmax,
+                Occludes &&occludes) const;
+protected:
+  //! \brief Max traversal stack size: each visited level pushes at
+  //!        most kWideBVHWidth - 1 entries
+  static constexpr uint kStackSize = (kWideBVHWidth - 1) *
+    LinearBVH::kMaxDepth + 1;
+
+  //! \brief Recursively collapse a binary (sub)tree into wide nodes
+  //! \param[in] bvh Binary BVH
+  //! \param[in] triangles Triangles referenced by bvh
+  //! \param[in] binary_index Index of the binary (sub)tree root
+  //! \return Index of the wide node
+  uint32_t BuildNode(const LinearBVH &bvh, const TriangleStore &triangles,
+                     uint32_t binary_index);
+
+  //! \brief Append packets for the triangles of a binary leaf
+  //! \param[in] triangles Triangles referenced by the leaf
+  //! \param[in] first Index of first triangle
+  //! \param[in] count Number of triangles
+  //! \return Index of the first packet
+  uint32_t AddPackets(const TriangleStore &triangles, uint32_t first,
+                      uint32_t count);
+
+  //! \brief Count the child bounds of a node that hold a child (for
+  //!        diagnostics, which count bounding boxes tested)
+  //! \param[in] node Wide node
+  //! \return Number of used child slots
+  static uint CountChildren(const WideBVHNode &node);
+
+  //! \brief Count the packet lanes that hold a triangle (for
+  //!        diagnostics, which count triangles tested)
+  //! \param[in] packets First packet
+  //! \param[in] count Number of packets
+  //! \return Number of triangles
+  static uint CountTriangles(const TrianglePacket *packets, uint count);
+
+  std::vector<WideBVHNode> nodes_;       //!< nodes (root first)
+  std::vector<TrianglePacket> packets_;  //!< triangles in leaf order
+};
+
+
+template<typename HitPrimitive>
+bool
+WideBVH::Intersect(const Ray &ray, Real tmin, Real tmax,
+                   HitPrimitive &&hit_primitive) const
+{
+  if (nodes_.empty())
+    return false;
+
+  const auto &kernels = GetSimdKernels();
+  const WideRay wide_ray{ray};
+  const auto tmin_f = static_cast<float>(tmin);
+
+  struct StackEntry {
+    uint32_t node;
+    float tnear;
+  };
+  StackEntry stack[kStackSize];
+  uint stack_size = 0;
+  stack[stack_size++] = StackEntry{0, tmin_f};
+
+  bool hit = false;
+  while (stack_size) {
+    const auto entry = stack[--stack_size];
+    auto tmax_f = static_cast<float>(tmax);
+    if (entry.tnear > tmax_f * kSimdFarScale)
+      continue;
+
+    // test all children at once
+    const auto &node = nodes_[entry.node];
+    float tnear[kWideBVHWidth];
+    uint mask = kernels.hit_boxes(node, wide_ray, tmin_f, tmax_f, tnear);
+    OLIO_DIAGNOSTICS_ADD(bvh_nodes, CountChildren(node));
+
+    // intersect leaves right away; push inner nodes far to near
+    uint first_entry = stack_size;
+    while (mask) {
+      uint i = LowestBit(mask);
+      mask &= mask - 1;
+      if (!node.packet_count[i]) {
+        uint j = stack_size++;
+        for (; j > first_entry && stack[j - 1].tnear < tnear[i]; --j)
+          stack[j] = stack[j - 1];
+        stack[j] = StackEntry{node.child[i], tnear[i]};
+        continue;
+      }
+      for (uint32_t p = 0; p < node.packet_count[i];
+           p += kTriangleKernelPackets) {
+        const auto *packets = &packets_[node.child[i] + p];
+        uint count = std::min(node.packet_count[i] - p,
+                              kTriangleKernelPackets);
+        uint lanes = kernels.hit_triangles(packets, count, wide_ray, tmin_f,
+                                           static_cast<float>(tmax));
+        OLIO_DIAGNOSTICS_ADD(primitive_tests, CountTriangles(packets, count));
+        while (lanes) {
+          uint lane = LowestBit(lanes);
+          lanes &= lanes - 1;
+          const auto &packet = packets[lane / kTrianglePacketSize];
+          if (hit_primitive(packet.triangle[lane % kTrianglePacketSize],
+                            tmin, tmax))
+            hit = true;
+        }
+      }
+    }
+  }
+  return hit;
+}
+
+
+template<typename Occludes>
+bool
+WideBVH::Occluded(const Ray &ray, Real tmin, Real tmax,
+                  Occludes &&occludes) const
+{
+  if (nodes_.empty())
+    return false;
+
+  const auto &kernels = GetSimdKernels();
+  const WideRay wide_ray{ray};
+  const auto tmin_f = static_cast<float>(tmin);
+  const auto tmax_f = static_cast<float>(tmax);
+
+  // tmax never shrinks, so children need not be sorted
+  uint32_t stack[kStackSize];
+  uint stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size) {
+    const auto &node = nodes_[stack[--stack_size]];
+    float tnear[kWideBVHWidth];
+    uint mask = kernels.hit_boxes(node, wide_ray, tmin_f, tmax_f, tnear);
+    OLIO_DIAGNOSTICS_ADD(bvh_nodes, CountChildren(node));
+    while (mask) {
+      uint i = LowestBit(mask);
+      mask &= mask - 1;
+      if (!node.packet_count[i]) {
+        stack[stack_size++] = node.child[i];
+        continue;
+      }
+      for (uint32_t p = 0; p < node.packet_count[i];
+           p += kTriangleKernelPackets) {
+        const auto *packets = &packets_[node.child[i] + p];
+        uint count = std::min(node.packet_count[i] - p,
+                              kTriangleKernelPackets);
+        uint lanes = kernels.hit_triangles(packets, count, wide_ray, tmin_f,
+                                           tmax_f);
+        OLIO_DIAGNOSTICS_ADD(primitive_tests, CountTriangles(packets, count));
+        while (lanes) {
+          uint lane = LowestBit(lanes);
+          lanes &= lanes - 1;
+          const auto &packet = packets[lane / kTrianglePacketSize];
+          if (occludes(packet.triangle[lane % kTrianglePacketSize],
+                       tmin, tmax))
+            return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace core
+}  // namespace olio
@@ -13,6 +13,7 @@
 #include "core/geometry/surface.h"
 #include "core/ray.h"
 #include "core/material/phong_material.h"
+#include "core/renderer/ray_stats.h"
 #include <iostream>
 
 namespace olio {
@@ -20,9 +21,158 @@ namespace core {
 
 using namespace std;
 
-size_t grid_size_ = 0;
-Real *random_pu_t;
-Real *random_pv_t;
+namespace {
+
+// smallest solid angle sampled by AreaLightSampling::kSolidAngle/kMIS;
+// smaller lights are sampled by area
+const Real kMinSolidAngle = 1e-5;
+
+
+//! \class SphericalRectangle
+//! \brief Samples the solid angle a rectangle subtends at a point
+//!        uniformly (Urena et al., "An Area-Preserving Parametrization
+//!        for Spherical Rectangles")
+class SphericalRectangle {
+public:
+  //! \brief Constructor
+  //! \param[in] origin Point the rectangle is seen from
+  //! \param[in] corner Rectangle corner
+  //! \param[in] x_dir Unit direction of the first edge
+  //! \param[in] y_dir Unit direction of the second edge
+  //! \param[in] x_len Length of the first edge
+  //! \param[in] y_len Length of the second edge
+  SphericalRectangle(const Vec3r &origin, const Vec3r &corner,
+                     const Vec3r &x_dir, const Vec3r &y_dir, Real x_len,
+                     Real y_len) :
+    origin_{origin},
+    x_{x_dir},
+    y_{y_dir},
+    z_{x_dir.cross(y_dir)}
+  {
+    Vec3r d = corner - origin;
+    z0_ = d.dot(z_);
+    if (z0_ > 0) {
+      z_ = -z_;
+      z0_ = -z0_;
+    }
+    x0_ = d.dot(x_);
+    y0_ = d.dot(y_);
+    x1_ = x0_ + x_len;
+    y1_ = y0_ + y_len;
+
+    // normals of the rectangle's edge planes and its internal angles
+    Vec3r v00{x0_, y0_, z0_}, v01{x0_, y1_, z0_};
+    Vec3r v10{x1_, y0_, z0_}, v11{x1_, y1_, z0_};
+    Vec3r n0 = v00.cross(v10).normalized();
+    Vec3r n1 = v10.cross(v11).normalized();
+    Vec3r n2 = v11.cross(v01).normalized();
+    Vec3r n3 = v01.cross(v00).normalized();
+    Real g0 = acos(Clamp(-n0.dot(n1)));
+    Real g1 = acos(Clamp(-n1.dot(n2)));
+    Real g2 = acos(Clamp(-n2.dot(n3)));
+    Real g3 = acos(Clamp(-n3.dot(n0)));
+    b0_ = n0[2];
+    b1_ = n2[2];
+    k_ = k2Pi - g2 - g3;
+    solid_angle_ = g0 + g1 - k_;
+  }
+
+  //! \brief Get the solid angle of the rectangle
+  //! \return Solid angle
+  Real GetSolidAngle() const {return solid_angle_;}
+
+  //! \brief Map a point of [0, 1)^2 to a point of the rectangle
+  //! \param[in] u First coordinate
+  //! \param[in] v Second coordinate
+  //! \return Point on the rectangle
+  Vec3r Sample(Real u, Real v) const {
+    // x coordinate: the sub-rectangle [x0, xu] covers u of the solid angle
+    Real au = u * solid_angle_ + k_;
+    Real fu = (cos(au) * b0_ - b1_) / sin(au);
+    Real cu = Clamp(std::copysign(Real{1}, fu) / sqrt(fu * fu + b0_ * b0_));
+    Real xu = -(cu * z0_) / std::max(sqrt(1 - cu * cu), kEpsilon2);
+    xu = std::min(std::max(xu, x0_), x1_);
+
+    // y coordinate, uniform in the projected height
+    Real d = sqrt(xu * xu + z0_ * z0_);
+    Real h0 = y0_ / sqrt(d * d + y0_ * y0_);
+    Real h1 = y1_ / sqrt(d * d + y1_ * y1_);
+    Real hv = h0 + v * (h1 - h0);
+    Real hv2 = hv * hv;
+    Real yv = hv2 < 1 - kEpsilon ? (hv * d) / sqrt(1 - hv2) : y1_;
+    return origin_ + xu * x_ + yv * y_ + z0_ * z_;
+  }
+protected:
+  static Real Clamp(Real value) {return std::min(std::max(value, Real{-1}),
+                                                 Real{1});}
+
+  Vec3r origin_;         //!< point the rectangle is seen from
+  Vec3r x_, y_, z_;      //!< local frame
+  Real x0_, y0_, x1_, y1_, z0_;  //!< rectangle bounds in the local frame
+  Real b0_, b1_, k_;     //!< sampling constants
+  Real solid_angle_;     //!< solid angle of the rectangle
+};
+
+
+//! \class SpecularLobe
+//! \brief Samples light directions proportionally to the Blinn-Phong
+//!        specular term (n.h)^shininess of PhongMaterial::Evaluate()
+class SpecularLobe {
+public:
+  //! \brief Constructor
+  //! \param[in] normal Surface normal
+  //! \param[in] view_vec View vector (points away from the surface)
+  //! \param[in] shininess Phong exponent
+  SpecularLobe(const Vec3r &normal, const Vec3r &view_vec, Real shininess) :
+    normal_{normal},
+    view_vec_{view_vec},
+    shininess_{shininess}
+  {
+    Vec3r axis = std::fabs(normal_[0]) > Real{0.9} ? Vec3r{0, 1, 0} :
+      Vec3r{1, 0, 0};
+    tangent_ = axis.cross(normal_).normalized();
+    bitangent_ = normal_.cross(tangent_);
+  }
+
+  //! \brief Sample a light direction
+  //! \param[in] u Random values in [0, 1)^2
+  //! \param[out] light_vec Sampled direction
+  //! \param[out] pdf Solid angle pdf of light_vec
+  //! \return False if the direction is below the surface
+  bool Sample(const Vec2r &u, Vec3r &light_vec, Real &pdf) const {
+    Real cos_theta = pow(u[0], 1 / (shininess_ + 1));
+    Real sin_theta = sqrt(std::max(Real{0}, 1 - cos_theta * cos_theta));
+    Real phi = k2Pi * u[1];
+    Vec3r half = sin_theta * cos(phi) * tangent_ +
+      sin_theta * sin(phi) * bitangent_ + cos_theta * normal_;
+    light_vec = 2 * view_vec_.dot(half) * half - view_vec_;
+    if (light_vec.dot(normal_) <= 0)
+      return false;
+    pdf = GetPdf(light_vec);
+    return pdf > 0;
+  }
+
+  //! \brief Get the pdf of sampling a direction
+  //! \param[in] light_vec Unit light direction
+  //! \return Solid angle pdf
+  Real GetPdf(const Vec3r &light_vec) const {
+    Vec3r half = (view_vec_ + light_vec).normalized();
+    Real view_dot = view_vec_.dot(half);
+    if (view_dot <= 0)
+      return 0;
+    Real cos_theta = std::max(Real{0}, half.dot(normal_));
+    return (shininess_ + 1) / k2Pi * pow(cos_theta, shininess_) /
+      (4 * view_dot);
+  }
+protected:
+  Vec3r normal_;     //!< surface normal
+  Vec3r view_vec_;   //!< view vector
+  Real shininess_;   //!< Phong exponent
+  Vec3r tangent_;    //!< frame tangent
+  Vec3r bitangent_;  //!< frame bitangent
+};
+
+}  // namespace
 
 Light::Light(const std::string &name) :
   Node{name}
@@ -32,10 +182,56 @@ Light::Light(const std::string &name) :
 
 
 Vec3r
-Light::Illuminate(const HitRecord &/*hit_record*/, const Vec3r &/*view_vec*/,
-                  Surface::Ptr /*scene*/) const
+Light::Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
+                  const Surface::Ptr &scene, Sampler &sampler) const
 {
-  return Vec3r{0, 0, 0};
+  // draw the light samples
+  static thread_local vector<LightSample> samples;
+  samples.clear();
+  Real scale = SampleIllumination(hit_record, view_vec, sampler, samples);
+
+  // trace the probes; if they agree, the other samples share their
+  // visibility (-1: trace every sample)
+  int probe_visibility = -1;
+  bool probes_agree = true;
+  for (const auto &sample : samples) {
+    if (!sample.is_probe)
+      continue;
+    CountRay(RayType::kShadow);
+    int visible = scene->Occluded(sample.shadow_ray, kEpsilon, 1) ? 0 : 1;
+    if (probe_visibility >= 0 && visible != probe_visibility)
+      probes_agree = false;
+    probe_visibility = visible;
+  }
+  if (!probes_agree)
+    probe_visibility = -1;
+
+  // sum the unblocked samples
+  Vec3r radiance{0, 0, 0};
+  for (const auto &sample : samples) {
+    if (sample.is_probe)
+      continue;
+    if (sample.has_shadow_ray) {
+      if (probe_visibility == 0)
+        continue;
+      if (probe_visibility < 0) {
+        CountRay(RayType::kShadow);
+        if (scene->Occluded(sample.shadow_ray, kEpsilon, 1))
+          continue;
+      }
+    }
+    radiance = radiance + sample.radiance;
+  }
+  return radiance * scale;
+}
+
+
+Real
+Light::SampleIllumination(const HitRecord &/*hit_record*/,
+                          const Vec3r &/*view_vec*/, Sampler &/*sampler*/,
+                          vector<LightSample> &/*samples*/) const
+{
+  return 1;
 }
 
 
@@ -54,19 +250,23 @@ AmbientLight::AmbientLight(const Vec3r &ambient, const std::string &name) :
 }
 
 
-Vec3r
-AmbientLight::Illuminate(const HitRecord &hit_record, const Vec3r &/*view_vec*/,
-                         Surface::Ptr /*scene*/) const
+Real
+AmbientLight::SampleIllumination(const HitRecord &hit_record,
+                                 const Vec3r &/*view_vec*/,
+                                 Sampler &/*sampler*/,
+                                 vector<LightSample> &samples) const
 {
   // only process phong materials
   auto surface = hit_record.GetSurface();
   if (!surface)
-    return Vec3r{0, 0, 0};
-  auto phong_material = dynamic_pointer_cast<PhongMaterial>(surface->
-                                                            GetMaterial());
+    return 1;
+  auto phong_material = AsPhongMaterial(surface->GetMaterial().get());
   if (!phong_material)
-    return Vec3r{0, 0, 0};
-  return ambient_.cwiseProduct(phong_material->GetAmbient());
+    return 1;
+  LightSample sample;
+  sample.radiance = ambient_.cwiseProduct(phong_material->GetAmbient());
+  samples.push_back(sample);
+  return 1;
 }
 
 
@@ -87,62 +287,72 @@ PointLight::PointLight(const Vec3r &position, const Vec3r &intensity,
 }
 
 
-Vec3r
-PointLight::Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
-                       Surface::Ptr scene) const
+Real
+PointLight::SampleIllumination(const HitRecord &hit_record,
+                               const Vec3r &view_vec, Sampler &/*sampler*/,
+                               vector<LightSample> &samples) const
 {
-  // evaluate hit points material
-  Vec3r black{0, 0, 0};
-
-  // create a shadow ray to the point light and check for occlusion
-  const auto &hit_position = hit_record.GetPoint();
-  Ray shadow_ray{hit_position, GetPosition() - hit_position};
-  HitRecord shadow_record;
-  if (scene->Hit(shadow_ray, kEpsilon, 1, shadow_record)) {
-    return black;
-  }
-
   // only process phong materials
   auto surface = hit_record.GetSurface();
   if (!surface)
-    return black;
-  auto phong_material = dynamic_pointer_cast<PhongMaterial>(surface->
-                                                            GetMaterial());
+    return 1;
+  auto phong_material = AsPhongMaterial(surface->GetMaterial().get());
   if (!phong_material)
-    return black;
+    return 1;
 
   // compute irradiance at hit point
+  const auto &hit_position = hit_record.GetPoint();
   const Vec3r &normal = hit_record.GetNormal();
   Vec3r light_vec = position_ - hit_position;
   auto distance2 = light_vec.squaredNorm();
   light_vec.normalize();
   auto denominator = std::max(kEpsilon2, distance2);
-  Vec3r irradiance = intensity_ * fmax(0.0f, normal.dot(light_vec))/denominator;
+  Vec3r irradiance = intensity_ * std::max<Real>(0, normal.dot(light_vec))/denominator;
 
-  // compute how much the material absorts light
+  // compute how much the material absorts light; the sample is
+  // visible if the shadow ray to the point light is not blocked
   const Vec3r &attenuation = phong_material->Evaluate(hit_record, light_vec,
                                                       view_vec);
-  return irradiance.cwiseProduct(attenuation);
+  LightSample sample;
+  sample.shadow_ray = Ray{hit_position, GetPosition() - hit_position};
+  sample.has_shadow_ray = true;
+  sample.radiance = irradiance.cwiseProduct(attenuation);
+  samples.push_back(sample);
+  return 1;
 }
 
 
+bool
+PointLight::SamplePoint(const Vec2r &/*u*/, Vec3r &point, Real &pdf) const
+{
+  point = position_;
+  pdf = 1;
+  return true;
+}
+
 
-void update_grid_size(size_t &grid_size)
+Vec3r
+PointLight::EvaluatePoint(const HitRecord &hit_record, const Vec3r &view_vec,
+                          const Vec3r &point) const
 {
-  grid_size_ = grid_size;
-  random_pu_t = new Real[grid_size*grid_size];
-  random_pv_t = new Real[grid_size*grid_size];
+  auto surface = hit_record.GetSurface();
+  if (!surface)
+    return Vec3r{0, 0, 0};
+  auto phong_material = AsPhongMaterial(surface->GetMaterial().get());
+  if (!phong_material)
+    return Vec3r{0, 0, 0};
 
-  int count = 0;
-  for (int i = 0; i < grid_size_; i++) {
-    for (int j = 0; j < grid_size_; j++) {
-      random_pu_t[count] = (((Real)rand())/((Real)RAND_MAX));
-      random_pv_t[count] = (((Real)rand())/((Real)RAND_MAX));
-      count++;
-    }
-  }
+  // same radiance as the sample drawn by SampleIllumination()
+  Vec3r light_vec = point - hit_record.GetPoint();
+  auto denominator = std::max(kEpsilon2, light_vec.squaredNorm());
+  light_vec.normalize();
+  Vec3r irradiance = intensity_ *
+    std::max<Real>(0, hit_record.GetNormal().dot(light_vec)) / denominator;
+  return irradiance.cwiseProduct(phong_material->Evaluate(hit_record,
+                                                          light_vec, view_vec));
 }
 
+
 Vec3r give_coordinates(Vec3r center, Vec3r u, Vec3r v, Vec2r rC, Real len) {
   Vec3r CD = center + ((rC[0] - 0.5) * len * u) + ((rC[1] - 0.5) * len * v);
   return CD;
@@ -161,48 +371,124 @@ AreaLight::AreaLight(const Vec3r &center, const Vec3r &normal, const Vec3r &u_di
   name_ = name.size() ? name : "AreaLight";
 }
 
-Vec3r AreaLight::Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
-                   std::shared_ptr<Surface> scene) const
+Real AreaLight::SampleIllumination(const HitRecord &hit_record, const Vec3r &view_vec,
+                                   Sampler &sampler, vector<LightSample> &samples) const
 {
-  Vec3r black{0, 0, 0};
-  
   auto surface = hit_record.GetSurface();
   if (!surface)
-    return black;
-  auto phong_material = dynamic_pointer_cast<PhongMaterial>(surface->
-                                                            GetMaterial());
+    return 1;
+  auto phong_material = AsPhongMaterial(surface->GetMaterial().get());
   if (!phong_material)
-    return black;
+    return 1;
+
+  // draw the light samples; solid angle sampling falls back to area
+  // sampling when the light covers a tiny solid angle
+  Real scale = 1;
+  auto first_sample = samples.size();
+  if (sampling_ == AreaLightSampling::kArea ||
+      !SampleSolidAngle(hit_record, view_vec, *phong_material, sampler,
+                        samples))
+    scale = SampleArea(hit_record, view_vec, *phong_material, sampler, samples);
+
+  // probe the centers of the corner cells and the center of the
+  // light, unless no sample faces the hit point or the grid has no
+  // more samples than there are probes
+  Vec3r v_dir = normal_.cross(u_dir_);
+  Vec3r hit_position = hit_record.GetPoint();
+  if (adaptive_ && grid_size_ * grid_size_ > kProbeCount &&
+      samples.size() > first_sample) {
+    Real lo = Real{0.5} / grid_size_;
+    Real hi = 1 - lo;
+    const Vec2r probes[] = {Vec2r{lo, lo}, Vec2r{hi, lo}, Vec2r{lo, hi},
+                            Vec2r{hi, hi}, Vec2r{0.5, 0.5}};
+    for (const auto &probe : probes) {
+      LightSample sample;
+      sample.shadow_ray = Ray{hit_position,
+                              give_coordinates(center_, u_dir_, v_dir, probe,
+                                               len_) - hit_position};
+      sample.has_shadow_ray = true;
+      sample.is_probe = true;
+      samples.push_back(sample);
+    }
+  }
+  return scale;
+}
 
 
+AABB
+AreaLight::GetBounds() const
+{
+  Vec3r v_dir = normal_.cross(u_dir_);
+  AABB bounds;
+  for (Real su : {Real{-0.5}, Real{0.5}}) {
+    for (Real sv : {Real{-0.5}, Real{0.5}})
+      bounds.ExpandBy(center_ + su * len_ * u_dir_ + sv * len_ * v_dir);
+  }
+  return bounds;
+}
 
+
+bool
+AreaLight::SamplePoint(const Vec2r &u, Vec3r &point, Real &pdf) const
+{
   Vec3r v_dir = normal_.cross(u_dir_);
-  Real sum_c = color_[0] + color_[1] + color_[2];
-  //Real max_value = max({color_[0], color_[1], color_[2]});
+  point = center_ + (u[0] - Real{0.5}) * len_ * u_dir_ +
+    (u[1] - Real{0.5}) * len_ * v_dir;
+  pdf = 1 / (len_ * len_);
+  return len_ > 0;
+}
+
 
-  Real I = sum_c;
+Vec3r
+AreaLight::EvaluatePoint(const HitRecord &hit_record, const Vec3r &view_vec,
+                         const Vec3r &point) const
+{
+  auto surface = hit_record.GetSurface();
+  if (!surface)
+    return Vec3r{0, 0, 0};
+  auto phong_material = AsPhongMaterial(surface->GetMaterial().get());
+  if (!phong_material)
+    return Vec3r{0, 0, 0};
 
-  Vec3r color_scaled = color_/I;
+  // same terms as the samples drawn by SampleArea()
+  Vec3r dir = point - hit_record.GetPoint();
+  Real r = dir.norm();
+  if (!(r > 0))
+    return Vec3r{0, 0, 0};
+  Vec3r light_vec = dir / r;
+  Real cos_theta = hit_record.GetNormal().dot(light_vec);
+  Real cos_alpha = normal_.dot(-light_vec);
+  if (cos_theta < 0 || cos_alpha < 0)
+    return Vec3r{0, 0, 0};
+  Vec3r attenuation = phong_material->Evaluate(hit_record, light_vec,
+                                               view_vec);
+  return (color_ * (cos_theta * cos_alpha / (r * r))).cwiseProduct(attenuation);
+}
 
 
+Real AreaLight::SampleArea(const HitRecord &hit_record, const Vec3r &view_vec,
+                           const PhongMaterial &material, Sampler &sampler,
+                           vector<LightSample> &samples) const
+{
+  Vec3r v_dir = normal_.cross(u_dir_);
 
   // create a shadow ray to the point light and check for occlusion
   Vec3r hit_position = hit_record.GetPoint();
   Vec3r hit_normal = hit_record.GetNormal();
 
   Real grid_slen = len_/grid_size_;
-  Vec3r ret{0, 0, 0};
 
   int n_rays = 0;
-  int count = 0;
-  for (int i = 0; i < grid_size_; i++) {
-    for (int j = 0; j < grid_size_; j++) {
+  for (int i = 0; i < static_cast<int>(grid_size_); i++) {
+    for (int j = 0; j < static_cast<int>(grid_size_); j++) {
       (n_rays)++;
       Vec2r rc = Vec2r{(i*grid_slen)/len_, (j*grid_slen)/len_};
       Vec3r point_scorner = give_coordinates(center_, u_dir_, v_dir, rc, len_);
 
-      Real random_pu = (((Real)rand())/((Real)RAND_MAX))*grid_slen;
-      Real random_pv = (((Real)rand())/((Real)RAND_MAX))*grid_slen;
+      // stratified offset inside the grid cell
+      const Vec2r &cell_offset = sampler.Get2D();
+      Real random_pu = cell_offset[0]*grid_slen;
+      Real random_pv = cell_offset[1]*grid_slen;
 
       Vec3r random_p = point_scorner + random_pu*u_dir_ + random_pv*v_dir;
 
@@ -215,39 +501,102 @@ Vec3r AreaLight::Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
 
       if ((cos_theta >= 0) && (cos_alpha >= 0)) {
 
-      Ray ray_temp(hit_position, dir);
-
-      HitRecord shadow_record;
-
-      update_shadow_hit();
-      if (scene->Hit(ray_temp, kEpsilon, 1, shadow_record)) {
-        update_shadow_hit();
-        continue;
-      }
-      update_shadow_hit();
-
       Vec3r light_vec = dir/dir.norm();
      // compute how much the material absorts light
-      Vec3r attenuation = phong_material->Evaluate(hit_record, light_vec,
-                                                      view_vec);
+      Vec3r attenuation = material.Evaluate(hit_record, light_vec, view_vec);
       Vec3r ret_add = (color_*((cos_theta*cos_alpha)/(r*r)));
-      Vec3r ret_add_v2 = ret_add.cwiseProduct(attenuation);
 
-      ret = ret + ret_add_v2;
+      LightSample sample;
+      sample.shadow_ray = Ray{hit_position, dir};
+      sample.has_shadow_ray = true;
+      sample.radiance = ret_add.cwiseProduct(attenuation);
+      samples.push_back(sample);
 
       }
     }
   }
-  if (n_rays > 0){
-    Vec3r final_ret = ret * (len_*len_/n_rays);
-  
-    return final_ret;
-  }
+
+  // the visible samples are averaged over all grid cells
+  if (n_rays > 0)
+    return len_*len_/n_rays;
   else
-    return ret;
-  
+    return 1;
 }
 
 
+bool AreaLight::SampleSolidAngle(const HitRecord &hit_record,
+                                 const Vec3r &view_vec,
+                                 const PhongMaterial &material,
+                                 Sampler &sampler,
+                                 vector<LightSample> &samples) const
+{
+  const Vec3r &hit_position = hit_record.GetPoint();
+  const Vec3r &hit_normal = hit_record.GetNormal();
+  Vec3r v_dir = normal_.cross(u_dir_);
+
+  // only the front of the light emits
+  if (normal_.dot(hit_position - center_) <= 0)
+    return true;
+  SphericalRectangle rectangle{hit_position,
+                               center_ - Real{0.5} * len_ * (u_dir_ + v_dir),
+                               u_dir_, v_dir, len_, len_};
+  if (!(rectangle.GetSolidAngle() > kMinSolidAngle))
+    return false;
+
+  // number of samples of each strategy, and their pdfs (balance
+  // heuristic)
+  const Real num_light_samples = static_cast<Real>(grid_size_ * grid_size_);
+  const Real light_pdf = 1 / rectangle.GetSolidAngle();
+  SpecularLobe lobe{hit_normal, view_vec, material.GetShininess()};
+  const bool sample_lobe = sampling_ == AreaLightSampling::kMIS &&
+    hit_record.IsFrontFace() && !material.GetSpecular().isZero();
+  const Real num_lobe_samples = sample_lobe ? num_light_samples : 0;
+  auto add_sample = [&](const Vec3r &point, const Vec3r &light_vec,
+                        Real lobe_pdf) {
+    Real cos_theta = hit_normal.dot(light_vec);
+    if (cos_theta <= 0)
+      return;
+    const Vec3r &attenuation = material.Evaluate(hit_record, light_vec,
+                                                 view_vec);
+    Real weight = 1 / (num_light_samples * light_pdf +
+                       num_lobe_samples * lobe_pdf);
+    LightSample sample;
+    sample.shadow_ray = Ray{hit_position, point - hit_position};
+    sample.has_shadow_ray = true;
+    sample.radiance = color_.cwiseProduct(attenuation) * (cos_theta * weight);
+    samples.push_back(sample);
+  };
+
+  // light samples, stratified over the solid angle
+  for (uint i = 0; i < grid_size_; ++i) {
+    for (uint j = 0; j < grid_size_; ++j) {
+      const Vec2r &cell_offset = sampler.Get2D();
+      const Vec3r &point = rectangle.Sample(
+        (i + cell_offset[0]) / grid_size_, (j + cell_offset[1]) / grid_size_);
+      const Vec3r &light_vec = (point - hit_position).normalized();
+      add_sample(point, light_vec, sample_lobe ? lobe.GetPdf(light_vec) : 0);
+    }
+  }
+
+  // specular lobe samples that hit the light
+  for (Real k = 0; k < num_lobe_samples; ++k) {
+    Vec3r light_vec;
+    Real lobe_pdf;
+    if (!lobe.Sample(sampler.Get2D(), light_vec, lobe_pdf))
+      continue;
+    Real denom = light_vec.dot(normal_);
+    if (denom >= 0)
+      continue;
+    Real t = (center_ - hit_position).dot(normal_) / denom;
+    Vec3r point = hit_position + t * light_vec;
+    Vec3r offset = point - center_;
+    if (std::fabs(offset.dot(u_dir_)) > Real{0.5} * len_ ||
+        std::fabs(offset.dot(v_dir)) > Real{0.5} * len_)
+      continue;
+    add_sample(point, light_vec, lobe_pdf);
+  }
+  return true;
+}
+
 }  // namespace core
 }  // namespace olio
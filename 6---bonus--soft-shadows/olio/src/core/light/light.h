@@ -13,16 +13,35 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include "core/types.h"
+#include "core/aabb.h"
 #include "core/node.h"
+#include "core/ray.h"
 #include "core/geometry/trimesh.h"
+#include "core/sampler/sampler.h"
 
 namespace olio {
 namespace core {
 
-class Ray;
-class HitRecord;
 class Surface;
+class PhongMaterial;
+
+//! \struct LightSample
+//! \brief Radiance a light sample contributes to a hit point, if the
+//!        sample is not blocked
+struct LightSample {
+  Ray shadow_ray;                //!< segment [kEpsilon, 1] must be unblocked
+  bool has_shadow_ray{false};    //!< false: the sample is always visible
+  Vec3r radiance{0, 0, 0};       //!< radiance leaving the hit point
+  bool is_probe{false};          //!< visibility probe (see below)
+};
+
+//! \details If some of the samples drawn by one SampleIllumination()
+//!    call are probes, their shadow rays are traced first. When all
+//!    probes agree, the other samples of the call get the probes'
+//!    visibility without tracing their own shadow rays. Probes add no
+//!    radiance.
 
 //! \class Light
 //! \brief Light class
@@ -39,10 +58,62 @@ public:
   //! \param[in] hit_record Hit record for the point
   //! \param[in] view_vec View vector (points away from the surface)
   //! \param[in] scene Pointer to the whole scene that's being rendered
+  //! \param[in] sampler Sampler used to draw random light samples
   //! \return Total radiance leaving the point in the direction of
   //!         view_vec
   virtual Vec3r Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
-                           std::shared_ptr<Surface> scene) const;
+                           const std::shared_ptr<Surface> &scene,
+                           Sampler &sampler) const;
+
+  //! \brief Draw the light samples that illuminate a hit point,
+  //!        without tracing their shadow rays
+  //! \details Illuminate() is the sum of the radiance of the visible
+  //!    samples (see LightSample for probes), multiplied by the returned
+  //!    scale. Splitting sampling
+  //!    from visibility lets the wavefront integrator trace the shadow
+  //!    rays of many hit points at once.
+  //! \param[in] hit_record Hit record for the point
+  //! \param[in] view_vec View vector (points away from the surface)
+  //! \param[in] sampler Sampler used to draw random light samples
+  //! \param[out] samples Light samples are appended to this vector
+  //! \return Scale applied to the sum of visible sample radiances
+  virtual Real SampleIllumination(const HitRecord &hit_record,
+                                  const Vec3r &view_vec, Sampler &sampler,
+                                  std::vector<LightSample> &samples) const;
+
+  //! \brief Get bounds of the light's emitting points
+  //! \details Lights without bounds are not stored in a LightTree and
+  //!    illuminate every hit point
+  //! \return Bounds (invalid if the light has no position)
+  virtual AABB GetBounds() const {return AABB{};}
+
+  //! \brief Get total power emitted by the light, used by LightTree to
+  //!        estimate the light's contribution
+  //! \return Power (sum over color channels)
+  virtual Real GetPower() const {return 0;}
+
+  //! \brief Draw a point of the light, used by light resampling
+  //! \param[in] u Random values in [0, 1)^2
+  //! \param[out] point Point of the light
+  //! \param[out] pdf Density of the point w.r.t. the light's area (1
+  //!             for point lights)
+  //! \return False if the light has no points to sample
+  virtual bool SamplePoint(const Vec2r &/*u*/, Vec3r &/*point*/,
+                           Real &/*pdf*/) const {return false;}
+
+  //! \brief Get the radiance a point of the light reflects off a hit
+  //!        point, ignoring visibility
+  //! \details Dividing it by the point's pdf from SamplePoint() gives
+  //!    the radiance of a light sample drawn by SampleIllumination().
+  //! \param[in] hit_record Hit record for the point
+  //! \param[in] view_vec View vector (points away from the surface)
+  //! \param[in] point Point of the light
+  //! \return Radiance leaving the hit point in the direction of view_vec
+  virtual Vec3r EvaluatePoint(const HitRecord &/*hit_record*/,
+                              const Vec3r &/*view_vec*/,
+                              const Vec3r &/*point*/) const {
+    return Vec3r{0, 0, 0};
+  }
 protected:
 };
 
@@ -62,15 +133,15 @@ public:
   //! \param[in] name Node name
   AmbientLight(const Vec3r &ambient, const std::string &name=std::string());
 
-  //! \brief Illuminate a hit point by retrieving its Phong material
-  //! and evaluating it with a call to `Material::Eval()`
+  //! \brief Draw the light samples that illuminate a hit point
   //! \param[in] hit_record Hit record for the point
   //! \param[in] view_vec View vector (points away from the surface)
-  //! \param[in] scene Pointer to the whole scene that's being rendered
-  //! \return Total radiance leaving the point in the direction of
-  //!         view_vec
-  Vec3r Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
-                   std::shared_ptr<Surface> scene) const override;
+  //! \param[in] sampler Sampler used to draw random light samples
+  //! \param[out] samples Light samples are appended to this vector
+  //! \return Scale applied to the sum of visible sample radiances
+  Real SampleIllumination(const HitRecord &hit_record, const Vec3r &view_vec,
+                          Sampler &sampler,
+                          std::vector<LightSample> &samples) const override;
 
   //! \brief Set ambient intensity
   //! \param[in] ambient Ambient intensity
@@ -101,15 +172,15 @@ public:
   PointLight(const Vec3r &position, const Vec3r &intensity,
              const std::string &name=std::string());
 
-  //! \brief Illuminate a hit point by retrieving its Phong material
-  //! and evaluating it with a call to `Material::Eval()`
+  //! \brief Draw the light samples that illuminate a hit point
   //! \param[in] hit_record Hit record for the point
   //! \param[in] view_vec View vector (points away from the surface)
-  //! \param[in] scene Pointer to the whole scene that's being rendered
-  //! \return Total radiance leaving the point in the direction of
-  //!         view_vec
-  Vec3r Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
-                   std::shared_ptr<Surface> scene) const override;
+  //! \param[in] sampler Sampler used to draw random light samples
+  //! \param[out] samples Light samples are appended to this vector
+  //! \return Scale applied to the sum of visible sample radiances
+  Real SampleIllumination(const HitRecord &hit_record, const Vec3r &view_vec,
+                          Sampler &sampler,
+                          std::vector<LightSample> &samples) const override;
 
   //! \brief Set light's position
   //! \param[in] position Light position
@@ -126,13 +197,48 @@ public:
   //! \brief Get light's intensity
   //! \return Light's intensity
   Vec3r GetIntensity() const  {return intensity_;}
+
+  //! \brief Get bounds of the light's emitting points
+  //! \return Bounds of the light position
+  AABB GetBounds() const override {return AABB{position_, position_};}
+
+  //! \brief Get total power emitted by the light
+  //! \return Power (sum over color channels)
+  Real GetPower() const override {return 4 * kPi * intensity_.sum();}
+
+  //! \brief Draw a point of the light
+  //! \param[in] u Random values in [0, 1)^2 (unused)
+  //! \param[out] point Light position
+  //! \param[out] pdf Set to 1
+  //! \return True
+  bool SamplePoint(const Vec2r &u, Vec3r &point, Real &pdf) const override;
+
+  //! \brief Get the radiance the light reflects off a hit point,
+  //!        ignoring visibility
+  //! \param[in] hit_record Hit record for the point
+  //! \param[in] view_vec View vector (points away from the surface)
+  //! \param[in] point Light position
+  //! \return Radiance leaving the hit point in the direction of view_vec
+  Vec3r EvaluatePoint(const HitRecord &hit_record, const Vec3r &view_vec,
+                      const Vec3r &point) const override;
 protected:
   Vec3r position_{0, 0, 0};   //!< light position
   Vec3r intensity_{0, 0, 0};  //!< light intensity
 };
 
-//! \class PointLight
-//! \brief PointLight class
+//! \enum AreaLightSampling
+//! \brief How an AreaLight places its light samples
+enum class AreaLightSampling {
+  kArea,        //!< uniformly over the light's area (stratified grid)
+  kSolidAngle,  //!< uniformly over the solid angle the light subtends
+  kMIS          //!< solid angle samples and specular lobe samples,
+                //!< combined with multiple importance sampling
+};
+
+
+//! \class AreaLight
+//! \brief Square area light, sampled with a stratified grid of shadow
+//!        rays
 class AreaLight : public Light {
 public:
   OLIO_NODE(AreaLight)
@@ -148,15 +254,15 @@ public:
   AreaLight(const Vec3r &center, const Vec3r &normal, const Vec3r &u_dir, const Vec3r &color, const Real &len,
              const std::string &name=std::string());
 
-  //! \brief Illuminate a hit point by retrieving its Phong material
-  //! and evaluating it with a call to `Material::Eval()`
+  //! \brief Draw the light samples that illuminate a hit point
   //! \param[in] hit_record Hit record for the point
   //! \param[in] view_vec View vector (points away from the surface)
-  //! \param[in] scene Pointer to the whole scene that's being rendered
-  //! \return Total radiance leaving the point in the direction of
-  //!         view_vec
-  Vec3r Illuminate(const HitRecord &hit_record, const Vec3r &view_vec,
-                   std::shared_ptr<Surface> scene) const override;
+  //! \param[in] sampler Sampler used to draw random light samples
+  //! \param[out] samples Light samples are appended to this vector
+  //! \return Scale applied to the sum of visible sample radiances
+  Real SampleIllumination(const HitRecord &hit_record, const Vec3r &view_vec,
+                          Sampler &sampler,
+                          std::vector<LightSample> &samples) const override;
 
   //! \brief Set light's position
   //! \param[in] position Light position
@@ -187,15 +293,106 @@ public:
 
   Real GetLen() const {return len_;}
 
+  //! \brief Set number of light samples per hit point
+  //! \param[in] grid_size The light is split into grid_size x
+  //!            grid_size cells, with one sample per cell
+  void SetGridSize(uint grid_size) {grid_size_ = grid_size;}
+
+  //! \brief Get number of light samples per hit point
+  //! \return Grid cells along each side of the light
+  uint GetGridSize() const {return grid_size_;}
+
+  //! \brief Number of probe shadow rays per hit point in adaptive mode
+  static constexpr uint kProbeCount = 5;
+
+  //! \brief Enable/disable adaptive sampling of soft shadows
+  //! \details When enabled, shadow rays to the light's four corners
+  //!    and center are traced first (see LightSample::is_probe). Only
+  //!    hit points whose probes disagree, i.e. points in the penumbra,
+  //!    trace the shadow rays of the full grid. Shadows of occluders
+  //!    that fall between the probes are missed. Grids of up to
+  //!    kProbeCount cells (e.g., 2x2) are always sampled in full, since
+  //!    probing them would cost more rays than it saves.
+  //! \param[in] adaptive Whether to probe before sampling the grid
+  void SetAdaptive(bool adaptive) {adaptive_ = adaptive;}
+
+  //! \brief Return whether soft shadows are sampled adaptively
+  //! \return Whether probes are traced first
+  bool IsAdaptive() const {return adaptive_;}
+
+  //! \brief Set how light samples are placed
+  //! \details kSolidAngle draws the grid_size x grid_size stratified
+  //!    samples over the light's solid angle (spherical rectangle
+  //!    sampling), which removes the cos/r^2 variance of lights that
+  //!    are large or close. kMIS also draws as many directions from the
+  //!    receiver's Blinn-Phong specular lobe and keeps those that hit
+  //!    the light, weighting both kinds with the balance heuristic;
+  //!    this helps glossy receivers.
+  //! \param[in] sampling Sampling strategy
+  void SetSampling(AreaLightSampling sampling) {sampling_ = sampling;}
+
+  //! \brief Get how light samples are placed
+  //! \return Sampling strategy
+  AreaLightSampling GetSampling() const {return sampling_;}
+
+  //! \brief Get bounds of the light's emitting points
+  //! \return Bounds of the light's square
+  AABB GetBounds() const override;
+
+  //! \brief Get total power emitted by the light
+  //! \return Power (sum over color channels)
+  Real GetPower() const override {return kPi * color_.sum() * len_ * len_;}
+
+  //! \brief Draw a point of the light uniformly over its area
+  //! \param[in] u Random values in [0, 1)^2
+  //! \param[out] point Point of the light
+  //! \param[out] pdf Density of the point w.r.t. the light's area
+  //! \return True
+  bool SamplePoint(const Vec2r &u, Vec3r &point, Real &pdf) const override;
+
+  //! \brief Get the radiance a point of the light reflects off a hit
+  //!        point, ignoring visibility
+  //! \param[in] hit_record Hit record for the point
+  //! \param[in] view_vec View vector (points away from the surface)
+  //! \param[in] point Point of the light
+  //! \return Radiance leaving the hit point in the direction of view_vec
+  Vec3r EvaluatePoint(const HitRecord &hit_record, const Vec3r &view_vec,
+                      const Vec3r &point) const override;
+
 protected:
+  //! \brief Draw the light samples uniformly over the light's area
+  //! \param[in] hit_record Hit record for the point
+  //! \param[in] view_vec View vector (points away from the surface)
+  //! \param[in] material Material of the hit point
+  //! \param[in] sampler Sampler used to draw random light samples
+  //! \param[out] samples Light samples are appended to this vector
+  //! \return Scale applied to the sum of visible sample radiances
+  Real SampleArea(const HitRecord &hit_record, const Vec3r &view_vec,
+                  const PhongMaterial &material, Sampler &sampler,
+                  std::vector<LightSample> &samples) const;
+
+  //! \brief Draw the light samples over the light's solid angle, and
+  //!        the specular lobe if sampling_ is kMIS
+  //! \details Sample radiances are already weighted (the scale is 1)
+  //! \param[in] hit_record Hit record for the point
+  //! \param[in] view_vec View vector (points away from the surface)
+  //! \param[in] material Material of the hit point
+  //! \param[in] sampler Sampler used to draw random light samples
+  //! \param[out] samples Light samples are appended to this vector
+  //! \return False if the solid angle is too small to be sampled
+  bool SampleSolidAngle(const HitRecord &hit_record, const Vec3r &view_vec,
+                        const PhongMaterial &material, Sampler &sampler,
+                        std::vector<LightSample> &samples) const;
+
   Vec3r center_{0, 0, 0};   //!< light position
   Vec3r normal_{0, 0, 0};
   Vec3r u_dir_{0, 0, 0};
   Vec3r color_{0, 0, 0};  //!< light intensity
   Real len_{0};
+  uint grid_size_{1};     //!< light samples along each side of the light
+  bool adaptive_{false};  //!< trace probes before the full grid
+  AreaLightSampling sampling_{AreaLightSampling::kArea};  //!< sampling strategy
 };
 
-void update_grid_size(size_t &grid_size);
-
 }  // namespace core
 }  // namespace olio
@@ -0,0 +1,183 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       light_tree.cc
+//! \brief      LightTree class
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/light/light_tree.h"
+#include <algorithm>
+#include <cmath>
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+// largest Real below 1: keeps rescaled samples in [0, 1)
+const Real kOneMinusEpsilon = std::nextafter(Real{1}, Real{0});
+
+}  // namespace
+
+
+void
+LightTree::Clear()
+{
+  nodes_.clear();
+  light_order_.clear();
+  other_lights_.clear();
+}
+
+
+void
+LightTree::Build(const vector<Light::Ptr> &lights)
+{
+  Clear();
+  vector<AABB> bounds(lights.size());
+  vector<Real> power(lights.size(), 0);
+  for (size_t i = 0; i < lights.size(); ++i) {
+    if (lights[i]) {
+      bounds[i] = lights[i]->GetBounds();
+      power[i] = lights[i]->GetPower();
+    }
+    if (bounds[i].IsValid() && power[i] > 0)
+      light_order_.push_back(static_cast<uint32_t>(i));
+    else if (lights[i])
+      other_lights_.push_back(static_cast<uint32_t>(i));
+  }
+  if (light_order_.empty())
+    return;
+  nodes_.reserve(2 * light_order_.size() - 1);
+  BuildNode(0, light_order_.size(), bounds, power);
+}
+
+
+uint32_t
+LightTree::BuildNode(size_t begin, size_t end, const vector<AABB> &bounds,
+                     const vector<Real> &power)
+{
+  auto node_index = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back(LightTreeNode{});
+  AABB node_bounds, centroid_bounds;
+  Real node_power = 0;
+  for (auto i = begin; i < end; ++i) {
+    const auto &light_bounds = bounds[light_order_[i]];
+    node_bounds.ExpandBy(light_bounds);
+    centroid_bounds.ExpandBy((light_bounds.GetMin() + light_bounds.GetMax()) /
+                             2);
+    node_power += power[light_order_[i]];
+  }
+  nodes_[node_index].bounds = node_bounds;
+  nodes_[node_index].power = node_power;
+  if (end - begin == 1) {
+    nodes_[node_index].light = static_cast<int32_t>(light_order_[begin]);
+    return node_index;
+  }
+
+  // split at the median light centroid along the largest axis
+  Vec3r extent = centroid_bounds.GetMax() - centroid_bounds.GetMin();
+  int axis = 0;
+  if (extent[1] > extent[axis])
+    axis = 1;
+  if (extent[2] > extent[axis])
+    axis = 2;
+  auto centroid = [&](uint32_t light) {
+    return bounds[light].GetMin()[axis] + bounds[light].GetMax()[axis];
+  };
+  auto mid = begin + (end - begin) / 2;
+  std::nth_element(light_order_.begin() + static_cast<ptrdiff_t>(begin),
+                   light_order_.begin() + static_cast<ptrdiff_t>(mid),
+                   light_order_.begin() + static_cast<ptrdiff_t>(end),
+                   [&](uint32_t a, uint32_t b) {
+                     return centroid(a) < centroid(b);
+                   });
+  BuildNode(begin, mid, bounds, power);
+  nodes_[node_index].second_child = BuildNode(mid, end, bounds, power);
+  return node_index;
+}
+
+
+Real
+LightTree::Importance(const LightTreeNode &node, const Vec3r &point,
+                      const Vec3r &normal)
+{
+  // nodes entirely below the hit point's tangent plane do not
+  // illuminate it
+  const Vec3r &bmin = node.bounds.GetMin();
+  const Vec3r &bmax = node.bounds.GetMax();
+  bool above = false;
+  for (int c = 0; c < 8 && !above; ++c) {
+    Vec3r corner{c & 1 ? bmax[0] : bmin[0], c & 2 ? bmax[1] : bmin[1],
+                 c & 4 ? bmax[2] : bmin[2]};
+    above = normal.dot(corner - point) > 0;
+  }
+  if (!above)
+    return 0;
+
+  // power over squared distance, which is clamped to the node's
+  // radius so that nodes containing the point are not overestimated
+  Vec3r center = (bmin + bmax) / 2;
+  Real radius2 = (bmax - bmin).squaredNorm() / 4;
+  Real distance2 = std::max((center - point).squaredNorm(), radius2);
+  return node.power / std::max(distance2, kEpsilon2);
+}
+
+
+void
+LightTree::Select(const Vec3r &point, const Vec3r &normal, Sampler &sampler,
+                  vector<LightPick> &picks) const
+{
+  for (auto light : other_lights_)
+    picks.push_back(LightPick{light, 1});
+  if (nodes_.empty())
+    return;
+  for (uint k = 0; k < budget_; ++k) {
+    uint32_t light;
+    Real pmf;
+    if (Pick(point, normal, sampler.Get1D(), light, pmf))
+      picks.push_back(LightPick{light, 1 / (static_cast<Real>(budget_) * pmf)});
+  }
+}
+
+
+bool
+LightTree::Pick(const Vec3r &point, const Vec3r &normal, Real u,
+                uint32_t &light, Real &pmf) const
+{
+  // walk down the tree, reusing the sample to choose each child
+  if (nodes_.empty() || !(Importance(nodes_[0], point, normal) > 0))
+    return false;
+  pmf = 1;
+  uint32_t index = 0;
+  while (nodes_[index].light < 0) {
+    uint32_t first = index + 1;
+    uint32_t second = nodes_[index].second_child;
+    Real first_importance = Importance(nodes_[first], point, normal);
+    Real second_importance = Importance(nodes_[second], point, normal);
+    Real total_importance = first_importance + second_importance;
+    if (!(total_importance > 0))
+      return false;
+    Real first_probability = first_importance / total_importance;
+    if (u < first_probability) {
+      u = std::min(u / first_probability, kOneMinusEpsilon);
+      pmf *= first_probability;
+      index = first;
+    } else {
+      u = std::min((u - first_probability) / (1 - first_probability),
+                   kOneMinusEpsilon);
+      pmf *= 1 - first_probability;
+      index = second;
+    }
+  }
+  light = static_cast<uint32_t>(nodes_[index].light);
+  return true;
+}
+
+}  // namespace core
+}  // namespace olio
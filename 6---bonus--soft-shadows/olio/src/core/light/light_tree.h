@@ -0,0 +1,128 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       light_tree.h
+//! \brief      LightTree class
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "core/types.h"
+#include "core/aabb.h"
+#include "core/light/light.h"
+#include "core/sampler/sampler.h"
+
+namespace olio {
+namespace core {
+
+//! \struct LightTreeNode
+//! \brief Node of a LightTree
+//! \details Nodes are stored in depth-first order: the first child of
+//!    an interior node immediately follows its parent.
+struct LightTreeNode {
+  AABB bounds;                //!< bounds of the node's lights
+  Real power{0};              //!< total power of the node's lights
+  uint32_t second_child{0};   //!< index of the second child (interior)
+  int32_t light{-1};          //!< light index (leaves), -1 for interior nodes
+};
+
+//! \struct LightPick
+//! \brief Light selected to illuminate a hit point
+struct LightPick {
+  uint32_t light;  //!< index of the light
+  Real weight;     //!< factor the light's illumination is multiplied by
+};
+
+//! \class LightTree
+//! \brief Bounding hierarchy over lights, used to pick a few lights
+//!        per hit point in scenes with many lights
+//! \details Lights with valid bounds and positive power (see
+//!    Light::GetBounds() and Light::GetPower()) are stored in a binary
+//!    tree, one light per leaf. Select() walks down the tree once per
+//!    light of the budget, choosing each child with a probability
+//!    proportional to its estimated contribution (power over squared
+//!    distance, zero if the node is behind the hit point), and weights
+//!    the picked light by the inverse of its probability. All other
+//!    lights (e.g., AmbientLight) are always selected.
+class LightTree {
+public:
+  LightTree() = default;
+
+  //! \brief Remove all nodes
+  void Clear();
+
+  //! \brief Build the tree over a list of lights
+  //! \param[in] lights Scene lights
+  void Build(const std::vector<Light::Ptr> &lights);
+
+  //! \brief Check if the tree has no nodes
+  //! \return True if empty
+  bool IsEmpty() const {return nodes_.empty();}
+
+  //! \brief Get the tree nodes
+  //! \return Nodes in depth-first order
+  const std::vector<LightTreeNode> &GetNodes() const {return nodes_;}
+
+  //! \brief Set number of lights picked from the tree per hit point
+  //! \param[in] budget Number of picks (lights may be picked repeatedly)
+  void SetBudget(uint budget) {budget_ = budget;}
+
+  //! \brief Get number of lights picked from the tree per hit point
+  //! \return Number of picks
+  uint GetBudget() const {return budget_;}
+
+  //! \brief Select the lights that illuminate a hit point
+  //! \details Draws one sample from sampler per pick. Lights that are
+  //!    not in the tree come first, with weight 1.
+  //! \param[in] point Hit point
+  //! \param[in] normal Surface normal at the hit point
+  //! \param[in] sampler Sampler used to pick lights
+  //! \param[out] picks Selected lights are appended to this vector
+  void Select(const Vec3r &point, const Vec3r &normal, Sampler &sampler,
+              std::vector<LightPick> &picks) const;
+
+  //! \brief Pick one light of the tree for a hit point
+  //! \param[in] point Hit point
+  //! \param[in] normal Surface normal at the hit point
+  //! \param[in] u Random value in [0, 1)
+  //! \param[out] light Index of the picked light
+  //! \param[out] pmf Probability of picking the light
+  //! \return False if no light of the tree can illuminate the point
+  bool Pick(const Vec3r &point, const Vec3r &normal, Real u, uint32_t &light,
+            Real &pmf) const;
+
+  //! \brief Get the lights that are not in the tree
+  //! \return Light indices
+  const std::vector<uint32_t> &GetOtherLights() const {return other_lights_;}
+protected:
+  //! \brief Build the subtree over a range of lights
+  //! \param[in] begin First entry of light_order_
+  //! \param[in] end One past the last entry of light_order_
+  //! \param[in] bounds Bounds of each light
+  //! \param[in] power Power of each light
+  //! \return Index of the subtree's root
+  uint32_t BuildNode(size_t begin, size_t end, const std::vector<AABB> &bounds,
+                     const std::vector<Real> &power);
+
+  //! \brief Estimate the contribution of a node's lights to a point
+  //! \param[in] node Tree node
+  //! \param[in] point Hit point
+  //! \param[in] normal Surface normal at the hit point
+  //! \return Importance of the node (0 if it is behind the point)
+  static Real Importance(const LightTreeNode &node, const Vec3r &point,
+                         const Vec3r &normal);
+
+  std::vector<LightTreeNode> nodes_;    //!< nodes in depth-first order
+  std::vector<uint32_t> light_order_;   //!< tree lights, sorted during build
+  std::vector<uint32_t> other_lights_;  //!< lights that are not in the tree
+  uint budget_{1};                      //!< lights picked per hit point
+};
+
+}  // namespace core
+}  // namespace olio
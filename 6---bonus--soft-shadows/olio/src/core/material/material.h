@@ -23,13 +23,26 @@ namespace core {
 class Ray;
 class HitRecord;
 
+//! \enum MaterialKind
+//! \brief Concrete material type, used for shading dispatch without RTTI
+enum class MaterialKind {
+  kNone,       //!< not shaded (black)
+  kPhong,      //!< PhongMaterial
+  kDielectric  //!< PhongDielectric
+};
+
 //! \class Material
 //! \brief Material class
 class Material : public Node {
 public:
   OLIO_NODE(Material)
   explicit Material(const std::string &name=std::string());
+
+  //! \brief Get concrete material type
+  //! \return Material kind
+  MaterialKind GetKind() const {return kind_;}
 protected:
+  MaterialKind kind_{MaterialKind::kNone};  //!< set by derived classes
 };
 
 }  // namespace core
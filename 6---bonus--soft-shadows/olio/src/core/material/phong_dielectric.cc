@@ -10,6 +10,7 @@
 //! \author     Hadi Fadaifard, 2022
 
 #include "core/material/phong_dielectric.h"
+#include <algorithm>
 #include <spdlog/spdlog.h>
 #include "core/ray.h"
 
@@ -22,6 +23,7 @@ PhongDielectric::PhongDielectric(const std::string &name) :
   PhongMaterial{}
 {
   name_ = name.size() ? name : "PhongDielectric";
+  kind_ = MaterialKind::kDielectric;
   //SetDiffuse(Vec3r{1, 1, 1});
   SetDiffuse(nullptr);
 }
@@ -33,57 +35,56 @@ PhongDielectric::PhongDielectric(Real ior, Texture::Ptr &attenuation,
   ior_{ior}
 {
   name_ = name.size() ? name : "PhongDielectric";
+  kind_ = MaterialKind::kDielectric;
   SetDiffuse(attenuation);
 }
 
 
-Vec3r
-PhongDielectric::Scatter(const HitRecord &hit_record,
-                         const Ray &ray_in,
-                         std::shared_ptr<Ray> &reflect_ray,
-                         std::shared_ptr<Ray> &refract_ray,
-                         Real &schlick_reflectance) const
+ScatterResult
+PhongDielectric::Scatter(const HitRecord &hit_record, const Ray &ray_in) const
 {
   // attenuation is stored in diffuse_
-  //Vec3r attenuation = diffuse_;
-
-  Vec3r attenuation{0,0,0};
+  ScatterResult result;
   Vec3r position{0,0,0};
   if (diffuse_) {
-    const auto &uv = hit_record.GetFaceGeouv().get_global_uv();
-    attenuation = diffuse_->Value(uv, position);
+    const Vec2r &uv = diffuse_->UsesUV() ?
+      hit_record.GetFaceGeouv().get_global_uv() : Vec2r{-1, -1};
+    result.attenuation = diffuse_->Value(uv, position);
   }
 
   // compute incoming angle's cos/sin
   const Vec3r &normal = hit_record.GetNormal();
   const Vec3r &v = -ray_in.GetDirection().normalized();
-  auto cos_theta = fmin(v.dot(normal), 1.0f);
-  auto sin_theta = sqrt(1.f - cos_theta * cos_theta);
+  auto cos_theta = std::min<Real>(v.dot(normal), 1);
+  auto sin_theta = sqrt(1 - cos_theta * cos_theta);
 
   // the below comparison checks for total internal reflection
-  Real ior_in = 1.0f;
+  Real ior_in = 1;
   Real ior_out = ior_;
   if (!hit_record.IsFrontFace())
     swap(ior_in, ior_out);
   bool reflect_only = (sin_theta * ior_in / ior_out) > 1;
 
   // Schlick’s approximation: estimate probability of reflection
+  Real schlick_reflectance;
   if (reflect_only)
-    schlick_reflectance = 1.0f;
+    schlick_reflectance = 1;
   else
     schlick_reflectance = SchlicksReflectance(cos_theta, ior_in, ior_out);
+  result.reflect_weight = schlick_reflectance;
+  result.refract_weight = 1 - schlick_reflectance;
 
   // create reflection ray
-  reflect_ray = make_shared<Ray>();
-  *reflect_ray = Ray::Reflect(ray_in, hit_record.GetPoint(), normal);
+  result.reflect_ray = Ray::Reflect(ray_in, hit_record.GetPoint(), normal);
+  result.has_reflect_ray = true;
 
   // create refraction ray
   if (!reflect_only) {
-    refract_ray = make_shared<Ray>();
-    *refract_ray = Ray::Refract(ray_in, hit_record.GetPoint(), normal,
-                                ior_in, ior_out);
+    result.refract_ray = Ray::Refract(ray_in, hit_record.GetPoint(), normal,
+                                      ior_in, ior_out);
+    result.has_refract_ray = true;
   }
-  return attenuation;
+  return result;
 }
 
 }  // namespace core
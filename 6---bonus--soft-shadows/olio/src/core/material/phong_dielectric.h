@@ -25,6 +25,23 @@ class Light;
 class AmbientLight;
 class PointLight;
 
+//! \struct ScatterResult
+//! \brief Rays leaving a glass hit point and their color weights
+//! \details The color of a ray traced through the glass is the color
+//!    of the reflected ray times attenuation times reflect_weight, plus
+//!    the color of the refracted ray times attenuation times
+//!    refract_weight.
+struct ScatterResult {
+  Ray reflect_ray;              //!< reflected ray
+  Ray refract_ray;              //!< refracted ray
+  bool has_reflect_ray{false};  //!< whether reflect_ray is traced
+  bool has_refract_ray{false};  //!< whether refract_ray is traced
+  Vec3r attenuation{0, 0, 0};   //!< glass attenuation
+  Real reflect_weight{0};       //!< reflected ray weight
+  Real refract_weight{0};       //!< refracted ray weight
+};
+
+
 //! \class PhongDielectric
 //! \brief PhongDielectric class
 class PhongDielectric : public PhongMaterial {
@@ -45,19 +62,14 @@ public:
 
   //! \brief Scatter incoming ray ray_in
   //! \details The function will generate a reflection and a refraction
-  //!    ray. The refraction ray will be null (not generated) if there is total
-  //!    internal reflection.
+  //!    ray, weighted by Schlick's reflectance. There is no refraction
+  //!    ray if there is total internal reflection.
   //! \param[in] hit_record Hit record at hit point
   //! \param[in] ray_in Incoming ray that hit the point
-  //! \param[out] reflect_ray Reflected ray
-  //! \param[out] refract_ray Refracted ray (null if not refracted)
-  //! \param[out] schlick_reflectance Schlick's reflectance
-  //! \return Attenuation factor (how much color of reflected/refracted
-  //! rays should be attenuated)
-  Vec3r Scatter(const HitRecord &hit_record, const Ray &ray_in,
-                std::shared_ptr<Ray> &reflect_ray,
-                std::shared_ptr<Ray> &refract_ray,
-                Real &schlick_reflectance) const;
+  //! \return Scattered rays, their weights, and the attenuation factor
+  //!         (how much color of reflected/refracted rays should be
+  //!         attenuated)
+  ScatterResult Scatter(const HitRecord &hit_record, const Ray &ray_in) const;
 
   //! \brief Set index of refraction
   //! \param[in] ior Index of refraction
@@ -83,9 +95,9 @@ inline Real
 PhongDielectric::SchlicksReflectance(Real cos_theta, Real ior_in, Real ior_out)
 {
   auto ior_ratio = ior_in / ior_out;
-  auto r0 = (1.0f - ior_ratio) / (1.0f + ior_ratio);
+  auto r0 = (1 - ior_ratio) / (1 + ior_ratio);
   r0 = r0 * r0;
-  return r0 + (1.0f - r0) * static_cast<Real>(pow(1 - cos_theta, 5));
+  return r0 + (1 - r0) * static_cast<Real>(pow(1 - cos_theta, 5));
 }
 
 }  // namespace core
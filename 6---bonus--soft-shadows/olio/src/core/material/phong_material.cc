@@ -22,6 +22,7 @@ PhongMaterial::PhongMaterial(const std::string &name) :
   Material{}
 {
   name_ = name.size() ? name : "PhongMaterial";
+  kind_ = MaterialKind::kPhong;
   SetDiffuse(nullptr);
 }
 
@@ -36,6 +37,7 @@ PhongMaterial::PhongMaterial(const Vec3r &ambient, Texture::Ptr &diffuse,
   mirror_{mirror}
 {
   name_ = name.size() ? name : "PhongMaterial";
+  kind_ = MaterialKind::kPhong;
   SetDiffuse(diffuse);
 }
 
@@ -62,7 +64,8 @@ PhongMaterial::Evaluate(const HitRecord &hit_record, const Vec3r &light_vec,
   Vec3r diffuse_color{0,0,0};
   Vec3r position{0,0,0};
   if (diffuse_) {
-    const auto &uv = hit_record.GetFaceGeouv().get_global_uv();
+    const Vec2r &uv = diffuse_->UsesUV() ?
+      hit_record.GetFaceGeouv().get_global_uv() : Vec2r{-1, -1};
     diffuse_color = diffuse_->Value(uv, position);
   }
 
@@ -78,11 +78,11 @@ public:
 
   //! \brief Get ambient coefficients
   //! \return Ambient coefficients
-  Vec3r GetAmbient() const  {return ambient_;}
+  const Vec3r &GetAmbient() const {return ambient_;}
 
   //! \brief Get specular coefficients
   //! \return Specular coefficients
-  Vec3r GetSpecular() const {return specular_;}
+  const Vec3r &GetSpecular() const {return specular_;}
 
   //! \brief Get shininess coefficient (Phong exponent)
   //! \return Shininess coefficient
@@ -90,7 +90,7 @@ public:
 
   //! \brief Get mirror coefficients
   //! \return Mirror coefficients
-  Vec3r GetMirror() const {return mirror_;}
+  const Vec3r &GetMirror() const {return mirror_;}
 protected:
   Vec3r ambient_{0, 0, 0};      //!< ambient coefficients
   Texture::Ptr diffuse_{nullptr};      //!< diffuse coefficients
@@ -99,5 +99,16 @@ protected:
   Vec3r mirror_{0, 0, 0};       //!< mirror coefficients
 };
 
+
+//! \brief Get a material as a PhongMaterial (PhongDielectric included)
+//! \param[in] material Input material (may be null)
+//! \return The material, or null if it's not a PhongMaterial
+inline const PhongMaterial *AsPhongMaterial(const Material *material)
+{
+  if (!material || material->GetKind() == MaterialKind::kNone)
+    return nullptr;
+  return static_cast<const PhongMaterial*>(material);
+}
+
 }  // namespace core
 }  // namespace olio
@@ -3,9 +3,12 @@
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <chrono>
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <spdlog/spdlog.h>
+#include <tbb/parallel_for.h>
 #include "core/geometry/surface.h"
 #include "core/geometry/sphere.h"
 #include "core/camera/camera.h"
@@ -60,6 +63,12 @@ bool RaytraParser::ParseFile(const std::string &filename, Surface::Ptr &scene,
   map<int, bool>argum2;
   map<int, boost::filesystem::path>argum3_path;
 
+  // meshes are loaded (and their BVHs built) in parallel after parsing;
+  // mesh_slots holds the index of each mesh's placeholder in 'surfaces'
+  vector<TriMesh::Ptr> meshes;
+  vector<fs::path> mesh_paths;
+  vector<size_t> mesh_slots;
+
   // parse file
   for (string line; getline(in, line);) {
     // skip comments and empty lines
@@ -106,7 +115,7 @@ bool RaytraParser::ParseFile(const std::string &filename, Surface::Ptr &scene,
         Vec3r up_vec{0, 1, 0};
         if (view_vec.isApprox(up_vec))
           up_vec = Vec3r{0, 0, 1};
-        Real fovy = 2 * atan2(viewport_height * 0.5f, focal_length) * kRADtoDEG;
+        Real fovy = 2 * atan2(viewport_height * Real{0.5}, focal_length) * kRADtoDEG;
 
         // check viewport/image aspect ratios
         Real viewport_aspect = viewport_width / viewport_height;
@@ -277,21 +286,12 @@ bool RaytraParser::ParseFile(const std::string &filename, Surface::Ptr &scene,
           std::cout << "Here is the string: " << concat_str << "\n" << std::endl;
 
           TriMesh::Ptr mesh = TriMesh::Create();
-          bool retu;
           mesh->SetMaterial(current_material);
-          retu = mesh->Load(concat_str);
-          std::cout << "Here is the string2: " << concat_str << "\n" << std::endl;
-          std::cout << "Return: " << retu << "\n" << std::endl;
-
-          
-          
-
-          std::cout << "Surface before size: " << surfaces.size() << "\n" << std::endl;
-          if (retu) {
-            surfaces.push_back(mesh);
-            std::cout << "Surface size: " << surfaces.size() << "\n" << std::endl;
-          }
-
+          meshes.push_back(mesh);
+          mesh_paths.push_back(concat_str);
+          mesh_slots.push_back(surfaces.size());
+          surfaces.push_back(nullptr);
+          break;
       }
     default:
       continue;
@@ -301,6 +301,23 @@ bool RaytraParser::ParseFile(const std::string &filename, Surface::Ptr &scene,
   // close input file
   in.close();
 
+  // load meshes
+  if (meshes.size()) {
+    auto start_time = chrono::system_clock::now();
+    tbb::parallel_for(size_t{0}, meshes.size(), [&](size_t i) {
+      if (meshes[i]->Load(mesh_paths[i]))
+        surfaces[mesh_slots[i]] = meshes[i];
+      else
+        spdlog::error("Failed to load mesh {}", mesh_paths[i].string());
+    });
+    auto end_time = chrono::system_clock::now();
+    auto load_time = chrono::duration_cast<chrono::duration<double>>
+      (end_time - start_time).count();
+    spdlog::info("Loaded {} mesh(es) in {:.3f} s", meshes.size(), load_time);
+    surfaces.erase(remove(surfaces.begin(), surfaces.end(), nullptr),
+                   surfaces.end());
+  }
+
   if (camera_count != 1) {
     spdlog::error("Parse error: scene file should contain only one camera");
     return false;
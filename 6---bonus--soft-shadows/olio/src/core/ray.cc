@@ -11,6 +11,7 @@
 
 #include "core/ray.h"
 #include <spdlog/spdlog.h>
+#include "core/geometry/surface.h"
 
 namespace olio {
 namespace core {
@@ -32,5 +33,24 @@ HitRecord::HitRecord(const Ray &ray, Real ray_t, const Vec3r &point,
   SetNormal(ray, face_normal);
 }
 
+
+void
+HitRecord::ComputeShading(const Ray &ray)
+{
+  if (surface_)
+    surface_->ComputeShading(ray, *this);
+}
+
+
+const FaceGeoUV &
+HitRecord::GetFaceGeouv() const
+{
+  if (!has_face_geouv_) {
+    face_geouv_ = surface_ ? surface_->ComputeFaceGeoUV(*this) : FaceGeoUV{};
+    has_face_geouv_ = true;
+  }
+  return face_geouv_;
+}
+
 }  // namespace core
 }  // namespace olio
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include "core/types.h"
@@ -45,11 +46,11 @@ public:
 
   //! \brief Get ray origin
   //! \return Ray origin
-  inline Vec3r GetOrigin() const {return origin_;}
+  inline const Vec3r &GetOrigin() const {return origin_;}
 
   //! \brief Get ray direction
   //! \return Ray direction
-  inline Vec3r GetDirection() const {return dir_;}
+  inline const Vec3r &GetDirection() const {return dir_;}
 
   //! \brief Evaluate ray at fractional distance t
   //! \param[in] t Fractional distance t to evaluate ray at
@@ -96,9 +97,13 @@ protected:
 //! \class HitRecord
 //! \brief HitRecord class is used during path tracing to keep track
 //! of information about the point on a surface that was hit by a ray.
-//! \details Information such as hit poisition, surface normal at
-//! that position, whether the normal was facing towards or away
-//! from the ray, the pointer to the surface that was hit, etc.
+//! \details Traversal only records what it needs to find the closest
+//! hit: the ray's t, the surface that was hit, and the primitive id and
+//! barycentric coordinates of the hit inside that surface. Shading
+//! attributes (hit position, surface normal, whether the normal was
+//! facing towards or away from the ray) are computed once, for the
+//! final hit, by ComputeShading(). Texture coordinates are computed on
+//! first access, so materials without image textures never pay for them.
 class HitRecord {
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -116,6 +121,30 @@ public:
   //! \brief Default constructor
   HitRecord() = default;
 
+  //! \brief Record a hit found during traversal
+  //! \details Only the intersection data is stored. The shading
+  //!          attributes of the previous hit, if any, become invalid.
+  //! \param[in] ray_t Ray's t
+  //! \param[in] surface Surface that was hit
+  //! \param[in] prim_id Id of the hit primitive inside the surface
+  //! \param[in] barycentric Barycentric coordinates of the hit inside
+  //!            the primitive
+  inline void SetHit(Real ray_t, Surface *surface, uint32_t prim_id=0,
+                     const Vec2r &barycentric=Vec2r{0, 0}) {
+    ray_t_ = ray_t;
+    surface_ = surface;
+    prim_id_ = prim_id;
+    barycentric_ = barycentric;
+    has_face_geouv_ = false;
+  }
+
+  //! \brief Compute the shading attributes of the recorded hit
+  //! \details Calls Surface::ComputeShading() of the hit surface. Should
+  //!          be called once, after the closest hit was found, and
+  //!          before any of the shading attributes are read.
+  //! \param[in] ray Ray that hit the surface
+  void ComputeShading(const Ray &ray);
+
   //! \brief Set ray's t (fractional distance) at hit time
   //! \param[in] ray_t Ray's t
   inline void SetRayT(Real ray_t) {ray_t_ = ray_t;}
@@ -153,7 +182,7 @@ public:
 
   //! \brief Set surface that was hit
   //! \param[in] surface Pointer to surface that was hit
-  inline void SetSurface(std::shared_ptr<Surface> surface) {surface_ = surface;}
+  inline void SetSurface(Surface *surface) {surface_ = surface;}
 
   //! \brief Get ray's fractional distance
   //! \return Ray's fractional distance
@@ -161,11 +190,11 @@ public:
 
   //! \brief Get hit position
   //! \return Hit position
-  inline Vec3r GetPoint() const {return point_;}
+  inline const Vec3r &GetPoint() const {return point_;}
 
   //! \brief Get surface normal at hit point
   //! \return surface normal
-  inline Vec3r GetNormal() const {return normal_;}
+  inline const Vec3r &GetNormal() const {return normal_;}
 
   //! \brief Return whether the hit point was front or back facing
   //! \return Whether the hit point was front or back facing
@@ -173,20 +202,41 @@ public:
 
   //! \brief Get hit surface
   //! \return Hit surface
-  inline std::shared_ptr<Surface> GetSurface() const {return surface_;}
+  inline Surface *GetSurface() const {return surface_;}
+
+  //! \brief Get id of the hit primitive inside the hit surface
+  //! \return Primitive id (e.g., triangle index in a TriMesh)
+  inline uint32_t GetPrimId() const {return prim_id_;}
 
+  //! \brief Get barycentric coordinates of the hit inside the primitive
+  //! \return Barycentric coordinates
+  inline const Vec2r &GetBarycentric() const {return barycentric_;}
 
-  inline void SetFaceGeouv(FaceGeoUV &face_geouv) {face_geouv_ = face_geouv;}
+  //! \brief Set face/texture coordinates of the hit point
+  //! \param[in] face_geouv Face/texture coordinates
+  inline void SetFaceGeouv(const FaceGeoUV &face_geouv) {
+    face_geouv_ = face_geouv;
+    has_face_geouv_ = true;
+  }
 
-  inline FaceGeoUV GetFaceGeouv() const {return face_geouv_;}
+  //! \brief Get face/texture coordinates of the hit point
+  //! \details Computed by Surface::ComputeFaceGeoUV() on first access
+  //! \return Face/texture coordinates
+  const FaceGeoUV &GetFaceGeouv() const;
 
 protected:
+  // intersection data, filled during traversal
   Real ray_t_{0}; //!< fractional distance along ray (t) that intersects surface
+  Surface *surface_{nullptr};  //!< pointer to the hit surface
+  uint32_t prim_id_{0};        //!< hit primitive inside surface_
+  Vec2r barycentric_{0, 0};    //!< barycentric coordinates inside primitive
+
+  // shading attributes, filled by ComputeShading()
   Vec3r point_{0, 0, 0};   //!< hit point
   Vec3r normal_{0, 0, 0};  //!< surface normal at hit point
   bool front_face_{true};  //!< whether hit point was front or back facing
-  std::shared_ptr<Surface> surface_;  //!< pointer to the hit surface
-  FaceGeoUV face_geouv_;  //!< track uv coordinates of intersected point
+  mutable bool has_face_geouv_{false};  //!< whether face_geouv_ is valid
+  mutable FaceGeoUV face_geouv_;  //!< track uv coordinates of intersected point
 };
 
 
@@ -203,9 +253,9 @@ Ray::Refract(const Ray& ray_in, const Vec3r &point, const Vec3r& normal,
              Real ior_in, Real ior_out)
 {
   const Vec3r &v = ray_in.GetDirection().normalized();
-  auto cos_theta = fmin(normal.dot(-v), 1.0f);
+  auto cos_theta = std::min<Real>(normal.dot(-v), 1);
   Vec3r r_out_perp =  (ior_in / ior_out) * (v + cos_theta * normal);
-  Vec3r r_out_parallel = -sqrt(fabs(1.0f - r_out_perp.squaredNorm())) * normal;
+  Vec3r r_out_parallel = -sqrt(fabs(1 - r_out_perp.squaredNorm())) * normal;
   return Ray{point, r_out_perp + r_out_parallel};
 }
 
@@ -215,9 +265,9 @@ Ray::Refract(const Ray& ray_in, const Vec3r &point, const Vec3r& normal,
              Real ior_ratio)
 {
   const Vec3r &v = ray_in.GetDirection().normalized();
-  auto cos_theta = fmin(normal.dot(-v), 1.0f);
+  auto cos_theta = std::min<Real>(normal.dot(-v), 1);
   Vec3r r_out_perp =  ior_ratio * (v + cos_theta * normal);
-  Vec3r r_out_parallel = -sqrt(fabs(1.0f - r_out_perp.squaredNorm())) * normal;
+  Vec3r r_out_parallel = -sqrt(fabs(1 - r_out_perp.squaredNorm())) * normal;
   return Ray{point, r_out_perp + r_out_parallel};
 }
 
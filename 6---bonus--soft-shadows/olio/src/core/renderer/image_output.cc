@@ -0,0 +1,173 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       image_output.cc
+//! \brief      Conversion of rendered images to output pixel formats
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/image_output.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+// the gamma table covers inputs in [2^kMinExponent, 1), with
+// 2^kSegmentBits linear segments per octave
+const int kMinExponent = -32;
+const int kSegmentBits = 8;
+const int kSegments = 1 << kSegmentBits;
+const int kFractionBits = 23 - kSegmentBits;
+const float kFractionScale = 1.0f / static_cast<float>(1 << kFractionBits);
+
+
+//! \brief Convert a display value in [0, 1] to an integer channel
+//! \param[in] value Display value
+//! \param[in] max_value Largest channel value
+//! \return Rounded channel value
+template <typename T>
+inline T
+Quantize(float value, float max_value)
+{
+  return static_cast<T>(value * max_value + 0.5f);
+}
+
+}  // namespace
+
+
+OutputConverter::OutputConverter(OutputDepth depth, Real exposure, Real gamma) :
+  depth_{depth == OutputDepth::kAuto ? OutputDepth::kUChar : depth},
+  exposure_{static_cast<float>(exposure)},
+  gamma_inv_{static_cast<float>(1 / gamma)}
+{
+  if (depth_ == OutputDepth::kHalf || depth_ == OutputDepth::kFloat ||
+      gamma == 1)
+    return;
+
+  // gamma curve at the start of each segment, plus 1 for the end of
+  // the last one
+  gamma_table_.resize(static_cast<size_t>(-kMinExponent * kSegments + 1));
+  for (int e = kMinExponent; e < 0; ++e) {
+    for (int s = 0; s < kSegments; ++s) {
+      double value = std::ldexp(1 + static_cast<double>(s) / kSegments, e);
+      gamma_table_[static_cast<size_t>((e - kMinExponent) * kSegments + s)] =
+        static_cast<float>(std::pow(value, static_cast<double>(gamma_inv_)));
+    }
+  }
+  gamma_table_.back() = 1;
+}
+
+
+int
+OutputConverter::GetImageType() const
+{
+  switch (depth_) {
+  case OutputDepth::kUShort:
+    return CV_16UC3;
+  case OutputDepth::kHalf:
+  case OutputDepth::kFloat:
+    return CV_32FC3;
+  default:
+    return CV_8UC3;
+  }
+}
+
+
+vector<int>
+OutputConverter::GetWriteParams() const
+{
+  if (depth_ == OutputDepth::kHalf)
+    return vector<int>{cv::IMWRITE_EXR_TYPE, cv::IMWRITE_EXR_TYPE_HALF};
+  return vector<int>{};
+}
+
+
+float
+OutputConverter::GammaCorrect(float value) const
+{
+  if (gamma_table_.empty())
+    return value;
+  if (!(value > 0))
+    return 0;
+  if (value >= 1)
+    return 1;
+
+  // the exponent and top mantissa bits of the value select the
+  // segment, the remaining bits interpolate within it
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  int exponent = static_cast<int>((bits >> 23) & 0xff) - 127;
+  if (exponent < kMinExponent)
+    return std::pow(value, gamma_inv_);
+  auto index = static_cast<size_t>((exponent - kMinExponent) * kSegments) +
+    ((bits >> kFractionBits) & (kSegments - 1));
+  float t = static_cast<float>(bits & ((1u << kFractionBits) - 1)) *
+    kFractionScale;
+  return gamma_table_[index] + t * (gamma_table_[index + 1] -
+                                    gamma_table_[index]);
+}
+
+
+void
+OutputConverter::ConvertRow(const float *rgb, size_t width, void *bgr) const
+{
+  switch (depth_) {
+  case OutputDepth::kUShort: {
+    auto out = static_cast<uint16_t*>(bgr);
+    for (size_t x = 0; x < width; ++x, rgb += 3, out += 3) {
+      out[0] = Quantize<uint16_t>(ToDisplay(rgb[2]), 65535);
+      out[1] = Quantize<uint16_t>(ToDisplay(rgb[1]), 65535);
+      out[2] = Quantize<uint16_t>(ToDisplay(rgb[0]), 65535);
+    }
+    break;
+  }
+  case OutputDepth::kHalf:
+  case OutputDepth::kFloat: {
+    // HDR output is not clamped or gamma corrected
+    auto out = static_cast<float*>(bgr);
+    for (size_t x = 0; x < width; ++x, rgb += 3, out += 3) {
+      out[0] = rgb[2] * exposure_;
+      out[1] = rgb[1] * exposure_;
+      out[2] = rgb[0] * exposure_;
+    }
+    break;
+  }
+  default: {
+    auto out = static_cast<unsigned char*>(bgr);
+    for (size_t x = 0; x < width; ++x, rgb += 3, out += 3) {
+      out[0] = Quantize<unsigned char>(ToDisplay(rgb[2]), 255);
+      out[1] = Quantize<unsigned char>(ToDisplay(rgb[1]), 255);
+      out[2] = Quantize<unsigned char>(ToDisplay(rgb[0]), 255);
+    }
+    break;
+  }
+  }
+}
+
+
+void
+OutputConverter::Convert(const cv::Mat &in_image, cv::Mat &out_image) const
+{
+  out_image.create(in_image.rows, in_image.cols, GetImageType());
+  const auto width = static_cast<size_t>(in_image.cols);
+  tbb::parallel_for(tbb::blocked_range<int>(0, in_image.rows),
+                    [&](const tbb::blocked_range<int> &rows) {
+                      for (int y = rows.begin(); y != rows.end(); ++y)
+                        ConvertRow(in_image.ptr<float>(y), width,
+                                   out_image.ptr(y));
+                    });
+}
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,103 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       image_output.h
+//! \brief      Conversion of rendered images to output pixel formats
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "core/types.h"
+
+namespace olio {
+namespace core {
+
+//! \enum OutputDepth
+//! \brief Channel type of written images
+enum class OutputDepth {
+  kAuto,    //!< kFloat for exr images, kUChar otherwise
+  kUChar,   //!< 8-bit, gamma corrected
+  kUShort,  //!< 16-bit, gamma corrected (png, tiff, ppm)
+  kHalf,    //!< 16-bit float, linear (exr)
+  kFloat    //!< 32-bit float, linear (exr)
+};
+
+//! \struct ImageOutputOptions
+//! \brief Parameters of RayTracer::WriteImage()
+struct ImageOutputOptions {
+  Real gamma{1};        //!< display gamma (integer depths only)
+  Real exposure{1};     //!< factor the rendered colors are scaled by
+  OutputDepth depth{OutputDepth::kAuto};  //!< channel type
+};
+
+//! \class OutputConverter
+//! \brief Converts float RGB images to the BGR buffers encoded by
+//!        cv::imwrite()
+//! \details Exposure, gamma correction, quantization, and the channel
+//!    swap are done in a single pass over each row, with the rows
+//!    converted in parallel. Gamma correction uses a table of the gamma
+//!    curve sampled 256 times per octave of the input and linearly
+//!    interpolated, which is accurate to a fraction of a 16-bit step.
+//!    Half float images are written as float buffers, which the exr
+//!    encoder stores as half (see GetWriteParams()).
+class OutputConverter {
+public:
+  //! \brief Constructor
+  //! \param[in] depth Output channel type (kAuto is treated as kUChar)
+  //! \param[in] exposure Factor colors are scaled by
+  //! \param[in] gamma Display gamma (ignored for float depths)
+  OutputConverter(OutputDepth depth, Real exposure=1, Real gamma=1);
+
+  //! \brief Get the OpenCV type of output images
+  //! \return CV_8UC3, CV_16UC3, or CV_32FC3
+  int GetImageType() const;
+
+  //! \brief Get the cv::imwrite() parameters of output images
+  //! \return Encoder parameters
+  std::vector<int> GetWriteParams() const;
+
+  //! \brief Convert a row of pixels
+  //! \param[in] rgb Input pixels (3 floats each, RGB order)
+  //! \param[in] width Number of pixels
+  //! \param[out] bgr Output pixels (3 channels of the output type each,
+  //!             BGR order)
+  void ConvertRow(const float *rgb, size_t width, void *bgr) const;
+
+  //! \brief Convert an image, row-parallel
+  //! \param[in] in_image Input image; must be of type CV_32FC3
+  //! \param[out] out_image Output image of type GetImageType(); it is
+  //!             (re)allocated if needed
+  void Convert(const cv::Mat &in_image, cv::Mat &out_image) const;
+
+  //! \brief Gamma correct a value in [0, 1] with the gamma table
+  //! \param[in] value Input value
+  //! \return value^(1/gamma)
+  float GammaCorrect(float value) const;
+protected:
+  //! \brief Scale, clamp to [0, 1], and gamma correct a value
+  //! \param[in] value Input value
+  //! \return Display value in [0, 1]
+  inline float ToDisplay(float value) const {
+    value *= exposure_;
+    if (!(value > 0))
+      return 0;
+    if (value >= 1)
+      return 1;
+    return gamma_table_.empty() ? value : GammaCorrect(value);
+  }
+
+  OutputDepth depth_;              //!< output channel type
+  float exposure_;                 //!< color scale
+  float gamma_inv_;                //!< 1 / gamma
+  std::vector<float> gamma_table_; //!< gamma curve (empty if gamma is 1)
+};
+
+}  // namespace core
+}  // namespace olio
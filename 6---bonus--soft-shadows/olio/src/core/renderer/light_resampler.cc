@@ -0,0 +1,314 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       light_resampler.cc
+//! \brief      Reservoir-based resampling of primary hit light samples
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/light_resampler.h"
+#include <algorithm>
+#include <cmath>
+#include "core/material/material.h"
+#include "core/renderer/ray_stats.h"
+#include "core/renderer/pixel_diagnostics.h"
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+// resampling passes of a camera sample (see LightResampler::StartPass())
+const uint kCandidatePass = 0;
+const uint kTemporalPass = 1;
+const uint kSpatialPass = 2;
+
+
+//! \brief Compute luminance of a linear RGB color
+//! \param[in] color Input color
+//! \return Luminance
+inline Real
+Luminance(const Vec3r &color)
+{
+  return Real{0.2126} * color[0] + Real{0.7152} * color[1] +
+    Real{0.0722} * color[2];
+}
+
+
+//! \brief Get the lookup key of a camera sample
+//! \param[in] pixel Pixel coordinates
+//! \param[in] sample_index Index of the sample in the pixel
+//! \return Key
+inline uint64_t
+SampleKey(const Vec2i &pixel, uint sample_index)
+{
+  return (static_cast<uint64_t>(static_cast<uint32_t>(pixel[1]) & 0xffffff)
+          << 40) |
+    (static_cast<uint64_t>(static_cast<uint32_t>(pixel[0]) & 0xffffff) << 16) |
+    (static_cast<uint64_t>(sample_index) & 0xffff);
+}
+
+
+//! \brief Mirror a coordinate that is out of a range back into it
+//! \param[in] value Coordinate
+//! \param[in] lo Smallest coordinate of the range
+//! \param[in] hi Largest coordinate of the range
+//! \return Coordinate in [lo, hi]
+inline int
+MirrorIntoRange(int value, int lo, int hi)
+{
+  if (value < lo)
+    value = 2 * lo - value;
+  else if (value > hi)
+    value = 2 * hi - value;
+  return std::min(std::max(value, lo), hi);
+}
+
+}  // namespace
+
+
+void
+Reservoir::Update(int32_t candidate_light, const Vec3r &candidate_point,
+                  Real candidate_target, Real weight, Real candidate_count,
+                  Real u)
+{
+  count += candidate_count;
+  if (!(weight > 0))
+    return;
+  weight_sum += weight;
+  if (u * weight_sum < weight) {
+    light = candidate_light;
+    point = candidate_point;
+    target = candidate_target;
+  }
+}
+
+
+void
+Reservoir::Finalize()
+{
+  if (light < 0 || !(target > 0) || !(count > 0))
+    contribution_weight = 0;
+  else
+    contribution_weight = weight_sum / (count * target);
+}
+
+
+void
+ReservoirFrame::Reset(int image_width, int image_height)
+{
+  width = image_width;
+  height = image_height;
+  reservoirs.assign(static_cast<size_t>(std::max(width, 0)) *
+                    static_cast<size_t>(std::max(height, 0)), Reservoir{});
+}
+
+
+LightResampler::LightResampler(const LightResamplingOptions &options,
+                               const Sampler &sampler,
+                               const LightTree &light_tree) :
+  options_{options},
+  sampler_{sampler},
+  light_tree_{light_tree}
+{
+}
+
+
+void
+LightResampler::StartPass(const CameraSample &sample, uint pass)
+{
+  sampler_.StartPixelSample(sample.pixel, sample.sample_index);
+  sampler_.StartBounce(kResamplingBounce + pass);
+}
+
+
+Real
+LightResampler::Target(const vector<Light::Ptr> &lights, size_t i,
+                       int32_t light, const Vec3r &point) const
+{
+  if (light < 0)
+    return 0;
+  return std::max(Real{0}, Luminance(lights[static_cast<size_t>(light)]->
+                                     EvaluatePoint(hits_[i], view_vecs_[i],
+                                                   point)));
+}
+
+
+bool
+LightResampler::IsSimilar(const Reservoir &other, const Reservoir &reservoir)
+{
+  return other.light >= 0 && other.normal.dot(reservoir.normal) > Real{0.9} &&
+    std::fabs(other.distance - reservoir.distance) <=
+    Real{0.1} * reservoir.distance;
+}
+
+
+void
+LightResampler::Resample(const vector<CameraSample> &samples,
+                         const Surface::Ptr &scene,
+                         const vector<Light::Ptr> &lights,
+                         const ReservoirFrame *previous,
+                         ReservoirFrame *current, vector<Vec3r> &radiance)
+{
+  const size_t num_samples = samples.size();
+  radiance.assign(num_samples, Vec3r{0, 0, 0});
+  hits_.resize(num_samples);
+  view_vecs_.resize(num_samples);
+  valid_.assign(num_samples, 0);
+  reservoirs_.assign(num_samples, Reservoir{});
+  sample_lookup_.clear();
+  Vec2i pixel_min{0, 0}, pixel_max{0, 0};
+  if (num_samples)
+    pixel_min = pixel_max = samples[0].pixel;
+
+  // primary hits (not counted as rays: the integrators trace them
+  // too) and their candidates
+  for (size_t i = 0; i < num_samples; ++i) {
+    const auto &ray = samples[i].ray;
+    auto &hit_record = hits_[i];
+    sample_lookup_[SampleKey(samples[i].pixel, samples[i].sample_index)] =
+      static_cast<uint32_t>(i);
+    pixel_min = pixel_min.cwiseMin(samples[i].pixel);
+    pixel_max = pixel_max.cwiseMax(samples[i].pixel);
+    OLIO_DIAGNOSTICS_SAMPLE(i);
+    if (!scene->Hit(ray, kEpsilon, kInfinity, hit_record))
+      continue;
+    const auto &material = hit_record.GetSurface()->GetMaterial();
+    if (!material || material->GetKind() != MaterialKind::kPhong)
+      continue;
+    hit_record.ComputeShading(ray);
+    valid_[i] = 1;
+    view_vecs_[i] = -ray.GetDirection().normalized();
+
+    auto &reservoir = reservoirs_[i];
+    reservoir.normal = hit_record.GetNormal();
+    reservoir.distance = hit_record.GetRayT() * ray.GetDirection().norm();
+    StartPass(samples[i], kCandidatePass);
+    for (uint c = 0; c < options_.candidates; ++c) {
+      Real u_light = sampler_.Get1D();
+      const Vec2r &u_point = sampler_.Get2D();
+      Real u_keep = sampler_.Get1D();
+      uint32_t light;
+      Real light_pmf, point_pdf;
+      Vec3r point{0, 0, 0};
+      if (!light_tree_.Pick(hit_record.GetPoint(), reservoir.normal, u_light,
+                            light, light_pmf) ||
+          !lights[light]->SamplePoint(u_point, point, point_pdf)) {
+        reservoir.Update(-1, point, 0, 0, 1, u_keep);
+        continue;
+      }
+      auto light_index = static_cast<int32_t>(light);
+      Real target = Target(lights, i, light_index, point);
+      reservoir.Update(light_index, point, target,
+                       target / (light_pmf * point_pdf), 1, u_keep);
+    }
+    reservoir.Finalize();
+  }
+
+  // temporal reuse: merge the pixel's reservoir of the previous frame,
+  // whose candidate count is capped
+  const Real max_count = static_cast<Real>(options_.max_history) *
+    static_cast<Real>(std::max(options_.candidates, 1u));
+  if (options_.temporal && previous) {
+    for (size_t i = 0; i < num_samples; ++i) {
+      if (!valid_[i])
+        continue;
+      const Reservoir *history = previous->At(samples[i].pixel);
+      if (!history || !IsSimilar(*history, reservoirs_[i]))
+        continue;
+      StartPass(samples[i], kTemporalPass);
+      const auto &reservoir = reservoirs_[i];
+      Reservoir merged;
+      merged.normal = reservoir.normal;
+      merged.distance = reservoir.distance;
+      merged.Update(reservoir.light, reservoir.point, reservoir.target,
+                    reservoir.target * reservoir.contribution_weight *
+                    reservoir.count, reservoir.count, sampler_.Get1D());
+      Real count = std::min(history->count, max_count);
+      Real target = Target(lights, i, history->light, history->point);
+      merged.Update(history->light, history->point, target,
+                    target * history->contribution_weight * count, count,
+                    sampler_.Get1D());
+      merged.Finalize();
+      reservoirs_[i] = merged;
+    }
+  }
+
+  // spatial reuse: merge the reservoirs of random neighbors of the
+  // batch, read from reservoirs_ so the order samples are processed in
+  // does not matter. Offsets that leave the batch's pixel bounds are
+  // mirrored back into them, so samples at the edges of a tile find as
+  // many neighbors as the others and tile seams do not show.
+  resampled_ = reservoirs_;
+  for (size_t i = 0; i < num_samples; ++i) {
+    if (!valid_[i] || !options_.spatial_neighbors)
+      continue;
+    StartPass(samples[i], kSpatialPass);
+    const auto &reservoir = reservoirs_[i];
+    Reservoir merged;
+    merged.normal = reservoir.normal;
+    merged.distance = reservoir.distance;
+    merged.Update(reservoir.light, reservoir.point, reservoir.target,
+                  reservoir.target * reservoir.contribution_weight *
+                  reservoir.count, reservoir.count, sampler_.Get1D());
+    for (uint k = 0; k < options_.spatial_neighbors; ++k) {
+      const Vec2r &offset = sampler_.Get2D();
+      Real u_keep = sampler_.Get1D();
+      Vec2i pixel;
+      for (int d = 0; d < 2; ++d) {
+        pixel[d] = MirrorIntoRange(
+          samples[i].pixel[d] + static_cast<int>(std::lround(
+              (2 * offset[d] - 1) * options_.spatial_radius)),
+          pixel_min[d], pixel_max[d]);
+      }
+      auto neighbor = sample_lookup_.find(SampleKey(pixel,
+                                                    samples[i].sample_index));
+      if (neighbor == sample_lookup_.end() || neighbor->second == i ||
+          !valid_[neighbor->second])
+        continue;
+      const auto &other = reservoirs_[neighbor->second];
+      if (!IsSimilar(other, reservoir))
+        continue;
+      Real target = Target(lights, i, other.light, other.point);
+      merged.Update(other.light, other.point, target,
+                    target * other.contribution_weight * other.count,
+                    other.count, u_keep);
+    }
+    merged.Finalize();
+    resampled_[i] = merged;
+  }
+
+  // one shadow ray per hit point
+  for (size_t i = 0; i < num_samples; ++i) {
+    if (!valid_[i])
+      continue;
+    auto &reservoir = resampled_[i];
+    if (reservoir.light >= 0 && reservoir.contribution_weight > 0) {
+      const auto &hit_position = hits_[i].GetPoint();
+      OLIO_DIAGNOSTICS_SAMPLE(i);
+      CountRay(RayType::kShadow);
+      if (scene->Occluded(Ray{hit_position, reservoir.point - hit_position},
+                          kEpsilon, 1)) {
+        reservoir.contribution_weight = 0;  // not reused by the next frame
+      } else {
+        const auto &light = lights[static_cast<size_t>(reservoir.light)];
+        radiance[i] = light->EvaluatePoint(hits_[i], view_vecs_[i],
+                                           reservoir.point) *
+          reservoir.contribution_weight;
+      }
+    }
+    if (current) {
+      Reservoir *stored = current->At(samples[i].pixel);
+      if (stored)
+        *stored = reservoir;
+    }
+  }
+}
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,185 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       light_resampler.h
+//! \brief      Reservoir-based resampling of primary hit light samples
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "core/types.h"
+#include "core/ray.h"
+#include "core/geometry/surface.h"
+#include "core/light/light.h"
+#include "core/light/light_tree.h"
+#include "core/sampler/sampler.h"
+#include "core/renderer/wavefront.h"
+
+namespace olio {
+namespace core {
+
+//! \struct LightResamplingOptions
+//! \brief Parameters of the resampled direct lighting of primary hits
+//!        (see LightResampler)
+struct LightResamplingOptions {
+  bool enabled{false};        //!< resample primary hit light samples
+  uint candidates{8};         //!< candidate light samples per hit point
+  uint spatial_neighbors{4};  //!< neighbor reservoirs merged per hit point
+  Real spatial_radius{8};     //!< max neighbor distance in pixels
+  bool temporal{false};       //!< merge the previous frame's reservoirs
+  uint max_history{20};       //!< cap of merged candidates, in candidates
+};
+
+//! \struct Reservoir
+//! \brief Light sample kept out of a stream of weighted candidates
+//!        (weighted reservoir sampling)
+struct Reservoir {
+  int32_t light{-1};            //!< light of the kept sample (-1: none)
+  Vec3r point{0, 0, 0};         //!< point of the light
+  Real target{0};               //!< target function of the kept sample
+  Real weight_sum{0};           //!< sum of candidate weights
+  Real count{0};                //!< number of candidates seen
+  Real contribution_weight{0};  //!< unbiased contribution weight W
+  Vec3r normal{0, 0, 0};        //!< normal of the reservoir's hit point
+  Real distance{0};             //!< camera distance of the hit point
+
+  //! \brief Add a weighted candidate, which replaces the kept sample
+  //!        with probability weight / weight_sum
+  //! \param[in] candidate_light Light of the candidate
+  //! \param[in] candidate_point Point of the light
+  //! \param[in] candidate_target Target function of the candidate
+  //! \param[in] weight Resampling weight of the candidate
+  //! \param[in] candidate_count Candidates the candidate stands for
+  //! \param[in] u Random value in [0, 1)
+  void Update(int32_t candidate_light, const Vec3r &candidate_point,
+              Real candidate_target, Real weight, Real candidate_count,
+              Real u);
+
+  //! \brief Compute contribution_weight from the candidates seen
+  void Finalize();
+};
+
+//! \struct ReservoirFrame
+//! \brief Final reservoirs of one rendered frame, one per pixel
+struct ReservoirFrame {
+  int width{0};                        //!< image width
+  int height{0};                       //!< image height
+  std::vector<Reservoir> reservoirs;   //!< reservoirs in row-major order
+
+  //! \brief Remove all reservoirs and set the image size
+  //! \param[in] image_width Image width
+  //! \param[in] image_height Image height
+  void Reset(int image_width, int image_height);
+
+  //! \brief Get the reservoir of a pixel
+  //! \param[in] pixel Pixel coordinates
+  //! \return Reservoir, or nullptr if the pixel is outside the frame
+  Reservoir *At(const Vec2i &pixel) {
+    if (pixel[0] < 0 || pixel[1] < 0 || pixel[0] >= width ||
+        pixel[1] >= height || reservoirs.empty())
+      return nullptr;
+    return &reservoirs[static_cast<size_t>(pixel[1]) *
+                       static_cast<size_t>(width) +
+                       static_cast<size_t>(pixel[0])];
+  }
+
+  //! \brief Get the reservoir of a pixel
+  //! \param[in] pixel Pixel coordinates
+  //! \return Reservoir, or nullptr if the pixel is outside the frame
+  const Reservoir *At(const Vec2i &pixel) const {
+    return const_cast<ReservoirFrame*>(this)->At(pixel);
+  }
+};
+
+//! \class LightResampler
+//! \brief Computes the direct lighting of the primary hits of a batch
+//!        of camera samples with one shadow ray each (ReSTIR)
+//! \details For every camera sample that hits a Phong surface:
+//!    1. candidates light samples are drawn, by picking a light from
+//!       the LightTree and a point of it with Light::SamplePoint(). No
+//!       shadow rays are traced; a candidate's target function is the
+//!       luminance of its unshadowed radiance (Light::EvaluatePoint()).
+//!       One candidate is kept in a Reservoir.
+//!    2. If temporal reuse is on, the pixel's reservoir from the
+//!       previous frame is merged, assuming a static camera.
+//!    3. The reservoirs of spatial_neighbors random samples of the
+//!       batch (same sample index, within spatial_radius pixels) are
+//!       merged. Neighbors with different normals or depths are
+//!       skipped. Only the batch's samples are known, so neighbors are
+//!       picked within the bounding box of its pixels (a tile, for
+//!       RayTracer): offsets that leave it are mirrored back inside.
+//!    4. One shadow ray is traced to the kept sample.
+//!    Merging uses the biased (1/M) normalization: the result is
+//!    consistent, but slightly darker at geometric discontinuities.
+//!    Only lights of the tree are resampled; the integrators skip them
+//!    at primary hits (see LightTree::GetOtherLights()).
+class LightResampler {
+public:
+  //! \brief Sampler bounce the resampling passes draw from; paths
+  //!        never get this deep
+  static constexpr uint kResamplingBounce = 0xfff0;
+
+  //! \brief Constructor
+  //! \param[in] options Resampling options
+  //! \param[in] sampler Sampler of the per-pixel sample streams
+  //! \param[in] light_tree Tree the candidate lights are picked from
+  LightResampler(const LightResamplingOptions &options, const Sampler &sampler,
+                 const LightTree &light_tree);
+
+  //! \brief Compute the resampled direct lighting of the primary hits
+  //!        of a batch of camera samples
+  //! \param[in] samples Camera samples
+  //! \param[in] scene Input scene
+  //! \param[in] lights Scene lights (the light tree is built over them)
+  //! \param[in] previous Reservoirs of the previous frame (may be nullptr)
+  //! \param[out] current Final reservoirs are stored per pixel in this
+  //!             frame (may be nullptr)
+  //! \param[out] radiance Direct lighting of each camera sample
+  void Resample(const std::vector<CameraSample> &samples,
+                const Surface::Ptr &scene,
+                const std::vector<Light::Ptr> &lights,
+                const ReservoirFrame *previous, ReservoirFrame *current,
+                std::vector<Vec3r> &radiance);
+protected:
+  //! \brief Restart sampler_ for a resampling pass of a camera sample
+  //! \param[in] sample Camera sample
+  //! \param[in] pass Pass index
+  void StartPass(const CameraSample &sample, uint pass);
+
+  //! \brief Evaluate the target function of a light point at a hit
+  //! \param[in] lights Scene lights
+  //! \param[in] i Index of the camera sample
+  //! \param[in] light Light index
+  //! \param[in] point Point of the light
+  //! \return Luminance of the unshadowed radiance
+  Real Target(const std::vector<Light::Ptr> &lights, size_t i,
+              int32_t light, const Vec3r &point) const;
+
+  //! \brief Check whether a reservoir can be reused at a hit point
+  //! \param[in] other Reservoir to reuse
+  //! \param[in] reservoir Reservoir of the hit point
+  //! \return True if the normals and camera distances are similar
+  static bool IsSimilar(const Reservoir &other, const Reservoir &reservoir);
+
+  LightResamplingOptions options_;  //!< resampling options
+  Sampler sampler_;                 //!< sampler re-keyed per pass
+  const LightTree &light_tree_;     //!< candidate light picks
+
+  std::vector<HitRecord> hits_;     //!< primary hit of each camera sample
+  std::vector<Vec3r> view_vecs_;    //!< view vector of each hit
+  std::vector<char> valid_;         //!< whether a sample hit Phong
+  std::vector<Reservoir> reservoirs_;   //!< reservoirs before spatial reuse
+  std::vector<Reservoir> resampled_;    //!< reservoirs after spatial reuse
+  std::unordered_map<uint64_t, uint32_t> sample_lookup_;  //!< camera
+                                    //!< sample of (pixel, sample index)
+};
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,74 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       path_options.cc
+//! \brief      Path pruning and Russian roulette options
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/path_options.h"
+
+namespace olio {
+namespace core {
+
+bool
+ContinuePath(const PathOptions &options, const Vec3r &throughput,
+             Sampler &sampler, Real &weight)
+{
+  weight = 1;
+  if (options.min_throughput <= 0)
+    return true;
+  Real max_throughput = throughput.maxCoeff();
+  if (max_throughput >= options.min_throughput)
+    return true;
+  if (!options.russian_roulette)
+    return false;
+
+  // survive with a probability proportional to the throughput
+  Real survival = max_throughput / options.min_throughput;
+  if (sampler.Get1D() >= survival)
+    return false;
+  weight = 1 / survival;
+  return true;
+}
+
+
+void
+SelectGlassRays(const PathOptions &options, const Vec3r &throughput,
+                Sampler &sampler, ScatterResult &scatter)
+{
+  // follow a single ray: reflect with probability reflect_weight
+  if (options.glass_sampling == GlassSampling::kSchlick &&
+      scatter.has_reflect_ray && scatter.has_refract_ray) {
+    if (sampler.Get1D() < scatter.reflect_weight) {
+      scatter.has_refract_ray = false;
+      scatter.reflect_weight = 1;
+    } else {
+      scatter.has_reflect_ray = false;
+      scatter.refract_weight = 1;
+    }
+  }
+
+  // prune/roulette low throughput rays
+  Real weight;
+  if (scatter.has_refract_ray) {
+    if (ContinuePath(options, throughput.cwiseProduct(scatter.attenuation) *
+                     scatter.refract_weight, sampler, weight))
+      scatter.refract_weight *= weight;
+    else
+      scatter.has_refract_ray = false;
+  }
+  if (scatter.has_reflect_ray) {
+    if (ContinuePath(options, throughput.cwiseProduct(scatter.attenuation) *
+                     scatter.reflect_weight, sampler, weight))
+      scatter.reflect_weight *= weight;
+    else
+      scatter.has_reflect_ray = false;
+  }
+}
+
+}  // namespace core
+}  // namespace olio
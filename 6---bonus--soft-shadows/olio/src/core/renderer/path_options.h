@@ -0,0 +1,64 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       path_options.h
+//! \brief      Path pruning and Russian roulette options
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include "core/types.h"
+#include "core/sampler/sampler.h"
+#include "core/material/phong_dielectric.h"
+
+namespace olio {
+namespace core {
+
+//! \enum GlassSampling
+//! \brief Which rays are traced at a glass hit point
+enum class GlassSampling {
+  kSplit,    //!< both the reflection and the refraction ray
+  kSchlick   //!< one of them, picked with Schlick's reflectance
+};
+
+//! \struct PathOptions
+//! \brief Parameters that limit the number of secondary rays
+//! \details The throughput of a ray is the factor its color is
+//!    multiplied by before it's added to its pixel (product of the
+//!    mirror colors, glass attenuations and reflectances along the
+//!    path). Rays with a throughput (max component) below
+//!    min_throughput are dropped, or played Russian roulette with if
+//!    russian_roulette is set, which keeps the image unbiased.
+struct PathOptions {
+  Real min_throughput{0};    //!< throughput pruning threshold (0: off)
+  bool russian_roulette{false};  //!< roulette instead of dropping rays
+  GlassSampling glass_sampling{GlassSampling::kSplit};  //!< glass rays
+};
+
+//! \brief Decide whether to trace a secondary ray
+//! \details Draws from the sampler only when russian roulette is played.
+//! \param[in] options Path options
+//! \param[in] throughput Throughput of the ray
+//! \param[in] sampler Sampler of the ray's parent hit point
+//! \param[out] weight Factor for the ray's color (1/survival probability)
+//! \return True if the ray should be traced
+bool ContinuePath(const PathOptions &options, const Vec3r &throughput,
+                  Sampler &sampler, Real &weight);
+
+//! \brief Pick the rays traced at a glass hit point
+//! \details Applies the glass sampling method and ContinuePath() to
+//!    the rays created by PhongDielectric::Scatter(): dropped rays are
+//!    unflagged and the weights of traced rays are updated.
+//! \param[in] options Path options
+//! \param[in] throughput Throughput of the ray that hit the glass
+//! \param[in] sampler Sampler of the hit point
+//! \param[in,out] scatter Scattered rays
+void SelectGlassRays(const PathOptions &options, const Vec3r &throughput,
+                     Sampler &sampler, ScatterResult &scatter);
+
+}  // namespace core
+}  // namespace olio
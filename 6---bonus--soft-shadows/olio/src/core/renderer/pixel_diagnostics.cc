@@ -0,0 +1,23 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       pixel_diagnostics.cc
+//! \brief      Per-pixel traversal and shading counters
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/pixel_diagnostics.h"
+
+namespace olio {
+namespace core {
+
+#ifdef OLIO_ENABLE_DIAGNOSTICS
+thread_local PixelDiagnostics *thread_sample_diagnostics = nullptr;
+thread_local PixelDiagnostics *thread_diagnostics = nullptr;
+#endif
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,98 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       pixel_diagnostics.h
+//! \brief      Per-pixel traversal and shading counters
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include "core/types.h"
+
+namespace olio {
+namespace core {
+
+//! \struct PixelDiagnostics
+//! \brief Work done to trace one camera sample, or the sum over the
+//!        samples of a pixel
+struct PixelDiagnostics {
+  uint64_t bvh_nodes{0};        //!< BVH bounding boxes tested
+  uint64_t primitive_tests{0};  //!< primitives tested against rays
+  uint64_t shadow_rays{0};      //!< shadow rays cast
+  uint64_t max_depth{0};        //!< deepest ray traced (1: primary ray)
+  uint64_t samples{0};          //!< camera samples summed (pixels only)
+
+  //! \brief Add the counters of a camera sample
+  //! \param[in] sample Diagnostics of the sample
+  void AddSample(const PixelDiagnostics &sample) {
+    bvh_nodes += sample.bvh_nodes;
+    primitive_tests += sample.primitive_tests;
+    shadow_rays += sample.shadow_rays;
+    max_depth = max_depth > sample.max_depth ? max_depth : sample.max_depth;
+    ++samples;
+  }
+};
+
+#ifdef OLIO_ENABLE_DIAGNOSTICS
+
+//! \brief Whether the counters below are compiled in
+constexpr bool kDiagnosticsCompiled = true;
+
+//! \brief Diagnostics of the camera samples the calling thread is
+//!        tracing, indexed by sample (nullptr: not recording)
+extern thread_local PixelDiagnostics *thread_sample_diagnostics;
+
+//! \brief Diagnostics of the camera sample the calling thread is
+//!        currently tracing (nullptr: not recording)
+extern thread_local PixelDiagnostics *thread_diagnostics;
+
+//! \brief Start recording into an array of per-sample diagnostics on
+//!        the calling thread (nullptr: stop recording)
+#define OLIO_DIAGNOSTICS_BEGIN(diagnostics)                             \
+  (::olio::core::thread_sample_diagnostics = (diagnostics),             \
+   ::olio::core::thread_diagnostics = nullptr)
+
+//! \brief Attribute the following work of the calling thread to the
+//!        camera sample with the given index
+#define OLIO_DIAGNOSTICS_SAMPLE(index)                                  \
+  (::olio::core::thread_diagnostics =                                   \
+   ::olio::core::thread_sample_diagnostics ?                            \
+   ::olio::core::thread_sample_diagnostics + (index) : nullptr)
+
+//! \brief Add to a counter of the current camera sample
+#define OLIO_DIAGNOSTICS_ADD(field, count)                              \
+  do {                                                                  \
+    if (::olio::core::thread_diagnostics)                               \
+      ::olio::core::thread_diagnostics->field += (count);               \
+  } while (0)
+
+//! \brief Record that the current camera sample traced a ray of the
+//!        given depth (1: primary ray)
+#define OLIO_DIAGNOSTICS_DEPTH(depth)                                   \
+  do {                                                                  \
+    auto olio_diagnostics_ = ::olio::core::thread_diagnostics;          \
+    if (olio_diagnostics_ && olio_diagnostics_->max_depth < (depth))    \
+      olio_diagnostics_->max_depth = (depth);                           \
+  } while (0)
+
+#else
+
+//! \brief Whether the counters are compiled in (build with
+//!        OLIO_ENABLE_DIAGNOSTICS to enable them)
+constexpr bool kDiagnosticsCompiled = false;
+
+// without OLIO_ENABLE_DIAGNOSTICS, the counters compile to nothing
+#define OLIO_DIAGNOSTICS_BEGIN(diagnostics) ((void)0)
+#define OLIO_DIAGNOSTICS_SAMPLE(index) ((void)0)
+#define OLIO_DIAGNOSTICS_ADD(field, count) ((void)0)
+#define OLIO_DIAGNOSTICS_DEPTH(depth) ((void)0)
+
+#endif
+
+}  // namespace core
+}  // namespace olio
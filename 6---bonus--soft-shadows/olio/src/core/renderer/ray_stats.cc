@@ -0,0 +1,29 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       ray_stats.cc
+//! \brief      Per-thread ray counters
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/ray_stats.h"
+
+namespace olio {
+namespace core {
+
+thread_local RayCounts thread_ray_counts{};
+
+
+RayCounts
+TakeThreadRayCounts()
+{
+  auto counts = thread_ray_counts;
+  thread_ray_counts = RayCounts{};
+  return counts;
+}
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,80 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       ray_stats.h
+//! \brief      Per-thread ray counters
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include "core/types.h"
+#include "core/renderer/pixel_diagnostics.h"
+
+namespace olio {
+namespace core {
+
+//! \enum RayType
+//! \brief Kinds of rays traced during rendering
+enum class RayType {
+  kPrimary,    //!< camera rays
+  kSecondary,  //!< reflection and refraction rays
+  kShadow,     //!< light visibility rays
+  kCount       //!< number of ray types
+};
+
+//! \struct RayCounts
+//! \brief Number of rays traced, per RayType
+struct RayCounts {
+  uint64_t counts[static_cast<int>(RayType::kCount)];  //!< count per type
+
+  //! \brief Get count of one ray type
+  //! \param[in] type Ray type
+  //! \return Number of rays
+  uint64_t Get(RayType type) const {return counts[static_cast<int>(type)];}
+
+  //! \brief Get count of all ray types
+  //! \return Number of rays
+  uint64_t GetTotal() const {
+    uint64_t total = 0;
+    for (auto count : counts)
+      total += count;
+    return total;
+  }
+
+  //! \brief Accumulate counts
+  //! \param[in] other Counts to add
+  //! \return This object
+  RayCounts &operator+=(const RayCounts &other) {
+    for (int i = 0; i < static_cast<int>(RayType::kCount); ++i)
+      counts[i] += other.counts[i];
+    return *this;
+  }
+};
+
+//! \brief Rays counted by the calling thread since the last call to
+//!        TakeThreadRayCounts()
+extern thread_local RayCounts thread_ray_counts;
+
+//! \brief Count a traced ray on the calling thread
+//! \details Counting is a plain increment of a thread-local counter,
+//!    so it is cheap enough for every ray. Renderers collect the
+//!    counts with TakeThreadRayCounts() once per unit of work.
+//! \param[in] type Ray type
+inline void CountRay(RayType type)
+{
+  ++thread_ray_counts.counts[static_cast<int>(type)];
+  if (type == RayType::kShadow)
+    OLIO_DIAGNOSTICS_ADD(shadow_rays, 1);
+}
+
+//! \brief Get and reset the calling thread's ray counts
+//! \return Rays counted since the previous call on this thread
+RayCounts TakeThreadRayCounts();
+
+}  // namespace core
+}  // namespace olio
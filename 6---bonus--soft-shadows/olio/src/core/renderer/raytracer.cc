@@ -24,14 +24,18 @@ namespace core {
 using namespace std;
 
 bool
-RayTracer::RayColor(const Ray &ray, Surface::Ptr scene,
+RayTracer::RayColor(const Ray &ray, const Surface::Ptr &scene,
                     const std::vector<Light::Ptr> &lights, uint ray_depth,
-                    uint max_ray_depth, Vec3r &ray_color)
+                    uint max_ray_depth, const Vec3r &throughput,
+                    Sampler &sampler, Vec3r &ray_color)
 {
   // check for when the ray bounces exceed the limit
   ray_color = Vec3r{0, 0, 0};
   if (ray_depth >= max_ray_depth)
     return false;
+  CountRay(ray_depth ? RayType::kSecondary : RayType::kPrimary);
+  OLIO_DIAGNOSTICS_DEPTH(ray_depth + 1);
+  sampler.StartBounce(ray_depth + 1);  // bounce 0 is used for pixel sampling
 
   // check whether ray hits any scene object
   HitRecord hit_record;
@@ -41,53 +45,91 @@ RayTracer::RayColor(const Ray &ray, Surface::Ptr scene,
   auto hit_surface = hit_record.GetSurface();
   if (!hit_surface)
     return false;
-  auto material = hit_surface->GetMaterial();
+  const auto &material = hit_surface->GetMaterial();
   if (!material) {
     spdlog::error("RayColor: surface has no material -- returning black.");
     return true;
   }
 
-  auto phong_material = dynamic_pointer_cast<PhongMaterial>(material);
-  if (phong_material) {
-    auto dielectric = dynamic_pointer_cast<PhongDielectric>(phong_material);
-    if (dielectric) {  // handle glass
-      shared_ptr<Ray> reflect_ray;
-      shared_ptr<Ray> refract_ray;
-      Real schlick_reflectance;
-      Vec3r attenuate = dielectric->Scatter(hit_record, ray, reflect_ray,
-                                            refract_ray, schlick_reflectance);
-      if (refract_ray) {  // refract
+  auto material_kind = material->GetKind();
+  if (material_kind != MaterialKind::kNone) {
+    // shading attributes of the closest hit only
+    hit_record.ComputeShading(ray);
+    if (material_kind == MaterialKind::kDielectric) {  // handle glass
+      auto dielectric = static_cast<const PhongDielectric*>(material.get());
+      auto scatter = dielectric->Scatter(hit_record, ray);
+      const auto &attenuate = scatter.attenuation;
+
+      // pick the rays to trace before recursing: the recursion
+      // restarts the sampler's stream
+      SelectGlassRays(path_options_, throughput, sampler, scatter);
+
+      // the two subtrees draw from streams of their own branches, so
+      // their samples aren't correlated
+      const auto branch = sampler.GetBranch();
+      if (scatter.has_refract_ray) {  // refract
         Vec3r refract_color;
-        if (RayColor(*refract_ray, scene, lights, ray_depth + 1, max_ray_depth,
-                     refract_color)) {
+        sampler.SetBranch(Sampler::ChildBranch(branch, 0));
+        if (RayColor(scatter.refract_ray, scene, lights, ray_depth + 1,
+                     max_ray_depth, throughput.cwiseProduct(attenuate) *
+                     scatter.refract_weight, sampler, refract_color)) {
           ray_color += attenuate.cwiseProduct(refract_color *
-                                              (1.0f - schlick_reflectance));
+                                              scatter.refract_weight);
         }
       }
 
-      if (reflect_ray) {  // reflect
+      if (scatter.has_reflect_ray) {  // reflect
         Vec3r reflect_color;
-        if (RayColor(*reflect_ray, scene, lights, ray_depth + 1, max_ray_depth,
-                     reflect_color)) {
-          ray_color += attenuate.cwiseProduct(reflect_color * schlick_reflectance);
+        sampler.SetBranch(Sampler::ChildBranch(branch, 1));
+        if (RayColor(scatter.reflect_ray, scene, lights, ray_depth + 1,
+                     max_ray_depth, throughput.cwiseProduct(attenuate) *
+                     scatter.reflect_weight, sampler, reflect_color)) {
+          ray_color += attenuate.cwiseProduct(reflect_color *
+                                              scatter.reflect_weight);
         }
       }
+      sampler.SetBranch(branch);
     } else {
+      auto phong_material = static_cast<const PhongMaterial*>(material.get());
       // compute normal Phong shading
       Vec3r view_vec = -ray.GetDirection().normalized();
-      for (auto light : lights)
-        ray_color += light->Illuminate(hit_record, view_vec, scene);
+      if (ray_depth == 0 && primary_lights_) {
+        // the other lights are resampled (see LightResampler)
+        for (auto light : *primary_lights_)
+          ray_color += lights[light]->Illuminate(hit_record, view_vec, scene,
+                                                 sampler);
+      } else if (!light_budget_ || light_tree_.IsEmpty()) {
+        for (const auto &light : lights)
+          ray_color += light->Illuminate(hit_record, view_vec, scene, sampler);
+      } else {
+        // only evaluate the lights picked from the light tree
+        static thread_local vector<LightPick> picks;
+        picks.clear();
+        light_tree_.Select(hit_record.GetPoint(), hit_record.GetNormal(),
+                           sampler, picks);
+        for (const auto &pick : picks) {
+          ray_color += lights[pick.light]->Illuminate(hit_record, view_vec,
+                                                      scene, sampler) *
+            pick.weight;
+        }
+      }
 
       // compute mirror reflections
       const auto &v = ray.GetDirection();
       const auto &n = hit_record.GetNormal();
       const Vec3r &reflect = v - 2 * v.dot(n) * n;
       const auto &mirror = phong_material->GetMirror();
-      if (!mirror.isZero() && hit_record.IsFrontFace()) {
+      Real mirror_weight;
+      if (!mirror.isZero() && hit_record.IsFrontFace() &&
+          ContinuePath(path_options_, throughput.cwiseProduct(mirror), sampler,
+                       mirror_weight)) {
+        const Vec3r &weighted_mirror = mirror * mirror_weight;
         Vec3r reflect_color;
         if (RayColor(Ray{hit_record.GetPoint(), reflect}, scene,
-                     lights, ray_depth + 1, max_ray_depth, reflect_color))
-          ray_color += mirror.cwiseProduct(reflect_color);
+                     lights, ray_depth + 1, max_ray_depth,
+                     throughput.cwiseProduct(weighted_mirror), sampler,
+                     reflect_color))
+          ray_color += weighted_mirror.cwiseProduct(reflect_color);
       }
     }
   }
@@ -95,6 +137,216 @@ RayTracer::RayColor(const Ray &ray, Surface::Ptr scene,
 }
 
 
+void
+RayTracer::TraceSamples(const std::vector<CameraSample> &samples,
+                        Surface::Ptr scene,
+                        const std::vector<Light::Ptr> &lights,
+                        std::vector<Vec3r> &colors)
+{
+  Sampler sampler{seed_, sampler_type_, std::max(num_samples_per_pixel_, 1u)};
+  if (integrator_ == Integrator::kWavefront) {
+    WavefrontIntegrator integrator{max_ray_depth_, sampler, path_options_,
+                                   light_budget_ ? &light_tree_ : nullptr,
+                                   primary_lights_};
+    integrator.Trace(samples, scene, lights, colors);
+  } else {
+    colors.resize(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+      OLIO_DIAGNOSTICS_SAMPLE(i);
+      sampler.StartPixelSample(samples[i].pixel, samples[i].sample_index);
+      RayColor(samples[i].ray, scene, lights, 0, max_ray_depth_,
+               Vec3r{1, 1, 1}, sampler, colors[i]);
+    }
+  }
+
+  // add the resampled direct lighting of primary hits
+  if (primary_lights_ && max_ray_depth_) {
+    Sampler resampling_sampler{seed_ + resampling_frame_, sampler_type_,
+                               std::max(num_samples_per_pixel_, 1u)};
+    LightResampler resampler{light_resampling_, resampling_sampler,
+                             light_tree_};
+    vector<Vec3r> direct;
+    const bool temporal = light_resampling_.temporal;
+    resampler.Resample(samples, scene, lights,
+                       temporal ? &previous_reservoirs_ : nullptr,
+                       temporal ? &reservoirs_ : nullptr, direct);
+    for (size_t i = 0; i < samples.size(); ++i)
+      colors[i] += direct[i];
+  }
+}
+
+
+bool
+RayTracer::IsPixelDone(const PixelStats &stats) const
+{
+  if (stats.num_samples >= std::max(num_samples_per_pixel_, 1u))
+    return true;
+  if (adaptive_tolerance_ <= 0 || stats.num_samples < 2)
+    return false;
+
+  // stop once the standard error of the mean is small relative to
+  // the mean. Samples that all agree so far (e.g., the lit side of a
+  // penumbra) have no variance, so the error is taken to be at least
+  // the change one sample off by the mean would make to the mean.
+  auto n = static_cast<Real>(stats.num_samples);
+  Real mean = std::max(stats.mean, kAdaptiveMinLuminance);
+  Real mean_variance = std::max(stats.squared_deviations / ((n - 1) * n),
+                                mean * mean / (n * n));
+  Real max_error = adaptive_tolerance_ * mean;
+  return mean_variance <= max_error * max_error;
+}
+
+
+void
+RayTracer::RenderTile(const tbb::blocked_range2d<int> &tile,
+                      Surface::Ptr scene, const std::vector<Light::Ptr> &lights,
+                      Camera::Ptr camera, uint sample_limit)
+{
+  const int width = frame_width_;
+  const int height = frame_height_;
+  Real xscale = 1.0 / width;
+  Real yscale = 1.0 / height;
+  TakeThreadRayCounts();  // drop rays traced outside of tiles
+  auto progress_slot = progress_.BeginWork();
+
+  // adaptive sampling takes samples in batches of
+  // adaptive_min_samples_, non-adaptive sampling in a single batch
+  const uint max_samples = std::max(num_samples_per_pixel_, 1u);
+  Sampler sampler{seed_, sampler_type_, max_samples};
+  const bool adaptive = adaptive_tolerance_ > 0;
+  const uint batch_size = adaptive ?
+    std::min(std::max(adaptive_min_samples_, 2u), max_samples) : max_samples;
+  const bool jitter = adaptive || max_samples != 1;
+
+  // per-pixel color sums and running luminance stats, kept in
+  // accumulation_ across passes if the render is checkpointed
+  const int tile_width = static_cast<int>(tile.cols().size());
+  vector<PixelStats> tile_stats;
+  if (accumulation_.empty())
+    tile_stats.resize(tile.rows().size() * tile.cols().size());
+  auto pixel_stats = [&](int x, int y) -> PixelStats& {
+    if (accumulation_.empty()) {
+      return tile_stats[static_cast<size_t>((y - tile.rows().begin()) *
+                                            tile_width + x -
+                                            tile.cols().begin())];
+    }
+    return accumulation_[static_cast<size_t>(y) * static_cast<size_t>(width) +
+                         static_cast<size_t>(x)];
+  };
+
+  // every batch traces the next samples of all unfinished pixels of
+  // the tile together, so the wavefront integrator gets large queues
+  vector<CameraSample> samples;
+  vector<Vec3r> colors;
+  vector<PixelDiagnostics> sample_diagnostics;
+  const bool diagnostics = kDiagnosticsCompiled && !diagnostics_.empty();
+  while (true) {
+    samples.clear();
+    for (int y = tile.rows().begin(); y != tile.rows().end(); ++y) {
+      for (int x = tile.cols().begin(); x != tile.cols().end(); ++x) {
+        const auto &stats = pixel_stats(x, y);
+        if (stats.done)
+          continue;
+        uint batch_end = std::min(stats.num_samples + batch_size,
+                                  sample_limit);
+        for (uint s = stats.num_samples; s < batch_end; ++s) {
+          // each pixel sample draws from its own stream so the result
+          // does not depend on tile scheduling
+          sampler.StartPixelSample(Vec2i{x, y}, s);
+          Vec2r offset{0.5, 0.5};
+          if (jitter)
+            offset = sampler.Get2D();  //!< random floats in [0, 1)
+          CameraSample sample;
+          sample.pixel = Vec2i{x, y};
+          sample.sample_index = s;
+          sample.ray = camera->GetRay((x + offset[0]) * xscale,
+                                      (y + offset[1]) * yscale);
+          samples.push_back(sample);
+        }
+      }
+    }
+    if (samples.empty())
+      break;
+    if (diagnostics) {
+      // record the work of each sample, then add it to its pixel
+      sample_diagnostics.assign(samples.size(), PixelDiagnostics{});
+      OLIO_DIAGNOSTICS_BEGIN(sample_diagnostics.data());
+      TraceSamples(samples, scene, lights, colors);
+      OLIO_DIAGNOSTICS_BEGIN(nullptr);
+      for (size_t i = 0; i < samples.size(); ++i) {
+        const auto &pixel = samples[i].pixel;
+        diagnostics_[static_cast<size_t>(pixel[1]) *
+                     static_cast<size_t>(width) +
+                     static_cast<size_t>(pixel[0])].AddSample(
+                       sample_diagnostics[i]);
+      }
+    } else {
+      TraceSamples(samples, scene, lights, colors);
+    }
+
+    // update pixels in sample order
+    for (size_t i = 0; i < samples.size(); ++i) {
+      const auto &pixel = samples[i].pixel;
+      auto &stats = pixel_stats(pixel[0], pixel[1]);
+      const auto &ray_color = colors[i];
+      stats.color_sum = stats.color_sum + ray_color;
+
+      // Welford's update of luminance mean/variance
+      Real luminance = Luminance(ray_color);
+      Real delta = luminance - stats.mean;
+      stats.mean += delta / static_cast<Real>(stats.num_samples + 1);
+      stats.squared_deviations += delta * (luminance - stats.mean);
+      ++stats.num_samples;
+    }
+    for (int y = tile.rows().begin(); y != tile.rows().end(); ++y) {
+      for (int x = tile.cols().begin(); x != tile.cols().end(); ++x) {
+        auto &stats = pixel_stats(x, y);
+        stats.done = stats.done || IsPixelDone(stats);
+      }
+    }
+  }
+  // store the pixels in the image, or stream the tile to the file,
+  // after the last pass
+  uint64_t tile_samples = 0;
+  if (sample_limit >= max_samples) {
+    vector<float> tile_rgb;
+    if (tile_file_)
+      tile_rgb.reserve(tile.rows().size() * tile.cols().size() * 3);
+    for (int y = tile.rows().begin(); y != tile.rows().end(); ++y) {
+      for (int x = tile.cols().begin(); x != tile.cols().end(); ++x) {
+        const auto &stats = pixel_stats(x, y);
+        Vec3r pixel_color = stats.color_sum /
+          static_cast<Real>(stats.num_samples);
+        tile_samples += stats.num_samples;
+        if (tile_file_) {
+          for (int c = 0; c < 3; ++c)
+            tile_rgb.push_back(static_cast<float>(pixel_color[c]));
+          continue;
+        }
+        rendered_image_.at<cv::Vec3f>((height - y -1), x) =
+          cv::Vec3f{static_cast<float>(pixel_color[0]),
+                    static_cast<float>(pixel_color[1]),
+                    static_cast<float>(pixel_color[2])};
+        sample_count_image_.at<int>((height - y - 1), x) =
+          static_cast<int>(stats.num_samples);
+      }
+    }
+    if (tile_file_) {
+      const int tile_size = tile_file_->GetTileSize();
+      auto tile_index = static_cast<size_t>(
+        (tile.rows().begin() / tile_size) * tile_file_->GetNumTilesX() +
+        tile.cols().begin() / tile_size);
+      if (!tile_file_->WriteTile(tile_index, tile_rgb))
+        spdlog::error("RayTracer: failed to write tile {}", tile_index);
+    }
+  }
+
+  // count the pixels and rays of this tile
+  progress_.EndWork(progress_slot, tile.rows().size() * tile.cols().size(),
+                    TakeThreadRayCounts(), tile_samples);
+}
+
+
 bool
 RayTracer::Render(Surface::Ptr scene, const std::vector<Light::Ptr> &lights,
                   Camera::Ptr camera)
@@ -105,6 +357,7 @@ RayTracer::Render(Surface::Ptr scene, const std::vector<Light::Ptr> &lights,
 
   // start timer
   auto start_time = chrono::system_clock::now();
+  BuildLightTree(lights);
 
   // compute output image dimensions
   auto aspect = camera->GetAspectRatio();
@@ -115,185 +368,443 @@ RayTracer::Render(Surface::Ptr scene, const std::vector<Light::Ptr> &lights,
     return false;
   }
 
-  // initialize image
-  rendered_image_ = cv::Mat(cv::Size(width, height), CV_64FC3,
-                            cv::Scalar(0, 0, 0, 0));
+  // initialize images (or the tile file) and statistics
+  ray_counts_ = RayCounts{};
+  total_samples_ = 0;
+  frame_width_ = width;
+  frame_height_ = height;
+  diagnostics_.clear();
+  if (diagnostics_enabled_ && !kDiagnosticsCompiled) {
+    spdlog::warn("RayTracer: diagnostics are not compiled in (build with "
+                 "OLIO_ENABLE_DIAGNOSTICS)");
+  } else if (diagnostics_enabled_) {
+    diagnostics_.resize(static_cast<size_t>(width) *
+                        static_cast<size_t>(height));
+  }
+  auto tile_size = static_cast<int>(std::max(tile_size_, 1u));
+  if (tile_output_.empty()) {
+    tile_file_.reset();
+    rendered_image_ = cv::Mat(cv::Size(width, height), CV_32FC3,
+                              cv::Scalar(0, 0, 0, 0));
+    sample_count_image_ = cv::Mat(cv::Size(width, height), CV_32SC1,
+                                  cv::Scalar(0));
+  } else {
+    rendered_image_ = cv::Mat();
+    sample_count_image_ = cv::Mat();
+    tile_file_.reset(new TiledImageFile);
+    if (!tile_file_->Open(tile_output_, width, height, tile_size,
+                          GetSettingsKey(scene, lights, *camera))) {
+      tile_file_.reset();
+      return false;
+    }
+    spdlog::info("Streaming tiles to {} ({} of {} tiles already done)",
+                 tile_output_, tile_file_->GetNumDoneTiles(),
+                 tile_file_->GetNumTilesX() * tile_file_->GetNumTilesY());
+  }
 
-  // start progress bar
-  spdlog::info("Rendering...");
-  auto total_pixels = static_cast<size_t>(width * height);
-  RenderProgressStart(total_pixels);
+  // light resampling reservoirs; the last frame's are kept for
+  // temporal reuse if it had the same size
+  if (primary_lights_ && light_resampling_.temporal) {
+    std::swap(reservoirs_, previous_reservoirs_);
+    if (previous_reservoirs_.width != width ||
+        previous_reservoirs_.height != height)
+      previous_reservoirs_.Reset(0, 0);
+    reservoirs_.Reset(width, height);
+    ++resampling_frame_;
+  } else {
+    previous_reservoirs_.Reset(0, 0);
+    reservoirs_.Reset(0, 0);
+  }
 
-  // send rays
-  Real xscale = 1.0 / width;
-  Real yscale = 1.0 / height;
-  Real xoffset[num_samples_per_pixel_], yoffset[num_samples_per_pixel_];
-  Vec3r ray_color_pixel{0,0,0};
+  // checkpointed renders keep the sample sums of all pixels and take
+  // their samples in passes of pass_samples
+  const uint max_samples = std::max(num_samples_per_pixel_, 1u);
+  uint pass_samples = max_samples;
+  accumulation_.clear();
+  uint64_t checkpoint_key = 0;
+  if (!checkpoint_.path.empty()) {
+    checkpoint_key = GetSettingsKey(scene, lights, *camera, false);
+    if (checkpoint_.resume &&
+        ReadCheckpoint(checkpoint_.path, width, height, checkpoint_key,
+                       accumulation_)) {
+      uint64_t resumed_samples = 0;
+      for (auto &stats : accumulation_) {
+        stats.done = IsPixelDone(stats);
+        resumed_samples += stats.num_samples;
+      }
+      spdlog::info("Resuming from {}: {:.2f} samples per pixel already taken",
+                   checkpoint_.path, static_cast<double>(resumed_samples) /
+                   static_cast<double>(accumulation_.size()));
+    } else {
+      accumulation_.assign(static_cast<size_t>(width) *
+                           static_cast<size_t>(height), PixelStats{});
+    }
 
-  for (uint n =0; n < num_samples_per_pixel_; n++) {
-          xoffset[n] = (((Real)rand())/((Real)RAND_MAX));  //!< random float in [0, 1)
-          yoffset[n] = (((Real)rand())/((Real)RAND_MAX));  //!< random float in [0, 1)
+    // passes end on adaptive batch boundaries, so the samples do not
+    // depend on the pass size
+    pass_samples = std::max(checkpoint_.pass_samples, 1u);
+    if (adaptive_tolerance_ > 0) {
+      uint batch_size = std::min(std::max(adaptive_min_samples_, 2u),
+                                 max_samples);
+      pass_samples = (pass_samples + batch_size - 1) / batch_size * batch_size;
+    }
   }
-  //std::cout << num_samples_per_pixel_;
-  for (int y = 0; y < height; ++y) {
-    for (int x = 0; x < width; ++x) {
-      ray_color_pixel = Vec3r{0,0,0};
-
-      if (num_samples_per_pixel_ != 1) {
-        for (uint n =0; n < num_samples_per_pixel_; n++) {
-          Real xoffset_tt = (((Real)rand())/((Real)RAND_MAX));  //!< random float in [0, 1)
-          Real yoffset_tt = (((Real)rand())/((Real)RAND_MAX));  //!< random float in [0, 1)
-          //std::cout << "xoffset: " << xoffset << "\n" << std::endl;
-          //std::cout << "yoffset: " << yoffset << "\n" << std::endl;
-          auto ray = camera->GetRay((x + xoffset_tt) * xscale, (y + yoffset_tt) * yscale);
-          Vec3r ray_color;
-          RayColor(ray, scene, lights, 0, max_ray_depth_, ray_color);
-          ray_color_pixel = ray_color_pixel + ray_color;
-        }
-      }
-      else {
-          auto ray = camera->GetRay((x + .5) * xscale, (y + .5) * yscale);
-          Vec3r ray_color;
-          RayColor(ray, scene, lights, 0, max_ray_depth_, ray_color);
-          ray_color_pixel = ray_color_pixel + ray_color;
+  const uint num_passes = (max_samples + pass_samples - 1) / pass_samples;
+
+  // start progress reports
+  int num_threads = num_threads_ ? static_cast<int>(num_threads_) :
+    tbb::task_arena::automatic;
+  tbb::task_arena arena{num_threads};
+  spdlog::info("Rendering with {} thread(s) ({} integrator)...",
+               arena.max_concurrency(),
+               integrator_ == Integrator::kWavefront ? "wavefront" :
+               "recursive");
+  auto total_pixels = static_cast<size_t>(width * height);
+  progress_.Start(total_pixels * num_passes, arena.max_concurrency(),
+                  progress_options_);
+
+  // send rays: the tiles of a fixed grid are distributed among
+  // threads by TBB's work-stealing scheduler
+  const int tiles_x = (width + tile_size - 1) / tile_size;
+  const int tiles_y = (height + tile_size - 1) / tile_size;
+  auto last_checkpoint = chrono::system_clock::now();
+  for (uint pass = 0; pass < num_passes; ++pass) {
+    uint sample_limit = pass + 1 == num_passes ? max_samples :
+      (pass + 1) * pass_samples;
+    arena.execute([&] {
+      tbb::parallel_for(tbb::blocked_range<int>{0, tiles_x * tiles_y, 1},
+                        [&](const tbb::blocked_range<int> &tiles) {
+                          for (int t = tiles.begin(); t != tiles.end(); ++t) {
+                            int y = (t / tiles_x) * tile_size;
+                            int x = (t % tiles_x) * tile_size;
+                            tbb::blocked_range2d<int> tile{
+                              y, std::min(y + tile_size, height),
+                              x, std::min(x + tile_size, width)};
+                            if (tile_file_ && tile_file_->IsTileDone(
+                                  static_cast<size_t>(t))) {
+                              progress_.AddPixels(
+                                tile.rows().size() * tile.cols().size());
+                              continue;
+                            }
+                            RenderTile(tile, scene, lights, camera,
+                                       sample_limit);
+                          }
+                        }, tbb::simple_partitioner{});
+    });
+
+    // save the sample sums every interval_passes passes, after
+    // interval_minutes, and at the end of the render
+    if (accumulation_.empty())
+      continue;
+    auto now = chrono::system_clock::now();
+    auto minutes = chrono::duration_cast<chrono::duration<double>>
+      (now - last_checkpoint).count() / 60;
+    if (pass + 1 == num_passes ||
+        (checkpoint_.interval_passes &&
+         (pass + 1) % checkpoint_.interval_passes == 0) ||
+        (checkpoint_.interval_minutes > 0 &&
+         minutes >= checkpoint_.interval_minutes)) {
+      if (WriteCheckpoint(checkpoint_.path, width, height, checkpoint_key,
+                          accumulation_)) {
+        last_checkpoint = now;
+      } else {
+        spdlog::error("RayTracer: failed to save checkpoint {}, will retry "
+                      "after the next pass", checkpoint_.path);
       }
-
-      Vec3r pixel_color = ray_color_pixel/num_samples_per_pixel_;
-      rendered_image_.at<cv::Vec3d>((height - y -1), x) =
-        cv::Vec3d{pixel_color[0], pixel_color[1], pixel_color[2]};
-      RenderProgressIncDonePixels();
     }
   }
 
-  // stop progress bar
-  RenderProgressEnd();
+  // stop progress reports and collect the counts of all threads
+  auto progress = progress_.Stop();
+  ray_counts_ = progress_.GetRayCounts();
+  total_samples_ = progress_.GetNumSamples();
+  tile_file_.reset();
+  accumulation_.clear();
+  accumulation_.shrink_to_fit();
 
   // stop timer
   auto end_time = std::chrono::system_clock::now();
   auto total_time = chrono::duration_cast<chrono::duration<double>>
     (end_time - start_time).count();
+  render_time_ = total_time;
   spdlog::info("Total render time: {}", total_time);
+  if (adaptive_tolerance_ > 0) {
+    spdlog::info("Adaptive sampling: {:.2f} samples per pixel on average "
+                 "(max {})", static_cast<double>(total_samples_) /
+                 static_cast<double>(total_pixels), num_samples_per_pixel_);
+  }
+  spdlog::info("Traced {} rays ({} primary, {} secondary, {} shadow): "
+               "{:.3f} Mrays/s", ray_counts_.GetTotal(),
+               ray_counts_.Get(RayType::kPrimary),
+               ray_counts_.Get(RayType::kSecondary),
+               ray_counts_.Get(RayType::kShadow),
+               total_time > 0 ? static_cast<double>(ray_counts_.GetTotal()) /
+               total_time * 1e-6 : 0.0);
+  if (!progress.thread_utilization.empty()) {
+    const auto &utilization = progress.thread_utilization;
+    double mean = 0;
+    for (auto use : utilization)
+      mean += use;
+    mean /= static_cast<double>(utilization.size());
+    spdlog::info("Thread utilization: {:.1f}% on average, {:.1f}% min, "
+                 "{:.1f}% max", 100 * mean,
+                 100 * *std::min_element(utilization.begin(),
+                                         utilization.end()),
+                 100 * *std::max_element(utilization.begin(),
+                                         utilization.end()));
+  }
 
   return true;
 }
 
 
-cv::Mat
-RayTracer::GammaCorrectImage(const cv::Mat &in_image, Real gamma) const
+uint64_t
+RayTracer::GetSettingsKey(const Surface::Ptr &scene,
+                          const std::vector<Light::Ptr> &lights,
+                          const Camera &camera,
+                          bool include_sample_counts) const
 {
-  Real gamma_inv = 1.0f / gamma;
-  cv::Mat out_image(in_image.rows, in_image.cols, CV_64FC3);
-  for (int y = 0; y < out_image.rows; ++y) {
-    for (int x = 0; x < out_image.cols; ++x) {
-      auto pixel = in_image.at<cv::Vec3d>(y, x);
-      auto r = pow(pixel[0], gamma_inv);
-      auto g = pow(pixel[1], gamma_inv);
-      auto b = pow(pixel[2], gamma_inv);
-      out_image.at<cv::Vec3d>(y, x) = cv::Vec3d{r, g, b};
+  // sampling and integrator settings
+  auto settings = fmt::format("{} {} {} {} {} {} {} {} {} {} {} {}",
+                              include_sample_counts ?
+                              num_samples_per_pixel_ : 0,
+                              include_sample_counts ? adaptive_tolerance_ : 0,
+                              adaptive_min_samples_, max_ray_depth_, seed_,
+                              static_cast<int>(sampler_type_),
+                              path_options_.min_throughput,
+                              path_options_.russian_roulette,
+                              static_cast<int>(path_options_.glass_sampling),
+                              light_budget_, light_resampling_.enabled,
+                              light_resampling_.candidates);
+  settings += fmt::format(" {} {} {} {}", light_resampling_.spatial_neighbors,
+                          light_resampling_.spatial_radius,
+                          light_resampling_.temporal,
+                          light_resampling_.max_history);
+  auto add_vector = [&settings](const Vec3r &v) {
+    settings += fmt::format(" {} {} {}", v[0], v[1], v[2]);
+  };
+
+  // scene file, scene bounds, and camera
+  namespace fs = boost::filesystem;
+  boost::system::error_code error;
+  if (!scene_file_.empty()) {
+    settings += " " + fs::absolute(scene_file_).string();
+    auto file_size = fs::file_size(scene_file_, error);
+    if (!error)
+      settings += fmt::format(" {} {}", file_size,
+                              fs::last_write_time(scene_file_, error));
+  }
+  if (scene) {
+    const auto &bounds = scene->GetBoundingBox();
+    add_vector(bounds.GetMin());
+    add_vector(bounds.GetMax());
+  }
+  add_vector(camera.GetEye());
+  add_vector(camera.GetTarget());
+  add_vector(camera.GetUpVector());
+  settings += fmt::format(" {} {}", camera.GetFovy(), camera.GetAspectRatio());
+
+  // lights
+  for (const auto &light : lights) {
+    if (auto area_light = dynamic_pointer_cast<AreaLight>(light)) {
+      settings += " area";
+      add_vector(area_light->GetCenter());
+      add_vector(area_light->GetNormal());
+      add_vector(area_light->GetUDir());
+      add_vector(area_light->GetColor());
+      settings += fmt::format(" {} {} {} {}", area_light->GetLen(),
+                              area_light->GetGridSize(),
+                              area_light->IsAdaptive(),
+                              static_cast<int>(area_light->GetSampling()));
+    } else if (auto point_light = dynamic_pointer_cast<PointLight>(light)) {
+      settings += " point";
+      add_vector(point_light->GetPosition());
+      add_vector(point_light->GetIntensity());
+    } else if (auto ambient_light =
+               dynamic_pointer_cast<AmbientLight>(light)) {
+      settings += " ambient";
+      add_vector(ambient_light->GetAmbient());
+    } else if (light) {
+      settings += " light";
     }
   }
-  return out_image;
+
+  // FNV-1a hash of the settings
+  uint64_t hash = 14695981039346656037ull;
+  for (auto c : settings) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
 }
 
 
-cv::Mat
-RayTracer::RGBToBGRUChar(const cv::Mat &in_image) const
+void
+RayTracer::BuildLightTree(const std::vector<Light::Ptr> &lights)
 {
-  // double RGB to uchar BGR:
-  cv::Mat out_image(in_image.rows, in_image.cols, CV_8UC3);
-  for (int y = 0; y < out_image.rows; ++y) {
-    for (int x = 0; x < out_image.cols; ++x) {
-      auto colord = in_image.at<cv::Vec3d>(y, x);
-      out_image.at<cv::Vec3b>(y, x) =
-        cv::Vec3b{static_cast<uchar>(CLAMP(colord[2] * 255 + 0.5f, 0, 255)),
-                  static_cast<uchar>(CLAMP(colord[1] * 255 + 0.5f, 0, 255)),
-                  static_cast<uchar>(CLAMP(colord[0] * 255 + 0.5f, 0, 255))};
-
-    }
+  light_tree_.Clear();
+  primary_lights_ = nullptr;
+  if (!light_budget_ && !light_resampling_.enabled)
+    return;
+  light_tree_.Build(lights);
+  light_tree_.SetBudget(light_budget_);
+  if (light_resampling_.enabled && !light_tree_.IsEmpty())
+    primary_lights_ = &light_tree_.GetOtherLights();
+  if (light_budget_ && !light_tree_.IsEmpty()) {
+    spdlog::info("Light tree: {} nodes, {} light(s) picked per hit point",
+                 light_tree_.GetNodes().size(), light_budget_);
   }
-  return out_image;
 }
 
 
-cv::Mat
-RayTracer::RGBToBGRFloat32(const cv::Mat &in_image) const
+bool
+RayTracer::WriteImage(const std::string &image_name, Real gamma) const
 {
-  // double RGB to float BGR:
-  cv::Mat out_image(in_image.rows, in_image.cols, CV_32FC3);
-  for (int y = 0; y < out_image.rows; ++y) {
-    for (int x = 0; x < out_image.cols; ++x) {
-      auto colord = in_image.at<cv::Vec3d>(y, x);
-      out_image.at<cv::Vec3f>(y, x) =
-        cv::Vec3f{static_cast<float>(colord[2]),
-                  static_cast<float>(colord[1]),
-                  static_cast<float>(colord[0])};
-    }
-  }
-  return out_image;
+  ImageOutputOptions options;
+  options.gamma = gamma;
+  return WriteImage(image_name, options);
 }
 
 
 bool
-RayTracer::WriteImage(const std::string &image_name, Real gamma) const
+RayTracer::WriteImage(const std::string &image_name,
+                      const ImageOutputOptions &options) const
 {
   namespace fs = boost::filesystem;
 
-  // check we have a rendered image
-  if (rendered_image_.empty())
+  // check we have a rendered image, in memory or in the tile file
+  if (rendered_image_.empty() && tile_output_.empty())
     return false;
 
-  // decide the output format
-  bool is_exr = fs::path(image_name).extension().string() == ".exr";
+  // decide the output format: HDR output does not need gamma correction
+  auto extension = fs::path(image_name).extension().string();
+  bool is_exr = extension == ".exr";
+  auto depth = options.depth;
+  if (depth == OutputDepth::kAuto)
+    depth = is_exr ? OutputDepth::kFloat : OutputDepth::kUChar;
+  bool is_float = depth == OutputDepth::kHalf || depth == OutputDepth::kFloat;
+  if (is_float != is_exr) {
+    spdlog::error(is_exr ? "RayTracer: exr images must be half or float" :
+                  "RayTracer: half and float images must be exr");
+    return false;
+  }
+  if (depth == OutputDepth::kUShort && extension != ".png" &&
+      extension != ".tif" && extension != ".tiff" && extension != ".ppm") {
+    spdlog::error("RayTracer: 16-bit {} images are not supported", extension);
+    return false;
+  }
+
+  // exposure, gamma, quantization, and BGR order in a single pass
+  OutputConverter converter{depth, options.exposure, options.gamma};
   cv::Mat out_image;
-  if (is_exr) {
-    // HDR output does not need gamma correction
-    out_image = RGBToBGRFloat32(rendered_image_);
+  if (!rendered_image_.empty()) {
+    converter.Convert(rendered_image_, out_image);
   } else {
-    // gamma correct and convert to uchar
-    cv::Mat image_real;
-    if (gamma == 1)
-      image_real = rendered_image_;
-    else
-      image_real = GammaCorrectImage(rendered_image_, gamma);
-    out_image = RGBToBGRUChar(image_real);
+    // convert the tile file one row of tiles at a time
+    TiledImageFile tile_file;
+    if (!tile_file.OpenForReading(tile_output_))
+      return false;
+    const int width = tile_file.GetWidth();
+    const int height = tile_file.GetHeight();
+    out_image.create(height, width, converter.GetImageType());
+    vector<float> rgb;
+    for (int tile_row = 0; tile_row < tile_file.GetNumTilesY(); ++tile_row) {
+      if (!tile_file.ReadTileRow(tile_row, rgb)) {
+        spdlog::error("RayTracer: failed to read {}", tile_output_);
+        return false;
+      }
+      const int y_begin = tile_row * tile_file.GetTileSize();
+      const int rows = static_cast<int>(rgb.size() /
+                                        (3 * static_cast<size_t>(width)));
+      tbb::parallel_for(0, rows, [&](int y) {
+          converter.ConvertRow(&rgb[3 * static_cast<size_t>(y) *
+                                    static_cast<size_t>(width)],
+                               static_cast<size_t>(width),
+                               out_image.ptr(height - (y_begin + y) - 1));
+        });
+    }
   }
 
-  // write image
-  cv::imwrite(image_name, out_image);
-  return true;
+  // write image, and the diagnostics next to it
+  if (!cv::imwrite(image_name, out_image, converter.GetWriteParams()))
+    return false;
+  return diagnostics_.empty() || WriteDiagnosticImages(image_name);
 }
 
 
-void
-RayTracer::RenderProgressStart(size_t total_pixels)
+bool
+RayTracer::WriteSampleCountImage(const std::string &image_name) const
 {
-  const std::lock_guard<std::mutex> lock(progress_bar_mutex_);
-  progress_bar_ = make_shared<tqdm>();
-  progress_bar_done_pixels_  = 0;
-  progress_bar_total_pixels_ = total_pixels;
-}
-
+  if (sample_count_image_.empty())
+    return false;
 
-void
-RayTracer::RenderProgressIncDonePixels()
-{
-  const std::lock_guard<std::mutex> lock(progress_bar_mutex_);
-  progress_bar_done_pixels_ = std::min(progress_bar_done_pixels_ + 1,
-                                       progress_bar_total_pixels_);
-  if (!progress_bar_)
-    return;
-  progress_bar_->progress(static_cast<int>(progress_bar_done_pixels_),
-                          static_cast<int>(progress_bar_total_pixels_));
+  // scale counts so that the max spp maps to the top of the color map
+  double max_count = std::max(num_samples_per_pixel_, 1u);
+  cv::Mat counts_uchar, out_image;
+  sample_count_image_.convertTo(counts_uchar, CV_8U, 255 / max_count);
+  cv::applyColorMap(counts_uchar, out_image, cv::COLORMAP_JET);
+  return cv::imwrite(image_name, out_image);
 }
 
 
-void
-RayTracer::RenderProgressEnd()
+bool
+RayTracer::WriteDiagnosticImages(const std::string &image_name) const
 {
-  const std::lock_guard<std::mutex> lock(progress_bar_mutex_);
-  if (progress_bar_)
-    progress_bar_->finish();
-  progress_bar_.reset();
+  namespace fs = boost::filesystem;
+  const int width = frame_width_;
+  const int height = frame_height_;
+  if (diagnostics_.empty() ||
+      diagnostics_.size() != static_cast<size_t>(width) *
+      static_cast<size_t>(height))
+    return false;
+
+  // per-sample averages of the counters, and the max depth
+  auto value = [](const PixelDiagnostics &pixel, int map) -> double {
+    double samples = static_cast<double>(std::max<uint64_t>(pixel.samples, 1));
+    switch (map) {
+    case 0:
+      return static_cast<double>(pixel.bvh_nodes) / samples;
+    case 1:
+      return static_cast<double>(pixel.primitive_tests) / samples;
+    case 2:
+      return static_cast<double>(pixel.shadow_rays) / samples;
+    default:
+      return static_cast<double>(pixel.max_depth);
+    }
+  };
+  const char *suffixes[] = {"_bvh_nodes", "_primitive_tests", "_shadow_rays",
+                            "_ray_depth"};
+  fs::path path{image_name};
+  for (int map = 0; map < 4; ++map) {
+    // scale values so that the image's max maps to the top of the
+    // color map (the max ray depth for depths)
+    double max_value = 0;
+    for (const auto &pixel : diagnostics_)
+      max_value = std::max(max_value, value(pixel, map));
+    if (map == 3)
+      max_value = std::max(max_ray_depth_, 1u);
+    double scale = max_value > 0 ? 255 / max_value : 0;
+    cv::Mat values_uchar(height, width, CV_8UC1), out_image;
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const auto &pixel = diagnostics_[static_cast<size_t>(y) *
+                                         static_cast<size_t>(width) +
+                                         static_cast<size_t>(x)];
+        values_uchar.at<uchar>(height - y - 1, x) = static_cast<uchar>(
+          std::min(value(pixel, map) * scale + 0.5, 255.0));
+      }
+    }
+    cv::applyColorMap(values_uchar, out_image, cv::COLORMAP_JET);
+    auto map_path = path.parent_path() / (path.stem().string() +
+                                          suffixes[map] + ".png");
+    if (!cv::imwrite(map_path.string(), out_image)) {
+      spdlog::error("RayTracer: could not write {}", map_path.string());
+      return false;
+    }
+    spdlog::info("Wrote {} (red: {:.1f}{})", map_path.string(), max_value,
+                 map == 3 ? "" : " per sample");
+  }
+  return true;
 }
 
 }  // namespace core
@@ -18,16 +18,33 @@
 #include <set>
 #include <tbb/tbb.h>
 #include <opencv2/opencv.hpp>
-#include <tqdm/tqdm.h>
 #include "core/types.h"
 #include "core/node.h"
 #include "core/geometry/surface.h"
 #include "core/camera/camera.h"
 #include "core/light/light.h"
+#include "core/light/light_tree.h"
+#include "core/sampler/sampler.h"
+#include "core/renderer/ray_stats.h"
+#include "core/renderer/path_options.h"
+#include "core/renderer/wavefront.h"
+#include "core/renderer/light_resampler.h"
+#include "core/renderer/image_output.h"
+#include "core/renderer/tiled_image_file.h"
+#include "core/renderer/render_checkpoint.h"
+#include "core/renderer/render_progress.h"
+#include "core/renderer/pixel_diagnostics.h"
 
 namespace olio {
 namespace core {
 
+//! \enum Integrator
+//! \brief How RayTracer computes the colors of camera samples
+enum class Integrator {
+  kRecursive,  //!< follow one path at a time (RayTracer::RayColor())
+  kWavefront   //!< process queues of rays (WavefrontIntegrator)
+};
+
 //! \class RayTracer
 //! \brief Main rendering class responsible for generating rays, path
 //! tracing, computing ray colors, and generating a rendered image of
@@ -46,6 +63,12 @@ public:
   //!    'rendered_image_'. This function is also responsible for
   //!    allocating an initial black image for 'rendered_image_'
   //!    before the start of the ray tracing process.
+  //!    The image is split into a grid of square tiles (see
+  //!    SetTileSize()) that are scheduled on TBB's work-stealing task
+  //!    scheduler; each worker writes its pixels directly into
+  //!    'rendered_image_', or streams them to the tile output file
+  //!    (see SetTileOutput()), in which case no frame buffer is
+  //!    allocated.
   //! \param[in] scene Input scene to render
   //! \param[in] lights Scene lights
   //! \param[in] camera Camera used for generating rays and rendering
@@ -56,6 +79,173 @@ public:
 
   inline void SetNumSamplesPerPixel(uint num_samples_per_pixel) {num_samples_per_pixel_ = num_samples_per_pixel;}
 
+  //! \brief Enable/disable adaptive sampling
+  //! \details In adaptive mode, every pixel is sampled in batches of
+  //!    min_samples until the standard error of its mean luminance is
+  //!    below tolerance times the mean, or until it has the number of
+  //!    samples set with SetNumSamplesPerPixel(). Since the standard
+  //!    error is taken to be at least mean / (number of samples), no
+  //!    pixel stops before 1 / tolerance samples.
+  //! \param[in] tolerance Max relative error (0: disable adaptive sampling)
+  //! \param[in] min_samples Samples per batch (at least 2)
+  inline void SetAdaptiveSampling(Real tolerance, uint min_samples=4) {
+    adaptive_tolerance_ = tolerance;
+    adaptive_min_samples_ = min_samples;
+  }
+
+  //! \brief Set the options that limit the number of secondary rays
+  //!        (throughput pruning, Russian roulette, glass sampling)
+  //! \param[in] options Path options
+  inline void SetPathOptions(const PathOptions &options) {
+    path_options_ = options;
+  }
+
+  //! \brief Get the options that limit the number of secondary rays
+  //! \return Path options
+  inline const PathOptions &GetPathOptions() const {return path_options_;}
+
+  //! \brief Set the integrator used to compute pixel sample colors.
+  //!        Both integrators produce the same images.
+  //! \param[in] integrator Integrator
+  inline void SetIntegrator(Integrator integrator) {integrator_ = integrator;}
+
+  //! \brief Get the integrator used to compute pixel sample colors
+  //! \return Integrator
+  inline Integrator GetIntegrator() const {return integrator_;}
+
+  //! \brief Set the sequence pixel jitter, light positions, and other
+  //!        random decisions are drawn from
+  //! \param[in] sampler_type Sampler type
+  inline void SetSamplerType(SamplerType sampler_type) {
+    sampler_type_ = sampler_type;
+  }
+
+  //! \brief Get the sequence pixel and light samples are drawn from
+  //! \return Sampler type
+  inline SamplerType GetSamplerType() const {return sampler_type_;}
+
+  //! \brief Set number of lights evaluated per hit point in scenes
+  //!        with many lights
+  //! \details When the budget is not 0, Render() builds a LightTree
+  //!    over the point and area lights, and every hit point only
+  //!    evaluates 'budget' lights picked from the tree by their
+  //!    estimated contribution (plus the ambient lights). The result is
+  //!    unbiased but noisier than evaluating all lights.
+  //! \param[in] budget Lights picked per hit point (0: all lights)
+  inline void SetLightBudget(uint budget) {light_budget_ = budget;}
+
+  //! \brief Get number of lights evaluated per hit point
+  //! \return Lights picked per hit point (0: all lights)
+  inline uint GetLightBudget() const {return light_budget_;}
+
+  //! \brief Set the options of the resampled direct lighting of
+  //!        primary hits (see LightResampler)
+  //! \details When enabled, the point and area lights of primary Phong
+  //!    hits are shaded with one shadow ray per camera sample, picked
+  //!    out of candidates reused from neighboring pixels (and, with
+  //!    options.temporal, from the previous call to Render()). Other
+  //!    hits are shaded as usual.
+  //! \param[in] options Resampling options
+  inline void SetLightResampling(const LightResamplingOptions &options) {
+    light_resampling_ = options;
+  }
+
+  //! \brief Get the options of the resampled direct lighting
+  //! \return Resampling options
+  inline const LightResamplingOptions &GetLightResampling() const {
+    return light_resampling_;
+  }
+
+  //! \brief Set number of threads used for rendering
+  //! \param[in] num_threads Number of render threads (0: use all cores)
+  inline void SetNumThreads(uint num_threads) {num_threads_ = num_threads;}
+
+  //! \brief Set width/height (in pixels) of the square image tiles
+  //! that are distributed among render threads
+  //! \param[in] tile_size Tile size in pixels
+  inline void SetTileSize(uint tile_size) {tile_size_ = tile_size;}
+
+  //! \brief Stream rendered tiles to a file instead of keeping the
+  //!        image in memory
+  //! \details Render() writes each tile to the TiledImageFile at path
+  //!    as soon as it's done. If the file already holds tiles of a
+  //!    render with the same image size, tile size, and settings
+  //!    (e.g., of a render that crashed; see GetSettingsKey()), they
+  //!    are not rendered again.
+  //!    WriteImage() reads the image back from the file, one row of
+  //!    tiles at a time.
+  //! \param[in] path Tile file path (empty: render into memory)
+  inline void SetTileOutput(const std::string &path) {tile_output_ = path;}
+
+  //! \brief Get the file rendered tiles are streamed to
+  //! \return Tile file path (empty: none)
+  inline const std::string &GetTileOutput() const {return tile_output_;}
+
+  //! \brief Set the file the rendered scene was loaded from
+  //! \details Its path, size, and modification time are part of the
+  //!    settings key, so tile files and checkpoints of another scene,
+  //!    or of an edited one, are not reused.
+  //! \param[in] path Scene file path (empty: unknown)
+  inline void SetSceneFile(const std::string &path) {scene_file_ = path;}
+
+  //! \brief Save the per-pixel sample sums of renders to a checkpoint
+  //!        file, and optionally continue from it
+  //! \details When options.path is set, Render() keeps the sample sums
+  //!    and counts of all pixels and takes their samples in passes of
+  //!    options.pass_samples. After a pass, the sums are written to the
+  //!    file if options.interval_passes passes or
+  //!    options.interval_minutes minutes have passed since the last
+  //!    checkpoint; they are always written at the end. With
+  //!    options.resume, Render() starts from the sums in the file (if
+  //!    it's of a render with the same image size and settings), so a
+  //!    preempted render continues where it was saved, and a finished
+  //!    one can be given more samples per pixel or a lower adaptive
+  //!    tolerance. Since every pixel sample has its own stream (see
+  //!    SetSeed()), a resumed render matches an uninterrupted one; when
+  //!    samples are added, this also holds for the independent sampler
+  //!    (the other sequences depend on the max samples per pixel).
+  //! \param[in] options Checkpoint options
+  inline void SetCheckpoint(const CheckpointOptions &options) {
+    checkpoint_ = options;
+  }
+
+  //! \brief Get the checkpoint options
+  //! \return Checkpoint options
+  inline const CheckpointOptions &GetCheckpoint() const {return checkpoint_;}
+
+  //! \brief Set how render progress is reported. Render threads only
+  //!        update their own atomic counters; a reporter thread prints
+  //!        pixel and ray rates, the ETA, and thread utilization every
+  //!        interval, on the terminal and/or as json lines.
+  //! \param[in] options Progress report options
+  inline void SetProgress(const ProgressOptions &options) {
+    progress_options_ = options;
+  }
+
+  //! \brief Get the progress report options
+  //! \return Progress report options
+  inline const ProgressOptions &GetProgress() const {return progress_options_;}
+
+  //! \brief Enable per-pixel diagnostics: BVH nodes visited, primitive
+  //!        tests, shadow rays cast, and ray depth reached, which
+  //!        WriteImage() saves as heatmaps next to the image
+  //! \details The counters are only compiled in with
+  //!    OLIO_ENABLE_DIAGNOSTICS (see pixel_diagnostics.h); otherwise
+  //!    Render() warns and records nothing. Resumed checkpointed
+  //!    renders only count the samples taken after resuming.
+  //! \param[in] enabled Whether the next renders record diagnostics
+  inline void SetDiagnostics(bool enabled) {diagnostics_enabled_ = enabled;}
+
+  //! \brief Check whether per-pixel diagnostics are enabled
+  //! \return True if enabled
+  inline bool GetDiagnostics() const {return diagnostics_enabled_;}
+
+  //! \brief Set seed of the per-pixel sample streams (see \ref
+  //! Sampler). The rendered image only depends on the seed, not on the
+  //! number of threads or the order in which tiles are rendered.
+  //! \param[in] seed Random seed
+  inline void SetSeed(uint seed) {seed_ = seed;}
+
   //! \brief Set output image height. The image width will be
   //! determined based on the aspect ratio of the camera's viewport.
   //! \param[in] image_height Output image height
@@ -73,6 +263,30 @@ public:
   //! \return Max ray depth (bounce count)
   inline uint GetMaxRayDepth() const {return max_ray_depth_;}
 
+  //! \brief Get number of render threads
+  //! \return Number of render threads (0: all cores)
+  inline uint GetNumThreads() const {return num_threads_;}
+
+  //! \brief Get render tile size
+  //! \return Tile size in pixels
+  inline uint GetTileSize() const {return tile_size_;}
+
+  //! \brief Get number of rays traced by the last call to Render()
+  //! \return Ray counts
+  inline const RayCounts &GetRayCounts() const {return ray_counts_;}
+
+  //! \brief Get the per-pixel diagnostics of the last call to Render()
+  //! \return Counters summed over the samples of each pixel, in render
+  //!         order (row 0 is the bottom of the image); empty if
+  //!         diagnostics are disabled or not compiled in
+  inline const std::vector<PixelDiagnostics> &GetPixelDiagnostics() const {
+    return diagnostics_;
+  }
+
+  //! \brief Get wall time of the last call to Render()
+  //! \return Render time in seconds
+  inline double GetRenderTime() const {return render_time_;}
+
   //! \brief Write rendered image to file. If the image extension is
   //!        exr, the image won't be gamma corrected before it's saved
   //!        (gamma is ignored).
@@ -80,7 +294,44 @@ public:
   //! \param[in] gamma Gamma value
   //! \return True on success
   bool WriteImage(const std::string &image_name, Real gamma=1) const;
+
+  //! \brief Write rendered image to file with the given exposure,
+  //!        gamma, and channel type (see OutputConverter)
+  //! \param[in] image_name Output image path
+  //! \param[in] options Output options; float depths require an exr
+  //!            image and ignore gamma
+  //! \return True on success
+  bool WriteImage(const std::string &image_name,
+                  const ImageOutputOptions &options) const;
+
+  //! \brief Write a color-mapped debug image of the number of samples
+  //!        taken in each pixel by the last render (blue: few, red:
+  //!        the max samples per pixel)
+  //! \param[in] image_name Output image path
+  //! \return True on success
+  bool WriteSampleCountImage(const std::string &image_name) const;
+
+  //! \brief Write color-mapped heatmaps of the per-pixel diagnostics
+  //!        of the last render (blue: none, red: the image's max),
+  //!        named after the image with _bvh_nodes, _primitive_tests,
+  //!        _shadow_rays, and _ray_depth suffixes and a png extension.
+  //!        Counts are averaged over the samples of each pixel.
+  //! \param[in] image_name Path of the rendered image
+  //! \return True on success
+  bool WriteDiagnosticImages(const std::string &image_name) const;
 protected:
+  //! \brief Luminance below which adaptive sampling uses an absolute
+  //!        instead of a relative error, so black pixels converge
+  static constexpr Real kAdaptiveMinLuminance = Real{1} / 256;
+
+  //! \brief Compute luminance of a linear RGB color
+  //! \param[in] color Input color
+  //! \return Luminance
+  static inline Real Luminance(const Vec3r &color) {
+    return Real{0.2126} * color[0] + Real{0.7152} * color[1] +
+      Real{0.0722} * color[2];
+  }
+
   //! \brief Determine ray color by intersecting it with the scene
   //! \details The main function responsible for checking for
   //!    intersections of the rays with scene objects (surfaces) and
@@ -88,52 +339,111 @@ protected:
   //! \param[in] ray Input ray
   //! \param[in] scene Input scene
   //! \param[in] lights Scene lights
+  //! \param[in] throughput Factor the ray color is multiplied by
+  //!            before it's added to its pixel (see PathOptions)
+  //! \param[in] sampler Sampler of the current pixel sample
   //! \param[out] ray_color Output ray color
   //! \return True if ray intersects a surface in the scene
-  bool RayColor(const Ray &ray, Surface::Ptr scene,
+  bool RayColor(const Ray &ray, const Surface::Ptr &scene,
                 const std::vector<Light::Ptr> &lights, uint ray_depth,
-                uint max_ray_depth, Vec3r &ray_color);
-
-  //! \brief Gamma correct input image
-  //! \details Input image is assumed to be of type CV_64FC3
-  //! \param[in] in_image Input image; must be of type: CV_64FC3
-  //! \param[in] gamma Gamma
-  //! \return Gamma corrected image
-  cv::Mat GammaCorrectImage(const cv::Mat &in_image, Real gamma) const;
-
-  //! \brief Convert an input image with double-precision floating
-  //! point RGB channels to an output image with uchar BGR channels.
-  //! \param[in] in_image Input image; must be of type CV_64FC3
-  //! \return Output image of type CV_8UC3 with BGR channel ordering
-  cv::Mat RGBToBGRUChar(const cv::Mat &in_image) const;
-
-  //! \brief Convert an input image with double-precision floating
-  //! point RGB channels to an output image with single-precision BGR
-  //! channels.
-  //! \param[in] in_image Input image
-  //! \return Output image of type CV_32FC3 with BGR channel ordering
-  cv::Mat RGBToBGRFloat32(const cv::Mat &in_image) const;
-
-  //! \brief Start the render progress bar
-  //! \param[in] total_pixels Total number of pixels that will be rendered
-  void RenderProgressStart(size_t total_pixels);
-
-  //! \brief Incremenet the number of rendered pixels in the progress bar
-  void RenderProgressIncDonePixels();
-
-  //! \brief Stop/end the render progress bar
-  void RenderProgressEnd();
+                uint max_ray_depth, const Vec3r &throughput, Sampler &sampler,
+                Vec3r &ray_color);
+
+  //! \brief Compute the colors of a batch of camera samples
+  //! \details Uses RayColor() or a WavefrontIntegrator, depending on
+  //!    the selected integrator.
+  //! \param[in] samples Camera samples
+  //! \param[in] scene Input scene
+  //! \param[in] lights Scene lights
+  //! \param[out] colors Color of each camera sample
+  void TraceSamples(const std::vector<CameraSample> &samples,
+                    Surface::Ptr scene, const std::vector<Light::Ptr> &lights,
+                    std::vector<Vec3r> &colors);
+
+  //! \brief Build light_tree_ over the scene lights if a light budget
+  //!        is set or light resampling is enabled, or clear it otherwise
+  //! \param[in] lights Scene lights
+  void BuildLightTree(const std::vector<Light::Ptr> &lights);
+
+  //! \brief Get a key of the settings rendered pixels depend on, which
+  //!        tells tile files and checkpoints of different renders apart
+  //! \details The key covers the sampling and integrator settings, the
+  //!    scene file (see SetSceneFile()) and the bounds of the scene, the
+  //!    camera, and the parameters of each light, including the shadow
+  //!    samples and sampling strategy of area lights.
+  //! \param[in] scene Input scene
+  //! \param[in] lights Scene lights
+  //! \param[in] camera Render camera
+  //! \param[in] include_sample_counts Whether the key depends on the
+  //!            number of samples per pixel and the adaptive tolerance
+  //! \return Settings key
+  uint64_t GetSettingsKey(const Surface::Ptr &scene,
+                          const std::vector<Light::Ptr> &lights,
+                          const Camera &camera,
+                          bool include_sample_counts=true) const;
+
+  //! \brief Check whether a pixel needs no more samples (it has the
+  //!        max number of samples, or adaptive sampling converged)
+  //! \param[in] stats Pixel sample sums
+  //! \return True if the pixel is done
+  bool IsPixelDone(const PixelStats &stats) const;
+
+  //! \brief Render all pixels inside an image tile
+  //! \param[in] tile Pixel range of the tile (rows: y, cols: x)
+  //! \param[in] scene Input scene
+  //! \param[in] lights Scene lights
+  //! \param[in] camera Camera used for generating primary rays
+  //! \param[in] sample_limit Samples per pixel taken by the end of this
+  //!            pass; the pixels are only stored in the image (or the
+  //!            tile file) when it reaches the max
+  void RenderTile(const tbb::blocked_range2d<int> &tile, Surface::Ptr scene,
+                  const std::vector<Light::Ptr> &lights, Camera::Ptr camera,
+                  uint sample_limit);
 
   uint image_height_{180};  //!< output image height
-  cv::Mat rendered_image_;  //!< output rendered image
+  //! output rendered image (CV_32FC3 in every build: samples are summed
+  //! in Real and only each pixel's mean is stored as float)
+  cv::Mat rendered_image_;
+  cv::Mat sample_count_image_;  //!< samples taken per pixel (CV_32SC1)
+  int frame_width_ = 0;     //!< width of the image being rendered
+  int frame_height_ = 0;    //!< height of the image being rendered
+  std::string tile_output_;  //!< tile file path (empty: none)
+  std::string scene_file_;   //!< scene file path (empty: unknown)
+  std::unique_ptr<TiledImageFile> tile_file_;  //!< tiles being streamed
+  CheckpointOptions checkpoint_;   //!< checkpoint file and intervals
+  std::vector<PixelStats> accumulation_;  //!< sample sums of all pixels
+                                   //!< (checkpointed renders only)
   uint max_ray_depth_ = 5;  //!< max ray depth
 
-  // progress bar related data members
-  std::mutex progress_bar_mutex_;        //!< progress bar mutex
-  std::shared_ptr<tqdm> progress_bar_;   //!< render progress bar
-  size_t progress_bar_total_pixels_ = 0; //!< total number pixels to render
-  size_t progress_bar_done_pixels_ = 0;  //!< number of pixels that have been rendered
+  ProgressOptions progress_options_;  //!< progress report options
+  bool diagnostics_enabled_ = false;  //!< record per-pixel diagnostics
+  std::vector<PixelDiagnostics> diagnostics_;  //!< diagnostics of each
+                                   //!< pixel (empty: not recorded)
+  RenderProgress progress_;        //!< per-thread progress counters
   uint num_samples_per_pixel_ = 1;
+  Real adaptive_tolerance_ = 0;    //!< adaptive sampling error (0: off)
+  uint adaptive_min_samples_ = 4;  //!< adaptive sampling batch size
+  Integrator integrator_ = Integrator::kRecursive;  //!< sample integrator
+  SamplerType sampler_type_ = SamplerType::kIndependent;  //!< sample sequence
+  PathOptions path_options_;       //!< secondary ray pruning options
+  uint light_budget_ = 0;          //!< lights per hit point (0: all)
+  LightTree light_tree_;           //!< lights picked by hit points
+  LightResamplingOptions light_resampling_;  //!< primary hit resampling
+  const std::vector<uint32_t> *primary_lights_ = nullptr;  //!< lights
+                                   //!< shaded at primary hits (nullptr: all)
+  ReservoirFrame reservoirs_;      //!< reservoirs of the current frame
+  ReservoirFrame previous_reservoirs_;  //!< reservoirs of the last frame
+  uint resampling_frame_ = 0;      //!< frames rendered with temporal reuse
+
+  // parallel rendering related data members
+  uint num_threads_ = 0;  //!< number of render threads (0: all cores)
+  uint tile_size_ = 16;   //!< width/height of image tiles in pixels
+  uint seed_ = 0;         //!< seed for per-pixel sample streams
+
+  // render statistics
+  RayCounts ray_counts_{};       //!< rays traced by the last render
+  uint64_t total_samples_ = 0;   //!< samples taken by the last render
+  double render_time_ = 0;       //!< wall time of the last render (s)
 };
 
 }  // namespace core
@@ -0,0 +1,131 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       render_checkpoint.cc
+//! \brief      Per-pixel sample accumulation and render checkpoints
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/render_checkpoint.h"
+#include <cstring>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <spdlog/spdlog.h>
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+// file header: magic, width, height, settings key; followed by one
+// record per pixel. Sums are stored as doubles in either precision.
+const char kMagic[8] = {'O', 'L', 'I', 'O', 'C', 'K', 'P', '1'};
+
+//! \struct PixelRecord
+//! \brief PixelStats as stored in checkpoint files
+struct PixelRecord {
+  double color_sum[3];
+  double mean;
+  double squared_deviations;
+  uint32_t num_samples;
+  uint32_t done;
+};
+
+}  // namespace
+
+
+bool
+WriteCheckpoint(const string &path, int width, int height, uint64_t key,
+                const vector<PixelStats> &pixels)
+{
+  namespace fs = boost::filesystem;
+  auto temp_path = path + ".tmp";
+  {
+    ofstream out(temp_path, ios::binary | ios::trunc);
+    int32_t size[2] = {width, height};
+    out.write(kMagic, sizeof(kMagic));
+    out.write(reinterpret_cast<const char*>(size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    vector<PixelRecord> records(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      const auto &stats = pixels[i];
+      auto &record = records[i];
+      for (int c = 0; c < 3; ++c)
+        record.color_sum[c] = static_cast<double>(stats.color_sum[c]);
+      record.mean = static_cast<double>(stats.mean);
+      record.squared_deviations = static_cast<double>(stats.squared_deviations);
+      record.num_samples = stats.num_samples;
+      record.done = stats.done ? 1 : 0;
+    }
+    out.write(reinterpret_cast<const char*>(records.data()),
+              static_cast<streamsize>(records.size() * sizeof(PixelRecord)));
+    if (!out) {
+      spdlog::error("WriteCheckpoint: could not write {}", temp_path);
+      return false;
+    }
+  }
+  boost::system::error_code error;
+  fs::rename(temp_path, path, error);
+  if (error) {
+    spdlog::error("WriteCheckpoint: could not rename {}: {}", temp_path,
+                  error.message());
+    return false;
+  }
+  return true;
+}
+
+
+bool
+ReadCheckpoint(const string &path, int width, int height, uint64_t key,
+               vector<PixelStats> &pixels)
+{
+  ifstream in(path, ios::binary);
+  if (!in) {
+    spdlog::warn("ReadCheckpoint: could not open {}", path);
+    return false;
+  }
+  char magic[sizeof(kMagic)];
+  int32_t size[2];
+  uint64_t file_key;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(size), sizeof(size));
+  in.read(reinterpret_cast<char*>(&file_key), sizeof(file_key));
+  if (!in || std::memcmp(magic, kMagic, sizeof(kMagic))) {
+    spdlog::warn("ReadCheckpoint: {} is not a checkpoint", path);
+    return false;
+  }
+  if (size[0] != width || size[1] != height || file_key != key) {
+    spdlog::warn("ReadCheckpoint: {} is of a render with other settings",
+                 path);
+    return false;
+  }
+  vector<PixelRecord> records(static_cast<size_t>(width) *
+                              static_cast<size_t>(height));
+  in.read(reinterpret_cast<char*>(records.data()),
+          static_cast<streamsize>(records.size() * sizeof(PixelRecord)));
+  if (!in) {
+    spdlog::warn("ReadCheckpoint: {} is truncated", path);
+    return false;
+  }
+  pixels.resize(records.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    const auto &record = records[i];
+    auto &stats = pixels[i];
+    stats.color_sum = Vec3r{static_cast<Real>(record.color_sum[0]),
+                            static_cast<Real>(record.color_sum[1]),
+                            static_cast<Real>(record.color_sum[2])};
+    stats.mean = static_cast<Real>(record.mean);
+    stats.squared_deviations = static_cast<Real>(record.squared_deviations);
+    stats.num_samples = record.num_samples;
+    stats.done = record.done != 0;
+  }
+  return true;
+}
+
+}  // namespace core
+}  // namespace olio
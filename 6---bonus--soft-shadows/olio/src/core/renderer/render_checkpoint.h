@@ -0,0 +1,69 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       render_checkpoint.h
+//! \brief      Per-pixel sample accumulation and render checkpoints
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "core/types.h"
+
+namespace olio {
+namespace core {
+
+//! \struct PixelStats
+//! \brief Running sums of the samples taken in a pixel
+//! \details Pixel sample s always draws from the sample stream keyed by
+//!    (seed, pixel, s) (see Sampler), so num_samples is all the random
+//!    number state a pixel needs to continue.
+struct PixelStats {
+  Vec3r color_sum{0, 0, 0};    //!< sum of sample colors
+  uint num_samples{0};         //!< samples taken (index of the next one)
+  Real mean{0};                //!< mean sample luminance
+  Real squared_deviations{0};  //!< sum of squared luminance deviations
+  bool done{false};            //!< whether the pixel needs no more samples
+};
+
+//! \struct CheckpointOptions
+//! \brief When and where RayTracer::Render() saves its per-pixel
+//!        sample sums (see RayTracer::SetCheckpoint())
+struct CheckpointOptions {
+  std::string path;            //!< checkpoint file (empty: no checkpoints)
+  double interval_minutes{10}; //!< min time between checkpoints (0: off)
+  uint interval_passes{0};     //!< passes between checkpoints (0: off)
+  uint pass_samples{16};       //!< max samples per pixel added by a pass
+  bool resume{false};          //!< continue from the file if it matches
+};
+
+//! \brief Write per-pixel sample sums to a checkpoint file
+//! \details The file is written next to path and then renamed, so an
+//!    interruption never leaves a partial checkpoint behind.
+//! \param[in] path Checkpoint file path
+//! \param[in] width Image width
+//! \param[in] height Image height
+//! \param[in] key Render settings the samples depend on
+//! \param[in] pixels Stats of each pixel, in render order
+//! \return True on success
+bool WriteCheckpoint(const std::string &path, int width, int height,
+                     uint64_t key, const std::vector<PixelStats> &pixels);
+
+//! \brief Read per-pixel sample sums from a checkpoint file
+//! \param[in] path Checkpoint file path
+//! \param[in] width Expected image width
+//! \param[in] height Expected image height
+//! \param[in] key Expected settings key
+//! \param[out] pixels Stats of each pixel, in render order
+//! \return False if the file is missing, invalid, or of another render
+bool ReadCheckpoint(const std::string &path, int width, int height,
+                    uint64_t key, std::vector<PixelStats> &pixels);
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,326 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       render_progress.cc
+//! \brief      RenderProgress class
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/render_progress.h"
+#include <algorithm>
+#include <unistd.h>
+#include <tbb/task_arena.h>
+#include <spdlog/spdlog.h>
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+const int kNumRayTypes = static_cast<int>(RayType::kCount);
+
+
+//! \brief Format a rate with a metric prefix
+//! \param[in] rate Events per second
+//! \return Text such as "1.23M"
+string
+FormatRate(double rate)
+{
+  if (rate >= 1e9)
+    return fmt::format("{:.2f}G", rate * 1e-9);
+  if (rate >= 1e6)
+    return fmt::format("{:.2f}M", rate * 1e-6);
+  if (rate >= 1e3)
+    return fmt::format("{:.2f}k", rate * 1e-3);
+  return fmt::format("{:.0f}", rate);
+}
+
+
+//! \brief Format a duration for the status line
+//! \param[in] seconds Duration (negative: unknown)
+//! \return Text such as "1h02m03s"
+string
+FormatDuration(double seconds)
+{
+  if (seconds < 0)
+    return "?";
+  auto total = static_cast<long long>(seconds + 0.5);
+  if (total >= 3600)
+    return fmt::format("{}h{:02}m{:02}s", total / 3600, total / 60 % 60,
+                       total % 60);
+  if (total >= 60)
+    return fmt::format("{}m{:02}s", total / 60, total % 60);
+  return fmt::format("{}s", total);
+}
+
+}  // namespace
+
+
+string
+ProgressReport::ToJson() const
+{
+  string utilization;
+  for (size_t i = 0; i < thread_utilization.size(); ++i)
+    utilization += fmt::format("{}{:.3f}", i ? ", " : "",
+                               thread_utilization[i]);
+  return fmt::format("{{\"event\": \"{}\", \"done_pixels\": {}, "
+                     "\"total_pixels\": {}, \"elapsed\": {:.3f}, "
+                     "\"pixels_per_second\": {:.1f}, \"rays_per_second\": "
+                     "{{\"primary\": {:.1f}, \"secondary\": {:.1f}, "
+                     "\"shadow\": {:.1f}}}, "
+                     "\"eta\": {:.3f}, \"thread_utilization\": [{}]}}",
+                     last ? "done" : "progress", done_pixels, total_pixels,
+                     elapsed, pixels_per_second,
+                     rays_per_second[static_cast<int>(RayType::kPrimary)],
+                     rays_per_second[static_cast<int>(RayType::kSecondary)],
+                     rays_per_second[static_cast<int>(RayType::kShadow)],
+                     eta, utilization);
+}
+
+
+void
+RenderProgress::Start(size_t total_pixels, int num_threads,
+                      const ProgressOptions &options)
+{
+  Stop();
+  num_slots_ = static_cast<size_t>(std::max(num_threads, 1));
+  // atomics cannot be moved, so the slots are built in a new vector
+  decltype(counters_) slots(num_slots_);
+  counters_.swap(slots);
+  for (size_t i = 0; i < num_slots_; ++i) {
+    auto &counters = counters_[i];
+    counters.pixels.store(0, memory_order_relaxed);
+    counters.samples.store(0, memory_order_relaxed);
+    for (auto &rays : counters.rays)
+      rays.store(0, memory_order_relaxed);
+    counters.busy_ns.store(0, memory_order_relaxed);
+    counters.work_start_ns.store(-1, memory_order_relaxed);
+  }
+  skipped_pixels_.store(0, memory_order_relaxed);
+  total_pixels_ = total_pixels;
+  options_ = options;
+  start_time_ = chrono::steady_clock::now();
+  last_report_time_ = 0;
+  last_pixels_ = 0;
+  last_rays_ = RayCounts{};
+  last_busy_ns_.assign(num_slots_, 0);
+
+  // the status line is only drawn on terminals, and not over json
+  // lines written to stdout
+  show_bar_ = options_.show_bar && options_.json_path != "-" &&
+    isatty(fileno(stdout));
+  json_file_ = nullptr;
+  if (options_.json_path == "-") {
+    json_file_ = stdout;
+  } else if (!options_.json_path.empty()) {
+    json_file_ = std::fopen(options_.json_path.c_str(), "a");
+    if (!json_file_)
+      spdlog::error("RenderProgress: could not open {}",
+                    options_.json_path);
+  }
+
+  stop_ = false;
+  if ((show_bar_ || json_file_) && options_.interval_seconds > 0)
+    reporter_ = thread{&RenderProgress::Run, this};
+}
+
+
+ProgressReport
+RenderProgress::Stop()
+{
+  if (counters_.empty())
+    return ProgressReport{};
+  {
+    std::lock_guard<std::mutex> lock{reporter_mutex_};
+    stop_ = true;
+  }
+  reporter_cv_.notify_all();
+  if (reporter_.joinable())
+    reporter_.join();
+
+  // final report over the whole render
+  last_report_time_ = 0;
+  last_pixels_ = 0;
+  last_rays_ = RayCounts{};
+  std::fill(last_busy_ns_.begin(), last_busy_ns_.end(), 0);
+  auto report = TakeReport();
+  report.last = true;
+  Print(report);
+  if (json_file_ && json_file_ != stdout)
+    std::fclose(json_file_);
+  json_file_ = nullptr;
+  show_bar_ = false;
+  return report;
+}
+
+
+size_t
+RenderProgress::BeginWork()
+{
+  // TBB numbers the threads of an arena from 0; threads outside of
+  // it share slots, which stays correct as the counters are atomic
+  int index = tbb::this_task_arena::current_thread_index();
+  size_t slot = index < 0 ? 0 : static_cast<size_t>(index) % num_slots_;
+  counters_[slot].work_start_ns.store(GetTime(), memory_order_relaxed);
+  return slot;
+}
+
+
+void
+RenderProgress::EndWork(size_t slot, size_t pixels, const RayCounts &rays,
+                        uint64_t samples)
+{
+  auto &counters = counters_[slot];
+  auto start = counters.work_start_ns.exchange(-1, memory_order_relaxed);
+  if (start >= 0)
+    counters.busy_ns.fetch_add(GetTime() - start, memory_order_relaxed);
+  counters.pixels.fetch_add(pixels, memory_order_relaxed);
+  counters.samples.fetch_add(samples, memory_order_relaxed);
+  for (int i = 0; i < kNumRayTypes; ++i)
+    counters.rays[i].fetch_add(rays.counts[i], memory_order_relaxed);
+}
+
+
+void
+RenderProgress::AddPixels(size_t pixels)
+{
+  skipped_pixels_.fetch_add(pixels, memory_order_relaxed);
+}
+
+
+RayCounts
+RenderProgress::GetRayCounts() const
+{
+  RayCounts rays{};
+  for (size_t i = 0; i < num_slots_; ++i) {
+    for (int j = 0; j < kNumRayTypes; ++j)
+      rays.counts[j] += counters_[i].rays[j].load(memory_order_relaxed);
+  }
+  return rays;
+}
+
+
+uint64_t
+RenderProgress::GetNumSamples() const
+{
+  uint64_t samples = 0;
+  for (size_t i = 0; i < num_slots_; ++i)
+    samples += counters_[i].samples.load(memory_order_relaxed);
+  return samples;
+}
+
+
+ProgressReport
+RenderProgress::TakeReport()
+{
+  ProgressReport report;
+  auto now = GetTime();
+  uint64_t pixels = skipped_pixels_.load(memory_order_relaxed);
+  for (size_t i = 0; i < num_slots_; ++i)
+    pixels += counters_[i].pixels.load(memory_order_relaxed);
+  auto rays = GetRayCounts();
+
+  // rates over the time since the previous report; the ETA uses the
+  // average rate of the whole render
+  double window = static_cast<double>(now - last_report_time_) * 1e-9;
+  report.done_pixels = std::min(static_cast<size_t>(pixels), total_pixels_);
+  report.total_pixels = total_pixels_;
+  report.elapsed = static_cast<double>(now) * 1e-9;
+  if (window > 0) {
+    report.pixels_per_second = static_cast<double>(pixels - last_pixels_) /
+      window;
+    for (int i = 0; i < kNumRayTypes; ++i) {
+      report.rays_per_second[i] = static_cast<double>(
+        rays.counts[i] - last_rays_.counts[i]) / window;
+    }
+  }
+  if (report.done_pixels == report.total_pixels)
+    report.eta = 0;
+  else if (report.done_pixels > 0)
+    report.eta = report.elapsed * static_cast<double>(
+      report.total_pixels - report.done_pixels) /
+      static_cast<double>(report.done_pixels);
+
+  // busy time includes the running part of the current work of each
+  // thread; the two counters are read separately, so the fraction is
+  // approximate and clamped
+  report.thread_utilization.resize(num_slots_);
+  for (size_t i = 0; i < num_slots_; ++i) {
+    auto busy = counters_[i].busy_ns.load(memory_order_relaxed);
+    auto start = counters_[i].work_start_ns.load(memory_order_relaxed);
+    if (start >= 0)
+      busy += std::max<int64_t>(now - start, 0);
+    double fraction = window > 0 ?
+      static_cast<double>(busy - last_busy_ns_[i]) * 1e-9 / window : 0;
+    report.thread_utilization[i] = std::min(std::max(fraction, 0.0), 1.0);
+    last_busy_ns_[i] = std::max(busy, last_busy_ns_[i]);
+  }
+  last_report_time_ = now;
+  last_pixels_ = pixels;
+  last_rays_ = rays;
+  return report;
+}
+
+
+void
+RenderProgress::Run()
+{
+  auto interval = chrono::duration<double>(options_.interval_seconds);
+  std::unique_lock<std::mutex> lock{reporter_mutex_};
+  while (!reporter_cv_.wait_for(lock, interval, [this] {return stop_;})) {
+    lock.unlock();
+    Print(TakeReport());
+    lock.lock();
+  }
+}
+
+
+void
+RenderProgress::Print(const ProgressReport &report)
+{
+  if (show_bar_) {
+    double percent = report.total_pixels ? 100.0 *
+      static_cast<double>(report.done_pixels) /
+      static_cast<double>(report.total_pixels) : 100.0;
+    double mean_use = 0, min_use = 1;
+    for (auto use : report.thread_utilization) {
+      mean_use += use;
+      min_use = std::min(min_use, use);
+    }
+    if (!report.thread_utilization.empty())
+      mean_use /= static_cast<double>(report.thread_utilization.size());
+    const auto &rays = report.rays_per_second;
+    std::printf("\r%5.1f%% | %s pixels/s | rays/s %s primary, %s secondary, "
+                "%s shadow | %s, ETA %s | threads %.0f%% busy (min %.0f%%)"
+                "\033[K", percent, FormatRate(report.pixels_per_second).c_str(),
+                FormatRate(rays[static_cast<int>(RayType::kPrimary)]).c_str(),
+                FormatRate(rays[static_cast<int>(RayType::kSecondary)]).c_str(),
+                FormatRate(rays[static_cast<int>(RayType::kShadow)]).c_str(),
+                FormatDuration(report.elapsed).c_str(),
+                FormatDuration(report.eta).c_str(), 100 * mean_use,
+                100 * min_use);
+    if (report.last)
+      std::printf("\n");
+    std::fflush(stdout);
+  }
+  if (json_file_) {
+    std::fprintf(json_file_, "%s\n", report.ToJson().c_str());
+    std::fflush(json_file_);
+  }
+}
+
+
+int64_t
+RenderProgress::GetTime() const
+{
+  return chrono::duration_cast<chrono::nanoseconds>(
+    chrono::steady_clock::now() - start_time_).count();
+}
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,161 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       render_progress.h
+//! \brief      RenderProgress class
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tbb/cache_aligned_allocator.h>
+#include "core/types.h"
+#include "core/renderer/ray_stats.h"
+
+namespace olio {
+namespace core {
+
+//! \struct ProgressOptions
+//! \brief How RenderProgress reports a render
+struct ProgressOptions {
+  double interval_seconds{1};  //!< time between reports
+  bool show_bar{true};         //!< draw a status line on the terminal
+  std::string json_path;       //!< json lines file ("-": stdout, empty: none)
+};
+
+//! \struct ProgressReport
+//! \brief Render progress and throughput at one point in time
+struct ProgressReport {
+  size_t done_pixels{0};       //!< pixels rendered so far
+  size_t total_pixels{0};      //!< pixels to render
+  double elapsed{0};           //!< time since the start (s)
+  double pixels_per_second{0}; //!< pixel rate since the last report
+  double rays_per_second[static_cast<int>(RayType::kCount)]{};  //!< ray rate
+                               //!< per RayType since the last report
+  double eta{-1};              //!< estimated time left (s, -1: unknown)
+  std::vector<double> thread_utilization;  //!< busy fraction of each
+                               //!< render thread since the last report
+  bool last{false};            //!< whether this is the final report,
+                               //!< whose rates cover the whole render
+
+  //! \brief Get the report as a single-line json object
+  //! \return Json text (without a line break)
+  std::string ToJson() const;
+};
+
+//! \class RenderProgress
+//! \brief Counts the work of render threads without locks and reports
+//!        it from a separate thread at a fixed interval
+//! \details Every render thread adds to its own slot of atomic
+//!    counters (relaxed increments, no shared cache lines between
+//!    slots). The reporter thread wakes up every interval, sums the
+//!    slots, and prints a status line and/or appends a json line with
+//!    pixel and ray rates, the ETA, and per-thread utilization, so the
+//!    cost of reporting does not depend on how fast pixels finish.
+class RenderProgress {
+public:
+  RenderProgress() = default;
+  RenderProgress(const RenderProgress&) = delete;
+  RenderProgress &operator=(const RenderProgress&) = delete;
+
+  //! \brief Stops the reporter thread
+  ~RenderProgress() {Stop();}
+
+  //! \brief Reset the counters and start the reporter thread
+  //! \param[in] total_pixels Number of pixels that will be rendered
+  //! \param[in] num_threads Number of render threads
+  //! \param[in] options Report interval and outputs
+  void Start(size_t total_pixels, int num_threads,
+             const ProgressOptions &options);
+
+  //! \brief Stop the reporter thread and print a final report
+  //! \return Final report, with rates over the whole render
+  ProgressReport Stop();
+
+  //! \brief Mark the start of a unit of work on the calling thread
+  //! \return Counter slot of the thread, to be passed to EndWork()
+  size_t BeginWork();
+
+  //! \brief Count a finished unit of work of the calling thread
+  //! \param[in] slot Slot returned by BeginWork()
+  //! \param[in] pixels Number of pixels that were rendered
+  //! \param[in] rays Rays that were traced
+  //! \param[in] samples Number of samples that were stored
+  void EndWork(size_t slot, size_t pixels, const RayCounts &rays,
+               uint64_t samples);
+
+  //! \brief Count pixels that did not need to be rendered
+  //! \param[in] pixels Number of pixels
+  void AddPixels(size_t pixels);
+
+  //! \brief Get the rays counted since Start()
+  //! \return Ray counts summed over all threads
+  RayCounts GetRayCounts() const;
+
+  //! \brief Get the samples counted since Start()
+  //! \return Sample count summed over all threads
+  uint64_t GetNumSamples() const;
+
+  //! \brief Get the progress since the previous report
+  //! \details Only the reporter thread should call this while a render
+  //!    is running, as it moves the start of the next rate window.
+  //! \return Current progress
+  ProgressReport TakeReport();
+protected:
+  //! \struct ThreadCounters
+  //! \brief Counters written by one render thread, on cache lines of
+  //!        their own
+  struct alignas(64) ThreadCounters {
+    std::atomic<uint64_t> pixels;      //!< rendered pixels
+    std::atomic<uint64_t> samples;     //!< stored samples
+    std::atomic<uint64_t> rays[static_cast<int>(RayType::kCount)];  //!< rays
+    std::atomic<int64_t> busy_ns;      //!< time spent in finished work
+    std::atomic<int64_t> work_start_ns;  //!< start of the current work
+                                       //!< (-1: idle)
+  };
+
+  //! \brief Reporter thread loop
+  void Run();
+
+  //! \brief Print or write one report
+  //! \param[in] report Report to print
+  void Print(const ProgressReport &report);
+
+  //! \brief Get time since Start()
+  //! \return Nanoseconds
+  int64_t GetTime() const;
+
+  std::vector<ThreadCounters, tbb::cache_aligned_allocator<ThreadCounters>>
+  counters_;                        //!< one slot per thread
+  size_t num_slots_ = 0;            //!< number of slots in counters_
+  std::atomic<uint64_t> skipped_pixels_{0};  //!< pixels added by AddPixels()
+  size_t total_pixels_ = 0;         //!< pixels to render
+  ProgressOptions options_;         //!< report interval and outputs
+  std::chrono::steady_clock::time_point start_time_;  //!< render start
+  int64_t last_report_time_ = 0;    //!< time of the previous report (ns)
+  uint64_t last_pixels_ = 0;        //!< pixels at the previous report
+  RayCounts last_rays_{};           //!< rays at the previous report
+  std::vector<int64_t> last_busy_ns_;  //!< thread busy times at the
+                                    //!< previous report
+  std::thread reporter_;            //!< reporter thread
+  std::mutex reporter_mutex_;       //!< guards stop_ for reporter_cv_
+  std::condition_variable reporter_cv_;  //!< wakes up the reporter early
+  bool stop_ = false;               //!< whether the reporter should exit
+  bool show_bar_ = false;           //!< whether the status line is drawn
+  std::FILE *json_file_ = nullptr;  //!< json lines output
+};
+
+}  // namespace core
+}  // namespace olio
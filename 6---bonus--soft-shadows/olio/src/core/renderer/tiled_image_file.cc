@@ -0,0 +1,213 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       tiled_image_file.cc
+//! \brief      TiledImageFile class
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/tiled_image_file.h"
+#include <algorithm>
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+// file header: magic, width, height, tile size, settings key
+const char kMagic[8] = {'O', 'L', 'I', 'O', 'T', 'I', 'L', '1'};
+const uint64_t kHeaderSize = sizeof(kMagic) + 3 * sizeof(int32_t) +
+  sizeof(uint64_t);
+
+}  // namespace
+
+
+void
+TiledImageFile::SetLayout(int width, int height, int tile_size)
+{
+  width_ = width;
+  height_ = height;
+  tile_size_ = tile_size;
+  tiles_x_ = (width + tile_size - 1) / tile_size;
+  tiles_y_ = (height + tile_size - 1) / tile_size;
+  done_.assign(static_cast<size_t>(tiles_x_) * static_cast<size_t>(tiles_y_),
+               0);
+}
+
+
+uint64_t
+TiledImageFile::GetTileOffset(size_t tile) const
+{
+  auto slot_size = static_cast<uint64_t>(tile_size_) *
+    static_cast<uint64_t>(tile_size_) * 3 * sizeof(float);
+  return kHeaderSize + done_.size() + tile * slot_size;
+}
+
+
+bool
+TiledImageFile::ReadHeader(uint64_t &key)
+{
+  char magic[sizeof(kMagic)];
+  int32_t layout[3];
+  file_.read(magic, sizeof(magic));
+  file_.read(reinterpret_cast<char*>(layout), sizeof(layout));
+  file_.read(reinterpret_cast<char*>(&key), sizeof(key));
+  if (!file_ || std::memcmp(magic, kMagic, sizeof(kMagic)) ||
+      layout[0] <= 0 || layout[1] <= 0 || layout[2] <= 0)
+    return false;
+  SetLayout(layout[0], layout[1], layout[2]);
+  file_.read(done_.data(), static_cast<streamsize>(done_.size()));
+  return static_cast<bool>(file_);
+}
+
+
+bool
+TiledImageFile::Open(const string &path, int width, int height, int tile_size,
+                     uint64_t key)
+{
+  Close();
+  if (width <= 0 || height <= 0 || tile_size <= 0) {
+    spdlog::error("TiledImageFile: invalid image layout");
+    return false;
+  }
+
+  // keep the done tiles of a matching file
+  file_.open(path, ios::in | ios::out | ios::binary);
+  uint64_t file_key = 0;
+  if (file_.is_open() && ReadHeader(file_key) && width_ == width &&
+      height_ == height && tile_size_ == tile_size && file_key == key) {
+    file_.clear();
+    return true;
+  }
+  if (file_.is_open()) {
+    spdlog::warn("TiledImageFile: {} was written with other settings; "
+                 "starting over", path);
+    file_.close();
+  }
+
+  // create a new file with no done tiles
+  file_.clear();
+  file_.open(path, ios::in | ios::out | ios::binary | ios::trunc);
+  if (!file_.is_open()) {
+    spdlog::error("TiledImageFile: could not create {}", path);
+    return false;
+  }
+  SetLayout(width, height, tile_size);
+  int32_t layout[3] = {width, height, tile_size};
+  file_.write(kMagic, sizeof(kMagic));
+  file_.write(reinterpret_cast<const char*>(layout), sizeof(layout));
+  file_.write(reinterpret_cast<const char*>(&key), sizeof(key));
+  file_.write(done_.data(), static_cast<streamsize>(done_.size()));
+  file_.flush();
+  if (!file_) {
+    spdlog::error("TiledImageFile: could not write {}", path);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+
+bool
+TiledImageFile::OpenForReading(const string &path)
+{
+  Close();
+  file_.open(path, ios::in | ios::binary);
+  uint64_t key;
+  if (!file_.is_open() || !ReadHeader(key)) {
+    spdlog::error("TiledImageFile: could not read {}", path);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+
+void
+TiledImageFile::Close()
+{
+  if (file_.is_open())
+    file_.close();
+  file_.clear();
+  SetLayout(0, 0, 1);
+}
+
+
+size_t
+TiledImageFile::GetNumDoneTiles() const
+{
+  return static_cast<size_t>(std::count(done_.begin(), done_.end(), 1));
+}
+
+
+bool
+TiledImageFile::IsTileDone(size_t tile) const
+{
+  return tile < done_.size() && done_[tile];
+}
+
+
+bool
+TiledImageFile::WriteTile(size_t tile, const vector<float> &rgb)
+{
+  if (tile >= done_.size())
+    return false;
+  std::lock_guard<std::mutex> lock{mutex_};
+
+  // pixels first, then the done flag, so that a crash never leaves a
+  // done tile with missing pixels
+  auto size = std::min(rgb.size(), static_cast<size_t>(tile_size_) *
+                       static_cast<size_t>(tile_size_) * 3);
+  file_.seekp(static_cast<streamoff>(GetTileOffset(tile)));
+  file_.write(reinterpret_cast<const char*>(rgb.data()),
+              static_cast<streamsize>(size * sizeof(float)));
+  file_.flush();
+  done_[tile] = 1;
+  file_.seekp(static_cast<streamoff>(kHeaderSize + tile));
+  file_.write(&done_[tile], 1);
+  file_.flush();
+  return static_cast<bool>(file_);
+}
+
+
+bool
+TiledImageFile::ReadTileRow(int tile_row, vector<float> &rgb)
+{
+  if (tile_row < 0 || tile_row >= tiles_y_)
+    return false;
+  std::lock_guard<std::mutex> lock{mutex_};
+  const int y_begin = tile_row * tile_size_;
+  const int rows = std::min(tile_size_, height_ - y_begin);
+  rgb.assign(static_cast<size_t>(rows) * static_cast<size_t>(width_) * 3, 0);
+  vector<float> tile_rgb;
+  for (int tx = 0; tx < tiles_x_; ++tx) {
+    auto tile = static_cast<size_t>(tile_row * tiles_x_ + tx);
+    if (!done_[tile])
+      continue;
+    const int x_begin = tx * tile_size_;
+    const int cols = std::min(tile_size_, width_ - x_begin);
+    tile_rgb.resize(static_cast<size_t>(rows * cols) * 3);
+    file_.seekg(static_cast<streamoff>(GetTileOffset(tile)));
+    file_.read(reinterpret_cast<char*>(tile_rgb.data()),
+               static_cast<streamsize>(tile_rgb.size() * sizeof(float)));
+    if (!file_)
+      return false;
+    for (int y = 0; y < rows; ++y) {
+      std::copy(tile_rgb.begin() + 3 * y * cols,
+                tile_rgb.begin() + 3 * (y + 1) * cols,
+                rgb.begin() + 3 * (static_cast<ptrdiff_t>(y) * width_ +
+                                   x_begin));
+    }
+  }
+  return true;
+}
+
+}  // namespace core
+}  // namespace olio
@@ -0,0 +1,131 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       tiled_image_file.h
+//! \brief      TiledImageFile class
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace olio {
+namespace core {
+
+//! \class TiledImageFile
+//! \brief Raw float RGB image on disk that is written one tile at a
+//!        time, in any order, so that large renders do not need a
+//!        frame buffer and can be resumed after a crash
+//! \details The image is split into a grid of square tiles. The file
+//!    holds a header (size, tile size, and a settings key), one done
+//!    flag per tile, and a fixed-size slot per tile, in native byte
+//!    order. A tile's pixels are stored row by row in render order
+//!    (row 0 is the bottom of the image), and its done flag is set
+//!    once they have been flushed. Reopening a file with the same size,
+//!    tile size, and key keeps its done tiles.
+class TiledImageFile {
+public:
+  TiledImageFile() = default;
+  TiledImageFile(const TiledImageFile&) = delete;
+  TiledImageFile &operator=(const TiledImageFile&) = delete;
+
+  //! \brief Open a file for writing, keeping the done tiles of an
+  //!        existing file with the same layout and key, or creating a
+  //!        new one otherwise
+  //! \param[in] path File path
+  //! \param[in] width Image width
+  //! \param[in] height Image height
+  //! \param[in] tile_size Tile width/height in pixels
+  //! \param[in] key Render settings the tiles depend on
+  //! \return True on success
+  bool Open(const std::string &path, int width, int height, int tile_size,
+            uint64_t key);
+
+  //! \brief Open an existing file for reading
+  //! \param[in] path File path
+  //! \return True on success
+  bool OpenForReading(const std::string &path);
+
+  //! \brief Close the file
+  void Close();
+
+  //! \brief Get image width
+  //! \return Width in pixels
+  int GetWidth() const {return width_;}
+
+  //! \brief Get image height
+  //! \return Height in pixels
+  int GetHeight() const {return height_;}
+
+  //! \brief Get tile width/height
+  //! \return Tile size in pixels
+  int GetTileSize() const {return tile_size_;}
+
+  //! \brief Get number of tile columns
+  //! \return Tiles per row of the grid
+  int GetNumTilesX() const {return tiles_x_;}
+
+  //! \brief Get number of tile rows
+  //! \return Tiles per column of the grid
+  int GetNumTilesY() const {return tiles_y_;}
+
+  //! \brief Get number of tiles whose pixels are in the file
+  //! \return Number of done tiles
+  size_t GetNumDoneTiles() const;
+
+  //! \brief Check whether a tile's pixels are in the file
+  //! \param[in] tile Tile index (row-major in the grid)
+  //! \return True if the tile is done
+  bool IsTileDone(size_t tile) const;
+
+  //! \brief Write the pixels of a tile and mark it as done. Can be
+  //!        called from several threads.
+  //! \param[in] tile Tile index (row-major in the grid)
+  //! \param[in] rgb Tile pixels (3 floats each), rows in render order
+  //! \return True on success
+  bool WriteTile(size_t tile, const std::vector<float> &rgb);
+
+  //! \brief Read the pixels of a row of tiles
+  //! \param[in] tile_row Index of the row of tiles
+  //! \param[out] rgb Image rows [tile_row * tile size, end of the tile
+  //!             row) in render order, 3 floats per pixel; the pixels
+  //!             of tiles that are not done are 0
+  //! \return True on success
+  bool ReadTileRow(int tile_row, std::vector<float> &rgb);
+protected:
+  //! \brief Set the image layout and allocate the done flags
+  //! \param[in] width Image width
+  //! \param[in] height Image height
+  //! \param[in] tile_size Tile width/height in pixels
+  void SetLayout(int width, int height, int tile_size);
+
+  //! \brief Read the header and done flags of the opened file
+  //! \param[out] key Settings key stored in the file
+  //! \return True if the file has a valid header
+  bool ReadHeader(uint64_t &key);
+
+  //! \brief Get offset of a tile's slot in the file
+  //! \param[in] tile Tile index
+  //! \return Offset in bytes
+  uint64_t GetTileOffset(size_t tile) const;
+
+  std::fstream file_;          //!< opened file
+  std::mutex mutex_;           //!< guards file_ and done_
+  int width_ = 0;              //!< image width
+  int height_ = 0;             //!< image height
+  int tile_size_ = 0;          //!< tile width/height
+  int tiles_x_ = 0;            //!< number of tile columns
+  int tiles_y_ = 0;            //!< number of tile rows
+  std::vector<char> done_;     //!< done flag of each tile
+};
+
+}  // namespace core
+}  // namespace olio
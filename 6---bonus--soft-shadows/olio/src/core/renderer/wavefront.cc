@@ -0,0 +1,382 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       wavefront.cc
+//! \brief      Wavefront (queue-based) integrator
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/renderer/wavefront.h"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include "core/material/phong_material.h"
+#include "core/material/phong_dielectric.h"
+#include "core/renderer/ray_stats.h"
+#include "core/renderer/pixel_diagnostics.h"
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+void
+RayQueue::Clear()
+{
+  rays_.clear();
+  index_.clear();
+}
+
+
+void
+RayQueue::Push(const Ray &ray, uint index)
+{
+  rays_.push_back(ray);
+  index_.push_back(index);
+}
+
+
+WavefrontIntegrator::WavefrontIntegrator(uint max_ray_depth,
+                                         const Sampler &sampler,
+                                         const PathOptions &path_options,
+                                         const LightTree *light_tree,
+                                         const vector<uint32_t> *primary_lights) :
+  max_ray_depth_{max_ray_depth},
+  path_options_{path_options},
+  sampler_{sampler},
+  light_tree_{light_tree},
+  primary_lights_{primary_lights}
+{
+}
+
+
+int
+WavefrontIntegrator::AddVertex(const Ray &ray, uint sample, uint depth,
+                               uint64_t branch, const Vec3r &throughput,
+                               RayQueue &queue)
+{
+  PathVertex vertex;
+  vertex.sample = sample;
+  vertex.depth = depth;
+  vertex.branch = branch;
+  vertex.throughput = throughput;
+  auto index = static_cast<int>(vertices_.size());
+  vertices_.push_back(vertex);
+  queue.Push(ray, static_cast<uint>(index));
+  return index;
+}
+
+
+void
+WavefrontIntegrator::StartVertex(const vector<CameraSample> &samples,
+                                 const PathVertex &vertex)
+{
+  const auto &camera_sample = samples[vertex.sample];
+  sampler_.StartPixelSample(camera_sample.pixel, camera_sample.sample_index);
+  sampler_.SetBranch(vertex.branch);
+  sampler_.StartBounce(vertex.depth + 1);
+}
+
+
+void
+WavefrontIntegrator::Intersect(Surface::Ptr scene)
+{
+  phong_hits_.clear();
+  dielectric_hits_.clear();
+  hits_.resize(ray_queue_.Size());
+  for (size_t i = 0; i < ray_queue_.Size(); ++i) {
+    auto &vertex = vertices_[ray_queue_.GetIndex(i)];
+    OLIO_DIAGNOSTICS_SAMPLE(vertex.sample);
+    OLIO_DIAGNOSTICS_DEPTH(vertex.depth + 1);
+    CountRay(vertex.depth ? RayType::kSecondary : RayType::kPrimary);
+    auto &hit_record = hits_[i];
+    hit_record = HitRecord{};
+    if (!scene->Hit(ray_queue_.GetRay(i), kEpsilon, kInfinity, hit_record))
+      continue;
+    auto hit_surface = hit_record.GetSurface();
+    if (!hit_surface)
+      continue;
+
+    // group hit points by material type
+    vertex.type = VertexType::kBlack;
+    const auto &material = hit_surface->GetMaterial();
+    if (!material) {
+      spdlog::error("WavefrontIntegrator: surface has no material -- "
+                    "returning black.");
+      continue;
+    }
+    if (material->GetKind() != MaterialKind::kNone)
+      hit_record.ComputeShading(ray_queue_.GetRay(i));
+    switch (material->GetKind()) {
+    case MaterialKind::kDielectric:
+      vertex.type = VertexType::kDielectric;
+      dielectric_hits_.push_back(i);
+      break;
+    case MaterialKind::kPhong:
+      vertex.type = VertexType::kPhong;
+      phong_hits_.push_back(i);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+
+void
+WavefrontIntegrator::ShadeDielectrics(const vector<CameraSample> &samples)
+{
+  for (auto i : dielectric_hits_) {
+    auto vertex_index = ray_queue_.GetIndex(i);
+    const auto &hit_record = hits_[i];
+    const auto &material = hit_record.GetSurface()->GetMaterial();
+    auto dielectric = static_cast<const PhongDielectric*>(material.get());
+    auto scatter = dielectric->Scatter(hit_record, ray_queue_.GetRay(i));
+    const auto &attenuate = scatter.attenuation;
+    StartVertex(samples, vertices_[vertex_index]);
+    Vec3r throughput = vertices_[vertex_index].throughput;
+    SelectGlassRays(path_options_, throughput, sampler_, scatter);
+
+    auto sample = vertices_[vertex_index].sample;
+    auto depth = vertices_[vertex_index].depth + 1;
+    auto branch = vertices_[vertex_index].branch;
+    int refract_child = -1, reflect_child = -1;
+    if (depth < max_ray_depth_) {
+      if (scatter.has_refract_ray)
+        refract_child = AddVertex(scatter.refract_ray, sample, depth,
+                                  Sampler::ChildBranch(branch, 0),
+                                  throughput.cwiseProduct(attenuate) *
+                                  scatter.refract_weight, next_ray_queue_);
+      if (scatter.has_reflect_ray)
+        reflect_child = AddVertex(scatter.reflect_ray, sample, depth,
+                                  Sampler::ChildBranch(branch, 1),
+                                  throughput.cwiseProduct(attenuate) *
+                                  scatter.reflect_weight, next_ray_queue_);
+    }
+    auto &vertex = vertices_[vertex_index];
+    vertex.weight = attenuate;
+    vertex.refract_weight = scatter.refract_weight;
+    vertex.reflect_weight = scatter.reflect_weight;
+    vertex.refract_child = refract_child;
+    vertex.reflect_child = reflect_child;
+  }
+}
+
+
+void
+WavefrontIntegrator::ShadePhong(const vector<CameraSample> &samples,
+                                const vector<Light::Ptr> &lights)
+{
+  for (auto i : phong_hits_) {
+    auto vertex_index = ray_queue_.GetIndex(i);
+    const auto &hit_record = hits_[i];
+    const auto &material = hit_record.GetSurface()->GetMaterial();
+    auto phong_material = static_cast<const PhongMaterial*>(material.get());
+    auto sample = vertices_[vertex_index].sample;
+    auto depth = vertices_[vertex_index].depth;
+    Vec3r throughput = vertices_[vertex_index].throughput;
+
+    // draw light samples from the same stream as RayTracer::RayColor()
+    StartVertex(samples, vertices_[vertex_index]);
+    auto ray = ray_queue_.GetRay(i);
+    Vec3r view_vec = -ray.GetDirection().normalized();
+    light_picks_.clear();
+    if (depth == 0 && primary_lights_) {
+      for (auto light : *primary_lights_)
+        light_picks_.push_back(LightPick{light, 1});
+    } else if (light_tree_ && !light_tree_->IsEmpty()) {
+      light_tree_->Select(hit_record.GetPoint(), hit_record.GetNormal(),
+                          sampler_, light_picks_);
+    } else {
+      for (size_t l = 0; l < lights.size(); ++l)
+        light_picks_.push_back(LightPick{static_cast<uint32_t>(l), 1});
+    }
+    for (const auto &pick : light_picks_) {
+      LightEval eval;
+      eval.vertex = vertex_index;
+      eval.begin = static_cast<uint>(light_samples_.size());
+      eval.scale = lights[pick.light]->SampleIllumination(hit_record, view_vec,
+                                                          sampler_,
+                                                          light_samples_);
+      eval.end = static_cast<uint>(light_samples_.size());
+      eval.weight = pick.weight;
+      light_evals_.push_back(eval);
+    }
+
+    // queue mirror reflection
+    const auto &v = ray.GetDirection();
+    const auto &n = hit_record.GetNormal();
+    const Vec3r &reflect = v - 2 * v.dot(n) * n;
+    const auto &mirror = phong_material->GetMirror();
+    Real mirror_weight;
+    if (!mirror.isZero() && hit_record.IsFrontFace() &&
+        ContinuePath(path_options_, throughput.cwiseProduct(mirror), sampler_,
+                     mirror_weight) && depth + 1 < max_ray_depth_) {
+      const Vec3r &weighted_mirror = mirror * mirror_weight;
+      int child = AddVertex(Ray{hit_record.GetPoint(), reflect}, sample,
+                            depth + 1, vertices_[vertex_index].branch,
+                            throughput.cwiseProduct(weighted_mirror),
+                            next_ray_queue_);
+      vertices_[vertex_index].weight = weighted_mirror;
+      vertices_[vertex_index].reflect_child = child;
+    }
+  }
+}
+
+
+void
+WavefrontIntegrator::TraceShadowQueue(const Surface::Ptr &scene)
+{
+  for (size_t i = 0; i < shadow_queue_.Size(); ++i) {
+#ifdef OLIO_ENABLE_DIAGNOSTICS
+    // light evals are stored in light sample order
+    auto light_sample = shadow_queue_.GetIndex(i);
+    auto eval = std::upper_bound(light_evals_.begin(), light_evals_.end(),
+                                 light_sample,
+                                 [](uint sample, const LightEval &other) {
+                                   return sample < other.begin;
+                                 }) - 1;
+    OLIO_DIAGNOSTICS_SAMPLE(vertices_[eval->vertex].sample);
+#endif
+    CountRay(RayType::kShadow);
+    if (scene->Occluded(shadow_queue_.GetRay(i), kEpsilon, 1))
+      visible_[shadow_queue_.GetIndex(i)] = 0;
+  }
+}
+
+
+void
+WavefrontIntegrator::ResolveOcclusion(Surface::Ptr scene)
+{
+  // queue the probes of lights that have them (see LightSample), and
+  // the shadow rays of all samples of the other lights
+  shadow_queue_.Clear();
+  visible_.assign(light_samples_.size(), 1);
+  probed_evals_.clear();
+  for (size_t e = 0; e < light_evals_.size(); ++e) {
+    const auto &eval = light_evals_[e];
+    bool has_probes = false;
+    for (auto i = eval.begin; i < eval.end; ++i)
+      has_probes = has_probes || light_samples_[i].is_probe;
+    if (has_probes)
+      probed_evals_.push_back(e);
+    for (auto i = eval.begin; i < eval.end; ++i) {
+      const auto &sample = light_samples_[i];
+      if (sample.has_shadow_ray && (!has_probes || sample.is_probe))
+        shadow_queue_.Push(sample.shadow_ray, i);
+    }
+  }
+  TraceShadowQueue(scene);
+
+  // samples of lights whose probes agree share the probes'
+  // visibility, the others are traced
+  shadow_queue_.Clear();
+  for (auto e : probed_evals_) {
+    const auto &eval = light_evals_[e];
+    int probe_visibility = -1;
+    bool probes_agree = true;
+    for (auto i = eval.begin; i < eval.end; ++i) {
+      if (!light_samples_[i].is_probe)
+        continue;
+      if (probe_visibility >= 0 && visible_[i] != probe_visibility)
+        probes_agree = false;
+      probe_visibility = visible_[i];
+    }
+    for (auto i = eval.begin; i < eval.end; ++i) {
+      const auto &sample = light_samples_[i];
+      if (sample.is_probe) {
+        visible_[i] = 0;  // probes add no radiance
+      } else if (sample.has_shadow_ray) {
+        if (probes_agree)
+          visible_[i] = static_cast<char>(probe_visibility);
+        else
+          shadow_queue_.Push(sample.shadow_ray, i);
+      }
+    }
+  }
+  TraceShadowQueue(scene);
+
+  // add visible radiance, light by light (see Light::Illuminate())
+  for (const auto &eval : light_evals_) {
+    Vec3r radiance{0, 0, 0};
+    for (auto i = eval.begin; i < eval.end; ++i) {
+      if (visible_[i])
+        radiance = radiance + light_samples_[i].radiance;
+    }
+    auto &vertex = vertices_[eval.vertex];
+    vertex.color += radiance * eval.scale * eval.weight;
+  }
+  light_samples_.clear();
+  light_evals_.clear();
+}
+
+
+void
+WavefrontIntegrator::Gather(vector<Vec3r> &colors)
+{
+  // children are always created after their parents, so walking the
+  // vertices backwards combines every subtree before its root
+  for (size_t k = vertices_.size(); k-- > 0;) {
+    auto &vertex = vertices_[k];
+    if (vertex.type == VertexType::kDielectric) {
+      if (vertex.refract_child >= 0) {
+        const auto &child =
+          vertices_[static_cast<size_t>(vertex.refract_child)];
+        if (child.type != VertexType::kMiss) {
+          vertex.color += vertex.weight.cwiseProduct(child.color *
+                                                     vertex.refract_weight);
+        }
+      }
+      if (vertex.reflect_child >= 0) {
+        const auto &child =
+          vertices_[static_cast<size_t>(vertex.reflect_child)];
+        if (child.type != VertexType::kMiss) {
+          vertex.color += vertex.weight.cwiseProduct(child.color *
+                                                     vertex.reflect_weight);
+        }
+      }
+    } else if (vertex.type == VertexType::kPhong &&
+               vertex.reflect_child >= 0) {
+      const auto &child =
+        vertices_[static_cast<size_t>(vertex.reflect_child)];
+      if (child.type != VertexType::kMiss)
+        vertex.color += vertex.weight.cwiseProduct(child.color);
+    }
+  }
+
+  // the first vertices are the camera samples' primary rays
+  for (size_t i = 0; i < colors.size(); ++i)
+    colors[i] = vertices_[i].color;
+}
+
+
+void
+WavefrontIntegrator::Trace(const vector<CameraSample> &samples,
+                           Surface::Ptr scene, const vector<Light::Ptr> &lights,
+                           vector<Vec3r> &colors)
+{
+  colors.assign(samples.size(), Vec3r{0, 0, 0});
+  vertices_.clear();
+  ray_queue_.Clear();
+  if (!max_ray_depth_)
+    return;
+  for (size_t i = 0; i < samples.size(); ++i)
+    AddVertex(samples[i].ray, static_cast<uint>(i), 0, 0, Vec3r{1, 1, 1},
+              ray_queue_);
+
+  // one wave per ray depth
+  while (ray_queue_.Size()) {
+    next_ray_queue_.Clear();
+    Intersect(scene);
+    ShadeDielectrics(samples);
+    ShadePhong(samples, lights);
+    ResolveOcclusion(scene);
+    std::swap(ray_queue_, next_ray_queue_);
+  }
+  Gather(colors);
+}
+
+}  // namespace core
+}  // namespace olio
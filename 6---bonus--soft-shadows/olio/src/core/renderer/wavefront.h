@@ -0,0 +1,215 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       wavefront.h
+//! \brief      Wavefront (queue-based) integrator
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <vector>
+#include "core/types.h"
+#include "core/ray.h"
+#include "core/geometry/surface.h"
+#include "core/light/light.h"
+#include "core/light/light_tree.h"
+#include "core/sampler/sampler.h"
+#include "core/renderer/path_options.h"
+
+namespace olio {
+namespace core {
+
+//! \struct CameraSample
+//! \brief Primary ray of one pixel sample
+struct CameraSample {
+  Vec2i pixel{0, 0};    //!< pixel the sample belongs to
+  uint sample_index{0}; //!< index of the sample in the pixel
+  Ray ray;              //!< primary ray
+};
+
+
+//! \class RayQueue
+//! \brief Queue of the rays of one wave, each with the path vertex or
+//!        light sample it belongs to
+//! \details Rays are stored as Ray objects: the scene is intersected
+//!    one ray at a time (Surface::Hit()), so splitting them into
+//!    coordinate arrays would only mean rebuilding every Ray on use.
+class RayQueue {
+public:
+  //! \brief Remove all rays from the queue
+  void Clear();
+
+  //! \brief Append a ray to the queue
+  //! \param[in] ray Ray
+  //! \param[in] index Index of the path vertex or light sample the
+  //!            ray belongs to
+  void Push(const Ray &ray, uint index);
+
+  //! \brief Get number of rays in the queue
+  //! \return Number of rays
+  inline size_t Size() const {return index_.size();}
+
+  //! \brief Get a ray from the queue
+  //! \param[in] i Ray position in the queue
+  //! \return Ray
+  inline const Ray &GetRay(size_t i) const {return rays_[i];}
+
+  //! \brief Get the index a ray was pushed with
+  //! \param[in] i Ray position in the queue
+  //! \return Path vertex or light sample index
+  inline uint GetIndex(size_t i) const {return index_[i];}
+protected:
+  std::vector<Ray> rays_;       //!< queued rays
+  std::vector<uint> index_;     //!< path vertex/light sample of each ray
+};
+
+
+//! \class WavefrontIntegrator
+//! \brief Computes the colors of a batch of camera samples one stage at
+//!        a time
+//! \details Instead of following one path at a time (see
+//!    RayTracer::RayColor()), the integrator keeps the rays of all
+//!    paths at the same depth in a RayQueue. Each wave intersects the
+//!    whole queue, shades the hit points grouped by material type,
+//!    generates the shadow and extension rays, and resolves the
+//!    occlusion of all shadow rays at once. Colors are combined once
+//!    all waves are done, in the same order as the recursive tracer,
+//!    so both produce the same images.
+class WavefrontIntegrator {
+public:
+  //! \brief Constructor
+  //! \param[in] max_ray_depth Max ray depth (bounce count)
+  //! \param[in] sampler Sampler of the per-pixel sample streams; it's
+  //!            restarted for every path vertex
+  //! \param[in] path_options Secondary ray pruning options
+  //! \param[in] light_tree Tree the lights of each hit point are picked
+  //!            from (nullptr or empty: all lights are evaluated)
+  //! \param[in] primary_lights Lights evaluated at primary hits
+  //!            (nullptr: same as other hits); see LightResampler
+  WavefrontIntegrator(uint max_ray_depth, const Sampler &sampler,
+                      const PathOptions &path_options=PathOptions{},
+                      const LightTree *light_tree=nullptr,
+                      const std::vector<uint32_t> *primary_lights=nullptr);
+
+  //! \brief Compute the colors of a batch of camera samples
+  //! \param[in] samples Camera samples
+  //! \param[in] scene Input scene
+  //! \param[in] lights Scene lights
+  //! \param[out] colors Color of each camera sample
+  void Trace(const std::vector<CameraSample> &samples, Surface::Ptr scene,
+             const std::vector<Light::Ptr> &lights,
+             std::vector<Vec3r> &colors);
+protected:
+  //! \enum VertexType
+  //! \brief How a path vertex is shaded
+  enum class VertexType {
+    kMiss,        //!< ray did not hit any surface
+    kBlack,       //!< hit surface without a Phong material
+    kPhong,       //!< Phong material with optional mirror reflection
+    kDielectric   //!< reflection and refraction
+  };
+
+  //! \struct PathVertex
+  //! \brief Hit point of a ray of a camera sample's path tree
+  struct PathVertex {
+    uint sample{0};                  //!< camera sample index
+    uint depth{0};                   //!< ray depth
+    uint64_t branch{0};              //!< sampler branch (see Sampler)
+    VertexType type{VertexType::kMiss};  //!< shading type
+    Vec3r throughput{1, 1, 1};       //!< ray throughput
+    Vec3r color{0, 0, 0};            //!< ray color
+    Vec3r weight{0, 0, 0};           //!< mirror color/glass attenuation
+    Real refract_weight{0};          //!< glass refraction ray weight
+    Real reflect_weight{0};          //!< glass reflection ray weight
+    int refract_child{-1};           //!< vertex of the refraction ray
+    int reflect_child{-1};           //!< vertex of the reflection ray
+  };
+
+  //! \struct LightEval
+  //! \brief Light samples drawn by one light for one path vertex
+  struct LightEval {
+    uint vertex;  //!< path vertex
+    uint begin;   //!< first light sample
+    uint end;     //!< one past the last light sample
+    Real scale;   //!< scale of the sum of visible samples
+    Real weight;  //!< weight of the light (see LightPick)
+  };
+
+  //! \brief Add a path vertex and queue its ray
+  //! \param[in] ray Ray of the vertex
+  //! \param[in] sample Camera sample index
+  //! \param[in] depth Ray depth
+  //! \param[in] branch Sampler branch of the ray's path
+  //! \param[in] throughput Ray throughput
+  //! \param[out] queue Queue the ray is added to
+  //! \return Index of the new vertex
+  int AddVertex(const Ray &ray, uint sample, uint depth, uint64_t branch,
+                const Vec3r &throughput, RayQueue &queue);
+
+  //! \brief Restart sampler_ at the stream RayTracer::RayColor() uses
+  //!        for a path vertex
+  //! \param[in] samples Camera samples
+  //! \param[in] vertex Path vertex
+  void StartVertex(const std::vector<CameraSample> &samples,
+                   const PathVertex &vertex);
+
+  //! \brief Intersect all rays in ray_queue_ with the scene and group
+  //!        the hit points by material type
+  //! \param[in] scene Input scene
+  void Intersect(Surface::Ptr scene);
+
+  //! \brief Shade all glass hit points, queueing their reflection and
+  //!        refraction rays
+  //! \param[in] samples Camera samples
+  void ShadeDielectrics(const std::vector<CameraSample> &samples);
+
+  //! \brief Shade all Phong hit points, drawing their light samples
+  //!        and queueing their mirror reflection rays
+  //! \param[in] samples Camera samples
+  //! \param[in] lights Scene lights
+  void ShadePhong(const std::vector<CameraSample> &samples,
+                  const std::vector<Light::Ptr> &lights);
+
+  //! \brief Trace all queued shadow rays and add the radiance of the
+  //!        visible light samples to their path vertices
+  //! \details Light probes are traced first, then the samples of the
+  //!    lights whose probes disagree (see LightSample)
+  //! \param[in] scene Input scene
+  void ResolveOcclusion(Surface::Ptr scene);
+
+  //! \brief Trace the rays in shadow_queue_ and clear the visibility of
+  //!        the blocked light samples
+  //! \param[in] scene Input scene
+  void TraceShadowQueue(const Surface::Ptr &scene);
+
+  //! \brief Combine the colors of all path vertices with their children
+  //!        into camera sample colors
+  //! \param[out] colors Color of each camera sample
+  void Gather(std::vector<Vec3r> &colors);
+
+  uint max_ray_depth_;   //!< max ray depth
+  PathOptions path_options_;  //!< secondary ray pruning options
+  Sampler sampler_;      //!< sampler re-keyed for every path vertex
+  const LightTree *light_tree_;  //!< many-light selection (may be nullptr)
+  const std::vector<uint32_t> *primary_lights_;  //!< lights of primary hits
+
+  std::vector<PathVertex> vertices_;  //!< vertices of all paths
+  RayQueue ray_queue_;                //!< rays of the current wave
+  RayQueue next_ray_queue_;           //!< extension rays of the next wave
+  RayQueue shadow_queue_;             //!< shadow rays of the current wave
+  std::vector<HitRecord> hits_;       //!< hit records of the current wave
+  std::vector<size_t> phong_hits_;    //!< ray_queue_ entries hitting Phong
+  std::vector<size_t> dielectric_hits_;  //!< ray_queue_ entries hitting glass
+  std::vector<LightSample> light_samples_;  //!< light samples of the wave
+  std::vector<LightEval> light_evals_;      //!< light samples per light
+  std::vector<LightPick> light_picks_;      //!< lights of a hit point
+  std::vector<char> visible_;         //!< visibility of each light sample
+  std::vector<size_t> probed_evals_;  //!< light_evals_ with probes
+};
+
+}  // namespace core
+}  // namespace olio
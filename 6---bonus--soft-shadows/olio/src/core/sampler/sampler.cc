@@ -0,0 +1,282 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       sampler.cc
+//! \brief      Sampler class
+//! \author     Hadi Fadaifard, 2022
+
+#include "core/sampler/sampler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace olio {
+namespace core {
+
+using namespace std;
+
+namespace {
+
+// largest Real below 1
+const Real kOneMinusEpsilon = std::nextafter(Real{1}, Real{0});
+
+// bases of the Halton dimensions; dimensions past the last prime are
+// drawn independently
+const uint kHaltonPrimes[] = {
+  2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+  59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+  137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+  227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+const uint64_t kNumHaltonDimensions = sizeof(kHaltonPrimes) / sizeof(uint);
+
+
+inline uint32_t
+ReverseBits(uint32_t value)
+{
+  value = (value << 16) | (value >> 16);
+  value = ((value & 0x00ff00ff) << 8) | ((value & 0xff00ff00) >> 8);
+  value = ((value & 0x0f0f0f0f) << 4) | ((value & 0xf0f0f0f0) >> 4);
+  value = ((value & 0x33333333) << 2) | ((value & 0xcccccccc) >> 2);
+  value = ((value & 0x55555555) << 1) | ((value & 0xaaaaaaaa) >> 1);
+  return value;
+}
+
+
+inline uint32_t
+SeedOf(uint64_t key, uint64_t index)
+{
+  return static_cast<uint32_t>(Sampler::Hash(key + index) >> 32);
+}
+
+}  // namespace
+
+
+Sampler::Sampler(uint seed, SamplerType type, uint num_samples) :
+  type_{type},
+  num_samples_{std::max(num_samples, 1u)},
+  seed_{seed}
+{
+  // 2D strata: the largest nx * ny grid with nx * ny <= num_samples_
+  strata_x_ = static_cast<uint>(std::sqrt(static_cast<double>(num_samples_)));
+  while ((strata_x_ + 1) * (strata_x_ + 1) <= num_samples_)
+    ++strata_x_;
+  strata_y_ = num_samples_ / strata_x_;
+  UpdateStreamKey();
+}
+
+
+void
+Sampler::StartPixelSample(const Vec2i &pixel, uint sample_index)
+{
+  pixel_ = pixel;
+  sample_index_ = sample_index;
+  bounce_ = 0;
+  branch_ = 0;
+  UpdateStreamKey();
+}
+
+
+void
+Sampler::StartBounce(uint bounce)
+{
+  bounce_ = bounce;
+  stream_key_ = Hash(pixel_key_ ^ (static_cast<uint64_t>(bounce_) << 48) ^
+                     branch_);
+  dimension_ = 0;
+  if (type_ == SamplerType::kIndependent)
+    return;
+
+  // same scrambling for all samples of the pixel, so that together
+  // they cover each dimension evenly
+  auto x = static_cast<uint64_t>(static_cast<uint32_t>(pixel_[0]));
+  auto y = static_cast<uint64_t>(static_cast<uint32_t>(pixel_[1]));
+  scramble_key_ = Hash(static_cast<uint64_t>(seed_) ^ 0x5851f42d4c957f2dULL);
+  scramble_key_ = Hash(scramble_key_ ^ ((y << 32) | x));
+  scramble_key_ = Hash(scramble_key_ ^ (static_cast<uint64_t>(bounce_) << 48) ^
+                       branch_);
+}
+
+
+void
+Sampler::UpdateStreamKey()
+{
+  auto x = static_cast<uint64_t>(static_cast<uint32_t>(pixel_[0]));
+  auto y = static_cast<uint64_t>(static_cast<uint32_t>(pixel_[1]));
+  pixel_key_ = Hash(static_cast<uint64_t>(seed_));
+  pixel_key_ = Hash(pixel_key_ ^ ((y << 32) | x));
+  pixel_key_ = Hash(pixel_key_ ^ static_cast<uint64_t>(sample_index_));
+  StartBounce(bounce_);
+}
+
+
+Real
+Sampler::GetSequence1D()
+{
+  auto dimension = dimension_++;
+  auto seed = SeedOf(scramble_key_, dimension);
+  switch (type_) {
+  case SamplerType::kStratified:
+    if (sample_index_ < num_samples_) {
+      auto stratum = PermutationElement(sample_index_, num_samples_, seed);
+      Real jitter = ToReal(Hash(stream_key_ + dimension));
+      return std::min((stratum + jitter) / num_samples_, kOneMinusEpsilon);
+    }
+    break;
+  case SamplerType::kHalton:
+    if (dimension < kNumHaltonDimensions)
+      return OwenScrambledRadicalInverse(sample_index_,
+                                         kHaltonPrimes[dimension], seed);
+    break;
+  case SamplerType::kSobol: {
+    // shuffle the sample order per dimension, so dimensions that share
+    // the sequence aren't correlated
+    uint32_t index = OwenScramble(sample_index_, seed);
+    return ToReal32(OwenScramble(Sobol(index, 0), SeedOf(seed, 1)));
+  }
+  default:
+    break;
+  }
+  return ToReal(Hash(stream_key_ + dimension));
+}
+
+
+Vec2r
+Sampler::GetSequence2D()
+{
+  auto dimension = dimension_;
+  dimension_ += 2;
+  auto seed = SeedOf(scramble_key_, dimension);
+  switch (type_) {
+  case SamplerType::kStratified:
+    if (sample_index_ < num_samples_) {
+      auto stratum = PermutationElement(sample_index_, num_samples_, seed);
+      if (stratum < strata_x_ * strata_y_) {
+        Real jitter_x = ToReal(Hash(stream_key_ + dimension));
+        Real jitter_y = ToReal(Hash(stream_key_ + dimension + 1));
+        return Vec2r{std::min((stratum % strata_x_ + jitter_x) / strata_x_,
+                              kOneMinusEpsilon),
+                     std::min((stratum / strata_x_ + jitter_y) / strata_y_,
+                              kOneMinusEpsilon)};
+      }
+    }
+    break;
+  case SamplerType::kHalton:
+    if (dimension + 1 < kNumHaltonDimensions) {
+      return Vec2r{
+        OwenScrambledRadicalInverse(sample_index_, kHaltonPrimes[dimension],
+                                    seed),
+        OwenScrambledRadicalInverse(sample_index_,
+                                    kHaltonPrimes[dimension + 1],
+                                    SeedOf(scramble_key_, dimension + 1))};
+    }
+    break;
+  case SamplerType::kSobol: {
+    // the first two Sobol dimensions form a (0,2)-sequence
+    uint32_t index = OwenScramble(sample_index_, seed);
+    return Vec2r{ToReal32(OwenScramble(Sobol(index, 0), SeedOf(seed, 1))),
+                 ToReal32(OwenScramble(Sobol(index, 1), SeedOf(seed, 2)))};
+  }
+  default:
+    break;
+  }
+  return Vec2r{ToReal(Hash(stream_key_ + dimension)),
+               ToReal(Hash(stream_key_ + dimension + 1))};
+}
+
+
+uint32_t
+Sampler::PermutationElement(uint32_t i, uint32_t n, uint32_t seed)
+{
+  uint32_t w = n - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+
+  // cycle walk a bijection on [0, w] until the result is < n
+  do {
+    i ^= seed;
+    i *= 0xe170893d;
+    i ^= seed >> 16;
+    i ^= (i & w) >> 4;
+    i ^= seed >> 8;
+    i *= 0x0929eb3f;
+    i ^= seed >> 23;
+    i ^= (i & w) >> 1;
+    i *= 1 | seed >> 27;
+    i *= 0x6935fa69;
+    i ^= (i & w) >> 11;
+    i *= 0x74dcb303;
+    i ^= (i & w) >> 2;
+    i *= 0x9e501cc3;
+    i ^= (i & w) >> 2;
+    i *= 0xc860a3df;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= n);
+  return (i + seed) % n;
+}
+
+
+uint32_t
+Sampler::OwenScramble(uint32_t value, uint32_t seed)
+{
+  // a Laine-Karras style permutation flips each bit depending on the
+  // bits below it; reversing makes it depend on the bits above
+  value = ReverseBits(value);
+  value ^= value * 0x3d20adea;
+  value += seed;
+  value *= (seed >> 16) | 1;
+  value ^= value * 0x05526c56;
+  value ^= value * 0x53a22864;
+  return ReverseBits(value);
+}
+
+
+uint32_t
+Sampler::Sobol(uint32_t index, uint dimension)
+{
+  uint32_t value = 0;
+  uint32_t direction = 0x80000000;
+  for (; index; index >>= 1) {
+    if (index & 1)
+      value ^= direction;
+    // dimension 0 is the van der Corput sequence; dimension 1 uses the
+    // direction numbers of the primitive polynomial x + 1
+    direction = dimension ? direction ^ (direction >> 1) : direction >> 1;
+  }
+  return value;
+}
+
+
+Real
+Sampler::OwenScrambledRadicalInverse(uint64_t index, uint base, uint32_t seed)
+{
+  // permute every digit with a permutation that depends on the digits
+  // before it; keep going past the index's last digit (to ~2^-40
+  // precision) so the point is randomized inside its smallest stratum
+  const double inv_base = 1.0 / base;
+  double inv_base_m = 1;
+  uint64_t reversed_digits = 0;
+  while (inv_base_m > 1e-12) {
+    uint64_t next = index / base;
+    auto digit = static_cast<uint32_t>(index - next * base);
+    auto digit_seed = static_cast<uint32_t>(
+      Hash((static_cast<uint64_t>(seed) << 32) ^ reversed_digits));
+    digit = PermutationElement(digit, base, digit_seed);
+    reversed_digits = reversed_digits * base + digit;
+    inv_base_m *= inv_base;
+    index = next;
+  }
+  return std::min(static_cast<Real>(inv_base_m *
+                                      static_cast<double>(reversed_digits)),
+                  kOneMinusEpsilon);
+}
+
+}  // namespace core
+}  // namespace olio
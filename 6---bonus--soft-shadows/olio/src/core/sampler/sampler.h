@@ -0,0 +1,221 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       sampler.h
+//! \brief      Sampler class
+//! \author     Hadi Fadaifard, 2022
+
+#pragma once
+
+#include <cstdint>
+#include "core/types.h"
+
+namespace olio {
+namespace core {
+
+//! \enum SamplerType
+//! \brief Sample sequence a Sampler draws its values from
+enum class SamplerType {
+  kIndependent,  //!< independent uniform random values
+  kStratified,   //!< one jittered stratum per pixel sample
+  kHalton,       //!< Owen-scrambled Halton sequence
+  kSobol         //!< Owen-scrambled Sobol (0,2)-sequence
+};
+
+
+//! \class Sampler
+//! \brief Counter-based random number generator used for Monte Carlo
+//! sampling during rendering
+//! \details Every returned value is a function of (seed, pixel, sample
+//!    index, branch, bounce, dimension), so a sampler holds no hidden
+//!    state besides its current key. Renders are therefore reproducible
+//!    regardless of the number of threads or the order in which
+//!    pixels are rendered.
+//!
+//!    With kIndependent, values are hashes of the key. The other types
+//!    spread the samples of a pixel evenly over each dimension: the
+//!    value of a dimension is the pixel sample index's point of a
+//!    sequence that is randomized (scrambled) per pixel, bounce, and
+//!    dimension. Pixel jitter and area light positions are drawn with
+//!    Get2D(), so the pairs of dimensions are well distributed too.
+class Sampler {
+public:
+  //! \brief Constructor
+  //! \param[in] seed Random seed
+  //! \param[in] type Sample sequence
+  //! \param[in] num_samples Number of samples per pixel; kStratified
+  //!            splits every dimension into this many strata
+  explicit Sampler(uint seed=0, SamplerType type=SamplerType::kIndependent,
+                   uint num_samples=1);
+
+  //! \brief Start generating values for a new pixel sample. Resets the
+  //!        branch, bounce, and dimension counters.
+  //! \param[in] pixel Pixel coordinates
+  //! \param[in] sample_index Index of the sample inside the pixel
+  void StartPixelSample(const Vec2i &pixel, uint sample_index);
+
+  //! \brief Start generating values for a new bounce of the current
+  //!        pixel sample. Resets the dimension counter.
+  //! \details Bounce 0 is used for sampling the pixel (camera)
+  //!        itself; shading a hit at ray depth d uses bounce d + 1.
+  //! \param[in] bounce Bounce index
+  void StartBounce(uint bounce);
+
+  //! \brief Set the branch of the pixel sample's path tree that the
+  //!        following bounces belong to
+  //! \details Rays that split into several child rays (e.g. glass
+  //!    reflection and refraction) give each child its own branch, so
+  //!    the subtrees don't reuse each other's values. Takes effect at
+  //!    the next StartBounce().
+  //! \param[in] branch Branch key (0: root of the path tree)
+  inline void SetBranch(uint64_t branch) {branch_ = branch;}
+
+  //! \brief Get the current branch of the path tree
+  //! \return Branch key
+  inline uint64_t GetBranch() const {return branch_;}
+
+  //! \brief Get the key of a child branch
+  //! \param[in] branch Parent branch key
+  //! \param[in] child Index of the child ray
+  //! \return Branch key of the child
+  static inline uint64_t ChildBranch(uint64_t branch, uint child) {
+    return Hash(branch ^ (0xd1342543de82ef95ULL * (child + 1ULL)));
+  }
+
+  //! \brief Get next random value
+  //! \return Random value in [0, 1)
+  inline Real Get1D() {
+    if (type_ == SamplerType::kIndependent)
+      return ToReal(Hash(stream_key_ + dimension_++));
+    return GetSequence1D();
+  }
+
+  //! \brief Get next pair of random values
+  //! \details Uses two dimensions
+  //! \return Random values in [0, 1)^2
+  inline Vec2r Get2D() {
+    if (type_ != SamplerType::kIndependent)
+      return GetSequence2D();
+    Real u = Get1D();
+    Real v = Get1D();
+    return Vec2r{u, v};
+  }
+
+  //! \brief Get sample sequence type
+  //! \return Sampler type
+  SamplerType GetType() const {return type_;}
+
+  //! \brief Get number of samples per pixel
+  //! \return Number of samples per pixel
+  uint GetNumSamples() const {return num_samples_;}
+
+  //! \brief Get random seed
+  //! \return Random seed
+  uint GetSeed() const {return seed_;}
+
+  //! \brief Get current pixel
+  //! \return Pixel coordinates
+  Vec2i GetPixel() const {return pixel_;}
+
+  //! \brief Get current sample index inside the pixel
+  //! \return Sample index
+  uint GetSampleIndex() const {return sample_index_;}
+
+  //! \brief Get current bounce
+  //! \return Bounce (ray depth)
+  uint GetBounce() const {return bounce_;}
+
+  //! \brief Hash a 64-bit value (splitmix64/PCG-style output mixing)
+  //! \param[in] value Value to hash
+  //! \return Hashed value
+  static inline uint64_t Hash(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+  }
+
+  //! \brief Map a 64-bit random value to [0, 1)
+  //! \param[in] value Random bits
+  //! \return Value in [0, 1)
+  static inline Real ToReal(uint64_t value) {
+#if defined(OLIO_USE_SINGLE_PRECISION)
+    return static_cast<Real>(value >> 40) * (1.0f / 16777216.0f);  // 2^-24
+#else
+    return static_cast<Real>(value >> 11) * (1.0 / 9007199254740992.0);  // 2^-53
+#endif
+  }
+
+  //! \brief Map 32 random bits to [0, 1)
+  //! \param[in] value Random bits
+  //! \return Value in [0, 1)
+  static inline Real ToReal32(uint32_t value) {
+#if defined(OLIO_USE_SINGLE_PRECISION)
+    return static_cast<Real>(value >> 8) * (1.0f / 16777216.0f);  // 2^-24
+#else
+    return static_cast<Real>(value) * (1.0 / 4294967296.0);  // 2^-32
+#endif
+  }
+
+  //! \brief Element of a random permutation of [0, n) (Kensler,
+  //!        "Correlated Multi-Jittered Sampling")
+  //! \param[in] i Index of the element (< n)
+  //! \param[in] n Permutation length
+  //! \param[in] seed Permutation seed
+  //! \return Permuted index in [0, n)
+  static uint32_t PermutationElement(uint32_t i, uint32_t n, uint32_t seed);
+
+  //! \brief Owen-scramble the bits of a 32-bit binary fraction (Burley,
+  //!        "Practical Hash-based Owen Scrambling")
+  //! \param[in] value Bits to scramble
+  //! \param[in] seed Scrambling seed
+  //! \return Scrambled bits
+  static uint32_t OwenScramble(uint32_t value, uint32_t seed);
+
+  //! \brief Point of the first two dimensions of the Sobol sequence
+  //! \param[in] index Point index
+  //! \param[in] dimension Dimension (0 or 1)
+  //! \return Binary fraction of the point's coordinate
+  static uint32_t Sobol(uint32_t index, uint dimension);
+
+  //! \brief Owen-scrambled radical inverse (one Halton dimension)
+  //! \param[in] index Point index
+  //! \param[in] base Prime base
+  //! \param[in] seed Scrambling seed
+  //! \return Value in [0, 1)
+  static Real OwenScrambledRadicalInverse(uint64_t index, uint base,
+                                          uint32_t seed);
+protected:
+  //! \brief Recompute the stream key from seed, pixel, sample, and bounce
+  void UpdateStreamKey();
+
+  //! \brief Get next value of a non-independent sampler
+  //! \return Value in [0, 1)
+  Real GetSequence1D();
+
+  //! \brief Get next pair of values of a non-independent sampler
+  //! \return Values in [0, 1)^2
+  Vec2r GetSequence2D();
+
+  SamplerType type_{SamplerType::kIndependent};  //!< sample sequence
+  uint num_samples_{1};     //!< samples per pixel
+  uint strata_x_{1};        //!< 2D strata along x (kStratified)
+  uint strata_y_{1};        //!< 2D strata along y (kStratified)
+  uint seed_{0};            //!< random seed
+  Vec2i pixel_{0, 0};       //!< current pixel
+  uint sample_index_{0};    //!< current sample index inside pixel
+  uint bounce_{0};          //!< current bounce
+  uint64_t branch_{0};      //!< current branch of the path tree
+  uint64_t pixel_key_{0};   //!< hash of seed, pixel, and sample index
+  uint64_t stream_key_{0};  //!< hash of pixel_key_, branch, and bounce
+  uint64_t scramble_key_{0};  //!< hash of seed, pixel, branch, and bounce,
+                              //!< shared by all samples of the pixel
+  uint64_t dimension_{0};   //!< number of values drawn in current bounce
+};
+
+}  // namespace core
+}  // namespace olio
@@ -138,8 +138,8 @@ ImageTexture::Value(const Vec2r &uv, const Vec3r &/*position*/)
   if (uv[0] == -1 || uv[1] == -1)
     return Vec3r{0,0,0} + bias_;
   
-  Real u = CLAMP(uv[0], 0.0f, 1.0f);
-  Real v = CLAMP(uv[1], 0.0f, 1.0f);
+  Real u = CLAMP(uv[0], 0, 1);
+  Real v = CLAMP(uv[1], 0, 1);
   //std::cout << "color: " << u << " " << v << "\n" << std::endl;
 
   auto x = static_cast<float>(u * (static_cast<float>(image_.cols) - 1));
@@ -150,9 +150,9 @@ ImageTexture::Value(const Vec2r &uv, const Vec3r &/*position*/)
   auto &color = patch.at<cv::Vec3b>(0, 0);
 
   Vec3r color_r{0,0,0};
-  color_r[2] = (Real)color.val[0]/255.0f;
-  color_r[1] = (Real)color.val[1]/255.0f;
-  color_r[0] = (Real)color.val[2]/255.0f;
+  color_r[2] = (Real)color.val[0]/255;
+  color_r[1] = (Real)color.val[1]/255;
+  color_r[0] = (Real)color.val[2]/255;
 
   
   return color_r + bias_;
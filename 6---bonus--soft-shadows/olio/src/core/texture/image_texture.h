@@ -50,6 +50,7 @@ public:
   cv::Mat GetImage() const {return image_;}
   boost::filesystem::path GetImagePath() const {return image_path_;}
   Vec3r Value(const Vec2r &uv, const Vec3r &position) override;
+  bool UsesUV() const override {return true;}
 
   //! \brief Flip image horizontally, vertically, or both
   //! \param[in] in_image Input image
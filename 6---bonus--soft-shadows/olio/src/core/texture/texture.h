@@ -35,6 +35,12 @@ public:
   virtual Vec3r Value(const Vec2r &/*uv*/, const Vec3r &/*position*/) {
     return Vec3r{0, 0, 0} + bias_;
   }
+
+  //! \brief Whether Value() reads its uv argument
+  //! \details Materials skip computing the hit point's texture
+  //!          coordinates for textures that don't use them
+  //! \return True if the texture is uv mapped
+  virtual bool UsesUV() const {return false;}
 protected:
   Vec3r gain_{1, 1, 1};
   Vec3r bias_{0, 0, 0};
@@ -33,6 +33,7 @@ typedef float Real;
 // misc constants
 static constexpr Real kEpsilon = 1e-4f;
 static constexpr Real kEpsilon2 = 1e-6f;
+static constexpr Real kRelativeEpsilon = 1e-6f;
 static constexpr Real kPi = 3.14159265359f;
 static constexpr Real k2Pi = 6.28318530718f;
 static constexpr Real kPi2 = 9.86960440108935861906f;
@@ -44,6 +45,7 @@ typedef double Real;
 // misc constants
 static constexpr Real kEpsilon = 1e-8;
 static constexpr Real kEpsilon2 = 1e-14;
+static constexpr Real kRelativeEpsilon = 1e-12;
 static constexpr Real kPi = 3.14159265359;
 static constexpr Real k2Pi = 6.28318530718;
 static constexpr Real kPi2 = 9.86960440108935861906;
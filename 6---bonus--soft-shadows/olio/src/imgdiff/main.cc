@@ -0,0 +1,135 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       main.cc
+//! \brief      imgdiff cli main.cc file: compares two rendered images
+//! \author     Hadi Fadaifard, 2022
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <string>
+#include <boost/program_options.hpp>
+#include <opencv2/opencv.hpp>
+#include <spdlog/spdlog.h>
+
+using namespace std;
+namespace po = boost::program_options;
+
+bool ParseArguments(int argc, char **argv, std::string *reference_name,
+                    std::string *image_name, double *max_rmse,
+                    double *pixel_threshold, double *max_bad_pixels) {
+  po::options_description desc("options");
+  try {
+    desc.add_options()
+      ("help,h", "print usage")
+      ("reference,r",
+       po::value             (reference_name)->required(),
+       "Reference image")
+      ("image,i",
+       po::value             (image_name)->required(),
+       "Image to compare against the reference")
+      ("max_rmse",
+       po::value             (max_rmse)->default_value(0.01),
+       "Max root mean square error (colors in [0, 1])")
+      ("pixel_threshold",
+       po::value             (pixel_threshold)->default_value(0.1),
+       "Pixels differing by more than this in any channel are bad")
+      ("max_bad_pixels",
+       po::value             (max_bad_pixels)->default_value(0.005),
+       "Max fraction of bad pixels");
+
+    // parse arguments
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+      cout << desc << endl;
+      return false;
+    }
+    po::notify(vm);
+  } catch(std::exception &e) {
+    cout << desc << endl;
+    spdlog::error("{}", e.what());
+    return false;
+  } catch(...) {
+    cout << desc << endl;
+    spdlog::error("Invalid arguments");
+    return false;
+  }
+  return true;
+}
+
+
+//! \brief Read an image as 3-channel float with values in [0, 1] (8
+//!        and 16-bit images) or as stored (floating point images)
+//! \param[in] image_name Image path
+//! \param[out] image Output image of type CV_32FC3
+//! \return True on success
+bool ReadImage(const std::string &image_name, cv::Mat &image)
+{
+  auto in_image = cv::imread(image_name, cv::IMREAD_ANYDEPTH |
+                             cv::IMREAD_COLOR);
+  if (in_image.empty()) {
+    spdlog::error("Failed to read image: {}", image_name);
+    return false;
+  }
+  double scale = 1;
+  if (in_image.depth() == CV_8U)
+    scale = 1.0 / 255;
+  else if (in_image.depth() == CV_16U)
+    scale = 1.0 / 65535;
+  in_image.convertTo(image, CV_32FC3, scale);
+  return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  string reference_name, image_name;
+  double max_rmse, pixel_threshold, max_bad_pixels;
+  if (!ParseArguments(argc, argv, &reference_name, &image_name, &max_rmse,
+                      &pixel_threshold, &max_bad_pixels))
+    return -1;
+
+  cv::Mat reference, image;
+  if (!ReadImage(reference_name, reference) || !ReadImage(image_name, image))
+    return -1;
+  if (reference.rows != image.rows || reference.cols != image.cols) {
+    spdlog::error("Image sizes differ: {}x{} vs {}x{}", reference.cols,
+                  reference.rows, image.cols, image.rows);
+    return -1;
+  }
+
+  // per-channel differences
+  double squared_error = 0;
+  double max_diff = 0;
+  size_t bad_pixels = 0;
+  for (int y = 0; y < image.rows; ++y) {
+    for (int x = 0; x < image.cols; ++x) {
+      const auto &ref_pixel = reference.at<cv::Vec3f>(y, x);
+      const auto &pixel = image.at<cv::Vec3f>(y, x);
+      double pixel_diff = 0;
+      for (int c = 0; c < 3; ++c) {
+        double diff = fabs(static_cast<double>(pixel[c]) - ref_pixel[c]);
+        squared_error += diff * diff;
+        pixel_diff = std::max(pixel_diff, diff);
+      }
+      max_diff = std::max(max_diff, pixel_diff);
+      if (pixel_diff > pixel_threshold)
+        ++bad_pixels;
+    }
+  }
+  auto pixel_count = static_cast<double>(image.total());
+  double rmse = sqrt(squared_error / (3 * pixel_count));
+  double bad_fraction = static_cast<double>(bad_pixels) / pixel_count;
+  bool passed = rmse <= max_rmse && bad_fraction <= max_bad_pixels;
+  spdlog::info("{}: rmse {:.6f}, max diff {:.4f}, bad pixels {} ({:.4f}%) "
+               "-- {}", image_name, rmse, max_diff, bad_pixels,
+               100 * bad_fraction, passed ? "PASSED" : "FAILED");
+  return passed ? 0 : 1;
+}
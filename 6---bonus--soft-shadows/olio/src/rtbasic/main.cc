@@ -12,6 +12,7 @@
 #include <vector>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 #include <boost/program_options.hpp>
 #include <spdlog/spdlog.h>
 
@@ -25,13 +26,30 @@
 #include "core/utils/segfault_handler.h"
 #include "core/light/light.h"
 #include "core/geometry/bvh_node.h"
+#include "core/geometry/simd_kernels.h"
 
 using namespace olio::core;
 using namespace std;
 namespace po = boost::program_options;
 
 bool ParseArguments(int argc, char **argv, std::string *input_scene_name,
-		    std::string *output_name, std::string *samples_per_pixel, std::string *shadow_samples) {
+		    std::string *output_name, std::string *samples_per_pixel, std::string *shadow_samples,
+		    std::string *num_threads, std::string *bvh_split,
+		    std::string *bvh_leaf_size, std::string *simd,
+		    std::string *adaptive_tolerance,
+		    std::string *adaptive_min_samples, std::string *spp_image,
+		    std::string *integrator, std::string *min_throughput,
+		    bool *russian_roulette, std::string *glass_sampling,
+		    std::string *sampler, bool *adaptive_shadows,
+		    std::string *light_sampling, std::string *light_budget,
+		    bool *light_resampling, std::string *resampling_candidates,
+		    std::string *resampling_frames,
+		    std::string *output_depth, std::string *exposure,
+		    std::string *tile_output, std::string *checkpoint,
+		    std::string *checkpoint_minutes,
+		    std::string *checkpoint_passes, bool *resume,
+		    std::string *progress_interval, std::string *progress_json,
+		    bool *no_progress_bar, bool *diagnostics) {
   po::options_description desc("options");
   try {
     desc.add_options()
@@ -47,7 +65,110 @@ bool ParseArguments(int argc, char **argv, std::string *input_scene_name,
        "Number of Samples per pixel")
       ("shadow_samples,d",
        po::value             (shadow_samples)->required(),
-       "shadow samples");
+       "shadow samples")
+      ("threads,t",
+       po::value             (num_threads)->default_value("0"),
+       "Number of render threads (0: use all cores)")
+      ("bvh_split",
+       po::value             (bvh_split)->default_value("sah"),
+       "BVH split method (sah, median)")
+      ("bvh_leaf_size",
+       po::value             (bvh_leaf_size)->default_value("4"),
+       "Max number of primitives in BVH leaves")
+      ("simd",
+       po::value             (simd)->default_value("auto"),
+       "Ray traversal kernels (auto, avx2, sse, scalar)")
+      ("adaptive_tolerance",
+       po::value             (adaptive_tolerance)->default_value("0"),
+       "Adaptive sampling: max relative error per pixel (0: off); "
+       "samples per pixel becomes the max")
+      ("adaptive_min_samples",
+       po::value             (adaptive_min_samples)->default_value("4"),
+       "Adaptive sampling: samples per batch")
+      ("spp_image",
+       po::value             (spp_image),
+       "Output debug image of samples taken per pixel")
+      ("integrator",
+       po::value             (integrator)->default_value("recursive"),
+       "Sample integrator (recursive, wavefront)")
+      ("min_throughput",
+       po::value             (min_throughput)->default_value("0"),
+       "Drop mirror/glass rays whose throughput is below this (0: off)")
+      ("russian_roulette",
+       po::bool_switch       (russian_roulette),
+       "Play Russian roulette with low throughput rays instead of "
+       "dropping them (unbiased)")
+      ("glass_sampling",
+       po::value             (glass_sampling)->default_value("split"),
+       "Glass rays: split (reflect and refract), schlick (pick one by "
+       "Schlick's reflectance)")
+      ("sampler",
+       po::value             (sampler)->default_value("independent"),
+       "Pixel/light sample sequence (independent, stratified, halton, "
+       "sobol)")
+      ("adaptive_shadows",
+       po::bool_switch       (adaptive_shadows),
+       "Trace area light shadow rays only in the penumbra, found with "
+       "probe rays to the light's corners and center")
+      ("light_sampling",
+       po::value             (light_sampling)->default_value("area"),
+       "Area light samples: area (uniform over the light), solid_angle "
+       "(uniform over its solid angle), mis (solid angle and specular "
+       "lobe samples, combined with MIS)")
+      ("light_budget",
+       po::value             (light_budget)->default_value("0"),
+       "Lights picked per hit point from a light tree, by estimated "
+       "contribution (0: evaluate all lights)")
+      ("light_resampling",
+       po::bool_switch       (light_resampling),
+       "Shade point and area lights at primary hits with one shadow ray "
+       "per sample, resampled from candidates shared with neighboring "
+       "pixels (ReSTIR)")
+      ("resampling_candidates",
+       po::value             (resampling_candidates)->default_value("8"),
+       "Light resampling: candidate light samples per hit point")
+      ("resampling_frames",
+       po::value             (resampling_frames)->default_value("1"),
+       "Light resampling: frames rendered, each reusing the reservoirs "
+       "of the previous one (temporal reuse); the last one is saved")
+      ("output_depth",
+       po::value             (output_depth)->default_value("auto"),
+       "Output channel type: auto (float for exr, 8 otherwise), 8, 16 "
+       "(png, tiff, ppm), half, float (exr)")
+      ("exposure",
+       po::value             (exposure)->default_value("1"),
+       "Factor the rendered colors are scaled by before they're saved")
+      ("tile_output",
+       po::value             (tile_output),
+       "Stream rendered tiles to this file instead of keeping the image "
+       "in memory; an interrupted render resumes from its done tiles")
+      ("checkpoint",
+       po::value             (checkpoint),
+       "Save per-pixel sample sums to this file while rendering")
+      ("checkpoint_minutes",
+       po::value             (checkpoint_minutes)->default_value("10"),
+       "Checkpoint: min minutes between saves (0: off)")
+      ("checkpoint_passes",
+       po::value             (checkpoint_passes)->default_value("0"),
+       "Checkpoint: passes of 16 samples per pixel between saves (0: off)")
+      ("resume",
+       po::bool_switch       (resume),
+       "Continue the render saved in the checkpoint file, or add samples "
+       "to it")
+      ("progress_interval",
+       po::value             (progress_interval)->default_value("1"),
+       "Seconds between render progress reports")
+      ("progress_json",
+       po::value             (progress_json),
+       "Append progress reports to this file as json lines (-: stdout)")
+      ("no_progress_bar",
+       po::bool_switch       (no_progress_bar),
+       "Do not draw the render status line on the terminal")
+      ("diagnostics",
+       po::bool_switch       (diagnostics),
+       "Save per-pixel BVH node, primitive test, shadow ray, and ray depth "
+       "heatmaps next to the output image (needs a build with "
+       "OLIO_ENABLE_DIAGNOSTICS)");
 
     // parse arguments
     po::variables_map vm;
@@ -74,19 +195,88 @@ int
 main(int argc, char **argv)
 {
   utils::InstallSegfaultHandler();
-  srand(123543);
 
   // parse command line arguments
   string input_scene_name, output_name;
   string samples_per_pixel;
   string shadow_samples;
+  string num_threads;
+  string bvh_split, bvh_leaf_size;
+  string simd;
+  string adaptive_tolerance, adaptive_min_samples, spp_image;
+  string integrator;
+  string min_throughput, glass_sampling;
+  string sampler, light_sampling, light_budget, resampling_candidates;
+  string resampling_frames;
+  string output_depth, exposure, tile_output;
+  string checkpoint, checkpoint_minutes, checkpoint_passes;
+  bool resume = false;
+  string progress_interval, progress_json;
+  bool no_progress_bar = false;
+  bool diagnostics = false;
+  bool russian_roulette = false;
+  bool adaptive_shadows = false;
+  bool light_resampling = false;
   uint num_samples;
   uint int_shadow_samples;
   size_t int_sqrt_shadow_samples;
 
-  if (!ParseArguments(argc, argv, &input_scene_name, &output_name, &samples_per_pixel, &shadow_samples))
+  if (!ParseArguments(argc, argv, &input_scene_name, &output_name, &samples_per_pixel, &shadow_samples,
+                      &num_threads, &bvh_split, &bvh_leaf_size,
+                      &simd, &adaptive_tolerance, &adaptive_min_samples,
+                      &spp_image, &integrator, &min_throughput,
+                      &russian_roulette, &glass_sampling, &sampler,
+                      &adaptive_shadows, &light_sampling, &light_budget,
+                      &light_resampling, &resampling_candidates,
+                      &resampling_frames,
+                      &output_depth, &exposure, &tile_output, &checkpoint,
+                      &checkpoint_minutes, &checkpoint_passes, &resume,
+                      &progress_interval, &progress_json, &no_progress_bar,
+                      &diagnostics))
     return -1;
 
+  // output image options
+  ImageOutputOptions output_options;
+  output_options.gamma = 2;
+  output_options.exposure = static_cast<Real>(stod(exposure));
+  if (output_depth == "8") {
+    output_options.depth = OutputDepth::kUChar;
+  } else if (output_depth == "16") {
+    output_options.depth = OutputDepth::kUShort;
+  } else if (output_depth == "half") {
+    output_options.depth = OutputDepth::kHalf;
+  } else if (output_depth == "float") {
+    output_options.depth = OutputDepth::kFloat;
+  } else if (output_depth != "auto") {
+    spdlog::error("Invalid output depth: {}", output_depth);
+    return -1;
+  }
+
+  // bvh build options (also used for meshes loaded by the parser)
+  BVHBuildOptions bvh_options;
+  if (bvh_split == "median") {
+    bvh_options.split_method = BVHSplitMethod::kMedian;
+  } else if (bvh_split != "sah") {
+    spdlog::error("Invalid BVH split method: {}", bvh_split);
+    return -1;
+  }
+  bvh_options.leaf_size = (uint) stoi(bvh_leaf_size);
+  BVHNode::SetDefaultBuildOptions(bvh_options);
+
+  // simd kernels (falls back to the best level supported by the cpu)
+  if (simd == "avx2") {
+    SetSimdLevel(SimdLevel::kAVX2);
+  } else if (simd == "sse") {
+    SetSimdLevel(SimdLevel::kSSE);
+  } else if (simd == "scalar") {
+    SetSimdLevel(SimdLevel::kScalar);
+  } else if (simd != "auto") {
+    spdlog::error("Invalid simd kernels: {}", simd);
+    return -1;
+  }
+  spdlog::info("Using {} ray traversal kernels",
+               GetSimdLevelName(GetSimdKernels().level));
+
   num_samples = (uint) stoi(samples_per_pixel);
   int_shadow_samples = (size_t) stoi(shadow_samples);
   int_sqrt_shadow_samples = (size_t) round(sqrt(int_shadow_samples));
@@ -103,19 +293,100 @@ main(int argc, char **argv)
     return -1;
   }
 
-  update_grid_size(int_sqrt_shadow_samples);
+  // shadow samples of the area lights
+  AreaLightSampling area_light_sampling = AreaLightSampling::kArea;
+  if (light_sampling == "solid_angle") {
+    area_light_sampling = AreaLightSampling::kSolidAngle;
+  } else if (light_sampling == "mis") {
+    area_light_sampling = AreaLightSampling::kMIS;
+  } else if (light_sampling != "area") {
+    spdlog::error("Invalid light sampling: {}", light_sampling);
+    return -1;
+  }
+  for (const auto &light : lights) {
+    auto area_light = dynamic_pointer_cast<AreaLight>(light);
+    if (!area_light)
+      continue;
+    area_light->SetGridSize(static_cast<uint>(int_sqrt_shadow_samples));
+    area_light->SetAdaptive(adaptive_shadows);
+    area_light->SetSampling(area_light_sampling);
+  }
 
   BVHNode bvh;
   auto scene_vec = dynamic_pointer_cast<SurfaceList>(scene);
-  BVHNode::Ptr BVH_pass = bvh.BuildBVH(scene_vec->GetListSurfaces());
+  BVHNode::Ptr BVH_pass = bvh.BuildBVH(scene_vec->GetListSurfaces(), "scene");
 
   // render scene
   RayTracer rt;
   rt.SetImageHeight(static_cast<uint>(image_size[1]));
   rt.SetNumSamplesPerPixel(num_samples);
-  rt.Render(BVH_pass, lights, camera);
+  rt.SetAdaptiveSampling(static_cast<Real>(stod(adaptive_tolerance)),
+                         (uint) stoi(adaptive_min_samples));
+  rt.SetNumThreads((uint) stoi(num_threads));
+  rt.SetLightBudget((uint) stoi(light_budget));
+  rt.SetTileOutput(tile_output);
+  if (resume && checkpoint.empty()) {
+    spdlog::error("--resume needs a --checkpoint file");
+    return -1;
+  }
+  CheckpointOptions checkpoint_options;
+  checkpoint_options.path = checkpoint;
+  checkpoint_options.interval_minutes = stod(checkpoint_minutes);
+  checkpoint_options.interval_passes = (uint) stoi(checkpoint_passes);
+  checkpoint_options.resume = resume;
+  rt.SetCheckpoint(checkpoint_options);
+  ProgressOptions progress_options;
+  progress_options.interval_seconds = stod(progress_interval);
+  progress_options.show_bar = !no_progress_bar;
+  progress_options.json_path = progress_json;
+  rt.SetProgress(progress_options);
+  rt.SetDiagnostics(diagnostics);
+  LightResamplingOptions resampling_options;
+  resampling_options.enabled = light_resampling;
+  resampling_options.candidates = (uint) stoi(resampling_candidates);
+  auto num_frames = (uint) std::max(stoi(resampling_frames), 1);
+  resampling_options.temporal = num_frames > 1;
+  if (resampling_options.temporal &&
+      (!tile_output.empty() || !checkpoint.empty())) {
+    spdlog::error("--resampling_frames cannot be combined with "
+                  "--tile_output or --checkpoint");
+    return -1;
+  }
+  rt.SetLightResampling(resampling_options);
+  if (integrator == "wavefront") {
+    rt.SetIntegrator(Integrator::kWavefront);
+  } else if (integrator != "recursive") {
+    spdlog::error("Invalid integrator: {}", integrator);
+    return -1;
+  }
+  PathOptions path_options;
+  path_options.min_throughput = static_cast<Real>(stod(min_throughput));
+  path_options.russian_roulette = russian_roulette;
+  if (glass_sampling == "schlick") {
+    path_options.glass_sampling = GlassSampling::kSchlick;
+  } else if (glass_sampling != "split") {
+    spdlog::error("Invalid glass sampling: {}", glass_sampling);
+    return -1;
+  }
+  rt.SetPathOptions(path_options);
+  if (sampler == "stratified") {
+    rt.SetSamplerType(SamplerType::kStratified);
+  } else if (sampler == "halton") {
+    rt.SetSamplerType(SamplerType::kHalton);
+  } else if (sampler == "sobol") {
+    rt.SetSamplerType(SamplerType::kSobol);
+  } else if (sampler != "independent") {
+    spdlog::error("Invalid sampler: {}", sampler);
+    return -1;
+  }
+  rt.SetSeed(123543);
+  rt.SetSceneFile(input_scene_name);
+  for (uint frame = 0; frame < num_frames; ++frame)
+    rt.Render(BVH_pass, lights, camera);
 
   // save rendered image to file
-  rt.WriteImage(output_name, 2);
+  rt.WriteImage(output_name, output_options);
+  if (!spp_image.empty())
+    rt.WriteSampleCountImage(spp_image);
   return 0;
 }
@@ -0,0 +1,247 @@
+// ======================================================================
+// Olio: Simple renderer
+// Copyright (C) 2022 by Hadi Fadaifard
+//
+// Author: Hadi Fadaifard, 2022
+// ======================================================================
+
+//! \file       main.cc
+//! \brief      shading_bench cli main.cc file: measures the cost of
+//!             material dispatch and scattering per hit point
+//! \author     Hadi Fadaifard, 2022
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <spdlog/spdlog.h>
+
+#include "core/types.h"
+#include "core/ray.h"
+#include "core/geometry/sphere.h"
+#include "core/geometry/surface_list.h"
+#include "core/material/phong_material.h"
+#include "core/material/phong_dielectric.h"
+#include "core/texture/texture.h"
+
+using namespace olio::core;
+using namespace std;
+namespace po = boost::program_options;
+
+bool ParseArguments(int argc, char **argv, uint *num_hits, uint *num_lights,
+                    uint *repetitions) {
+  po::options_description desc("options");
+  try {
+    desc.add_options()
+      ("help,h", "print usage")
+      ("hits,n",
+       po::value             (num_hits)->default_value(1 << 20),
+       "Number of hit points to shade")
+      ("lights,l",
+       po::value             (num_lights)->default_value(3),
+       "Number of lights evaluated per Phong hit point")
+      ("repetitions,r",
+       po::value             (repetitions)->default_value(5),
+       "Number of timed passes over the hit points (best is reported)");
+
+    // parse arguments
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+      cout << desc << endl;
+      return false;
+    }
+    po::notify(vm);
+  } catch(std::exception &e) {
+    cout << desc << endl;
+    spdlog::error("{}", e.what());
+    return false;
+  } catch(...) {
+    cout << desc << endl;
+    spdlog::error("Invalid arguments");
+    return false;
+  }
+  return true;
+}
+
+
+//! \brief Shade a hit point the way RayColor() used to: shared_ptr
+//!        copies, dynamic_pointer_cast dispatch (also once per light),
+//!        and heap allocated scatter rays
+//! \param[in] ray Ray that hit the point
+//! \param[in] hit_record Hit record
+//! \param[in] light_positions Light positions
+//! \return Shading result
+Vec3r ShadeWithRTTI(const Ray &ray, const HitRecord &hit_record,
+                    const vector<Vec3r> &light_positions)
+{
+  Vec3r color{0, 0, 0};
+  auto surface = hit_record.GetSurface();
+  auto material = surface->GetMaterial();
+  auto phong_material = dynamic_pointer_cast<PhongMaterial>(material);
+  if (!phong_material)
+    return color;
+  auto dielectric = dynamic_pointer_cast<PhongDielectric>(phong_material);
+  if (dielectric) {
+    auto scatter = dielectric->Scatter(hit_record, ray);
+    shared_ptr<Ray> reflect_ray = make_shared<Ray>(scatter.reflect_ray);
+    shared_ptr<Ray> refract_ray;
+    if (scatter.has_refract_ray)
+      refract_ray = make_shared<Ray>(scatter.refract_ray);
+    color += scatter.attenuation * scatter.reflect_weight +
+      reflect_ray->GetDirection();
+    if (refract_ray)
+      color += scatter.attenuation * scatter.refract_weight +
+        refract_ray->GetDirection();
+    return color;
+  }
+  Vec3r view_vec = -ray.GetDirection().normalized();
+  for (const auto &position : light_positions) {
+    auto light_surface = hit_record.GetSurface();
+    auto light_material = dynamic_pointer_cast<PhongMaterial>(light_surface->
+                                                              GetMaterial());
+    if (!light_material)
+      continue;
+    Vec3r light_vec = (position - hit_record.GetPoint()).normalized();
+    color += light_material->Evaluate(hit_record, light_vec, view_vec);
+  }
+  return color;
+}
+
+
+//! \brief Shade a hit point with MaterialKind dispatch and a by-value
+//!        ScatterResult, as RayColor() does
+//! \param[in] ray Ray that hit the point
+//! \param[in] hit_record Hit record
+//! \param[in] light_positions Light positions
+//! \return Shading result
+Vec3r ShadeWithKinds(const Ray &ray, const HitRecord &hit_record,
+                     const vector<Vec3r> &light_positions)
+{
+  Vec3r color{0, 0, 0};
+  const auto &material = hit_record.GetSurface()->GetMaterial();
+  switch (material->GetKind()) {
+  case MaterialKind::kDielectric: {
+    auto dielectric = static_cast<const PhongDielectric*>(material.get());
+    auto scatter = dielectric->Scatter(hit_record, ray);
+    color += scatter.attenuation * scatter.reflect_weight +
+      scatter.reflect_ray.GetDirection();
+    if (scatter.has_refract_ray)
+      color += scatter.attenuation * scatter.refract_weight +
+        scatter.refract_ray.GetDirection();
+    return color;
+  }
+  case MaterialKind::kPhong: {
+    Vec3r view_vec = -ray.GetDirection().normalized();
+    for (const auto &position : light_positions) {
+      auto light_material = AsPhongMaterial(hit_record.GetSurface()->
+                                            GetMaterial().get());
+      Vec3r light_vec = (position - hit_record.GetPoint()).normalized();
+      color += light_material->Evaluate(hit_record, light_vec, view_vec);
+    }
+    return color;
+  }
+  default:
+    return color;
+  }
+}
+
+
+//! \brief Time the shading of all hit points
+//! \param[in] name Shading method name
+//! \param[in] shade Shading function
+//! \param[in] rays Rays
+//! \param[in] hits Hit record of each ray
+//! \param[in] light_positions Light positions
+//! \param[in] repetitions Number of timed passes
+//! \return Best time per hit point in nanoseconds
+template <typename ShadeFunc>
+double TimeShading(const string &name, ShadeFunc shade, const vector<Ray> &rays,
+                   const vector<HitRecord> &hits,
+                   const vector<Vec3r> &light_positions, uint repetitions)
+{
+  double best_time = 0;
+  for (uint r = 0; r < repetitions; ++r) {
+    Vec3r checksum{0, 0, 0};
+    auto start_time = chrono::system_clock::now();
+    for (size_t i = 0; i < hits.size(); ++i)
+      checksum += shade(rays[i], hits[i], light_positions);
+    auto time = chrono::duration_cast<chrono::duration<double>>
+      (chrono::system_clock::now() - start_time).count();
+    if (r == 0 || time < best_time)
+      best_time = time;
+    if (r == 0)
+      spdlog::info("{}: checksum {:.6f}", name, checksum.sum());
+  }
+  return hits.empty() ? 0 : best_time * 1e9 / static_cast<double>(hits.size());
+}
+
+
+int
+main(int argc, char **argv)
+{
+  uint num_hits, num_lights, repetitions;
+  if (!ParseArguments(argc, argv, &num_hits, &num_lights, &repetitions))
+    return -1;
+
+  // one Phong, one mirror and one glass sphere
+  Texture::Ptr white = SolidTexture::Create(Vec3r{0.8, 0.8, 0.8});
+  Texture::Ptr clear = SolidTexture::Create(Vec3r{0.95, 0.95, 1});
+  auto diffuse_sphere = Sphere::Create(Vec3r{-2.5, 0, 0}, 1);
+  diffuse_sphere->SetMaterial(PhongMaterial::Create(Vec3r{0.1, 0.1, 0.1},
+                                                    white, Vec3r{0.5, 0.5, 0.5},
+                                                    50));
+  auto mirror_sphere = Sphere::Create(Vec3r{0, 0, 0}, 1);
+  mirror_sphere->SetMaterial(PhongMaterial::Create(Vec3r{0, 0, 0}, white,
+                                                   Vec3r{0.5, 0.5, 0.5}, 50,
+                                                   Vec3r{0.6, 0.6, 0.6}));
+  auto glass_sphere = Sphere::Create(Vec3r{2.5, 0, 0}, 1);
+  glass_sphere->SetMaterial(PhongDielectric::Create(1.5, clear));
+  auto scene = SurfaceList::Create(vector<Surface::Ptr>{
+      diffuse_sphere, mirror_sphere, glass_sphere});
+
+  // hit points of random rays, from outside and inside the spheres
+  mt19937 generator{1234};
+  uniform_real_distribution<Real> uniform{-1, 1};
+  vector<Ray> rays;
+  vector<HitRecord> hits;
+  rays.reserve(num_hits);
+  hits.reserve(num_hits);
+  while (hits.size() < num_hits) {
+    Vec3r origin{4 * uniform(generator), 2 * uniform(generator),
+                 4 + uniform(generator)};
+    if (uniform(generator) < -0.6)
+      origin = Vec3r{2.5, 0, 0} + 0.5 * Vec3r{uniform(generator),
+                                                uniform(generator),
+                                                uniform(generator)};
+    Vec3r target{4 * uniform(generator), uniform(generator),
+                 uniform(generator)};
+    Ray ray{origin, target - origin};
+    HitRecord hit_record;
+    if (!scene->Hit(ray, kEpsilon, kInfinity, hit_record))
+      continue;
+    hit_record.ComputeShading(ray);
+    rays.push_back(ray);
+    hits.push_back(hit_record);
+  }
+  vector<Vec3r> light_positions;
+  for (uint i = 0; i < num_lights; ++i)
+    light_positions.push_back(Vec3r{static_cast<Real>(i) - 1, 5, 3});
+
+  // time both dispatch methods
+  double rtti_time = TimeShading("rtti", ShadeWithRTTI, rays, hits,
+                                 light_positions, repetitions);
+  double kinds_time = TimeShading("kinds", ShadeWithKinds, rays, hits,
+                                  light_positions, repetitions);
+  spdlog::info("{} hits, {} lights", hits.size(), num_lights);
+  spdlog::info("dynamic_pointer_cast + shared_ptr<Ray>: {:.2f} ns/hit",
+               rtti_time);
+  spdlog::info("MaterialKind + ScatterResult:           {:.2f} ns/hit",
+               kinds_time);
+  if (kinds_time > 0)
+    spdlog::info("speedup: {:.2f}x", rtti_time / kinds_time);
+  return 0;
+}
@@ -9,15 +9,1440 @@
 //! \brief      main tests file
 //! \author     Hadi Fadaifard, 2022
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <random>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <fstream>
 
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
+#include <boost/filesystem.hpp>
 
 #include "core/types.h"
+#include "core/sampler/sampler.h"
+#include "core/ray.h"
+#include "core/geometry/sphere.h"
+#include "core/geometry/triangle.h"
+#include "core/geometry/triangle_store.h"
+#include "core/geometry/wide_bvh.h"
+#include "core/geometry/surface_list.h"
+#include "core/geometry/bvh_node.h"
+#include "core/renderer/ray_stats.h"
+#include "core/renderer/raytracer.h"
+#include "core/renderer/image_output.h"
+#include "core/renderer/tiled_image_file.h"
+#include "core/renderer/render_checkpoint.h"
+#include "core/renderer/render_progress.h"
+#include "core/camera/camera.h"
+#include "core/material/phong_material.h"
+#include "core/material/phong_dielectric.h"
+#include "core/texture/texture.h"
 
 using namespace std;
 using namespace olio::core;
 
+//! \brief Create the ground of the light tests: a large triangle in
+//!        the y = 0 plane, facing up
+//! \param[in] ambient Ambient color
+//! \param[in] diffuse Diffuse color
+//! \param[in] specular Specular color
+//! \param[in] shininess Phong exponent
+//! \return Ground triangle
+Surface::Ptr
+CreateGround(const Vec3r &ambient, const Vec3r &diffuse,
+             const Vec3r &specular=Vec3r{0, 0, 0}, Real shininess=1)
+{
+  auto ground = Triangle::Create(vector<Vec3r>{
+      Vec3r{-100, 0, -100}, Vec3r{-100, 0, 100}, Vec3r{100, 0, 0}});
+  Texture::Ptr texture = SolidTexture::Create(diffuse);
+  ground->SetMaterial(PhongMaterial::Create(ambient, texture, specular,
+                                            shininess));
+  return ground;
+}
+
+
+//! \brief Create an ambient light and a 16x16 grid of point lights one
+//!        unit above the ground (see CreateGround())
+//! \return Lights, the ambient light first
+vector<Light::Ptr>
+CreatePointLightGrid()
+{
+  vector<Light::Ptr> lights{AmbientLight::Create(Vec3r{0.2, 0.2, 0.2})};
+  for (int i = 0; i < 16; ++i) {
+    for (int j = 0; j < 16; ++j)
+      lights.push_back(PointLight::Create(Vec3r{i - 7.5, 1, j - 7.5},
+                                          Vec3r{1, 1, 1}));
+  }
+  return lights;
+}
+
+
 TEST_CASE("DoNothing") {
 }
+
+
+TEST_CASE("SamplerIsReproducible") {
+  for (auto type : {SamplerType::kIndependent, SamplerType::kStratified,
+                    SamplerType::kHalton, SamplerType::kSobol}) {
+    Sampler a{7, type, 16}, b{7, type, 16};
+    a.StartPixelSample(Vec2i{3, 5}, 2);
+    a.StartBounce(1);
+    Real a0 = a.Get1D();
+    const Vec2r &a1 = a.Get2D();
+
+    // drawing from another pixel in between must not change the stream
+    b.StartPixelSample(Vec2i{4, 5}, 2);
+    b.Get2D();
+    b.StartPixelSample(Vec2i{3, 5}, 2);
+    b.StartBounce(1);
+    REQUIRE(b.Get1D() == a0);
+    REQUIRE(b.Get2D() == a1);
+
+    // the child branches of a split path draw other values than the
+    // parent and each other
+    Real branch_values[2];
+    for (uint child = 0; child < 2; ++child) {
+      b.SetBranch(Sampler::ChildBranch(0, child));
+      b.StartBounce(1);
+      branch_values[child] = b.Get1D();
+      REQUIRE(branch_values[child] != a0);
+    }
+    REQUIRE(branch_values[0] != branch_values[1]);
+    b.StartPixelSample(Vec2i{3, 5}, 2);
+    b.StartBounce(1);
+    REQUIRE(b.Get1D() == a0);
+
+    for (int i = 0; i < 1000; ++i) {
+      Real value = a.Get1D();
+      REQUIRE(value >= 0);
+      REQUIRE(value < 1);
+    }
+  }
+}
+
+
+TEST_CASE("LowDiscrepancySamplersReduceError") {
+  // estimate the area below a shadow edge (u + v < 1, area 0.5) in
+  // many pixels, with 16 samples per pixel
+  const uint num_samples = 16;
+  const int num_pixels = 512;
+  std::map<SamplerType, Real> errors;
+  for (auto type : {SamplerType::kIndependent, SamplerType::kStratified,
+                    SamplerType::kHalton, SamplerType::kSobol}) {
+    Sampler sampler{11, type, num_samples};
+    Real squared_error = 0;
+    for (int p = 0; p < num_pixels; ++p) {
+      Real estimate = 0;
+      std::vector<int> strata(num_samples, 0);
+      for (uint s = 0; s < num_samples; ++s) {
+        sampler.StartPixelSample(Vec2i{p, 0}, s);
+        sampler.StartBounce(1);
+        Real u = sampler.Get1D();
+        ++strata[static_cast<size_t>(u * num_samples)];
+        const Vec2r &uv = sampler.Get2D();
+        estimate += uv[0] + uv[1] < 1 ? 1 : 0;
+      }
+      estimate /= num_samples;
+      squared_error += (estimate - 0.5) * (estimate - 0.5);
+
+      // the samples of a pixel cover all 1D strata
+      if (type != SamplerType::kIndependent)
+        REQUIRE(std::count(strata.begin(), strata.end(), 1) == num_samples);
+    }
+    errors[type] = std::sqrt(squared_error / num_pixels);
+  }
+  auto independent_error = errors[SamplerType::kIndependent];
+  REQUIRE(errors[SamplerType::kStratified] < 0.6 * independent_error);
+  REQUIRE(errors[SamplerType::kHalton] < 0.6 * independent_error);
+  REQUIRE(errors[SamplerType::kSobol] < 0.6 * independent_error);
+}
+
+
+TEST_CASE("RayCountsArePerThread") {
+  TakeThreadRayCounts();
+  CountRay(RayType::kPrimary);
+  CountRay(RayType::kShadow);
+  CountRay(RayType::kShadow);
+
+  // other threads' counts are separate
+  std::thread{[] {CountRay(RayType::kSecondary);}}.join();
+
+  auto counts = TakeThreadRayCounts();
+  REQUIRE(counts.Get(RayType::kPrimary) == 1);
+  REQUIRE(counts.Get(RayType::kSecondary) == 0);
+  REQUIRE(counts.Get(RayType::kShadow) == 2);
+  REQUIRE(counts.GetTotal() == 3);
+  REQUIRE(TakeThreadRayCounts().GetTotal() == 0);
+}
+
+
+TEST_CASE("DistantAndSmallPrimitivesAreHit") {
+  // sphere far from the ray origin: its quadratic cancels badly in
+  // single precision unless solved carefully
+  auto sphere = Sphere::Create(Vec3r{0, 0.5, -10000}, 1);
+  Ray ray{Vec3r{0, 0, 0}, Vec3r{0, 0, -1}};
+  HitRecord hit_record;
+  REQUIRE(sphere->Hit(ray, kEpsilon, kInfinity, hit_record));
+  REQUIRE(hit_record.GetRayT() == Approx(10000 - std::sqrt(0.75)).margin(1e-2));
+  REQUIRE(sphere->Occluded(ray, kEpsilon, kInfinity));
+  REQUIRE_FALSE(sphere->Occluded(ray, kEpsilon, 9000));
+
+  // millimeter sized triangle: its determinant is tiny in absolute terms
+  auto triangle = Triangle::Create(std::vector<Vec3r>{
+      Vec3r{-0.001, -0.001, -1}, Vec3r{0.001, -0.001, -1},
+      Vec3r{0, 0.001, -1}});
+  REQUIRE(triangle->Hit(ray, kEpsilon, kInfinity, hit_record));
+  REQUIRE(hit_record.GetRayT() == Approx(1));
+
+  // ray parallel to the triangle
+  Ray parallel_ray{Vec3r{0, -1, -1}, Vec3r{0, 1, 0}};
+  REQUIRE_FALSE(triangle->Hit(parallel_ray, kEpsilon, kInfinity, hit_record));
+}
+
+
+TEST_CASE("HitRecordComputesShadingOnDemand") {
+  // traversal only records t, surface, primitive id and barycentrics
+  auto sphere = Sphere::Create(Vec3r{0, 0, -5}, 1);
+  Ray ray{Vec3r{0, 0, 0}, Vec3r{0, 0, -1}};
+  HitRecord hit_record;
+  REQUIRE(sphere->Hit(ray, kEpsilon, kInfinity, hit_record));
+  REQUIRE(hit_record.GetSurface() == sphere.get());
+  REQUIRE(hit_record.GetNormal().isZero());
+
+  // shading attributes of the final hit
+  hit_record.ComputeShading(ray);
+  REQUIRE(hit_record.GetRayT() == Approx(4));
+  REQUIRE(hit_record.GetPoint().isApprox(Vec3r{0, 0, -4}));
+  REQUIRE(hit_record.GetNormal().isApprox(Vec3r{0, 0, 1}));
+  REQUIRE(hit_record.IsFrontFace());
+  const auto &sphere_uv = hit_record.GetFaceGeouv().get_global_uv();
+  REQUIRE(sphere_uv[1] == Approx(0));
+
+  // the triangle's uv coordinates are the barycentrics of the hit
+  auto triangle = Triangle::Create(std::vector<Vec3r>{
+      Vec3r{-1, -1, -2}, Vec3r{1, -1, -2}, Vec3r{-1, 1, -2}});
+  Ray triangle_ray{Vec3r{-0.5, -0.5, 0}, Vec3r{0, 0, -1}};
+  REQUIRE(triangle->Hit(triangle_ray, kEpsilon, kInfinity, hit_record));
+  REQUIRE(hit_record.GetSurface() == triangle.get());
+  hit_record.ComputeShading(triangle_ray);
+  REQUIRE(hit_record.GetPoint().isApprox(Vec3r{-0.5, -0.5, -2}));
+  const auto &face_geouv = hit_record.GetFaceGeouv();
+  REQUIRE(face_geouv.get_face_id() == 0);
+  REQUIRE(face_geouv.get_uv().isApprox(hit_record.GetBarycentric()));
+  REQUIRE(face_geouv.get_uv().isApprox(Vec2r{0.25, 0.25}));
+}
+
+
+TEST_CASE("BVHMatchesSurfaceList") {
+  // random spheres and triangles
+  std::mt19937 rng{1};
+  std::uniform_real_distribution<Real> coord{-10, 10};
+  std::uniform_real_distribution<Real> size{0.05, 1};
+  std::vector<Surface::Ptr> surfaces;
+  for (int i = 0; i < 300; ++i) {
+    Vec3r center{coord(rng), coord(rng), coord(rng)};
+    if (i % 2) {
+      surfaces.push_back(Sphere::Create(center, size(rng)));
+    } else {
+      std::vector<Vec3r> points;
+      for (int j = 0; j < 3; ++j)
+        points.push_back(center + Vec3r{size(rng), size(rng), size(rng)});
+      surfaces.push_back(Triangle::Create(points));
+    }
+  }
+  auto surface_list = SurfaceList::Create(surfaces);
+
+  std::vector<Ray> rays;
+  for (int i = 0; i < 2000; ++i) {
+    rays.emplace_back(Vec3r{coord(rng), coord(rng), coord(rng)},
+                      Vec3r{coord(rng), coord(rng), coord(rng)});
+  }
+
+  for (auto split_method : {BVHSplitMethod::kMedian, BVHSplitMethod::kSAH}) {
+    for (uint leaf_size : {1u, 4u}) {
+      BVHBuildOptions options;
+      options.split_method = split_method;
+      options.leaf_size = leaf_size;
+      auto bvh = BVHNode::BuildBVH(surfaces, options);
+      REQUIRE(bvh);
+
+      // every primitive is in exactly one leaf of at most leaf_size
+      const auto &stats = bvh->GetBuildStats();
+      REQUIRE(stats.prim_count == surfaces.size());
+      REQUIRE(stats.leaf_histogram.size() <= leaf_size + 1);
+      REQUIRE(stats.max_depth < LinearBVH::kMaxDepth);
+
+      for (const auto &ray : rays) {
+        HitRecord list_record, bvh_record;
+        bool list_hit = surface_list->Hit(ray, kEpsilon, kInfinity,
+                                          list_record);
+        bool bvh_hit = bvh->Hit(ray, kEpsilon, kInfinity, bvh_record);
+        REQUIRE(list_hit == bvh_hit);
+        if (list_hit)
+          REQUIRE(bvh_record.GetRayT() == Approx(list_record.GetRayT()));
+
+        // occlusion of the segment [kEpsilon, 1]
+        HitRecord segment_record;
+        bool segment_hit = surface_list->Hit(ray, kEpsilon, 1, segment_record);
+        REQUIRE(surface_list->Occluded(ray, kEpsilon, 1) == segment_hit);
+        REQUIRE(bvh->Occluded(ray, kEpsilon, 1) == segment_hit);
+      }
+    }
+  }
+}
+
+
+TEST_CASE("ParallelBVHBuildMatchesSerialBuild") {
+  // random boxes
+  std::mt19937 rng{2};
+  std::uniform_real_distribution<Real> coord{-100, 100};
+  std::uniform_real_distribution<Real> size{0.01, 2};
+  std::vector<AABB> prim_bounds;
+  for (int i = 0; i < 20000; ++i) {
+    Vec3r bmin{coord(rng), coord(rng), coord(rng)};
+    prim_bounds.emplace_back(bmin, bmin + Vec3r{size(rng), size(rng),
+                                                size(rng)});
+  }
+
+  for (auto split_method : {BVHSplitMethod::kMedian, BVHSplitMethod::kSAH}) {
+    BVHBuildOptions options;
+    options.split_method = split_method;
+    options.parallel_size = std::numeric_limits<uint>::max();
+    LinearBVH serial_bvh, parallel_bvh;
+    std::vector<uint32_t> serial_order, parallel_order;
+    serial_bvh.Build(prim_bounds, options, serial_order);
+    options.parallel_size = 64;
+    parallel_bvh.Build(prim_bounds, options, parallel_order);
+
+    REQUIRE(serial_order == parallel_order);
+    const auto &serial_nodes = serial_bvh.GetNodes();
+    const auto &parallel_nodes = parallel_bvh.GetNodes();
+    REQUIRE(serial_nodes.size() == parallel_nodes.size());
+    for (size_t i = 0; i < serial_nodes.size(); ++i) {
+      REQUIRE(std::memcmp(&serial_nodes[i], &parallel_nodes[i],
+                          sizeof(LinearBVHNode)) == 0);
+    }
+  }
+}
+
+
+TEST_CASE("TriangleStoreMatchesTriangles") {
+  // random triangles sharing vertices
+  std::mt19937 rng{3};
+  std::uniform_real_distribution<Real> coord{-10, 10};
+  std::uniform_int_distribution<uint32_t> vertex{0, 199};
+  TriangleStore store;
+  for (int i = 0; i < 200; ++i) {
+    store.AddVertex(Vec3r{coord(rng), coord(rng), coord(rng)},
+                    Vec3r{0, 0, 1}, Vec2r{0, 0});
+  }
+  std::vector<Surface::Ptr> triangles;
+  std::vector<AABB> triangle_bounds;
+  for (int i = 0; i < 500; ++i) {
+    uint32_t v0 = vertex(rng), v1 = vertex(rng), v2 = vertex(rng);
+    auto tri = store.AddTriangle(v0, v1, v2, i);
+    triangles.push_back(Triangle::Create(std::vector<Vec3r>{
+          store.GetPosition(v0), store.GetPosition(v1),
+          store.GetPosition(v2)}));
+    triangle_bounds.push_back(store.GetTriangleBounds(tri));
+  }
+  LinearBVH bvh;
+  std::vector<uint32_t> order;
+  bvh.Build(triangle_bounds, BVHBuildOptions{}, order);
+  store.ReorderTriangles(order);
+  WideBVH wide_bvh;
+  wide_bvh.Build(bvh, store);
+  auto surface_list = SurfaceList::Create(triangles);
+
+  std::vector<Ray> rays;
+  for (int i = 0; i < 2000; ++i) {
+    rays.emplace_back(Vec3r{coord(rng), coord(rng), coord(rng)},
+                      Vec3r{coord(rng), coord(rng), coord(rng)});
+  }
+
+  // binary bvh, and wide bvh with every supported kernel
+  std::vector<int> levels{-1};
+  for (int level = 0; level <= static_cast<int>(GetSupportedSimdLevel());
+       ++level)
+    levels.push_back(level);
+  for (int level : levels) {
+    if (level >= 0)
+      SetSimdLevel(static_cast<SimdLevel>(level));
+    for (const auto &ray : rays) {
+      HitRecord list_record;
+      bool list_hit = surface_list->Hit(ray, kEpsilon, kInfinity,
+                                        list_record);
+      Real hit_t = 0;
+      int hit_face = -1;
+      auto hit_triangle = [&](uint32_t tri, Real tmin, Real &tmax) {
+        Real t;
+        Vec2r uv;
+        if (!store.RayTriangleHit(tri, ray, tmin, tmax, t, uv))
+          return false;
+        tmax = hit_t = t;
+        hit_face = store.GetFaceId(tri);
+        return true;
+      };
+      bool store_hit = level < 0 ?
+        bvh.Intersect(ray, kEpsilon, kInfinity, hit_triangle) :
+        wide_bvh.Intersect(ray, kEpsilon, kInfinity, hit_triangle);
+      REQUIRE(list_hit == store_hit);
+      if (list_hit) {
+        REQUIRE(hit_t == Approx(list_record.GetRayT()));
+        REQUIRE(triangles[static_cast<size_t>(hit_face)].get() ==
+                list_record.GetSurface());
+      }
+
+      // occlusion of the segment [kEpsilon, 1]
+      HitRecord segment_record;
+      bool segment_hit = surface_list->Hit(ray, kEpsilon, 1, segment_record);
+      auto occludes = [&](uint32_t tri, Real tmin, Real tmax) {
+        Real t;
+        Vec2r uv;
+        return store.RayTriangleHit(tri, ray, tmin, tmax, t, uv);
+      };
+      bool store_occluded = level < 0 ?
+        bvh.Occluded(ray, kEpsilon, 1, occludes) :
+        wide_bvh.Occluded(ray, kEpsilon, 1, occludes);
+      REQUIRE(store_occluded == segment_hit);
+    }
+  }
+  SetSimdLevel(GetSupportedSimdLevel());
+}
+
+
+TEST_CASE("WideBVHKeepsDistantAndGrazingHits") {
+  // triangles that a float filter with an absolute tolerance rejects:
+  // millimeter sized ones far from the ray origin, tiny ones near an
+  // offset origin, and large ones seen at grazing angles
+  std::mt19937 rng{11};
+  std::uniform_real_distribution<Real> unit{-1, 1};
+  TriangleStore store;
+  std::vector<Surface::Ptr> triangles;
+  std::vector<AABB> triangle_bounds;
+  auto add_triangle = [&](const Vec3r &p0, const Vec3r &p1, const Vec3r &p2) {
+    uint32_t v0 = store.AddVertex(p0, Vec3r{0, 0, 1}, Vec2r{0, 0});
+    uint32_t v1 = store.AddVertex(p1, Vec3r{0, 0, 1}, Vec2r{0, 0});
+    uint32_t v2 = store.AddVertex(p2, Vec3r{0, 0, 1}, Vec2r{0, 0});
+    auto tri = store.AddTriangle(v0, v1, v2,
+                                 static_cast<int>(triangles.size()));
+    triangles.push_back(Triangle::Create(std::vector<Vec3r>{p0, p1, p2}));
+    triangle_bounds.push_back(store.GetTriangleBounds(tri));
+  };
+  auto random_vec = [&](Real scale) {
+    return Vec3r{scale * unit(rng), scale * unit(rng), scale * unit(rng)};
+  };
+
+  // rays aimed at the interior, edges and corners of the triangles,
+  // with the target at t = 1
+  std::vector<Ray> rays;
+  auto aim_rays = [&](size_t first, const Vec3r &origin, Real jitter) {
+    const Real weights[][2] = {{0.3, 0.3}, {0, 0.5}, {0.5, 0}, {0.5, 0.5},
+                               {0, 0}, {1, 0}, {0, 1}};
+    for (size_t i = first; i < triangles.size(); ++i) {
+      const auto *v = store.GetTriangle(static_cast<uint32_t>(i));
+      Vec3r p0 = store.GetPosition(v[0]);
+      Vec3r e1 = store.GetPosition(v[1]) - p0;
+      Vec3r e2 = store.GetPosition(v[2]) - p0;
+      for (const auto &w : weights) {
+        Vec3r target = p0 + w[0] * e1 + w[1] * e2;
+        Vec3r ray_origin = origin + random_vec(jitter);
+        rays.emplace_back(ray_origin, target - ray_origin);
+      }
+    }
+  };
+
+  // millimeter sized triangles ten kilometers away
+  size_t first = triangles.size();
+  for (int i = 0; i < 40; ++i) {
+    Vec3r center = Vec3r{10000, 0, 0} + random_vec(0.05);
+    add_triangle(center + random_vec(0.001), center + random_vec(0.001),
+                 center + random_vec(0.001));
+  }
+  aim_rays(first, Vec3r{0, 0, 0}, 0);
+
+  // sub-millimeter triangles next to an offset origin
+  first = triangles.size();
+  const Vec3r offset{1000, -1000, 1000};
+  for (int i = 0; i < 40; ++i) {
+    Vec3r center = offset + random_vec(0.1);
+    add_triangle(center + random_vec(0.0001), center + random_vec(0.0001),
+                 center + random_vec(0.0001));
+  }
+  aim_rays(first, offset, 0.2);
+
+  // large triangles hit at grazing angles
+  first = triangles.size();
+  for (int i = 0; i < 8; ++i) {
+    Real z = static_cast<Real>(i);
+    add_triangle(Vec3r{-5, -5, z}, Vec3r{5, -5, z}, Vec3r{5, 5, z});
+    add_triangle(Vec3r{-5, -5, z}, Vec3r{5, 5, z}, Vec3r{-5, 5, z});
+  }
+  const Real elevations[] = {1e-7, 1e-5, 1e-3};
+  for (size_t i = first; i < triangles.size(); ++i) {
+    const auto *v = store.GetTriangle(static_cast<uint32_t>(i));
+    Vec3r p0 = store.GetPosition(v[0]);
+    for (Real elevation : elevations) {
+      Vec3r target = p0 + Vec3r{5 + 2 * unit(rng), 5 + 2 * unit(rng), 0};
+      Vec3r dir = Vec3r{1, unit(rng), -elevation}.normalized();
+      rays.emplace_back(target - 6 * dir, 6 * dir);
+    }
+  }
+
+  // two packets per leaf, so wide kernels test full registers
+  BVHBuildOptions options;
+  options.leaf_size = 8;
+  LinearBVH bvh;
+  std::vector<uint32_t> order;
+  bvh.Build(triangle_bounds, options, order);
+  store.ReorderTriangles(order);
+  WideBVH wide_bvh;
+  wide_bvh.Build(bvh, store);
+
+  for (int level = 0; level <= static_cast<int>(GetSupportedSimdLevel());
+       ++level) {
+    SetSimdLevel(static_cast<SimdLevel>(level));
+    size_t hit_count = 0;
+    for (const auto &ray : rays) {
+      // reference: every triangle with the exact test
+      Real reference_t = kInfinity;
+      bool reference_hit = false, reference_occluded = false;
+      for (const auto &triangle : triangles) {
+        HitRecord record;
+        if (triangle->Hit(ray, kEpsilon, reference_t, record)) {
+          reference_t = record.GetRayT();
+          reference_hit = true;
+        }
+        if (triangle->Occluded(ray, kEpsilon, 1))
+          reference_occluded = true;
+      }
+      hit_count += reference_hit ? 1 : 0;
+
+      Real hit_t = kInfinity;
+      auto hit_triangle = [&](uint32_t tri, Real tmin, Real &tmax) {
+        Real t;
+        Vec2r uv;
+        if (!store.RayTriangleHit(tri, ray, tmin, tmax, t, uv))
+          return false;
+        tmax = hit_t = t;
+        return true;
+      };
+      auto occludes = [&](uint32_t tri, Real tmin, Real tmax) {
+        Real t;
+        Vec2r uv;
+        return store.RayTriangleHit(tri, ray, tmin, tmax, t, uv);
+      };
+      REQUIRE(wide_bvh.Intersect(ray, kEpsilon, kInfinity, hit_triangle) ==
+              reference_hit);
+      REQUIRE(hit_t == reference_t);
+      REQUIRE(wide_bvh.Occluded(ray, kEpsilon, 1, occludes) ==
+              reference_occluded);
+    }
+    REQUIRE(hit_count > rays.size() / 2);
+  }
+  SetSimdLevel(GetSupportedSimdLevel());
+}
+
+//! \class SampleTracer
+//! \brief Exposes RayTracer::TraceSamples() to tests
+class SampleTracer : public RayTracer {
+public:
+  using RayTracer::TraceSamples;
+  using RayTracer::BuildLightTree;
+  using RayTracer::GetSettingsKey;
+  using RayTracer::IsPixelDone;
+  using RayTracer::rendered_image_;
+};
+
+
+TEST_CASE("ParallelRenderMatchesSerialRender") {
+  namespace fs = boost::filesystem;
+  Texture::Ptr white = SolidTexture::Create(Vec3r{0.8, 0.8, 0.8});
+  auto ground = Sphere::Create(Vec3r{0, -1001, -5}, 1000);
+  ground->SetMaterial(PhongMaterial::Create(Vec3r{0.1, 0.1, 0.1}, white,
+                                            Vec3r{0.3, 0.3, 0.3}, 20));
+  auto ball = Sphere::Create(Vec3r{0, 0, -5}, 1);
+  ball->SetMaterial(PhongMaterial::Create(Vec3r{0.1, 0.1, 0.1}, white,
+                                          Vec3r{0, 0, 0}, 1));
+  Surface::Ptr scene = SurfaceList::Create(vector<Surface::Ptr>{ground, ball});
+  auto area_light = AreaLight::Create(Vec3r{0, 4, -5}, Vec3r{0, -1, 0},
+                                      Vec3r{1, 0, 0}, Vec3r{10, 10, 10}, 1);
+  area_light->SetGridSize(2);
+  vector<Light::Ptr> lights{area_light};
+  auto camera = Camera::Create(Vec3r{0, 0, 0}, Vec3r{0, 0, -1},
+                               Vec3r{0, 1, 0}, Real{45}, Real{1.5});
+
+  // the same soft shadow render in memory and streamed to a tile file,
+  // with one thread and with several threads and tile sizes
+  auto render = [&](uint num_threads, uint tile_size, cv::Mat &image,
+                    vector<float> &file_rgb) {
+    SampleTracer tracer;
+    tracer.SetImageHeight(12);
+    tracer.SetNumSamplesPerPixel(4);
+    tracer.SetSeed(5);
+    tracer.SetNumThreads(num_threads);
+    tracer.SetTileSize(tile_size);
+    REQUIRE(tracer.Render(scene, lights, camera));
+    image = tracer.rendered_image_;
+    auto rays = tracer.GetRayCounts();
+
+    auto path = (fs::temp_directory_path() /
+                 fs::unique_path("olio-%%%%-%%%%.tiles")).string();
+    tracer.SetTileOutput(path);
+    REQUIRE(tracer.Render(scene, lights, camera));
+    TiledImageFile reader;
+    REQUIRE(reader.OpenForReading(path));
+    file_rgb.clear();
+    vector<float> rgb;
+    for (int tile_row = 0; tile_row < reader.GetNumTilesY(); ++tile_row) {
+      REQUIRE(reader.ReadTileRow(tile_row, rgb));
+      file_rgb.insert(file_rgb.end(), rgb.begin(), rgb.end());
+    }
+    reader.Close();
+    fs::remove(path);
+    return rays;
+  };
+  cv::Mat serial_image;
+  vector<float> serial_rgb;
+  auto serial_rays = render(1, 16, serial_image, serial_rgb);
+  REQUIRE(serial_rgb.size() == 18u * 12u * 3u);
+  const uint configs[][2] = {{4, 16}, {4, 5}, {3, 7}, {2, 1}};
+  for (const auto &config : configs) {
+    INFO("threads: " << config[0] << ", tile size: " << config[1]);
+    cv::Mat image;
+    vector<float> rgb;
+    auto rays = render(config[0], config[1], image, rgb);
+    REQUIRE(rays.GetTotal() == serial_rays.GetTotal());
+    REQUIRE(rgb == serial_rgb);
+    REQUIRE(image.rows == serial_image.rows);
+    REQUIRE(image.cols == serial_image.cols);
+    REQUIRE(image.type() == serial_image.type());
+    const size_t image_bytes = serial_image.total() * serial_image.elemSize();
+    if (image_bytes) {
+      REQUIRE(std::memcmp(image.data, serial_image.data, image_bytes) == 0);
+    }
+  }
+}
+
+
+TEST_CASE("AdaptiveSamplingMatchesNoiseWithFewerRays") {
+  // pixels whose samples all agree only stop after 1 / tolerance
+  // samples, not after the first batch
+  SampleTracer stop_tracer;
+  stop_tracer.SetAdaptiveSampling(0.05, 4);
+  stop_tracer.SetNumSamplesPerPixel(64);
+  PixelStats stats;
+  stats.mean = 1;
+  stats.num_samples = 4;
+  REQUIRE_FALSE(stop_tracer.IsPixelDone(stats));
+  stats.num_samples = 16;
+  REQUIRE_FALSE(stop_tracer.IsPixelDone(stats));
+  stats.num_samples = 24;
+  REQUIRE(stop_tracer.IsPixelDone(stats));
+
+  // ball casting a soft shadow on the ground, lit by one sample of an
+  // area light per camera sample
+  namespace fs = boost::filesystem;
+  Texture::Ptr white = SolidTexture::Create(Vec3r{0.8, 0.8, 0.8});
+  auto ground = Sphere::Create(Vec3r{0, -1001, -5}, 1000);
+  ground->SetMaterial(PhongMaterial::Create(Vec3r{0, 0, 0}, white,
+                                            Vec3r{0, 0, 0}, 1));
+  auto ball = Sphere::Create(Vec3r{0, 0, -5}, 1);
+  ball->SetMaterial(PhongMaterial::Create(Vec3r{0, 0, 0}, white,
+                                          Vec3r{0, 0, 0}, 1));
+  Surface::Ptr scene = SurfaceList::Create(vector<Surface::Ptr>{ground, ball});
+  auto area_light = AreaLight::Create(Vec3r{0, 4, -5}, Vec3r{0, -1, 0},
+                                      Vec3r{1, 0, 0}, Vec3r{10, 10, 10}, 0.5);
+  area_light->SetGridSize(1);
+  vector<Light::Ptr> lights{area_light};
+  auto camera = Camera::Create(Vec3r{0, 0, 0}, Vec3r{0, 0, -1},
+                               Vec3r{0, 1, 0}, Real{45}, Real{1.5});
+
+  auto render = [&](uint spp, Real tolerance, vector<float> &rgb) {
+    SampleTracer tracer;
+    tracer.SetImageHeight(16);
+    tracer.SetNumSamplesPerPixel(spp);
+    tracer.SetAdaptiveSampling(tolerance);
+    tracer.SetSeed(9);
+    tracer.SetTileSize(64);
+    auto path = (fs::temp_directory_path() /
+                 fs::unique_path("olio-%%%%-%%%%.tiles")).string();
+    tracer.SetTileOutput(path);
+    REQUIRE(tracer.Render(scene, lights, camera));
+    TiledImageFile reader;
+    REQUIRE(reader.OpenForReading(path));
+    REQUIRE(reader.GetNumTilesY() == 1);
+    REQUIRE(reader.ReadTileRow(0, rgb));
+    reader.Close();
+    fs::remove(path);
+    return tracer.GetRayCounts().GetTotal();
+  };
+  // rms error relative to the pixel (the error adaptive sampling bounds),
+  // with the same floor for black pixels as adaptive sampling
+  auto relative_error = [](const vector<float> &rgb,
+                           const vector<float> &reference) {
+    double sum = 0;
+    for (size_t i = 0; i < rgb.size(); ++i) {
+      double error = static_cast<double>(rgb[i] - reference[i]) /
+        std::max(static_cast<double>(reference[i]), 1.0 / 256);
+      sum += error * error;
+    }
+    return std::sqrt(sum / static_cast<double>(rgb.size()));
+  };
+
+  // adaptive sampling spends the rays saved on the lit and unlit
+  // ground on the penumbra and the silhouettes
+  vector<float> reference, uniform, adaptive;
+  render(1024, 0, reference);
+  auto uniform_rays = render(64, 0, uniform);
+  auto adaptive_rays = render(256, 0.07, adaptive);
+  REQUIRE(adaptive_rays < uniform_rays);
+  REQUIRE(relative_error(adaptive, reference) <=
+          relative_error(uniform, reference));
+}
+
+TEST_CASE("WavefrontMatchesRecursive") {
+  // diffuse ground, mirror, glass, and non-Phong spheres
+  Texture::Ptr white = SolidTexture::Create(Vec3r{0.8, 0.8, 0.8});
+  Texture::Ptr red = SolidTexture::Create(Vec3r{0.8, 0.1, 0.1});
+  Texture::Ptr clear = SolidTexture::Create(Vec3r{0.95, 0.95, 1});
+  auto ground = Sphere::Create(Vec3r{0, -1001, -5}, 1000);
+  ground->SetMaterial(PhongMaterial::Create(Vec3r{0.1, 0.1, 0.1}, white,
+                                            Vec3r{0, 0, 0}, 1));
+  auto mirror = Sphere::Create(Vec3r{-1.2, 0, -5}, 1);
+  mirror->SetMaterial(PhongMaterial::Create(Vec3r{0, 0, 0}, red,
+                                            Vec3r{0.5, 0.5, 0.5}, 50,
+                                            Vec3r{0.6, 0.6, 0.6}));
+  auto glass = Sphere::Create(Vec3r{1.2, 0, -4}, 1);
+  glass->SetMaterial(PhongDielectric::Create(1.5, clear));
+  auto black = Sphere::Create(Vec3r{0, 2, -7}, 1);
+  black->SetMaterial(Material::Create());
+  auto scene = SurfaceList::Create(vector<Surface::Ptr>{ground, mirror,
+                                                        glass, black});
+  auto area_light = AreaLight::Create(Vec3r{0, 4, -5}, Vec3r{0, -1, 0},
+                                      Vec3r{1, 0, 0}, Vec3r{10, 10, 10}, 1);
+  area_light->SetGridSize(2);
+  vector<Light::Ptr> lights{
+    AmbientLight::Create(Vec3r{0.2, 0.2, 0.2}),
+    PointLight::Create(Vec3r{3, 5, 0}, Vec3r{20, 20, 20}), area_light};
+
+  // two samples per pixel of a small image
+  vector<CameraSample> samples;
+  for (int y = 0; y < 24; ++y) {
+    for (int x = 0; x < 32; ++x) {
+      for (uint s = 0; s < 2; ++s) {
+        CameraSample sample;
+        sample.pixel = Vec2i{x, y};
+        sample.sample_index = s;
+        sample.ray = Ray{Vec3r{0, 0, 0}, Vec3r{(x - 16 + 0.5 * s) / 16,
+                                                (y - 12 + 0.5 * s) / 16, -1}};
+        samples.push_back(sample);
+      }
+    }
+  }
+
+  // default, pruned, and rouletted paths with both glass sampling methods
+  vector<PathOptions> path_options(4);
+  path_options[1].min_throughput = 0.3;
+  path_options[2].min_throughput = 0.3;
+  path_options[2].russian_roulette = true;
+  path_options[3].min_throughput = 0.3;
+  path_options[3].russian_roulette = true;
+  path_options[3].glass_sampling = GlassSampling::kSchlick;
+  uint64_t full_secondary_rays = 0;
+  for (size_t k = 0; k < path_options.size(); ++k) {
+    SampleTracer tracer;
+    tracer.SetSeed(7);
+    tracer.SetPathOptions(path_options[k]);
+    if (k == path_options.size() - 1)
+      tracer.SetSamplerType(SamplerType::kSobol);
+    area_light->SetAdaptive(k == 2);
+    tracer.SetLightBudget(k == 1 ? 1 : 0);
+    LightResamplingOptions resampling_options;
+    resampling_options.enabled = k == 3;
+    tracer.SetLightResampling(resampling_options);
+    tracer.BuildLightTree(lights);
+    vector<Vec3r> recursive_colors, wavefront_colors;
+    TakeThreadRayCounts();
+    tracer.TraceSamples(samples, scene, lights, recursive_colors);
+    auto recursive_counts = TakeThreadRayCounts();
+    tracer.SetIntegrator(Integrator::kWavefront);
+    tracer.TraceSamples(samples, scene, lights, wavefront_colors);
+    auto wavefront_counts = TakeThreadRayCounts();
+
+    REQUIRE(wavefront_colors.size() == samples.size());
+    for (size_t i = 0; i < samples.size(); ++i)
+      REQUIRE(wavefront_colors[i] == recursive_colors[i]);
+    for (int type = 0; type < static_cast<int>(RayType::kCount); ++type) {
+      REQUIRE(wavefront_counts.Get(static_cast<RayType>(type)) ==
+              recursive_counts.Get(static_cast<RayType>(type)));
+    }
+
+    // pruning only ever removes secondary rays
+    auto secondary_rays = recursive_counts.Get(RayType::kSecondary);
+    if (k == 0)
+      full_secondary_rays = secondary_rays;
+    else
+      REQUIRE(secondary_rays < full_secondary_rays);
+    REQUIRE(secondary_rays > 0);
+  }
+}
+
+
+TEST_CASE("AdaptiveShadowsOnlySampleThePenumbra") {
+  // ground plane below a square light, partially shadowed by a sphere
+  auto ground = CreateGround(Vec3r{0, 0, 0}, Vec3r{0.8, 0.8, 0.8});
+  auto blocker = Sphere::Create(Vec3r{0, 2, 0}, 0.5);
+  auto scene = SurfaceList::Create(vector<Surface::Ptr>{ground, blocker});
+  auto light = AreaLight::Create(Vec3r{0, 4, 0}, Vec3r{0, -1, 0},
+                                 Vec3r{1, 0, 0}, Vec3r{10, 10, 10}, 1);
+
+  // illuminate a line of ground points running from the umbra to the
+  // fully lit region
+  for (uint grid_size : {4u, 2u}) {
+    INFO("grid size: " << grid_size);
+    light->SetGridSize(grid_size);
+    Sampler sampler{5};
+    Vec3r view_vec{0, 1, 0};
+    Real total_radiance = 0, total_error = 0;
+    uint64_t full_rays = 0, adaptive_rays = 0;
+    for (int i = 0; i < 400; ++i) {
+      Ray ray{Vec3r{i * 0.02, 1, 0.01}, Vec3r{0, -1, 0}};
+      HitRecord hit_record;
+      REQUIRE(scene->Hit(ray, kEpsilon, kInfinity, hit_record));
+      hit_record.ComputeShading(ray);
+      Vec3r radiance[2];
+      for (int adaptive = 0; adaptive < 2; ++adaptive) {
+        light->SetAdaptive(adaptive != 0);
+        sampler.StartPixelSample(Vec2i{i, 0}, 0);
+        sampler.StartBounce(1);
+        TakeThreadRayCounts();
+        radiance[adaptive] = light->Illuminate(hit_record, view_vec, scene,
+                                               sampler);
+        auto rays = TakeThreadRayCounts().Get(RayType::kShadow);
+        (adaptive ? adaptive_rays : full_rays) += rays;
+      }
+      total_radiance += radiance[0].norm();
+      total_error += (radiance[1] - radiance[0]).norm();
+    }
+    INFO("relative error: " << total_error / total_radiance);
+    INFO("shadow rays: " << adaptive_rays << " vs " << full_rays);
+    REQUIRE(full_rays == 400 * grid_size * grid_size);
+    if (grid_size * grid_size <= AreaLight::kProbeCount) {
+      // grids with no more cells than probes are not probed
+      REQUIRE(adaptive_rays == full_rays);
+      REQUIRE(total_error == 0);
+    } else {
+      // about the same shading, with the full grid only traced in the
+      // penumbra (occluders between the probes are missed)
+      REQUIRE(total_error < 0.02 * total_radiance);
+      REQUIRE(adaptive_rays < full_rays / 2);
+    }
+  }
+}
+
+
+TEST_CASE("AreaLightSamplingStrategiesAgree") {
+  // glossy ground close to a large light, viewed so that the light's
+  // highlight covers the shading point
+  auto ground = CreateGround(Vec3r{0, 0, 0}, Vec3r{0.3, 0.3, 0.3},
+                             Vec3r{0.6, 0.6, 0.6}, 50);
+  auto scene = SurfaceList::Create(vector<Surface::Ptr>{ground});
+  auto light = AreaLight::Create(Vec3r{0, 1, 0}, Vec3r{0, -1, 0},
+                                 Vec3r{1, 0, 0}, Vec3r{10, 10, 10}, 2);
+  light->SetGridSize(2);
+  Ray ray{Vec3r{0.5, 1, 0.01}, Vec3r{-0.5, -1, 0}};
+  HitRecord hit_record;
+  REQUIRE(scene->Hit(ray, kEpsilon, kInfinity, hit_record));
+  hit_record.ComputeShading(ray);
+  Vec3r view_vec = -ray.GetDirection().normalized();
+
+  // mean and variance of each strategy's estimate
+  const AreaLightSampling strategies[] = {AreaLightSampling::kArea,
+                                          AreaLightSampling::kSolidAngle,
+                                          AreaLightSampling::kMIS};
+  const int n = 4000;
+  Real mean[3], variance[3];
+  Sampler sampler{9};
+  for (int s = 0; s < 3; ++s) {
+    light->SetSampling(strategies[s]);
+    Real sum = 0, sum2 = 0;
+    for (int i = 0; i < n; ++i) {
+      sampler.StartPixelSample(Vec2i{i, 0}, 0);
+      sampler.StartBounce(1);
+      Real value = light->Illuminate(hit_record, view_vec, scene,
+                                     sampler).sum();
+      sum += value;
+      sum2 += value * value;
+    }
+    mean[s] = sum / n;
+    variance[s] = sum2 / n - mean[s] * mean[s];
+  }
+
+  // same shading; solid angle and MIS samples are less noisy
+  INFO("means: " << mean[0] << " " << mean[1] << " " << mean[2]);
+  INFO("variances: " << variance[0] << " " << variance[1] << " "
+       << variance[2]);
+  REQUIRE(mean[1] == Approx(mean[0]).epsilon(0.03));
+  REQUIRE(mean[2] == Approx(mean[0]).epsilon(0.03));
+  REQUIRE(variance[1] < variance[0]);
+  REQUIRE(variance[2] < variance[1]);
+}
+
+
+TEST_CASE("LightTreeSamplesManyLights") {
+  // ground lit by a 16x16 grid of point lights and an ambient light
+  auto scene = SurfaceList::Create(vector<Surface::Ptr>{
+      CreateGround(Vec3r{0.1, 0.1, 0.1}, Vec3r{0.8, 0.8, 0.8})});
+  auto lights = CreatePointLightGrid();
+  LightTree light_tree;
+  light_tree.SetBudget(4);
+  light_tree.Build(lights);
+  REQUIRE(light_tree.GetNodes().size() == 2 * 256 - 1);
+
+  // picks of a point under the lights: the ambient light comes first
+  Ray ray{Vec3r{0.3, 1, 0.2}, Vec3r{0, -1, 0}};
+  HitRecord hit_record;
+  REQUIRE(scene->Hit(ray, kEpsilon, kInfinity, hit_record));
+  hit_record.ComputeShading(ray);
+  Vec3r view_vec{0, 1, 0};
+  Sampler sampler{11};
+  Vec3r exact{0, 0, 0};
+  for (const auto &light : lights)
+    exact += light->Illuminate(hit_record, view_vec, scene, sampler);
+
+  // the weighted picks are an unbiased estimate of all lights, with
+  // one shadow ray per pick
+  Vec3r sum{0, 0, 0};
+  const int n = 4000;
+  vector<LightPick> picks;
+  TakeThreadRayCounts();
+  for (int i = 0; i < n; ++i) {
+    sampler.StartPixelSample(Vec2i{i, 0}, 0);
+    sampler.StartBounce(1);
+    picks.clear();
+    light_tree.Select(hit_record.GetPoint(), hit_record.GetNormal(), sampler,
+                      picks);
+    REQUIRE(picks.size() == 5);
+    REQUIRE(picks[0].light == 0);
+    REQUIRE(picks[0].weight == 1);
+    for (const auto &pick : picks)
+      sum += lights[pick.light]->Illuminate(hit_record, view_vec, scene,
+                                            sampler) * pick.weight;
+  }
+  REQUIRE(TakeThreadRayCounts().Get(RayType::kShadow) == 4u * n);
+  Vec3r mean = sum / n;
+  INFO("mean: " << mean.transpose() << ", exact: " << exact.transpose());
+  REQUIRE((mean - exact).norm() < 0.02 * exact.norm());
+
+  // lights below the surface are never picked
+  Ray up_ray{Vec3r{0.3, -1, 0.2}, Vec3r{0, 1, 0}};
+  REQUIRE(scene->Hit(up_ray, kEpsilon, kInfinity, hit_record));
+  hit_record.ComputeShading(up_ray);
+  picks.clear();
+  light_tree.Select(hit_record.GetPoint(), hit_record.GetNormal(), sampler,
+                    picks);
+  REQUIRE(picks.size() == 1);
+}
+
+
+TEST_CASE("LightResamplingReducesNoise") {
+  // ground lit by a 16x16 grid of point lights and an ambient light,
+  // seen from above through a 32x32 image
+  auto scene = SurfaceList::Create(vector<Surface::Ptr>{
+      CreateGround(Vec3r{0.1, 0.1, 0.1}, Vec3r{0.8, 0.8, 0.8})});
+  auto lights = CreatePointLightGrid();
+  vector<CameraSample> samples;
+  for (int y = 0; y < 32; ++y) {
+    for (int x = 0; x < 32; ++x) {
+      CameraSample sample;
+      sample.pixel = Vec2i{x, y};
+      sample.sample_index = 0;
+      sample.ray = Ray{Vec3r{x * 0.05 - 0.8, 1, y * 0.05 - 0.8},
+                       Vec3r{0, -1, 0}};
+      samples.push_back(sample);
+    }
+  }
+  auto error = [&](const vector<Vec3r> &colors,
+                   const vector<Vec3r> &reference) {
+    Real sum = 0;
+    for (size_t i = 0; i < colors.size(); ++i)
+      sum += (colors[i] - reference[i]).squaredNorm();
+    return std::sqrt(sum / static_cast<Real>(colors.size()));
+  };
+
+  // reference (all lights), one light per hit point, and resampled
+  // lighting, the last two with one shadow ray per sample
+  SampleTracer tracer;
+  tracer.SetSeed(3);
+  vector<Vec3r> reference, picked, resampled;
+  tracer.BuildLightTree(lights);
+  tracer.TraceSamples(samples, scene, lights, reference);
+  tracer.SetLightBudget(1);
+  tracer.BuildLightTree(lights);
+  TakeThreadRayCounts();
+  tracer.TraceSamples(samples, scene, lights, picked);
+  REQUIRE(TakeThreadRayCounts().Get(RayType::kShadow) == samples.size());
+  tracer.SetLightBudget(0);
+  LightResamplingOptions options;
+  options.enabled = true;
+  tracer.SetLightResampling(options);
+  tracer.BuildLightTree(lights);
+  tracer.TraceSamples(samples, scene, lights, resampled);
+  REQUIRE(TakeThreadRayCounts().Get(RayType::kShadow) == samples.size());
+
+  Vec3r reference_mean{0, 0, 0}, resampled_mean{0, 0, 0};
+  for (size_t i = 0; i < samples.size(); ++i) {
+    reference_mean += reference[i];
+    resampled_mean += resampled[i];
+  }
+  INFO("means: " << resampled_mean.transpose() << " vs "
+       << reference_mean.transpose());
+  INFO("errors: " << error(resampled, reference) << " vs "
+       << error(picked, reference));
+  REQUIRE((resampled_mean - reference_mean).norm() <
+          0.03 * reference_mean.norm());
+  REQUIRE(error(resampled, reference) < 0.5 * error(picked, reference));
+
+  // resampling the 16x16 tiles of the image separately, neighbors are
+  // kept within each tile, and the noise stays about the same
+  vector<Vec3r> tiled(samples.size());
+  for (int tile = 0; tile < 4; ++tile) {
+    vector<CameraSample> tile_samples;
+    vector<size_t> tile_indices;
+    for (size_t i = 0; i < samples.size(); ++i) {
+      if (samples[i].pixel[0] / 16 + 2 * (samples[i].pixel[1] / 16) == tile) {
+        tile_samples.push_back(samples[i]);
+        tile_indices.push_back(i);
+      }
+    }
+    vector<Vec3r> tile_colors;
+    tracer.TraceSamples(tile_samples, scene, lights, tile_colors);
+    for (size_t i = 0; i < tile_indices.size(); ++i)
+      tiled[tile_indices[i]] = tile_colors[i];
+  }
+  INFO("tiled error: " << error(tiled, reference));
+  REQUIRE(error(tiled, reference) < 0.5 * error(picked, reference));
+
+  // temporal reuse: a second frame that merges the first one's
+  // reservoirs is less noisy
+  LightTree light_tree;
+  light_tree.Build(lights);
+  options.temporal = true;
+  options.spatial_neighbors = 0;
+  ReservoirFrame frames[2];
+  frames[0].Reset(32, 32);
+  frames[1].Reset(32, 32);
+  vector<Vec3r> first, second;
+  LightResampler{options, Sampler{1}, light_tree}.Resample(
+      samples, scene, lights, nullptr, &frames[0], first);
+  LightResampler{options, Sampler{2}, light_tree}.Resample(
+      samples, scene, lights, &frames[0], &frames[1], second);
+  vector<Vec3r> direct_reference(samples.size());
+  Sampler sampler{4};
+  for (size_t i = 0; i < samples.size(); ++i) {
+    HitRecord hit_record;
+    REQUIRE(scene->Hit(samples[i].ray, kEpsilon, kInfinity, hit_record));
+    hit_record.ComputeShading(samples[i].ray);
+    direct_reference[i] = reference[i] -
+      lights[0]->Illuminate(hit_record, Vec3r{0, 1, 0}, scene, sampler);
+  }
+  INFO("temporal errors: " << error(second, direct_reference) << " vs "
+       << error(first, direct_reference));
+  REQUIRE(error(second, direct_reference) <
+          0.9 * error(first, direct_reference));
+}
+
+
+TEST_CASE("OutputConverterMatchesReference") {
+  // a row of values from below 0 to above 1, most of them tiny
+  const size_t width = 4096;
+  vector<float> rgb(3 * width);
+  for (size_t i = 0; i < rgb.size(); ++i) {
+    double t = static_cast<double>(i) / static_cast<double>(rgb.size());
+    rgb[i] = i % 7 ? static_cast<float>(std::pow(2.0, -40 * (1 - t)) * 1.2) :
+      static_cast<float>(1.3 * t - 0.1);
+  }
+
+  // the gamma table is close to pow()
+  const Real gamma = 2.2, exposure = 0.9;
+  OutputConverter uchar_converter{OutputDepth::kUChar, exposure, gamma};
+  for (auto value : rgb) {
+    if (value <= 0 || value >= 1)
+      continue;
+    double exact = std::pow(static_cast<double>(value), 1 / 2.2);
+    REQUIRE(std::fabs(uchar_converter.GammaCorrect(value) - exact) <
+            1e-5 * exact);
+  }
+
+  // integer depths: rounded, clamped, gamma-corrected colors in BGR
+  // order, at most one step off
+  auto expected = [&](float value, double max_value) {
+    double scaled = std::min(std::max(value * 0.9, 0.0), 1.0);
+    return std::floor(std::pow(scaled, 1 / 2.2) * max_value + 0.5);
+  };
+  OutputConverter ushort_converter{OutputDepth::kUShort, exposure, gamma};
+  vector<unsigned char> bgr8(3 * width);
+  vector<uint16_t> bgr16(3 * width);
+  uchar_converter.ConvertRow(rgb.data(), width, bgr8.data());
+  ushort_converter.ConvertRow(rgb.data(), width, bgr16.data());
+  for (size_t x = 0; x < width; ++x) {
+    for (size_t c = 0; c < 3; ++c) {
+      float value = rgb[3 * x + 2 - c];
+      REQUIRE(std::fabs(bgr8[3 * x + c] - expected(value, 255)) <= 1);
+      REQUIRE(std::fabs(bgr16[3 * x + c] - expected(value, 65535)) <= 1);
+    }
+  }
+
+  // float depths: scaled linear colors in BGR order
+  OutputConverter half_converter{OutputDepth::kHalf, exposure, gamma};
+  REQUIRE(half_converter.GetImageType() == CV_32FC3);
+  REQUIRE(half_converter.GetWriteParams().size() == 2);
+  vector<float> bgr_float(3 * width);
+  half_converter.ConvertRow(rgb.data(), width, bgr_float.data());
+  for (size_t x = 0; x < width; ++x) {
+    for (size_t c = 0; c < 3; ++c)
+      REQUIRE(bgr_float[3 * x + c] == rgb[3 * x + 2 - c] * 0.9f);
+  }
+}
+
+
+TEST_CASE("TiledImageFileResumesDoneTiles") {
+  namespace fs = boost::filesystem;
+  auto path = (fs::temp_directory_path() /
+               fs::unique_path("olio-%%%%-%%%%.tiles")).string();
+
+  // a 37x21 image in 8x8 tiles; edge tiles are smaller
+  const int width = 37, height = 21, tile_size = 8;
+  auto tile_pixels = [&](size_t tile, int tiles_x) {
+    int y_begin = static_cast<int>(tile) / tiles_x * tile_size;
+    int x_begin = static_cast<int>(tile) % tiles_x * tile_size;
+    vector<float> rgb;
+    for (int y = y_begin; y < std::min(y_begin + tile_size, height); ++y) {
+      for (int x = x_begin; x < std::min(x_begin + tile_size, width); ++x) {
+        for (int c = 0; c < 3; ++c)
+          rgb.push_back(static_cast<float>(y * 1000 + x * 10 + c));
+      }
+    }
+    return rgb;
+  };
+  {
+    TiledImageFile file;
+    REQUIRE(file.Open(path, width, height, tile_size, 42));
+    REQUIRE(file.GetNumTilesX() == 5);
+    REQUIRE(file.GetNumTilesY() == 3);
+    REQUIRE(file.GetNumDoneTiles() == 0);
+    for (size_t tile : {0u, 4u, 7u, 14u})
+      REQUIRE(file.WriteTile(tile, tile_pixels(tile, 5)));
+  }
+
+  // reopening with the same settings keeps the done tiles, and
+  // unwritten tiles read as black
+  {
+    TiledImageFile file;
+    REQUIRE(file.Open(path, width, height, tile_size, 42));
+    REQUIRE(file.GetNumDoneTiles() == 4);
+    REQUIRE(file.IsTileDone(7));
+    REQUIRE(!file.IsTileDone(8));
+    REQUIRE(file.WriteTile(8, tile_pixels(8, 5)));
+  }
+  TiledImageFile reader;
+  REQUIRE(reader.OpenForReading(path));
+  REQUIRE(reader.GetWidth() == width);
+  REQUIRE(reader.GetHeight() == height);
+  vector<float> rgb;
+  for (int tile_row = 0; tile_row < 3; ++tile_row) {
+    REQUIRE(reader.ReadTileRow(tile_row, rgb));
+    int rows = std::min(tile_size, height - tile_row * tile_size);
+    REQUIRE(rgb.size() == static_cast<size_t>(rows * width * 3));
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < width; ++x) {
+        auto tile = static_cast<size_t>(tile_row * 5 + x / tile_size);
+        bool done = tile == 0 || tile == 4 || tile == 7 || tile == 8 ||
+          tile == 14;
+        int image_y = tile_row * tile_size + y;
+        for (int c = 0; c < 3; ++c) {
+          REQUIRE(rgb[static_cast<size_t>(3 * (y * width + x) + c)] ==
+                  (done ? static_cast<float>(image_y * 1000 + x * 10 + c) :
+                   0));
+        }
+      }
+    }
+  }
+  reader.Close();
+
+  // other settings start over
+  {
+    TiledImageFile file;
+    REQUIRE(file.Open(path, width, height, tile_size, 43));
+    REQUIRE(file.GetNumDoneTiles() == 0);
+  }
+  fs::remove(path);
+}
+
+
+TEST_CASE("RenderProgressCountsAllThreads") {
+  namespace fs = boost::filesystem;
+  auto path = (fs::temp_directory_path() /
+               fs::unique_path("olio-%%%%-%%%%.json")).string();
+  ProgressOptions options;
+  options.interval_seconds = 0.005;
+  options.show_bar = false;
+  options.json_path = path;
+
+  // 4 threads render 200 "tiles" of 10 pixels, 2 are skipped
+  RenderProgress progress;
+  const int num_threads = 4;
+  progress.Start(2000, num_threads, options);
+  RayCounts tile_rays{};
+  tile_rays.counts[static_cast<int>(RayType::kPrimary)] = 10;
+  tile_rays.counts[static_cast<int>(RayType::kShadow)] = 30;
+  tbb::task_arena arena{num_threads};
+  arena.execute([&] {
+    tbb::parallel_for(tbb::blocked_range<int>{0, 198, 1},
+                      [&](const tbb::blocked_range<int> &tiles) {
+                        for (int t = tiles.begin(); t != tiles.end(); ++t) {
+                          auto slot = progress.BeginWork();
+                          std::this_thread::sleep_for(
+                            std::chrono::microseconds(200));
+                          progress.EndWork(slot, 10, tile_rays, 20);
+                        }
+                      });
+  });
+  progress.AddPixels(20);
+  auto report = progress.Stop();
+  REQUIRE(report.last);
+  REQUIRE(report.done_pixels == 2000);
+  REQUIRE(report.total_pixels == 2000);
+  REQUIRE(report.eta == 0);
+  REQUIRE(report.thread_utilization.size() ==
+          static_cast<size_t>(num_threads));
+  for (auto use : report.thread_utilization)
+    REQUIRE((use >= 0 && use <= 1));
+  REQUIRE(progress.GetRayCounts().Get(RayType::kPrimary) == 1980);
+  REQUIRE(progress.GetRayCounts().Get(RayType::kShadow) == 5940);
+  REQUIRE(progress.GetRayCounts().Get(RayType::kSecondary) == 0);
+  REQUIRE(progress.GetNumSamples() == 3960);
+
+  // one json object per line, the last one being the final report
+  std::ifstream in(path);
+  string line, last_line;
+  size_t num_lines = 0;
+  while (std::getline(in, line)) {
+    REQUIRE(line.front() == '{');
+    REQUIRE(line.back() == '}');
+    REQUIRE(line.find("\"thread_utilization\": [") != string::npos);
+    last_line = line;
+    ++num_lines;
+  }
+  REQUIRE(num_lines >= 1);
+  REQUIRE(last_line == report.ToJson());
+  REQUIRE(last_line.find("\"event\": \"done\"") != string::npos);
+  REQUIRE(last_line.find("\"done_pixels\": 2000,") != string::npos);
+  in.close();
+  fs::remove(path);
+}
+
+
+TEST_CASE("CheckpointedRenderResumes") {
+  namespace fs = boost::filesystem;
+  Texture::Ptr white = SolidTexture::Create(Vec3r{0.8, 0.8, 0.8});
+  auto ground = Sphere::Create(Vec3r{0, -1001, -5}, 1000);
+  ground->SetMaterial(PhongMaterial::Create(Vec3r{0.1, 0.1, 0.1}, white,
+                                            Vec3r{0.3, 0.3, 0.3}, 20));
+  auto ball = Sphere::Create(Vec3r{0, 0, -5}, 1);
+  ball->SetMaterial(PhongMaterial::Create(Vec3r{0.1, 0.1, 0.1}, white,
+                                          Vec3r{0, 0, 0}, 1));
+  Surface::Ptr scene = SurfaceList::Create(vector<Surface::Ptr>{ground, ball});
+  auto area_light = AreaLight::Create(Vec3r{0, 4, -5}, Vec3r{0, -1, 0},
+                                      Vec3r{1, 0, 0}, Vec3r{10, 10, 10}, 1);
+  area_light->SetGridSize(2);
+  vector<Light::Ptr> lights{area_light};
+  auto camera = Camera::Create(Vec3r{0, 0, 0}, Vec3r{0, 0, -1},
+                               Vec3r{0, 1, 0}, Real{45}, Real{1.5});
+
+  // 8 samples per pixel in 3 passes, rendered at once and in two runs
+  // of 4 samples per pixel
+  auto render = [&](const string &path, uint samples, bool resume) {
+    SampleTracer tracer;
+    tracer.SetImageHeight(12);
+    tracer.SetTileSize(5);
+    tracer.SetSeed(5);
+    tracer.SetNumSamplesPerPixel(samples);
+    CheckpointOptions options;
+    options.path = path;
+    options.interval_minutes = 0;
+    options.pass_samples = 3;
+    options.resume = resume;
+    tracer.SetCheckpoint(options);
+    REQUIRE(tracer.Render(scene, lights, camera));
+    return std::make_pair(tracer.GetRayCounts().Get(RayType::kPrimary),
+                          tracer.GetSettingsKey(scene, lights, *camera,
+                                                false));
+  };
+  auto full_path = (fs::temp_directory_path() /
+                    fs::unique_path("olio-%%%%-%%%%.ckp")).string();
+  auto resumed_path = full_path + ".resumed";
+  auto full = render(full_path, 8, false);
+  REQUIRE(full.first == 8 * 12 * 18);
+  REQUIRE(render(resumed_path, 4, false).first == 4 * 12 * 18);
+  REQUIRE(render(resumed_path, 8, true).first == 4 * 12 * 18);
+
+  // same sums; resuming a finished render takes no samples
+  vector<PixelStats> full_pixels, resumed_pixels;
+  REQUIRE(ReadCheckpoint(full_path, 18, 12, full.second, full_pixels));
+  REQUIRE(ReadCheckpoint(resumed_path, 18, 12, full.second, resumed_pixels));
+  REQUIRE(!ReadCheckpoint(resumed_path, 18, 12, full.second + 1,
+                          resumed_pixels));
+  REQUIRE(full_pixels.size() == 12 * 18);
+  for (size_t i = 0; i < full_pixels.size(); ++i) {
+    REQUIRE(resumed_pixels[i].num_samples == 8);
+    REQUIRE(resumed_pixels[i].color_sum == full_pixels[i].color_sum);
+    REQUIRE(resumed_pixels[i].squared_deviations ==
+            full_pixels[i].squared_deviations);
+  }
+  REQUIRE(render(resumed_path, 8, true).first == 0);
+
+  // lights with more shadow samples, or a moved camera, start over
+  area_light->SetGridSize(3);
+  REQUIRE(render(resumed_path, 8, true).first == 8 * 12 * 18);
+  camera->LookAt(Vec3r{0, 0.5, 0}, Vec3r{0, 0, -1}, Vec3r{0, 1, 0});
+  REQUIRE(render(resumed_path, 8, true).first == 8 * 12 * 18);
+  fs::remove(full_path);
+  fs::remove(resumed_path);
+}
+
+
+TEST_CASE("PixelDiagnosticsAddUpToRenderTotals") {
+  // ground, mirror, and glass spheres in a BVH
+  Texture::Ptr white = SolidTexture::Create(Vec3r{0.8, 0.8, 0.8});
+  auto ground = Sphere::Create(Vec3r{0, -1001, -5}, 1000);
+  ground->SetMaterial(PhongMaterial::Create(Vec3r{0.1, 0.1, 0.1}, white,
+                                            Vec3r{0, 0, 0}, 1));
+  auto mirror = Sphere::Create(Vec3r{-1.2, 0, -5}, 1);
+  mirror->SetMaterial(PhongMaterial::Create(Vec3r{0, 0, 0}, white,
+                                            Vec3r{0.5, 0.5, 0.5}, 50,
+                                            Vec3r{0.6, 0.6, 0.6}));
+  auto glass = Sphere::Create(Vec3r{1.2, 0, -4}, 1);
+  glass->SetMaterial(PhongDielectric::Create(1.5, white));
+  Surface::Ptr scene = BVHNode::BuildBVH(vector<Surface::Ptr>{ground, mirror,
+                                                               glass});
+  auto area_light = AreaLight::Create(Vec3r{0, 4, -5}, Vec3r{0, -1, 0},
+                                      Vec3r{1, 0, 0}, Vec3r{10, 10, 10}, 1);
+  area_light->SetGridSize(2);
+  vector<Light::Ptr> lights{
+    PointLight::Create(Vec3r{3, 5, 0}, Vec3r{20, 20, 20}), area_light};
+  auto camera = Camera::Create(Vec3r{0, 0, 0}, Vec3r{0, 0, -1},
+                               Vec3r{0, 1, 0}, Real{45}, Real{1.5});
+
+  // both integrators, with resampled primary hits
+  vector<vector<PixelDiagnostics>> diagnostics;
+  for (auto integrator : {Integrator::kRecursive, Integrator::kWavefront}) {
+    RayTracer tracer;
+    tracer.SetImageHeight(16);
+    tracer.SetNumSamplesPerPixel(3);
+    tracer.SetSeed(3);
+    tracer.SetIntegrator(integrator);
+    LightResamplingOptions resampling_options;
+    resampling_options.enabled = true;
+    tracer.SetLightResampling(resampling_options);
+    tracer.SetDiagnostics(true);
+    REQUIRE(tracer.Render(scene, lights, camera));
+    const auto &pixels = tracer.GetPixelDiagnostics();
+    if (!kDiagnosticsCompiled) {
+      REQUIRE(pixels.empty());
+      return;
+    }
+
+    // every ray is attributed to the pixel of its camera sample
+    REQUIRE(pixels.size() == 24u * 16u);
+    uint64_t shadow_rays = 0;
+    uint64_t primitive_tests = 0;
+    uint64_t max_depth = 0;
+    for (const auto &pixel : pixels) {
+      REQUIRE(pixel.samples == 3);
+      REQUIRE(pixel.max_depth >= 1);
+      REQUIRE(pixel.bvh_nodes >= 3);
+      shadow_rays += pixel.shadow_rays;
+      primitive_tests += pixel.primitive_tests;
+      max_depth = std::max(max_depth, pixel.max_depth);
+    }
+    REQUIRE(shadow_rays == tracer.GetRayCounts().Get(RayType::kShadow));
+    REQUIRE(primitive_tests > 0);
+    REQUIRE(max_depth >= 3);
+    diagnostics.push_back(pixels);
+  }
+
+  // the integrators do the same work for each pixel
+  for (size_t i = 0; i < diagnostics[0].size(); ++i) {
+    const auto &recursive = diagnostics[0][i];
+    const auto &wavefront = diagnostics[1][i];
+    REQUIRE(recursive.bvh_nodes == wavefront.bvh_nodes);
+    REQUIRE(recursive.primitive_tests == wavefront.primitive_tests);
+    REQUIRE(recursive.shadow_rays == wavefront.shadow_rays);
+    REQUIRE(recursive.max_depth == wavefront.max_depth);
+  }
+
+  // a wide BVH leaf of 5 triangles (which cannot be split, as they
+  // are the same) is one box and 5 triangle tests, although its two
+  // packets have 8 lanes
+  TriangleStore store;
+  vector<AABB> triangle_bounds;
+  for (int i = 0; i < 5; ++i) {
+    uint32_t v0 = store.AddVertex(Vec3r{-1, -1, 0}, Vec3r{0, 0, 1},
+                                  Vec2r{0, 0});
+    uint32_t v1 = store.AddVertex(Vec3r{1, -1, 0}, Vec3r{0, 0, 1},
+                                  Vec2r{0, 0});
+    uint32_t v2 = store.AddVertex(Vec3r{0, 1, 0}, Vec3r{0, 0, 1},
+                                  Vec2r{0, 0});
+    triangle_bounds.push_back(store.GetTriangleBounds(
+                                store.AddTriangle(v0, v1, v2, 0)));
+  }
+  BVHBuildOptions options;
+  options.leaf_size = 8;
+  LinearBVH bvh;
+  vector<uint32_t> order;
+  bvh.Build(triangle_bounds, options, order);
+  store.ReorderTriangles(order);
+  WideBVH wide_bvh;
+  wide_bvh.Build(bvh, store);
+  PixelDiagnostics sample;
+  OLIO_DIAGNOSTICS_BEGIN(&sample);
+  OLIO_DIAGNOSTICS_SAMPLE(0);
+  REQUIRE(!wide_bvh.Occluded(Ray{Vec3r{0, 0, 1}, Vec3r{0, 0, -1}}, kEpsilon,
+                             kInfinity, [](uint32_t, Real, Real) {
+                               return false;
+                             }));
+  OLIO_DIAGNOSTICS_BEGIN(nullptr);
+  REQUIRE(sample.bvh_nodes == 1);
+  REQUIRE(sample.primitive_tests == 5);
+}
+
+
+TEST_CASE("RussianRouletteIsUnbiased") {
+  PathOptions options;
+  options.min_throughput = 0.1;
+  options.russian_roulette = true;
+  Sampler sampler{3};
+  Vec3r throughput{0.02, 0.01, 0};
+  Real weight_sum = 0;
+  const int n = 100000;
+  for (int i = 0; i < n; ++i) {
+    sampler.StartPixelSample(Vec2i{i, 0}, 0);
+    Real weight;
+    if (ContinuePath(options, throughput, sampler, weight))
+      weight_sum += weight;
+  }
+  REQUIRE(weight_sum / n == Approx(1).epsilon(0.05));
+
+  // high throughput rays are always traced, without drawing samples
+  Real weight;
+  REQUIRE(ContinuePath(options, Vec3r{0.5, 0, 0}, sampler, weight));
+  REQUIRE(weight == 1);
+  options.russian_roulette = false;
+  REQUIRE_FALSE(ContinuePath(options, throughput, sampler, weight));
+}